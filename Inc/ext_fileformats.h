@@ -31,6 +31,7 @@ struct execEntryHash
     /* Counter at assembly and source line levels */
     uint64_t count;                      /* Instruction level count */
     uint64_t scount;                     /* Source level count (applied to first instruction of a new source line) */
+    uint64_t cycles;                     /* Cycles spent on this instruction (cycle accurate trace only) */
 
     /* Details about this instruction */
     bool     isJump;                     /* Flag if this is a jump instruction */
@@ -74,6 +75,7 @@ struct subcall
 
     /* Housekeeping */
     uint64_t myCost;                   /* Inclusive cost of this call */
+    uint64_t myCycles;                 /* Inclusive cycles of this call (cycle accurate trace only) */
     uint64_t count;                    /* Number of executions of this call */
     uint64_t inTicks;
 
@@ -81,11 +83,26 @@ struct subcall
     UT_hash_handle hh;
 };
 
+/* A frame in the tree of call stacks that have been seen. Entry 0 is the root, so 0 also means no entry */
+#define STACK_ROOT (0)
+
+struct stackNode
+{
+    uint32_t functionindex;             /* Function executing in this frame (from symbols.c) */
+    uint32_t fileindex;                 /* ...and the file it's in */
+    uint32_t parent;                    /* Frame this one was called from */
+    uint32_t child;                     /* First of the frames called from this one */
+    uint32_t sibling;                   /* Next frame called from the same parent */
+    uint64_t count;                     /* Instructions executed with exactly this call stack */
+};
+
 
 // ====================================================================================================
-bool ext_ff_outputDot( char *dotfile, struct subcall *subcallList, struct SymbolSet *ss );
-bool ext_ff_outputProfile( char *profile, char *elffile, char *deleteMaterial, bool includeVisits, uint64_t timelen,
-                           struct execEntryHash *insthead, struct subcall *subcallList, struct SymbolSet *ss );
+bool ext_ff_outputDot( char *dotfile, struct subcall **calls, uint32_t callCount, struct SymbolSet *ss );
+bool ext_ff_outputProfile( char *profile, char *elffile, char *deleteMaterial, bool includeVisits, bool includeCycles, uint64_t timelen,
+                           struct execEntryHash **insts, uint32_t instCount, struct subcall **calls, uint32_t callCount, struct SymbolSet *ss );
+bool ext_ff_outputFolded( char *foldedfile, struct stackNode *stackTree, uint32_t nodeCount, struct SymbolSet *ss );
+bool ext_ff_outputSpeedscope( char *ssfile, char *elffile, struct stackNode *stackTree, uint32_t nodeCount, struct SymbolSet *ss );
 // ====================================================================================================
 
 #ifdef __cplusplus
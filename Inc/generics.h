@@ -99,7 +99,10 @@ char *genericsUnescape( char *str );
 uint64_t genericsTimestampuS( void );
 uint32_t genericsTimestampmS( void );
 bool genericsSetReportLevel( enum verbLevel lset );
+enum verbLevel genericsGetReportLevel( void );
 void genericsFPrintf( FILE *stream, const char *fmt, ... );
+const char *genericsColourSequence( char code );
+char *genericsColourExpand( const char *str );
 char *genericsGetBaseDirectory( void );
 const char *genericsBasename( const char *n );
 const char *genericsBasenameN( const char *n, int c );
@@ -16,6 +16,9 @@ extern "C" {
 #define NO_DESTADDRESS (-1)
 #define NO_ADDRESS     (-1)
 
+/* Predecoded instruction, private to loadelf */
+struct symbolInstruction;
+
 /* Structure for a memory segment */
 struct symbolMemoryStore
 {
@@ -23,6 +26,7 @@ struct symbolMemoryStore
     symbolMemaddr   len;                   /* Length of the memory segment */
     char           *name;                  /* Name of the segment as defined by the linker */
     symbolMemptr    data;                  /* Contents of the segment */
+    struct symbolInstruction **insn;       /* Pages of predecoded instructions, allocated as they're touched */
 };
 
 
@@ -56,10 +60,12 @@ struct symbolFunctionStore
 
 struct symbolSourcecodeStore
 {
-    char                     **linetext;   /* Table of text lines in this file */
-
-
+    const char               **linetext;   /* Table of text lines in this file, each ending at \n, \r or 0 */
     unsigned int               nlines;     /* Number of text lines in this file */
+    char                      *text;       /* Text of the file, or NULL if it couldn't be read */
+    size_t                     textlen;    /* Length of text */
+    bool                       ismapped;   /* Text is mapped from the file rather than malloced */
+    uint64_t                   lastuse;    /* Access stamp, for choosing what to evict */
 };
 
 enum symbolTables { PT_PRODUCER, PT_FILENAME, PT_NUMTABLES };
@@ -69,7 +75,10 @@ struct symbol
     char **stringTable[PT_NUMTABLES];      /* Strings that we don't want to duplicate, so we give them an index */
     unsigned int tableLen[PT_NUMTABLES];   /* Number of strings for each of the deduplication tables */
 
-    struct symbolSourcecodeStore **source; /* Table for source code lines, indexed by file number */
+    struct symbolSourcecodeStore **source; /* Table for source code lines, indexed by file number, loaded on demand */
+    size_t sourceBytes;                    /* Amount of source text currently loaded */
+    size_t sourceLimit;                    /* Limit on loaded source text before eviction starts (0 for no limit) */
+    uint64_t sourceStamp;                  /* Counter for marking source accesses */
 
     struct symbolMemoryStore *mem;         /* Table of memory regions, sorted according to start address */
     unsigned int nsect_mem;                /* Number of entries in memory region table */
@@ -91,9 +100,12 @@ enum instructionClass { LE_IC_NONE, LE_IC_JUMP = ( 1 << 0 ), LE_IC_4BYTE = ( 1 <
 
 // ====================================================================================================
 
-/* Return pointer to source code for specified line in file index */
+/* Return pointer to source code for specified line in file index, terminated by \n, \r or 0 */
 const char *symbolSource( struct symbol *p, unsigned int fileNumber, unsigned int lineNumber );
 
+/* Set limit on memory used for source text. Once exceeded, text returned by symbolSource for other files may be released */
+void symbolSetSourceLimit( struct symbol *p, size_t limit );
+
 /* Return function that encloses specified address, or NULL */
 struct symbolFunctionStore *symbolFunctionAt( struct symbol *p, symbolMemaddr addr );
 
@@ -118,8 +130,8 @@ const char *symbolGetFilename( struct symbol *p, unsigned int index );
 /* Get pointer to memory at specified address...can move backwards and forwards through the region */
 symbolMemptr symbolCodeAt( struct symbol *p, symbolMemaddr addr, unsigned int *len );
 
-/* Return assembly code representing this line, with annotations */
-char *symbolDisassembleLine( struct symbol *p, enum instructionClass *ic, symbolMemaddr addr, symbolMemaddr *newaddr );
+/* Return assembly code representing this line, with annotations. Text remains valid until the symbol set is deleted */
+const char *symbolDisassembleLine( struct symbol *p, enum instructionClass *ic, symbolMemaddr addr, symbolMemaddr *newaddr );
 
 /* Delete symbol set */
 void symbolDelete( struct symbol *p );
@@ -0,0 +1,59 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+/*
+ * Output Buffer Module
+ * ====================
+ *
+ * Buffered output for text sinks. Output is collected in a userspace buffer
+ * and written on newline (if requested), when the buffer is full, or when
+ * the oldest unwritten output reaches a latency deadline. Screen codes (see
+ * CMD_ALERT in generics.h) are translated on the way in, exactly as
+ * genericsFPrintf would translate them.
+ */
+
+#ifndef _OPBUFFER_H_
+#define _OPBUFFER_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "generics.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define OPBUFFER_DEFAULT_LEN  (64*1024)   /* Default size of an output buffer */
+
+struct OPBuffer
+
+{
+    FILE *stream;            /* Where the output eventually goes */
+    char *buffer;            /* Output waiting to be written */
+    size_t size;             /* Size of the buffer */
+    size_t used;             /* ...and how much of it is in use */
+
+    bool lineFlush;          /* Write whenever a line is completed */
+    uint64_t latencyuS;      /* Longest time output can wait before it is written */
+    uint64_t deadlineuS;     /* Time by which the current buffer contents must be written */
+    uint64_t dropped;        /* Bytes the stream wouldn't take (e.g. a non-blocking pipe that's full) */
+};
+
+// ====================================================================================================
+
+void OPBufferInit( struct OPBuffer *b, FILE *stream, size_t size, uint32_t latencymS, bool lineFlush );
+void OPBufferDestroy( struct OPBuffer *b );
+
+void OPBufferWrite( struct OPBuffer *b, const char *s, size_t len );
+void OPBufferPuts( struct OPBuffer *b, const char *s );
+
+void OPBufferFlush( struct OPBuffer *b );
+bool OPBufferPoll( struct OPBuffer *b );
+int64_t OPBufferTimeToDeadline( struct OPBuffer *b );
+
+// ====================================================================================================
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -1,13 +1,20 @@
 #ifndef _READSOURCE_H_
 #define _READSOURCE_H_
 
+#include <stdbool.h>
+#include <stddef.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
 // ====================================================================================================
 
-char *readsourcefile( char *path, size_t *l );
+/* Collect source file into memory, either mapped or malloced. Last byte of buffer is always \n or 0 */
+char *readsourcefile( char *path, size_t *l, bool *ismapped );
+
+/* Release memory returned by readsourcefile */
+void releasesourcefile( char *buffer, size_t l, bool ismapped );
 
 // ====================================================================================================
 
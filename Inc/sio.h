@@ -18,6 +18,7 @@ extern "C" {
 
 #define MAX_TAGS            (10)               /* Maximum number of tagged positions in file */
 #define WARN_TIMEOUT        (2000)             /* How long a warning or info message remains on the display */
+#define SIO_NO_PROGRESS     (-1)               /* Progress value when there is no background decode */
 
 
 /* The main handle-type */
@@ -25,7 +26,7 @@ struct SIOInstance;
 
 /* Events that can be returned by the handler */
 enum SIOEvent { SIO_EV_NONE, SIO_EV_HOLD, SIO_EV_QUIT, SIO_EV_SAVE, SIO_EV_CONSUMED, SIO_EV_SURFACE, SIO_EV_DIVE, SIO_EV_FOPEN,
-                SIO_EV_PREV, SIO_EV_NEXT
+                SIO_EV_PREV, SIO_EV_NEXT, SIO_EV_CANCEL
               };
 
 /* Types of line (each with their own display mechanism & colours */
@@ -47,6 +48,8 @@ int32_t SIOgetCurrentLineno( struct SIOInstance *sio );
 int32_t SIOgetLastLineno( struct SIOInstance *sio );
 void SIOsetCurrentLineno( struct SIOInstance *sio, int32_t l );
 void SIOsetOutputBuffer( struct SIOInstance *sio, int32_t numLines, int32_t currentLine, struct sioline **opTextSet, bool amDiving );
+void SIOextendOutputBuffer( struct SIOInstance *sio, int32_t numLines, int32_t linesPrepended );
+void SIOsetProgress( struct SIOInstance *sio, int progress );
 void SIOalert( struct SIOInstance *sio, const char *msg );
 void SIOrequestRefresh( struct SIOInstance *sio );
 void SIOheld( struct SIOInstance *sio, bool isHeld );
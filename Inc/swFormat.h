@@ -0,0 +1,70 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+/*
+ * Software Message Formatter Module
+ * =================================
+ *
+ * Compiles the printf style format given for a software (ITM channel) message
+ * into a program of literal segments and typed conversions, once, so that
+ * rendering each message doesn't need to re-parse the format.
+ *
+ * As with the original printf based rendering, a format containing a float
+ * conversion renders the message value as a float, a format containing a %c
+ * conversion is repeated for each byte of the message, and anything else
+ * renders the 32 bit value for each conversion.
+ */
+
+#ifndef _SWFORMAT_H_
+#define _SWFORMAT_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* How the message is presented to the conversions */
+enum SWFormatMode { SWF_MODE_VALUE, SWF_MODE_BYTES, SWF_MODE_FLOAT };
+
+/* Types of step in a program */
+enum SWFormatOp { SWF_LITERAL, SWF_SIGNED, SWF_UNSIGNED, SWF_OCTAL, SWF_HEX, SWF_HEXUPPER, SWF_CHAR, SWF_FLOAT };
+
+/* Conversion flags */
+#define SWF_FLAG_LEFT  (1<<0)       /* '-' Left justify */
+#define SWF_FLAG_ZERO  (1<<1)       /* '0' Pad with zeros */
+#define SWF_FLAG_PLUS  (1<<2)       /* '+' Always include sign */
+#define SWF_FLAG_SPACE (1<<3)       /* ' ' Space in place of positive sign */
+#define SWF_FLAG_ALT   (1<<4)       /* '#' Alternate form */
+
+struct SWFormatStep
+{
+    enum SWFormatOp op;
+    const char *text;               /* Literal text, or the conversion spec for a float */
+    uint32_t len;                   /* Length of literal text */
+    uint8_t flags;                  /* Conversion flags */
+    uint8_t bits;                   /* Size of value after length modifier (8, 16, 32 or 64) */
+    int32_t width;                  /* Minimum field width */
+    int32_t precision;              /* Precision, or -1 if not set */
+};
+
+struct SWFormat
+{
+    enum SWFormatMode mode;         /* How the message is presented to the conversions */
+    uint32_t numSteps;              /* Number of steps in the program */
+    struct SWFormatStep *step;      /* ...and the steps themselves */
+    char *text;                     /* Storage for literal text and float specs */
+};
+
+// ====================================================================================================
+
+struct SWFormat *SWFormatCompile( const char *fmt );
+size_t SWFormatRender( const struct SWFormat *f, uint32_t value, uint32_t len, char *op, size_t opLen );
+void SWFormatDelete( struct SWFormat *f );
+
+// ====================================================================================================
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -121,7 +121,7 @@ struct nameEntry
     const struct assyLineEntry *assy;      /* Corresponding assembly text */
     uint32_t assyLine;                     /* Line of assembly text */
     uint32_t addr;                         /* Matched address */
-    uint32_t index;
+    uint32_t index;                        /* Index of the source line entry that matched */
 };
 
 // ====================================================================================================
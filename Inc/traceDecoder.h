@@ -143,23 +143,121 @@ struct TRACECPUState
 
     // Convinience, for debug reporting
     genericsReportCB report;
+    enum verbLevel reportLevel;          /* Most verbose level that report will be called for */
 
     // Debugging
     uint64_t overflows;
 };
 
+/* Reporting from within the decoders. The level is checked before any of the arguments are  */
+/* evaluated, so reports that aren't wanted cost a single test. Building with NO_TRACE_DEBUG  */
+/* removes the debug reports completely.                                                     */
+#define TRACE_REPORT(cpu, l, ...) do { if ( ( (l) <= (cpu)->reportLevel ) && ( (cpu)->report ) ) (cpu)->report( (l), __VA_ARGS__ ); } while ( 0 )
+
+#ifdef NO_TRACE_DEBUG
+    #define TRACE_DEBUG(cpu, ...) do { if ( 0 ) (cpu)->report( V_DEBUG, __VA_ARGS__ ); } while ( 0 )
+#else
+    #define TRACE_DEBUG(cpu, ...) TRACE_REPORT( cpu, V_DEBUG, __VA_ARGS__ )
+#endif
+
+// ============================================================================
+// Decoded trace records, delivered in batches
+// ============================================================================
+
+/* Changes that are carried in a record. Anything else ends the batch it's in, so the rest of */
+/* the CPU state still describes that record when the batch is delivered.                     */
+#define TRACE_FLOW_CHANGES ( ( 1 << EV_CH_EX_ENTRY ) | ( 1 << EV_CH_EX_EXIT ) | ( 1 << EV_CH_ENATOMS ) | ( 1 << EV_CH_WATOMS ) | \
+                             ( 1 << EV_CH_ADDRESS ) | ( 1 << EV_CH_CANCELLED ) | ( 1 << EV_CH_TSTAMP ) | ( 1 << EV_CH_CYCLECOUNT ) | \
+                             ( 1 << EV_CH_LINEAR ) | ( 1 << EV_CH_FNRETURN ) | ( 1 << EV_CH_EXRETURN ) )
+
+#define TRACE_RECORD_BATCH (256)
+
+struct TRACERecord
+{
+    uint32_t changes;                    /* What changed with this record, bits are enum TRACEchanges */
+    symbolMemaddr addr;                  /* Address at this point */
+    symbolMemaddr toAddr;                /* Address to run to in linear mode (MTB) */
+    uint32_t disposition;                /* Which of the atoms were executed, first one in the lsb */
+    uint8_t eatoms;                      /* Number of E (executed) atoms */
+    uint8_t natoms;                      /* Number of N (non-executed) atoms */
+    uint8_t watoms;                      /* Number of W atoms (exact timing mode only) */
+    uint16_t exception;                  /* Exception type being executed */
+    uint64_t ts;                         /* Latest timestamp */
+    uint64_t cycleCount;                 /* Cycle count for exact mode */
+    uint64_t instCount;                  /* Number of instructions executed */
+};
+
+struct TRACERecordBatch
+{
+    int n;                               /* Number of records in the batch */
+    bool flush;                          /* The batch must be delivered before anything more is added */
+    bool foldAtoms;                      /* Runs of atoms may be folded into a single record */
+    struct TRACERecord r[TRACE_RECORD_BATCH];
+};
+
+// ====================================================================================================
+static inline void TRACERecordAdd( struct TRACECPUState *cpu, struct TRACERecordBatch *b )
+
+/* Take the changes reported by the CPU state into the batch. If the client allows it, runs of  */
+/* atoms with nothing else happening between them are folded into a single record while their  */
+/* disposition fits. A client that acts on each atom packet separately (e.g. by predicting      */
+/* return addresses from a stack) must leave folding off, which is the default.                 */
+
+{
+    struct TRACERecord *r = ( ( b->foldAtoms ) && ( b->n ) ) ? &b->r[b->n - 1] : NULL;
+
+    if ( ( r ) && ( cpu->changeRecord == ( 1 << EV_CH_ENATOMS ) ) && ( r->changes == ( 1 << EV_CH_ENATOMS ) ) &&
+            ( r->eatoms + r->natoms + cpu->eatoms + cpu->natoms <= 32 ) )
+    {
+        r->disposition |= ( uint32_t )( ( uint64_t )cpu->disposition << ( r->eatoms + r->natoms ) );
+        r->eatoms += cpu->eatoms;
+        r->natoms += cpu->natoms;
+        r->instCount = cpu->instCount;
+    }
+    else
+    {
+        r = &b->r[b->n++];
+        r->changes     = cpu->changeRecord;
+        r->addr        = cpu->addr;
+        r->toAddr      = cpu->toAddr;
+        r->disposition = cpu->disposition;
+        r->eatoms      = cpu->eatoms;
+        r->natoms      = cpu->natoms;
+        r->watoms      = cpu->watoms;
+        r->exception   = cpu->exception;
+        r->ts          = cpu->ts;
+        r->cycleCount  = cpu->cycleCount;
+        r->instCount   = cpu->instCount;
+        b->flush       = ( ( r->changes & ~TRACE_FLOW_CHANGES ) != 0 ) || ( b->n == TRACE_RECORD_BATCH );
+    }
+
+    cpu->changeRecord = 0;
+}
+// ====================================================================================================
+static inline bool TRACERecordChanged( struct TRACERecord *r, enum TRACEchanges c )
+
+/* Equivalent of TRACEStateChanged for a record */
+
+{
+    bool ret = ( r->changes & ( 1 << c ) ) != 0;
+    r->changes &= ~( 1 << c );
+    return ret;
+}
+// ====================================================================================================
+
 // ============================================================================
 // The TRACE decoder state
 // ============================================================================
 
 typedef void ( *traceDecodeCB )( void *d );
+typedef void ( *traceDecodeRecordCB )( struct TRACERecord *r, int n, void *d );
 
 struct TRACEDecoder;
 
 struct TRACEDecoderEngine
 {
     bool ( *action )        ( struct TRACEDecoderEngine *e, struct TRACECPUState *cpu, uint8_t c  );
-    bool ( *actionPair )    ( struct TRACEDecoderEngine *e, struct TRACECPUState *cpu, uint32_t source, uint32_t dest );
+    int ( *actionRecords )  ( struct TRACEDecoderEngine *e, struct TRACECPUState *cpu, const uint8_t *buf, int len, struct TRACERecordBatch *b );
     void ( *destroy )       ( struct TRACEDecoderEngine *e );
     bool ( *synced )        ( struct TRACEDecoderEngine *e );
     void ( *forceSync )     ( struct TRACEDecoderEngine *e, bool isSynced );
@@ -167,6 +265,7 @@ struct TRACEDecoderEngine
 
     /* Config specific to ETM3.5 */
     void ( *altAddrEncode ) ( struct TRACEDecoderEngine *e, bool using );
+    void ( *cycleAccurate ) ( struct TRACEDecoderEngine *e, bool using );
 };
 
 struct TRACEDecoder
@@ -176,6 +275,7 @@ struct TRACEDecoder
     struct TRACECPUState cpu;          /* Current state of the CPU */
 
     enum TRACEprotocol protocol;       /* What trace protocol are we using? */
+    bool foldAtoms;                    /* Fold runs of atoms into single records when pumping records */
 
     struct TRACEDecoderEngine *engine; /* The actual engine for the decode, including internal state */
 
@@ -197,8 +297,13 @@ const char *TRACEExceptionName( int exceptionNumber );
 const char *TRACEDecodeGetProtocolName( enum TRACEprotocol protocol );
 
 void TRACEDecoderPump( struct TRACEDecoder *i, uint8_t *buf, int len, traceDecodeCB cb, void *d );
+void TRACEDecoderPumpRecords( struct TRACEDecoder *i, uint8_t *buf, int len, traceDecodeRecordCB cb, void *d );
 
+void TRACEDecoderSetReportLevel( struct TRACEDecoder *i, enum verbLevel l );
+void TRACEDecoderSetCycleAccurate( struct TRACEDecoder *i, bool cycleAccurate );
+void TRACEDecoderSetFoldAtoms( struct TRACEDecoder *i, bool foldAtoms );
 void TRACEDecoderInit( struct TRACEDecoder *i, enum TRACEprotocol protocol, bool usingAltAddrEncodeSet, genericsReportCB report );
+void TRACEDecoderDestroy( struct TRACEDecoder *i );
 // ====================================================================================================
 #ifdef __cplusplus
 }
@@ -0,0 +1,99 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+/*
+ * orbzmq Binary Event Schema
+ * ==========================
+ *
+ * Layout of the payloads orbzmq publishes on the hwevent topics when binary
+ * events are selected (-B). Every payload starts with the same header, giving
+ * the schema version, the event type and the timestamp carried by the decoded
+ * message, followed by the fields for that event. Layouts are packed, with
+ * values in host byte order (little endian on all supported hosts).
+ *
+ * Any change to these layouts must bump ZMQEV_VERSION.
+ */
+
+#ifndef _ZMQ_EVENTS_H_
+#define _ZMQ_EVENTS_H_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define ZMQEV_VERSION (1)
+
+/* Event types, as carried in the header */
+enum zmqEvType
+{
+    ZMQEV_TS        = 0,             /* hweventTS */
+    ZMQEV_EXCEPTION = 1,             /* hweventEXCP */
+    ZMQEV_PCSAMPLE  = 2,             /* hweventPC */
+    ZMQEV_DWT       = 3,             /* hweventDWT */
+    ZMQEV_RWWT      = 4,             /* hweventRWWT */
+    ZMQEV_AWP       = 5,             /* hweventAWP */
+    ZMQEV_OFS       = 6              /* hweventOFS */
+};
+
+struct __attribute__( ( packed ) ) zmqEvHeader
+{
+    uint8_t version;                 /* ZMQEV_VERSION */
+    uint8_t type;                    /* enum zmqEvType */
+    uint64_t ts;                     /* Timestamp of the message */
+};
+
+struct __attribute__( ( packed ) ) zmqEvTS
+{
+    struct zmqEvHeader h;
+    uint8_t timeStatus;              /* enum timeDelay of the timestamp */
+    uint32_t timeInc;                /* Time increment since the last timestamp */
+};
+
+struct __attribute__( ( packed ) ) zmqEvException
+{
+    struct zmqEvHeader h;
+    uint32_t exceptionNumber;        /* Exception number (16 upwards are external) */
+    uint8_t eventType;               /* 1 Enter, 2 Exit, 3 Resume */
+};
+
+struct __attribute__( ( packed ) ) zmqEvPCSample
+{
+    struct zmqEvHeader h;
+    uint32_t pc;                     /* Sampled PC (not valid when sleeping) */
+    uint8_t sleep;                   /* Non-zero if the CPU was asleep */
+};
+
+struct __attribute__( ( packed ) ) zmqEvDWT
+{
+    struct zmqEvHeader h;
+    uint8_t event;                   /* Bitmap of CPI, Exc, Sleep, LSU, Fold, Cyc counter wraps */
+};
+
+struct __attribute__( ( packed ) ) zmqEvRWWT
+{
+    struct zmqEvHeader h;
+    uint8_t comp;                    /* Comparator that matched */
+    uint8_t isWrite;                 /* Non-zero for a write */
+    uint32_t data;                   /* Value read or written */
+};
+
+struct __attribute__( ( packed ) ) zmqEvAWP
+{
+    struct zmqEvHeader h;
+    uint8_t comp;                    /* Comparator that matched */
+    uint32_t data;                   /* PC of the access */
+};
+
+struct __attribute__( ( packed ) ) zmqEvOFS
+{
+    struct zmqEvHeader h;
+    uint8_t comp;                    /* Comparator that matched */
+    uint32_t offset;                 /* Offset of the access */
+};
+
+// ====================================================================================================
+#ifdef __cplusplus
+}
+#endif
+#endif
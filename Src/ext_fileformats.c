@@ -7,9 +7,22 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include "ext_fileformats.h"
+#include "generics.h"
+#include "cJSON.h"
 
 #define HANDLE_MASK         (0xFFFFFF)   /* cachegrind cannot cope with large file handle numbers */
+#define OUTPUT_BUFFER_SIZE  (1024*1024)  /* Buffer for the writers, which make many small writes */
+#define MAX_LINE_LEN        (160)        /* Longest line of numbers the profile writer will build */
+
+/* A record to be sorted, with the key it's sorted by */
+struct sortKey
+{
+    uint64_t key;
+    void *item;
+};
 
 // ====================================================================================================
 // ====================================================================================================
@@ -18,27 +31,58 @@
 // ====================================================================================================
 // ====================================================================================================
 // ====================================================================================================
-static int _inst_sort_fn( const void *a, const void *b )
+static int _key_sort_fn( const void *a, const void *b )
+
+/* Sort keys in ascending order, without the overflow a subtraction would have for large values */
+
+{
+    uint64_t ka = ( ( struct sortKey * )a )->key;
+    uint64_t kb = ( ( struct sortKey * )b )->key;
+
+    return ( ka > kb ) - ( ka < kb );
+}
+// ====================================================================================================
+static uint64_t _instKey( const void *item )
 
 /* Sort instructions by address */
 
 {
-    return ( int )( ( ( struct execEntryHash * )a )->addr ) - ( int )( ( ( struct execEntryHash * )b )->addr );
+    return ( ( struct execEntryHash * )item )->addr;
 }
 // ====================================================================================================
-static int _calls_src_sort_fn( const void *a, const void *b )
+static uint64_t _callSrcKey( const void *item )
 
-/* Sort instructions by called from address */
+/* Sort calls by called from function, then by called to function */
 
 {
-    int i;
+    const struct subcall *s = ( const struct subcall * )item;
+
+    return ( ( uint64_t )s->srch->functionindex << 32 ) | s->dsth->functionindex;
+}
+// ====================================================================================================
+static void _sortByKey( void **items, uint32_t count, uint64_t ( *keyOf )( const void *item ) )
 
-    if ( ( i = ( int )( ( ( struct subcall * )a )->srch->functionindex ) - ( int )( ( ( struct subcall * )b )->srch->functionindex ) ) )
+/* Sort an array of records in place. The keys are taken out first, so the sort works through a compact */
+/* array of them rather than reaching into every record for each comparison.                            */
+
+{
+    struct sortKey *k = ( struct sortKey * )malloc( count * sizeof( struct sortKey ) );
+    MEMCHECKV( k );
+
+    for ( uint32_t i = 0; i < count; i++ )
     {
-        return i;
+        k[i].key  = keyOf( items[i] );
+        k[i].item = items[i];
     }
 
-    return ( int )( ( ( struct subcall * )a )->dsth->functionindex ) - ( int )( ( ( struct subcall * )b )->dsth->functionindex );
+    qsort( k, count, sizeof( struct sortKey ), _key_sort_fn );
+
+    for ( uint32_t i = 0; i < count; i++ )
+    {
+        items[i] = k[i].item;
+    }
+
+    free( k );
 }
 // ====================================================================================================
 #if 0 // Not used for now, but left here in case its useful later...
@@ -58,6 +102,193 @@ static int _calls_dst_sort_fn( const void *a, const void *b )
 }
 #endif
 // ====================================================================================================
+static FILE *_openOutput( const char *filename, char **buffer )
+
+/* Open an output file with a large buffer, returning NULL if it can't be opened */
+
+{
+    FILE *c = fopen( filename, "w" );
+
+    *buffer = NULL;
+
+    if ( c )
+    {
+        *buffer = ( char * )malloc( OUTPUT_BUFFER_SIZE );
+
+        if ( *buffer )
+        {
+            setvbuf( c, *buffer, _IOFBF, OUTPUT_BUFFER_SIZE );
+        }
+    }
+
+    return c;
+}
+// ====================================================================================================
+static bool _closeOutput( FILE *c, char *buffer )
+
+/* Close an output file opened by _openOutput, returning false if any write to it failed */
+
+{
+    bool ok = !ferror( c );
+
+    ok = ( fclose( c ) == 0 ) && ok;
+    free( buffer );
+    return ok;
+}
+// ====================================================================================================
+static bool _firstUse( uint8_t *seen, uint32_t count, uint32_t index )
+
+/* Return true the first time an index is used, so its name is written out only then. Indices   */
+/* outside the symbol tables (INTERRUPT and the like) are rare, and get their name every time. */
+
+{
+    if ( index >= count )
+    {
+        return true;
+    }
+
+    if ( seen[index / 8] & ( 1 << ( index % 8 ) ) )
+    {
+        return false;
+    }
+
+    seen[index / 8] |= ( 1 << ( index % 8 ) );
+    return true;
+}
+// ====================================================================================================
+static char *_putDec( char *p, uint64_t v )
+
+/* Write v in decimal at p, returning the position following it */
+
+{
+    char t[20];
+    int n = 0;
+
+    do
+    {
+        t[n++] = '0' + v % 10;
+        v /= 10;
+    }
+    while ( v );
+
+    while ( n )
+    {
+        *p++ = t[--n];
+    }
+
+    return p;
+}
+// ====================================================================================================
+static char *_putHex( char *p, uint32_t v )
+
+/* Write v as 0x and eight hex digits at p, returning the position following it */
+
+{
+    *p++ = '0';
+    *p++ = 'x';
+
+    for ( int i = 28; i >= 0; i -= 4 )
+    {
+        *p++ = "0123456789abcdef"[( v >> i ) & 0xf];
+    }
+
+    return p;
+}
+// ====================================================================================================
+static char *_putDelta( char *p, int64_t from, int64_t to )
+
+/* Write a position relative to the previous one at p, returning the position following it */
+
+{
+    if ( from == to )
+    {
+        *p++ = '*';
+    }
+    else
+    {
+        *p++ = ( to > from ) ? '+' : '-';
+        p = _putDec( p, ( to > from ) ? to - from : from - to );
+    }
+
+    return p;
+}
+// ====================================================================================================
+static void _outputId( FILE *c, const char *key, uint32_t index )
+
+/* Write a file or function specification by id alone, for a name that has already been written */
+
+{
+    char l[MAX_LINE_LEN];
+    size_t n = strlen( key );
+    char *p = l + n;
+
+    memcpy( l, key, n );
+    *p++ = '=';
+    *p++ = '(';
+    p = _putDec( p, index & HANDLE_MASK );
+    *p++ = ')';
+    *p++ = '\n';
+    fwrite( l, 1, p - l, c );
+}
+// ====================================================================================================
+static void _outputFile( FILE *c, const char *key, uint8_t *seen, uint32_t index, const char *prefix, struct SymbolSet *ss )
+
+/* Write a file specification in compressed form, with the name following the id on first use only */
+
+{
+    if ( _firstUse( seen, ss->fileCount, index ) )
+    {
+        fprintf( c, "%s=(%u) %s%s\n", key, index & HANDLE_MASK, prefix ? prefix : "", SymbolFilename( ss, index ) );
+    }
+    else
+    {
+        _outputId( c, key, index );
+    }
+}
+// ====================================================================================================
+static void _outputFunction( FILE *c, const char *key, uint8_t *seen, uint32_t index, struct SymbolSet *ss )
+
+/* Write a function specification in compressed form, with the name following the id on first use only */
+
+{
+    if ( _firstUse( seen, ss->functionCount, index ) )
+    {
+        fprintf( c, "%s=(%u) %s\n", key, index & HANDLE_MASK, SymbolFunction( ss, index ) );
+    }
+    else
+    {
+        _outputId( c, key, index );
+    }
+}
+// ====================================================================================================
+static int64_t _line( uint32_t line )
+
+/* Line to write for a position, with unknown lines as 0 */
+
+{
+    return ( line == NO_LINE ) ? 0 : line;
+}
+// ====================================================================================================
+static uint32_t _stackPath( struct stackNode *stackTree, uint32_t node, uint32_t *path )
+
+/* Fill path with the frames leading to node, outermost first, and return how many there are */
+
+{
+    uint32_t depth = 0;
+
+    for ( uint32_t n = node; n != STACK_ROOT; n = stackTree[n].parent )
+    {
+        depth++;
+    }
+
+    for ( uint32_t i = depth; i; node = stackTree[node].parent )
+    {
+        path[--i] = node;
+    }
+
+    return depth;
+}
+// ====================================================================================================
 // ====================================================================================================
 // ====================================================================================================
 // Externally available routines
@@ -70,79 +301,100 @@ static int _calls_dst_sort_fn( const void *a, const void *b )
 // Dot support
 // ====================================================================================================
 // ====================================================================================================
-bool ext_ff_outputDot( char *dotfile, struct subcall *subcallList, struct SymbolSet *ss )
+bool ext_ff_outputDot( char *dotfile, struct subcall **calls, uint32_t callCount, struct SymbolSet *ss )
 
-/* Output call graph to dot file */
+/* Output call graph to dot file. The calls array is sorted in place. Each function is a node, */
+/* declared with its label the first time it's used, so the edges need only name the nodes.  */
 
 {
     FILE *c;
-    uint32_t functionidx, dfunctionidx, fileidx;
+    char *buffer;
+    uint8_t *seen;
+    uint32_t functionidx, dfunctionidx;
     uint64_t cnt;
     struct subcall *s;
+    uint32_t i = 0;
 
     if ( !dotfile )
     {
         return false;
     }
 
-    if ( !subcallList )
+    if ( !callCount )
     {
         return false;
     }
 
-    /* Sort according to addresses visited. */
+    c = _openOutput( dotfile, &buffer );
+
+    if ( !c )
+    {
+        return false;
+    }
+
+    seen = ( uint8_t * )calloc( ( ss->functionCount + 7 ) / 8 + 1, 1 );
+    MEMCHECK( seen, false );
 
-    c = fopen( dotfile, "w" );
     fprintf( c, "graph calls\n{\n  overlap=true; splines=true; size=\"7.75,10.25\"; orientation=portrait; sep=0.1; nodesep=1;\n" );
 
-    HASH_SORT( subcallList, _calls_src_sort_fn );
-    s = subcallList;
+    /* Sort according to addresses visited. */
+    _sortByKey( ( void ** )calls, callCount, _callSrcKey );
 
     /* Now go through and label the arrows... */
 
-    s = subcallList;
-
-    while ( s )
+    while ( i < callCount )
     {
+        s = calls[i++];
         functionidx = s->srch->functionindex;
-        fileidx = s->srch->fileindex;
-
         dfunctionidx = s->dsth->functionindex;
         cnt = s->count;
-        s = s->hh.next;
 
-        while ( ( s ) && ( functionidx == s->srch->functionindex ) && ( dfunctionidx == s->dsth->functionindex ) )
+        while ( ( i < callCount ) && ( functionidx == calls[i]->srch->functionindex ) && ( dfunctionidx == calls[i]->dsth->functionindex ) )
         {
-            cnt += s->count;
-            s = s->hh.next;
+            cnt += calls[i++]->count;
         }
 
-        fprintf( c, "    \"\n(%s)\n%s\n\n\" -- ", SymbolFilename( ss, fileidx ), SymbolFunction( ss, functionidx ) );
-        fprintf( c, "\"\n(%s)\n%s\n\n\" [label=%" PRIu64 ", weight=0.1 ];\n", SymbolFilename( ss, fileidx ), SymbolFunction( ss, dfunctionidx ), cnt );
+        if ( _firstUse( seen, ss->functionCount, functionidx ) )
+        {
+            fprintf( c, "    \"%u\" [label=\"\n(%s)\n%s\n\n\"];\n", functionidx, SymbolFilename( ss, s->srch->fileindex ), SymbolFunction( ss, functionidx ) );
+        }
+
+        if ( _firstUse( seen, ss->functionCount, dfunctionidx ) )
+        {
+            fprintf( c, "    \"%u\" [label=\"\n(%s)\n%s\n\n\"];\n", dfunctionidx, SymbolFilename( ss, s->dsth->fileindex ), SymbolFunction( ss, dfunctionidx ) );
+        }
+
+        fprintf( c, "    \"%u\" -- \"%u\" [label=%" PRIu64 ", weight=0.1 ];\n", functionidx, dfunctionidx, cnt );
     }
 
     fprintf( c, "}\n" );
-    fclose( c );
-    return true;
+    free( seen );
+    return _closeOutput( c, buffer );
 }
 // ====================================================================================================
 // ====================================================================================================
 // KCacheGrind support
 // ====================================================================================================
 // ====================================================================================================
-bool ext_ff_outputProfile( char *profile, char *elffile, char *deleteMaterial, bool includeVisits, uint64_t timelen,
-                           struct execEntryHash *insthead, struct subcall *subcallList, struct SymbolSet *ss )
+bool ext_ff_outputProfile( char *profile, char *elffile, char *deleteMaterial, bool includeVisits, bool includeCycles, uint64_t timelen,
+                           struct execEntryHash **insts, uint32_t instCount, struct subcall **calls, uint32_t callCount, struct SymbolSet *ss )
 
-/* Output a KCacheGrind compatible profile, with instruction coverage in insthead, calls in subcallList */
+/* Output a KCacheGrind compatible profile, with instruction coverage in insts, calls in calls. Both arrays are sorted in place */
+/* The optional event columns follow Inst in the order Visits, Cycles. File, function and line come from the records          */
+/* themselves, and file and function names are compressed, written only with the first use of their id.                      */
 
 {
-    struct nameEntry n;
     uint32_t prevfile = NO_FILE;
     uint32_t prevfn   = NO_FUNCTION;
     uint32_t prevaddr = NO_FUNCTION;
     uint32_t prevline = NO_LINE;
     char *e = elffile;
     char *d = deleteMaterial;
+    char *buffer;
+    char l[MAX_LINE_LEN];
+    char *p;
+    uint8_t *seenFiles;
+    uint8_t *seenFunctions;
     FILE *c;
 
     if ( !profile )
@@ -150,18 +402,34 @@ bool ext_ff_outputProfile( char *profile, char *elffile, char *deleteMaterial, b
         return false;
     }
 
-    c = fopen( profile, "w" );
+    c = _openOutput( profile, &buffer );
+
+    if ( !c )
+    {
+        return false;
+    }
+
+    seenFiles = ( uint8_t * )calloc( ( ss->fileCount + 7 ) / 8 + 1, 1 );
+    MEMCHECK( seenFiles, false );
+    seenFunctions = ( uint8_t * )calloc( ( ss->functionCount + 7 ) / 8 + 1, 1 );
+    MEMCHECK( seenFunctions, false );
+
     fprintf( c, "# callgrind format\n" );
 
+    fprintf( c, "creator: orbprofile\npositions: instr line\nevent: Inst : CPU Instructions\n" );
+
     if ( includeVisits )
     {
-        fprintf( c, "creator: orbprofile\npositions: instr line\nevent: Inst : CPU Instructions\nevent: Visits : Visits to source line\nevents: Inst Visits\n" );
+        fprintf( c, "event: Visits : Visits to source line\n" );
     }
-    else
+
+    if ( includeCycles )
     {
-        fprintf( c, "creator: orbprofile\npositions: instr line\nevent: Inst : CPU Instructions\nevents: Inst\n" );
+        fprintf( c, "event: Cycles : CPU Cycles\n" );
     }
 
+    fprintf( c, "events: Inst%s%s\n", includeVisits ? " Visits" : "", includeCycles ? " Cycles" : "" );
+
     /* Samples are in time order, so we can determine the extent of time.... */
     fprintf( c, "summary: %" PRIu64 "\n", timelen );
 
@@ -184,101 +452,290 @@ bool ext_ff_outputProfile( char *profile, char *elffile, char *deleteMaterial, b
     /* ...and record whatever elffilename we ended up with */
     fprintf( c, "ob=%s\n", e );
 
-    HASH_SORT( insthead, _inst_sort_fn );
-    struct execEntryHash *f = insthead;
+    _sortByKey( ( void ** )insts, instCount, _instKey );
 
-    while ( f )
+    for ( uint32_t i = 0; i < instCount; i++ )
     {
-        SymbolLookup( ss, f->addr, &n );
+        struct execEntryHash *f = insts[i];
+
+        /* Records with no cost (such as the INTERRUPT placeholder) are only there to be called */
+        if ( ( !f->count ) && ( !f->cycles ) )
+        {
+            continue;
+        }
 
-        if ( prevfile != n.fileindex )
+        if ( prevfile != f->fileindex )
         {
-            fprintf( c, "fl=(%u) %s%s\n", n.fileindex & HANDLE_MASK, deleteMaterial  ? deleteMaterial : "", SymbolFilename( ss, n.fileindex ) );
+            _outputFile( c, "fl", seenFiles, f->fileindex, deleteMaterial, ss );
         }
 
-        if ( prevfn != n.functionindex )
+        if ( prevfn != f->functionindex )
         {
-            fprintf( c, "fn=(%u) %s\n", n.functionindex & HANDLE_MASK, SymbolFunction( ss, n.functionindex ) );
+            _outputFunction( c, "fn", seenFunctions, f->functionindex, ss );
         }
 
+        /* These lines are most of the file, so they're built up directly rather than through fprintf */
+        p = l;
+
         if ( ( prevline == NO_LINE ) || ( prevaddr == NO_FUNCTION ) )
         {
-            fprintf( c, "0x%08x %d ", f->addr, n.line );
+            p = _putHex( p, f->addr );
+            *p++ = ' ';
+            p = _putDec( p, _line( f->line ) );
         }
         else
         {
-            if ( prevaddr == f->addr )
-            {
-                fprintf( c, "* " );
-            }
-            else
-            {
-                fprintf( c, "%s%d ", f->addr > prevaddr ? "+" : "", ( int )f->addr - prevaddr );
-            }
-
-            if ( prevline == n.line )
-            {
-                fprintf( c, "* " );
-            }
-            else
-            {
-                fprintf( c, "%s%d ", n.line > prevline ? "+" : "", ( int )n.line - prevline );
-            }
+            p = _putDelta( p, prevaddr, f->addr );
+            *p++ = ' ';
+            p = _putDelta( p, _line( prevline ), _line( f->line ) );
         }
 
+        *p++ = ' ';
+        p = _putDec( p, f->count );
+
         if ( includeVisits )
         {
-            fprintf( c, "%" PRIu64 " %" PRIu64 "\n", f->count, f->scount );
+            *p++ = ' ';
+            p = _putDec( p, f->scount );
         }
-        else
+
+        if ( includeCycles )
         {
-            fprintf( c, "%" PRIu64 "\n", f->count );
+            *p++ = ' ';
+            p = _putDec( p, f->cycles );
         }
 
+        *p++ = '\n';
+        fwrite( l, 1, p - l, c );
 
-        prevline = n.line;
+        prevline = f->line;
         prevaddr = f->addr;
-        prevfile = n.fileindex;
-        prevfn = n.functionindex;
-        f = f->hh.next;
+        prevfile = f->fileindex;
+        prevfn = f->functionindex;
     }
 
     fprintf( c, "\n\n## ------------------- Calls Follow ------------------------\n" );
-    HASH_SORT( subcallList, _calls_src_sort_fn );
-    struct subcall *s = subcallList;
+    _sortByKey( ( void ** )calls, callCount, _callSrcKey );
 
-    while ( s )
+    for ( uint32_t i = 0; i < callCount; i++ )
     {
+        struct subcall *s = calls[i];
+
         /* Now publish the call destination. By definition is is known, so can be shortformed */
         if ( prevfile != s->srch->fileindex )
         {
-            fprintf( c, "fl=(%u)\n", s->srch->fileindex & HANDLE_MASK );
+            _outputFile( c, "fl", seenFiles, s->srch->fileindex, deleteMaterial, ss );
             prevfile = s->srch->fileindex;
         }
 
         if ( prevfn != s->srch->functionindex )
         {
-            fprintf( c, "fn=(%u)\n", s->srch->functionindex & HANDLE_MASK );
+            _outputFunction( c, "fn", seenFunctions, s->srch->functionindex, ss );
             prevfn = s->srch->functionindex;
         }
 
-        fprintf( c, "cfl=(%d)\ncfn=(%d)\n", s->dsth->fileindex, s->dsth->functionindex );
-        fprintf( c, "calls=%" PRIu64 " 0x%08x %d\n", s->count, s->sig.dst, s->dsth->line );
+        _outputFile( c, "cfl", seenFiles, s->dsth->fileindex, deleteMaterial, ss );
+        _outputFunction( c, "cfn", seenFunctions, s->dsth->functionindex, ss );
+        p = l;
+        memcpy( p, "calls=", 6 );
+        p = _putDec( p + 6, s->count );
+        *p++ = ' ';
+        p = _putHex( p, s->sig.dst );
+        *p++ = ' ';
+        p = _putDec( p, _line( s->dsth->line ) );
+        *p++ = '\n';
+
+        p = _putHex( p, s->sig.src );
+        *p++ = ' ';
+        p = _putDec( p, _line( s->srch->line ) );
+        *p++ = ' ';
+        p = _putDec( p, s->myCost );
 
         if ( includeVisits )
         {
-            fprintf( c, "0x%08x %d %" PRIu64 " %" PRIu64 "\n", s->sig.src, s->srch->line, s->myCost, s->count );
+            *p++ = ' ';
+            p = _putDec( p, s->count );
         }
-        else
+
+        if ( includeCycles )
         {
-            fprintf( c, "0x%08x %d %" PRIu64 "\n", s->sig.src, s->srch->line, s->myCost );
+            *p++ = ' ';
+            p = _putDec( p, s->myCycles );
         }
 
-        s = s->hh.next;
+        *p++ = '\n';
+        fwrite( l, 1, p - l, c );
     }
 
-    fclose( c );
+    free( seenFunctions );
+    free( seenFiles );
+    return _closeOutput( c, buffer );
+}
+// ====================================================================================================
+// ====================================================================================================
+// Call stack support
+// ====================================================================================================
+// ====================================================================================================
+bool ext_ff_outputFolded( char *foldedfile, struct stackNode *stackTree, uint32_t nodeCount, struct SymbolSet *ss )
+
+/* Output call stacks in folded format (one line of 'outer;...;inner count' per stack) for flame graph tools */
+
+{
+    FILE *c;
+    char *buffer;
+    uint32_t *path;
+    uint32_t depth;
 
+    if ( !foldedfile )
+    {
+        return false;
+    }
+
+    c = _openOutput( foldedfile, &buffer );
+
+    if ( !c )
+    {
+        return false;
+    }
+
+    path = ( uint32_t * )malloc( nodeCount * sizeof( uint32_t ) );
+    MEMCHECK( path, false );
+
+    for ( uint32_t n = STACK_ROOT + 1; n < nodeCount; n++ )
+    {
+        if ( stackTree[n].count )
+        {
+            depth = _stackPath( stackTree, n, path );
+
+            for ( uint32_t i = 0; i < depth; i++ )
+            {
+                fprintf( c, "%s%s", i ? ";" : "", SymbolFunction( ss, stackTree[path[i]].functionindex ) );
+            }
+
+            fprintf( c, " %" PRIu64 "\n", stackTree[n].count );
+        }
+    }
+
+    free( path );
+    return _closeOutput( c, buffer );
+}
+// ====================================================================================================
+bool ext_ff_outputSpeedscope( char *ssfile, char *elffile, struct stackNode *stackTree, uint32_t nodeCount, struct SymbolSet *ss )
+
+/* Output call stacks as a speedscope (https://www.speedscope.app) sampled profile, weighted by instructions */
+
+{
+    FILE *c;
+    uint32_t *path;
+    uint32_t *frameOf;
+    uint32_t depth;
+    uint32_t frameCount = 0;
+    uint64_t total = 0;
+    char *op;
+
+    struct frameEntry
+    {
+        uint32_t functionindex;
+        uint32_t frame;
+        UT_hash_handle hh;
+    } *frames = NULL, *f, *t;
+
+    if ( !ssfile )
+    {
+        return false;
+    }
+
+    path = ( uint32_t * )malloc( nodeCount * sizeof( uint32_t ) );
+    MEMCHECK( path, false );
+    frameOf = ( uint32_t * )malloc( nodeCount * sizeof( uint32_t ) );
+    MEMCHECK( frameOf, false );
+
+    cJSON *shared = cJSON_CreateObject();
+    cJSON *jframes = cJSON_AddArrayToObject( shared, "frames" );
+    cJSON *samples = cJSON_CreateArray();
+    cJSON *weights = cJSON_CreateArray();
+
+    /* Each function gets one frame, whichever stacks it appears in */
+    for ( uint32_t n = STACK_ROOT + 1; n < nodeCount; n++ )
+    {
+        HASH_FIND_INT( frames, &stackTree[n].functionindex, f );
+
+        if ( !f )
+        {
+            f = ( struct frameEntry * )calloc( 1, sizeof( struct frameEntry ) );
+            MEMCHECK( f, false );
+            f->functionindex = stackTree[n].functionindex;
+            f->frame = frameCount++;
+            HASH_ADD_INT( frames, functionindex, f );
+
+            cJSON *jf = cJSON_CreateObject();
+            cJSON_AddStringToObject( jf, "name", SymbolFunction( ss, stackTree[n].functionindex ) );
+            cJSON_AddStringToObject( jf, "file", SymbolFilename( ss, stackTree[n].fileindex ) );
+            cJSON_AddItemToArray( jframes, jf );
+        }
+
+        frameOf[n] = f->frame;
+    }
+
+    for ( uint32_t n = STACK_ROOT + 1; n < nodeCount; n++ )
+    {
+        if ( stackTree[n].count )
+        {
+            depth = _stackPath( stackTree, n, path );
+            cJSON *sample = cJSON_CreateArray();
+
+            for ( uint32_t i = 0; i < depth; i++ )
+            {
+                cJSON_AddItemToArray( sample, cJSON_CreateNumber( frameOf[path[i]] ) );
+            }
+
+            cJSON_AddItemToArray( samples, sample );
+            cJSON_AddItemToArray( weights, cJSON_CreateNumber( stackTree[n].count ) );
+            total += stackTree[n].count;
+        }
+    }
+
+    cJSON *profile = cJSON_CreateObject();
+    cJSON_AddStringToObject( profile, "type", "sampled" );
+    cJSON_AddStringToObject( profile, "name", elffile );
+    cJSON_AddStringToObject( profile, "unit", "none" );
+    cJSON_AddNumberToObject( profile, "startValue", 0 );
+    cJSON_AddNumberToObject( profile, "endValue", total );
+    cJSON_AddItemToObject( profile, "samples", samples );
+    cJSON_AddItemToObject( profile, "weights", weights );
+
+    cJSON *root = cJSON_CreateObject();
+    cJSON_AddStringToObject( root, "$schema", "https://www.speedscope.app/file-format-schema.json" );
+    cJSON_AddItemToObject( root, "shared", shared );
+    cJSON *profiles = cJSON_AddArrayToObject( root, "profiles" );
+    cJSON_AddItemToArray( profiles, profile );
+    cJSON_AddStringToObject( root, "name", elffile );
+    cJSON_AddStringToObject( root, "exporter", "orbprofile" );
+
+    HASH_ITER( hh, frames, f, t )
+    {
+        HASH_DEL( frames, f );
+        free( f );
+    }
+
+    free( frameOf );
+    free( path );
+
+    op = cJSON_PrintUnformatted( root );
+    cJSON_Delete( root );
+    MEMCHECK( op, false );
+
+    c = fopen( ssfile, "w" );
+
+    if ( !c )
+    {
+        free( op );
+        return false;
+    }
+
+    fputs( op, c );
+    fclose( c );
+    free( op );
     return true;
 }
 // ====================================================================================================
@@ -338,12 +338,99 @@ char *genericsGetBaseDirectory( void )
 #endif
 }
 // ====================================================================================================
+const char *genericsColourSequence( char code )
+
+/* Return the control sequence for a screen code that follows CMD_ALERT. This is empty if screen handling is  */
+/* off, or NULL if this isn't a recognised code (in which case CMD_ALERT is dropped and the code char is kept) */
+
+{
+    static char colours[16][sizeof( CC_COLOUR )];
+
+    switch ( code )
+    {
+        case '0'...'9':
+        case 'a'...'f':
+            if ( !_screenHandling )
+            {
+                return "";
+            }
+
+            if ( !*colours[_htoi( code )] )
+            {
+                snprintf( colours[_htoi( code )], sizeof( colours[0] ), CC_COLOUR, _htoi( code ) > 7, _htoi( code ) & 7 );
+            }
+
+            return colours[_htoi( code )];
+
+        case 'u':
+            return _screenHandling ? CC_PREV_LN : "";
+
+        case 'U':
+            return _screenHandling ? CC_CLR_LN : "";
+
+        case 'r':
+            return _screenHandling ? CC_RES : "";
+
+        case 'z':
+            /* We'll take a flyer on it being vt100 compatible */
+            return CC_CLEAR_SCREEN;
+
+        default:
+            return NULL;
+    }
+}
+// ====================================================================================================
+char *genericsColourExpand( const char *str )
+
+/* Return a malloced copy of printf format str with screen codes already expanded. Output through genericsFPrintf */
+/* is unchanged. CMD_ALERT ahead of a conversion stays, since what follows it isn't known until the format is used */
+
+{
+    size_t len = strlen( str ) + 1;
+    char *op = ( char * )malloc( len );
+    char *d = op;
+    const char *seq;
+
+    MEMCHECK( op, NULL );
+
+    while ( *str )
+    {
+        if ( ( *str == CMD_ALERT[0] ) && ( ( seq = genericsColourSequence( *( str + 1 ) ) ) ) )
+        {
+            /* Expansions are longer than the codes they replace, so make room */
+            size_t seqLen = strlen( seq );
+            size_t offset = d - op;
+            len += seqLen;
+            op = ( char * )realloc( op, len );
+            MEMCHECK( op, NULL );
+            d = op + offset;
+
+            memcpy( d, seq, seqLen );
+            d += seqLen;
+            str += 2;
+        }
+        else if ( ( *str == CMD_ALERT[0] ) && ( *( str + 1 ) != '%' ) )
+        {
+            /* Not a code, so CMD_ALERT would be dropped anyway */
+            str++;
+        }
+        else
+        {
+            *d++ = *str++;
+        }
+    }
+
+    *d = 0;
+    return op;
+}
+// ====================================================================================================
 void genericsFPrintf( FILE *stream, const char *fmt, ... )
 
 /* Print to output stream */
 
 {
     static char op[MAX_STRLEN];
+    const char *seq;
     char *p = op;
 
     va_list va;
@@ -361,53 +448,10 @@ void genericsFPrintf( FILE *stream, const char *fmt, ... )
         {
             p++;
 
-            switch ( *p )
+            if ( ( seq = genericsColourSequence( *p ) ) )
             {
-                case '0'...'9':
-                case 'a'...'f':
-                    if ( _screenHandling )
-                    {
-                        fprintf( stream, CC_COLOUR, _htoi( *p ) > 7, _htoi( *p ) & 7 );
-                    }
-
-                    p++;
-                    break;
-
-                case 'u':
-                    if ( _screenHandling )
-                    {
-                        fprintf( stream, CC_PREV_LN );
-                    }
-
-                    p++;
-                    break;
-
-                case 'U':
-                    if ( _screenHandling )
-                    {
-                        fprintf( stream, CC_CLR_LN );
-                    }
-
-                    p++;
-                    break;
-
-                case 'r':
-                    if ( _screenHandling )
-                    {
-                        fprintf( stream, CC_RES );
-                    }
-
-                    p++;
-                    break;
-
-                case 'z':
-                    /* We'll take a flyer on it being vt100 compatible */
-                    fprintf( stream, CC_CLEAR_SCREEN );
-                    p++;
-                    break;
-
-                default:
-                    break;
+                fputs( seq, stream );
+                p++;
             }
         }
     }
@@ -8,15 +8,61 @@
 #include <ctype.h>
 #include <dwarf.h>
 #include <libdwarf.h>
+#include <pthread.h>
 
 #include "loadelf.h"
 #include "generics.h"
 #include "readsource.h"
+#include "uthash.h"
 
-#define DP_MAX_LINE_LEN (4095)
-#define IS_INFO (true)
+#define DP_MAX_LINE_LEN   (4095)
+#define IS_INFO           (true)
+#define MAX_DWARF_WORKERS (16)     /* Maximum number of threads to use collecting the DWARF */
+#define MIN_SORT_RUN      (4096)   /* Minimum run length per thread before parallel sorting is worth it */
+#define INSN_PAGE_SIZE    (256)    /* Number of halfwords of code covered by each page of predecoded instructions */
+#define DISASSEMBLY_LEN   (255)    /* Maximum length of disassembly text for an instruction */
 
-static char _print_buffer[DP_MAX_LINE_LEN];
+/* A thread collecting a share of the compilation units */
+struct cuWorker
+{
+    pthread_t thread;
+    const char *filename;                  /* File to open for our own libdwarf handle */
+    int fd;                                /* ...and the handle for it */
+    unsigned int index;                    /* Which worker this is */
+    unsigned int nworkers;                 /* ...out of how many */
+    struct symbol **cu;                    /* Partial symbol set for each CU handled, in CU order */
+    unsigned int ncu;                      /* Number of CUs handled by this worker */
+    unsigned int totalcu;                  /* Number of CUs in the file */
+    bool ok;                               /* Worker completed successfully */
+    char printBuffer[DP_MAX_LINE_LEN];     /* Buffer for libdwarf printing */
+};
+
+/* A run to be sorted, or a pair of runs to be merged */
+struct sortJob
+{
+    pthread_t thread;
+    void **base;                           /* Start of the run(s) */
+    void **scratch;                        /* Space to merge into */
+    size_t n;                              /* Total length */
+    size_t split;                          /* Start of the second run, when merging */
+    int ( *cmp )( const void *, const void * );
+};
+
+/* Predecoded instruction. Thumb instructions are halfword aligned so there's one of these per halfword of code */
+struct symbolInstruction
+{
+    symbolMemaddr target;                  /* Static branch target, if LE_IC_IMMEDIATE */
+    char *text;                            /* Disassembly text */
+    uint8_t ic;                            /* enum instructionClass bits */
+    bool isdecoded;                        /* This entry has been populated */
+};
+
+/* Hashed index into a string table, used when merging per-CU tables */
+struct stringIndex
+{
+    unsigned int index;
+    UT_hash_handle hh;
+};
 
 // ====================================================================================================
 // ====================================================================================================
@@ -510,42 +556,226 @@ static char *_joinPaths( const char *p1, const char *p2 )
 
 // ====================================================================================================
 
-static bool _readLines( struct symbol *p )
+static int _openElf( const char *filename )
+
 {
+    /* O_BINARY Only needed on platforms that differentiate between binary and text files */
+#ifndef O_BINARY
+    return open( filename, O_RDONLY, 0 );
+#else
+    return open( filename, O_RDONLY | O_BINARY, 0 );
+#endif
+}
+
+// ====================================================================================================
+
+static unsigned int _workerCount( void )
+
+/* Number of threads to use for collecting the DWARF */
+
+{
+#ifdef _SC_NPROCESSORS_ONLN
+    long n = sysconf( _SC_NPROCESSORS_ONLN );
+
+    return ( n < 1 ) ? 1 : ( n > MAX_DWARF_WORKERS ) ? MAX_DWARF_WORKERS : n;
+#else
+    return 1;
+#endif
+}
+
+// ====================================================================================================
+
+static void *_sortRun( void *arg )
+
+{
+    struct sortJob *j = ( struct sortJob * )arg;
+
+    qsort( j->base, j->n, sizeof( void * ), j->cmp );
+    return NULL;
+}
+
+// ====================================================================================================
+
+static void *_mergeRuns( void *arg )
+
+/* Merge the two sorted runs either side of split via the scratch area */
+
+{
+    struct sortJob *j = ( struct sortJob * )arg;
+    size_t l = 0;
+    size_t r = j->split;
+    size_t o = 0;
+
+    while ( ( l < j->split ) && ( r < j->n ) )
+    {
+        j->scratch[o++] = ( j->cmp( &j->base[r], &j->base[l] ) < 0 ) ? j->base[r++] : j->base[l++];
+    }
+
+    while ( l < j->split )
+    {
+        j->scratch[o++] = j->base[l++];
+    }
+
+    while ( r < j->n )
+    {
+        j->scratch[o++] = j->base[r++];
+    }
+
+    memcpy( j->base, j->scratch, j->n * sizeof( void * ) );
+    return NULL;
+}
+
+// ====================================================================================================
+
+static void _parallelSort( void **base, size_t n, int ( *cmp )( const void *, const void * ), unsigned int nthreads )
+
+/* Sort a table of pointers. Each thread sorts a run, then runs are merged pairwise, also in parallel */
+
+{
+    struct sortJob j[MAX_DWARF_WORKERS];
+    size_t bound[MAX_DWARF_WORKERS + 1];
+    unsigned int nruns = ( n < nthreads * MIN_SORT_RUN ) ? 1 : nthreads;
+
+    if ( nruns == 1 )
+    {
+        qsort( base, n, sizeof( void * ), cmp );
+        return;
+    }
+
+    void **scratch = ( void ** )malloc( n * sizeof( void * ) );
+    MEMCHECKV( scratch );
+
+    for ( unsigned int i = 0; i <= nruns; i++ )
+    {
+        bound[i] = ( n * i ) / nruns;
+    }
+
+    for ( unsigned int i = 0; i < nruns; i++ )
+    {
+        j[i] = ( struct sortJob )
+        {
+            .base = &base[bound[i]], .n = bound[i + 1] - bound[i], .cmp = cmp
+        };
+        pthread_create( &j[i].thread, NULL, _sortRun, &j[i] );
+    }
+
+    for ( unsigned int i = 0; i < nruns; i++ )
+    {
+        pthread_join( j[i].thread, NULL );
+    }
+
+    /* Now merge neighbouring runs until there's only one left */
+    while ( nruns > 1 )
+    {
+        unsigned int npairs = nruns / 2;
+
+        for ( unsigned int i = 0; i < npairs; i++ )
+        {
+            j[i] = ( struct sortJob )
+            {
+                .base = &base[bound[2 * i]], .scratch = &scratch[bound[2 * i]], .n = bound[2 * i + 2] - bound[2 * i],
+                .split = bound[2 * i + 1] - bound[2 * i], .cmp = cmp
+            };
+            pthread_create( &j[i].thread, NULL, _mergeRuns, &j[i] );
+        }
+
+        for ( unsigned int i = 0; i < npairs; i++ )
+        {
+            pthread_join( j[i].thread, NULL );
+        }
+
+        /* Collapse the boundaries of the merged runs, carrying any odd one at the end */
+        for ( unsigned int i = 0; i <= npairs; i++ )
+        {
+            bound[i] = bound[2 * i];
+        }
+
+        if ( nruns & 1 )
+        {
+            bound[npairs + 1] = n;
+        }
+
+        nruns = ( nruns + 1 ) / 2;
+    }
+
+    free( scratch );
+}
+
+// ====================================================================================================
+
+static void _processCU( struct symbol *cu, Dwarf_Debug dbg, Dwarf_Die cu_die )
+
+/* Collect the functions and lines from one compilation unit into its own (partial) symbol set */
+
+{
+    Dwarf_Addr cu_low_addr;
+    char *name;
+    char *producer;
+    char *compdir;
+
+    unsigned int filenameN;
+    unsigned int producerN;
+
+    dwarf_diename( cu_die, &name, 0 );
+    dwarf_die_text( cu_die, DW_AT_producer, &producer, 0 );
+    dwarf_die_text( cu_die, DW_AT_comp_dir, &compdir, 0 );
+
+    /* Need to construct the fully qualified filename from the directory + filename */
+    char *s = _joinPaths( compdir, name );
+    filenameN  = _findOrAddString( s, &cu->stringTable[PT_FILENAME],  &cu->tableLen[PT_FILENAME] );
+    free( s );
+    producerN =  _findOrAddString( producer, &cu->stringTable[PT_PRODUCER],  &cu->tableLen[PT_PRODUCER] );
+
+    /* Kickoff the process for the DIE and its children to get the functions in this cu */
+    dwarf_lowpc( cu_die, &cu_low_addr, 0 );
+    _processDie( cu, dbg, cu_die, 0, filenameN, producerN, cu_low_addr );
+
+    /* ...and the source lines */
+    _getSourceLines( cu, dbg, cu_die );
+}
+
+// ====================================================================================================
+
+static void *_cuWorker( void *arg )
+
+/* Thread to process every nworker'th compilation unit, using its own libdwarf handle */
+
+{
+    struct cuWorker *w = ( struct cuWorker * )arg;
     Dwarf_Debug dbg;
     Dwarf_Error err;
     Dwarf_Unsigned cu_header_length = 0;
     Dwarf_Half     version_stamp = 0;
     Dwarf_Off      abbrev_offset = 0;
-    Dwarf_Addr     cu_low_addr;
     Dwarf_Half     address_size = 0;
     Dwarf_Unsigned next_cu_header = 0;
     Dwarf_Die      cu_die = NULL;
 
-    bool retval = false;
     Dwarf_Half dw_length_size = 0;
     Dwarf_Half dw_extension_size = 0;
     Dwarf_Sig8 dw_type_signature;
     Dwarf_Unsigned dw_typeoffset = 0;
     Dwarf_Half dw_header_cu_type = DW_UT_compile;
 
-    char *name;
-    char *producer;
-    char *compdir;
+    unsigned int cuNumber = 0;
 
-    unsigned int filenameN;
-    unsigned int producerN;
+    /* libdwarf handles cannot be shared between threads, and neither can a file position, so take our own of both */
+    if ( ( w->fd = _openElf( w->filename ) ) < 0 )
+    {
+        return NULL;
+    }
 
-    if ( 0 != dwarf_init_b( p->fd, DW_GROUPNUMBER_ANY, NULL, NULL, &dbg, &err ) )
+    if ( 0 != dwarf_init_b( w->fd, DW_GROUPNUMBER_ANY, NULL, NULL, &dbg, &err ) )
     {
-        return false;
+        close( w->fd );
+        return NULL;
     }
 
     struct Dwarf_Printf_Callback_Info_s print_setup =
     {
-        .dp_user_pointer = p,
+        .dp_user_pointer = w,
         .dp_fptr = &_dwarf_print,
-        .dp_buffer = _print_buffer,
+        .dp_buffer = w->printBuffer,
         .dp_buffer_len = DP_MAX_LINE_LEN,
         .dp_buffer_user_provided = true,
         .dp_reserved = NULL
@@ -554,14 +784,6 @@ static bool _readLines( struct symbol *p )
 
     dwarf_register_printf_callback( dbg, &print_setup );
 
-    /* Add an empty string to each string table, so the 0th element is the empty string in all cases */
-    for ( enum symbolTables pt = 0; pt < PT_NUMTABLES; pt++ )
-    {
-        _findOrAddString( "", &p->stringTable[pt],  &p->tableLen[pt] );
-    }
-
-    /* 1: Collect the functions and lines */
-    /* ---------------------------------- */
     while ( true )
     {
         memset( &dw_type_signature, 0, sizeof( dw_type_signature ) );
@@ -574,27 +796,202 @@ static bool _readLines( struct symbol *p )
             break;
         }
 
+        /* Walking the headers is cheap, it's the DIEs and line tables that cost, so only take our share of those */
+        if ( ( cuNumber++ % w->nworkers ) != w->index )
+        {
+            continue;
+        }
+
+        w->cu = ( struct symbol ** )realloc( w->cu, sizeof( struct symbol * ) * ( w->ncu + 1 ) );
+        MEMCHECK( w->cu, NULL );
+        w->cu[w->ncu] = ( struct symbol * )calloc( 1, sizeof( struct symbol ) );
+        MEMCHECK( w->cu[w->ncu], NULL );
+
         dwarf_siblingof_b( dbg, NULL, IS_INFO, &cu_die, 0 );
+        _processCU( w->cu[w->ncu++], dbg, cu_die );
+        dwarf_dealloc( dbg, cu_die, DW_DLA_DIE );
+    }
 
-        dwarf_diename( cu_die, &name, 0 );
-        dwarf_die_text( cu_die, DW_AT_producer, &producer, 0 );
-        dwarf_die_text( cu_die, DW_AT_comp_dir, &compdir, 0 );
+    w->totalcu = cuNumber;
+    w->ok = true;
 
-        /* Need to construct the fully qualified filename from the directory + filename */
-        char *s = _joinPaths( compdir, name );
-        filenameN  = _findOrAddString( s, &p->stringTable[PT_FILENAME],  &p->tableLen[PT_FILENAME] );
-        free( s );
-        producerN =  _findOrAddString( producer, &p->stringTable[PT_PRODUCER],  &p->tableLen[PT_PRODUCER] );
+    dwarf_finish( dbg );
+    close( w->fd );
+    return NULL;
+}
 
-        /* Kickoff the process for the DIE and its children to get the functions in this cu */
+// ====================================================================================================
 
-        dwarf_lowpc( cu_die, &cu_low_addr, 0 );
-        _processDie( p, dbg, cu_die, 0, filenameN, producerN, cu_low_addr );
+static unsigned int _mapString( struct symbol *p, enum symbolTables pt, struct stringIndex **h, const char *s )
 
-        /* ...and the source lines */
-        _getSourceLines( p, dbg, cu_die );
+/* Find index of string in the global table via its hash, adding it if it isn't there */
 
-        dwarf_dealloc( dbg, cu_die, DW_DLA_DIE );
+{
+    struct stringIndex *e;
+    size_t len = strlen( s );
+
+    HASH_FIND( hh, *h, s, len, e );
+
+    if ( !e )
+    {
+        p->stringTable[pt] = ( char ** )realloc( p->stringTable[pt], sizeof( char * ) * ( p->tableLen[pt] + 1 ) );
+        MEMCHECK( p->stringTable[pt], 0 );
+        p->stringTable[pt][p->tableLen[pt]] = strdup( s );
+
+        e = ( struct stringIndex * )calloc( 1, sizeof( struct stringIndex ) );
+        MEMCHECK( e, 0 );
+        e->index = p->tableLen[pt]++;
+        HASH_ADD_KEYPTR( hh, *h, p->stringTable[pt][e->index], len, e );
+    }
+
+    return e->index;
+}
+
+// ====================================================================================================
+
+static void _mergeCU( struct symbol *p, struct symbol *cu, struct stringIndex **h )
+
+/* Move the functions and lines collected for a compilation unit into the main symbol set, then dispose of the remains */
+
+{
+    unsigned int *map[PT_NUMTABLES];
+
+    /* Work out where each of the CU's strings end up in the main tables */
+    for ( enum symbolTables pt = 0; pt < PT_NUMTABLES; pt++ )
+    {
+        map[pt] = ( unsigned int * )malloc( sizeof( unsigned int ) * ( cu->tableLen[pt] + 1 ) );
+        MEMCHECKV( map[pt] );
+
+        for ( unsigned int i = 0; i < cu->tableLen[pt]; i++ )
+        {
+            map[pt][i] = _mapString( p, pt, &h[pt], cu->stringTable[pt][i] );
+            free( cu->stringTable[pt][i] );
+        }
+
+        free( cu->stringTable[pt] );
+    }
+
+    if ( cu->nfunc )
+    {
+        p->func = ( struct symbolFunctionStore ** )realloc( p->func, sizeof( struct symbolFunctionStore * ) * ( p->nfunc + cu->nfunc ) );
+        MEMCHECKV( p->func );
+
+        for ( unsigned int i = 0; i < cu->nfunc; i++ )
+        {
+            cu->func[i]->filename = map[PT_FILENAME][cu->func[i]->filename];
+            cu->func[i]->producer = map[PT_PRODUCER][cu->func[i]->producer];
+            p->func[p->nfunc++] = cu->func[i];
+        }
+    }
+
+    if ( cu->nlines )
+    {
+        p->line = ( struct symbolLineStore ** )realloc( p->line, sizeof( struct symbolLineStore * ) * ( p->nlines + cu->nlines ) );
+        MEMCHECKV( p->line );
+
+        for ( unsigned int i = 0; i < cu->nlines; i++ )
+        {
+            cu->line[i]->filename = map[PT_FILENAME][cu->line[i]->filename];
+            p->line[p->nlines++] = cu->line[i];
+        }
+    }
+
+    for ( enum symbolTables pt = 0; pt < PT_NUMTABLES; pt++ )
+    {
+        free( map[pt] );
+    }
+
+    free( cu->func );
+    free( cu->line );
+    free( cu );
+}
+
+// ====================================================================================================
+
+static bool _readLines( struct symbol *p, const char *filename )
+{
+    bool retval = false;
+    bool failed = false;
+    unsigned int nworkers = _workerCount();
+    struct cuWorker *w = ( struct cuWorker * )calloc( nworkers, sizeof( struct cuWorker ) );
+    struct stringIndex *h[PT_NUMTABLES] = { NULL };
+    struct stringIndex *e;
+    struct stringIndex *tmp;
+
+    MEMCHECK( w, false );
+
+    /* Add an empty string to each string table, so the 0th element is the empty string in all cases */
+    for ( enum symbolTables pt = 0; pt < PT_NUMTABLES; pt++ )
+    {
+        _mapString( p, pt, &h[pt], "" );
+    }
+
+    /* 1: Collect the functions and lines, with the compilation units shared between the workers */
+    /* ------------------------------------------------------------------------------------------ */
+    for ( unsigned int i = 0; i < nworkers; i++ )
+    {
+        w[i].filename = filename;
+        w[i].index    = i;
+        w[i].nworkers = nworkers;
+
+        if ( pthread_create( &w[i].thread, NULL, _cuWorker, &w[i] ) )
+        {
+            genericsExit( -1, "Failed to create DWARF worker" EOL );
+        }
+    }
+
+    for ( unsigned int i = 0; i < nworkers; i++ )
+    {
+        pthread_join( w[i].thread, NULL );
+    }
+
+    /* Merge the results back in CU order, so the tables come out the same however many workers there were */
+    if ( w[0].ok )
+    {
+        for ( unsigned int c = 0; c < w[0].totalcu; c++ )
+        {
+            struct cuWorker *cw = &w[c % nworkers];
+            unsigned int n = c / nworkers;
+
+            if ( ( cw->ok ) && ( n < cw->ncu ) )
+            {
+                _mergeCU( p, cw->cu[n], h );
+                cw->cu[n] = NULL;
+            }
+        }
+    }
+
+    /* Anything left over is from a failed run. There's no sensible way to use a partial set, but merging */
+    /* what there is means it gets disposed of along with everything else.                                 */
+    for ( unsigned int i = 0; i < nworkers; i++ )
+    {
+        failed |= !w[i].ok;
+
+        for ( unsigned int n = 0; n < w[i].ncu; n++ )
+        {
+            if ( w[i].cu[n] )
+            {
+                _mergeCU( p, w[i].cu[n], h );
+            }
+        }
+
+        free( w[i].cu );
+    }
+
+    free( w );
+
+    for ( enum symbolTables pt = 0; pt < PT_NUMTABLES; pt++ )
+    {
+        HASH_ITER( hh, h[pt], e, tmp )
+        {
+            HASH_DEL( h[pt], e );
+            free( e );
+        }
+    }
+
+    if ( failed )
+    {
+        return false;
     }
 
     if ( p->nlines && p->nfunc )
@@ -602,8 +999,8 @@ static bool _readLines( struct symbol *p )
         /* 2: We have the lines and functions. Clean them up and interlink them so they're useful to applications */
         /* ------------------------------------------------------------------------------------------------------ */
         /* Sort tables into address order, just in case they're not ... no gaurantees from the DWARF */
-        qsort( p->line, p->nlines, sizeof( struct symbolLineStore * ), _compareLineMem );
-        qsort( p->func, p->nfunc, sizeof( struct symbolFunctionStore * ), _compareFunc );
+        _parallelSort( ( void ** )p->line, p->nlines, _compareLineMem, nworkers );
+        _parallelSort( ( void ** )p->func, p->nfunc, _compareFunc, nworkers );
 
         /* Combine addresses in the lines table which have the same memory location...those aren't too useful for us      */
         int nlines = 0;
@@ -689,50 +1086,263 @@ static bool _readLines( struct symbol *p )
         }
     }
 
-    dwarf_finish( dbg );
-
     return retval;
 }
 
 // ====================================================================================================
 
-static bool _loadSource( struct symbol *p )
+static void _releaseSource( struct symbol *p, unsigned int fileNumber )
+
+{
+    struct symbolSourcecodeStore *store = p->source[fileNumber];
+
+    if ( store )
+    {
+        if ( store->text )
+        {
+            releasesourcefile( store->text, store->textlen, store->ismapped );
+            p->sourceBytes -= store->textlen;
+        }
+
+        free( store->linetext );
+        free( store );
+        p->source[fileNumber] = NULL;
+    }
+}
+
+// ====================================================================================================
+
+static void _evictSource( struct symbol *p, unsigned int keep )
+
+/* Release least recently used source files until we're back inside the limit */
 
 {
-    char *r;
-    size_t l;
+    while ( p->sourceLimit && ( p->sourceBytes > p->sourceLimit ) )
+    {
+        unsigned int oldest = keep;
 
-    /* We need to aqquire source code for all of the files that we have an entry in the stringtable, so let's start by making room */
-    p->source = ( struct symbolSourcecodeStore ** )calloc( 1, sizeof( struct symbolSourcecodeStore * )*p->tableLen[PT_FILENAME] );
+        for ( unsigned int i = 0; i < p->tableLen[PT_FILENAME]; i++ )
+        {
+            if ( ( i != keep ) && ( p->source[i] ) && ( p->source[i]->text ) &&
+                    ( ( oldest == keep ) || ( p->source[i]->lastuse < p->source[oldest]->lastuse ) ) )
+            {
+                oldest = i;
+            }
+        }
 
-    for ( int i = 0; i < p->tableLen[PT_FILENAME]; i++ )
+        if ( oldest == keep )
+        {
+            /* Nothing left to evict but the file we're using */
+            break;
+        }
+
+        _releaseSource( p, oldest );
+    }
+}
+
+// ====================================================================================================
+
+static struct symbolSourcecodeStore *_loadSource( struct symbol *p, unsigned int fileNumber )
+
+/* Collect source code for specified file, the first time it's asked for */
+
+{
+    struct symbolSourcecodeStore *store = p->source[fileNumber];
+
+    if ( store )
     {
-        r = readsourcefile( p->stringTable[PT_FILENAME][i], &l );
+        store->lastuse = ++p->sourceStamp;
+        return store;
+    }
 
-        /* Create an entry for this file. It will remain zero (NULL) if there are no lines in it, because r was NULL */
-        struct symbolSourcecodeStore *store = p->source[i] = ( struct symbolSourcecodeStore * )calloc( 1, sizeof( struct symbolSourcecodeStore ) );
+    /* Create an entry for this file. It will have no lines in it if the file couldn't be read */
+    store = p->source[fileNumber] = ( struct symbolSourcecodeStore * )calloc( 1, sizeof( struct symbolSourcecodeStore ) );
+    MEMCHECK( store, NULL );
+    store->lastuse = ++p->sourceStamp;
+    store->text = readsourcefile( p->stringTable[PT_FILENAME][fileNumber], &store->textlen, &store->ismapped );
 
-        /* Lines in sio.c are demarked by \n, \r or \0 ... so we just need to find the indicies to one after each of those */
-        while ( l )
+    if ( !store->text )
+    {
+        return store;
+    }
+
+    p->sourceBytes += store->textlen;
+
+    /* Lines are demarked by \n, with the last one possibly ending at the terminating 0 instead. The text  */
+    /* is left untouched (it may be mapped read-only), so we only need the indicies to the start of each. */
+    const char *c = store->text;
+    const char *e = store->text + store->textlen;
+    unsigned int nlines = 0;
+
+    /* First pass to count them, so the index can be allocated in one go */
+    while ( ( c < e ) && ( *c ) )
+    {
+        nlines++;
+
+        if ( !( c = memchr( c, '\n', e - c ) ) )
+        {
+            break;
+        }
+
+        c++;
+    }
+
+    if ( nlines )
+    {
+        store->linetext = ( const char ** )malloc( sizeof( char * ) * nlines );
+        MEMCHECK( store->linetext, NULL );
+    }
+
+    /* ...and second pass to fill the index */
+    c = store->text;
+
+    while ( store->nlines < nlines )
+    {
+        store->linetext[store->nlines++] = c;
+
+        if ( ( c = memchr( c, '\n', e - c ) ) )
         {
-            /* Add this line to the storage. */
-            store->linetext = ( char ** )realloc( store->linetext, sizeof( char * ) * ( store->nlines + 1 ) );
-            store->linetext[store->nlines++] = r;
+            c++;
+        }
+    }
+
+    _evictSource( p, fileNumber );
+    return store;
+}
+
+static void _decodeInstruction( struct symbol *p, struct symbolInstruction *e, symbolMemptr m, symbolMemaddr addr )
+
+/* Disassemble and classify the instruction at addr, recording the results in e */
+
+{
+    cs_insn *insn;
+    size_t count;
+    char op[DISASSEMBLY_LEN];
 
-            /* Spin forwards for next newline or eof */
-            while ( ( --l > 0 ) && ( *r++ != '\n' ) ) {};
+    e->ic = LE_IC_NONE;
+    e->target = NO_ADDRESS;
+    e->isdecoded = true;
 
-            if ( l )
+    count = cs_disasm( p->caphandle, m, 4, addr, 0, &insn );
+
+    if ( count > 0 )
+    {
+        /* Characterise the instruction using rules from F1.3 of ARM IHI0064H.a */
+
+        /* Check instruction size */
+        e->ic |= ( insn->size == 4 ) ? LE_IC_4BYTE : 0;
+
+        /* Was it a subroutine call? */
+        e->ic |= ( ( insn->id == ARM_INS_BL ) || ( insn->id == ARM_INS_BLX ) ) ? LE_IC_JUMP | LE_IC_CALL : 0;
+
+        /* Was it a regular call? */
+        e->ic |= ( ( insn->id == ARM_INS_B )    || ( insn->id == ARM_INS_BX )  || ( insn->id == ARM_INS_ISB ) ||
+                   ( insn->id == ARM_INS_WFI )  || ( insn->id == ARM_INS_WFE ) || ( insn->id == ARM_INS_TBB ) ||
+                   ( insn->id == ARM_INS_TBH )  || ( insn->id == ARM_INS_BXJ ) || ( insn->id == ARM_INS_CBZ ) ||
+                   ( insn->id == ARM_INS_CBNZ ) || ( insn->id == ARM_INS_WFI ) || ( insn->id == ARM_INS_WFE )
+                 ) ? LE_IC_JUMP : 0;
+
+        e->ic |=  (
+                              ( ( ( insn->id == ARM_INS_SUB ) || ( insn->id == ARM_INS_MOV ) ||
+                                  ( insn->id == ARM_INS_LDM ) || ( insn->id == ARM_INS_POP ) )
+                                && strstr( insn->op_str, "pc" ) )
+                  ) ? LE_IC_JUMP : 0;
+
+        /* Check if load in pc...that's only the case if pc is the first operand */
+        const char *pc = strstr( insn->op_str, "pc" );
+        e->ic |= ( ( insn->id == ARM_INS_LDR ) && ( pc ) && ( pc - insn->op_str < strcspn( insn->op_str, "," ) ) ) ? LE_IC_JUMP : 0;
+
+        /* Was it an exception return? */
+        e->ic |=  ( ( insn->id == ARM_INS_ERET ) ) ? LE_IC_JUMP | LE_IC_IRET : 0;
+
+        /* Add text describing instruction */
+        if ( e->ic & LE_IC_4BYTE )
+        {
+            snprintf( op, DISASSEMBLY_LEN, "%8"PRIx64":   %02x%02x %02x%02x   %s %s", insn->address, insn->bytes[1], insn->bytes[0], insn->bytes[3], insn->bytes[2], insn->mnemonic, insn->op_str );
+        }
+        else
+        {
+            snprintf( op, DISASSEMBLY_LEN, "%8"PRIx64":   %02x%02x        %s  %s", insn->address, insn->bytes[1], insn->bytes[0], insn->mnemonic, insn->op_str  );
+        }
+
+        /* Check to see if operands are immediate */
+        cs_detail *detail = insn->detail;
+
+        for ( int n = 0; n < detail->arm.op_count; n++ )
+        {
+            if ( detail->arm.operands[n].type == ARM_OP_IMM )
             {
-                *r++ = 0;
-                l--;
+                e->ic |= LE_IC_IMMEDIATE;
+                e->target = detail->arm.operands[n].imm;
+                break;
             }
         }
     }
+    else
+    {
+        snprintf( op, DISASSEMBLY_LEN, "No disassembly" );
+    }
 
-    return true;
+    cs_free( insn, count );
+    e->text = strdup( op );
+    MEMCHECKV( e->text );
 }
 
+// ====================================================================================================
+
+static struct symbolInstruction *_instructionAt( struct symbol *p, symbolMemaddr addr )
+
+/* Find predecoded instruction for address, decoding it if this is the first time it's been touched */
+
+{
+    if ( !p->caphandle )
+    {
+        /* Disassembler isn't initialised yet */
+        if ( cs_open( CS_ARCH_ARM, CS_MODE_THUMB + CS_MODE_LITTLE_ENDIAN + CS_MODE_MCLASS, &p->caphandle ) != CS_ERR_OK )
+        {
+            return NULL;
+        }
+
+        cs_option( p->caphandle, CS_OPT_DETAIL, CS_OPT_ON );
+    }
+
+    symbolMemptr m = symbolCodeAt( p, addr, NULL );
+
+    if ( !m )
+    {
+        /* If we don't have memory then we can't decode */
+        return NULL;
+    }
+
+    /* symbolCodeAt leaves the region that was found in the search cache */
+    struct symbolMemoryStore *s = &p->mem[p->cachedSearchIndex];
+    unsigned int slot = ( addr - s->start ) / 2;
+
+    if ( !s->insn )
+    {
+        s->insn = ( struct symbolInstruction ** )calloc( ( s->len / 2 + INSN_PAGE_SIZE - 1 ) / INSN_PAGE_SIZE, sizeof( struct symbolInstruction * ) );
+        MEMCHECK( s->insn, NULL );
+    }
+
+    struct symbolInstruction **page = &s->insn[slot / INSN_PAGE_SIZE];
+
+    if ( !*page )
+    {
+        *page = ( struct symbolInstruction * )calloc( INSN_PAGE_SIZE, sizeof( struct symbolInstruction ) );
+        MEMCHECK( *page, NULL );
+    }
+
+    struct symbolInstruction *e = &( *page )[slot % INSN_PAGE_SIZE];
+
+    if ( !e->isdecoded )
+    {
+        _decodeInstruction( p, e, m, addr );
+    }
+
+    return e;
+}
+
+// ====================================================================================================
 // ====================================================================================================
 // ====================================================================================================
 // ====================================================================================================
@@ -747,16 +1357,28 @@ const char *symbolSource( struct symbol *p, unsigned int fileNumber, unsigned in
 
 {
     assert( p );
+    struct symbolSourcecodeStore *store;
 
-    if ( ( fileNumber < p->tableLen[PT_FILENAME] ) && p->source && ( lineNumber < p->source[fileNumber]->nlines ) )
+    if ( ( fileNumber < p->tableLen[PT_FILENAME] ) && p->source && ( store = _loadSource( p, fileNumber ) ) && ( lineNumber < store->nlines ) )
     {
-        return ( const char * )p->source[fileNumber]->linetext[lineNumber];
+        return store->linetext[lineNumber];
     }
     else
     {
         return NULL;
     }
 }
+
+// ====================================================================================================
+
+void symbolSetSourceLimit( struct symbol *p, size_t limit )
+
+/* Set limit on memory used for source text (0 for no limit) */
+
+{
+    assert( p );
+    p->sourceLimit = limit;
+}
 // ====================================================================================================
 
 struct symbolFunctionStore *symbolFunctionAt( struct symbol *p, symbolMemaddr addr )
@@ -897,14 +1519,14 @@ void symbolDelete( struct symbol *p )
         }
 
         /* Close the disassembler if it's in use */
-        if ( !p->caphandle )
+        if ( p->caphandle )
         {
             cs_close( &p->caphandle );
         }
 
         if ( p->nsect_mem )
         {
-            for ( int i = p->nsect_mem - 1; i; i-- )
+            for ( int i = p->nsect_mem - 1; i >= 0; i-- )
             {
                 if ( p->mem[i].name )
                 {
@@ -915,6 +1537,25 @@ void symbolDelete( struct symbol *p )
                         free( p->mem[i].data );
                     }
                 }
+
+                /* ...and any instructions that were decoded from it */
+                if ( p->mem[i].insn )
+                {
+                    for ( int pg = 0; pg < ( p->mem[i].len / 2 + INSN_PAGE_SIZE - 1 ) / INSN_PAGE_SIZE; pg++ )
+                    {
+                        if ( p->mem[i].insn[pg] )
+                        {
+                            for ( int n = 0; n < INSN_PAGE_SIZE; n++ )
+                            {
+                                free( p->mem[i].insn[pg][n].text );
+                            }
+
+                            free( p->mem[i].insn[pg] );
+                        }
+                    }
+
+                    free( p->mem[i].insn );
+                }
             }
 
             free( p->mem );
@@ -945,6 +1586,17 @@ void symbolDelete( struct symbol *p )
             free( f );
         }
 
+        /* Remove any source code we might be holding...this needs the filename table to still be populated */
+        if ( p->source )
+        {
+            for ( int i = 0; i < p->tableLen[PT_FILENAME]; i++ )
+            {
+                _releaseSource( p, i );
+            }
+
+            free( p->source );
+        }
+
         /* Flush the string tables */
         for ( enum symbolTables pt = 0; pt < PT_NUMTABLES; pt++ )
         {
@@ -965,16 +1617,6 @@ void symbolDelete( struct symbol *p )
             free( p->line );
         }
 
-        /* Remove any source code we might be holding */
-        for ( int i = 0; i < p->tableLen[PT_FILENAME]; i++ )
-        {
-            /* Text is all allocated in one block by readsource, so just deleting the firt element is enough */
-            free( p->source[i]->linetext[0] );
-
-            /* ...and the block of pointers to lines in that text */
-            free( p->source[i] );
-        }
-
         free( p );
     }
 
@@ -983,127 +1625,26 @@ void symbolDelete( struct symbol *p )
 
 // ====================================================================================================
 
-char *symbolDisassembleLine( struct symbol *p, enum instructionClass *ic, symbolMemaddr addr, symbolMemaddr *newaddr )
+const char *symbolDisassembleLine( struct symbol *p, enum instructionClass *ic, symbolMemaddr addr, symbolMemaddr *newaddr )
 
 /* Return assembly code representing this line */
 
 {
-    cs_insn *insn;
-    size_t count;
-    static char op[255];
+    struct symbolInstruction *e = _instructionAt( p, addr );
 
     if ( newaddr )
     {
-        *newaddr = NO_ADDRESS;
-    }
-
-    *ic = 0;
-
-    if ( !p->caphandle )
-    {
-        /* Disassembler isn't initialised yet */
-        if ( cs_open( CS_ARCH_ARM, CS_MODE_THUMB + CS_MODE_LITTLE_ENDIAN + CS_MODE_MCLASS, &p->caphandle ) != CS_ERR_OK )
-        {
-            return NULL;
-        }
-
-        cs_option( p->caphandle, CS_OPT_DETAIL, CS_OPT_ON );
+        *newaddr = ( e && ( e->ic & LE_IC_IMMEDIATE ) ) ? e->target : NO_ADDRESS;
     }
 
-    symbolMemptr m = symbolCodeAt( p, addr, NULL );
-
-    if ( !m )
+    if ( !e )
     {
-        /* If we don't have memory then we can't decode */
+        *ic = LE_IC_NONE;
         return NULL;
     }
 
-    count = cs_disasm( p->caphandle, m, 4, addr, 0, &insn );
-    *ic = LE_IC_NONE;
-
-
-    if ( count > 0 )
-    {
-        /* Characterise the instruction using rules from F1.3 of ARM IHI0064H.a */
-
-        /* Check instruction size */
-        *ic |= ( insn->size == 4 ) ? LE_IC_4BYTE : 0;
-
-        /* Was it a subroutine call? */
-        *ic |= ( ( insn->id == ARM_INS_BL ) || ( insn->id == ARM_INS_BLX ) ) ? LE_IC_JUMP | LE_IC_CALL : 0;
-
-        /* Was it a regular call? */
-        *ic |= ( ( insn->id == ARM_INS_B )    || ( insn->id == ARM_INS_BX )  || ( insn->id == ARM_INS_ISB ) ||
-                 ( insn->id == ARM_INS_WFI )  || ( insn->id == ARM_INS_WFE ) || ( insn->id == ARM_INS_TBB ) ||
-                 ( insn->id == ARM_INS_TBH )  || ( insn->id == ARM_INS_BXJ ) || ( insn->id == ARM_INS_CBZ ) ||
-                 ( insn->id == ARM_INS_CBNZ ) || ( insn->id == ARM_INS_WFI ) || ( insn->id == ARM_INS_WFE )
-               ) ? LE_IC_JUMP : 0;
-
-        *ic |=  (
-                            ( ( ( insn->id == ARM_INS_SUB ) || ( insn->id == ARM_INS_MOV ) ||
-                                ( insn->id == ARM_INS_LDM ) || ( insn->id == ARM_INS_POP ) )
-                              && strstr( insn->op_str, "pc" ) )
-                ) ? LE_IC_JUMP : 0;
-
-        /* create a copy to check if load in pc */
-        char *copy = strdup( insn->op_str );
-        *ic |=  (
-                            ( ( ( insn->id == ARM_INS_LDR ) )
-                              && strstr( strtok( copy, "," ), "pc" ) )
-                ) ? LE_IC_JUMP : 0;
-        free( copy );
-
-        /* Was it an exception return? */
-        *ic |=  ( ( insn->id == ARM_INS_ERET ) ) ? LE_IC_JUMP | LE_IC_IRET : 0;
-
-
-        /* Add text describing instruction */
-        if ( *ic & LE_IC_4BYTE )
-        {
-            sprintf( op, "%8"PRIx64":   %02x%02x %02x%02x   %s %s", insn->address, insn->bytes[1], insn->bytes[0], insn->bytes[3], insn->bytes[2], insn->mnemonic, insn->op_str );
-        }
-        else
-        {
-            sprintf( op, "%8"PRIx64":   %02x%02x        %s  %s", insn->address, insn->bytes[1], insn->bytes[0], insn->mnemonic, insn->op_str  );
-        }
-
-        /* Check to see if operands are immediate */
-        cs_detail *detail = insn->detail;
-
-        if ( detail->arm.op_count )
-        {
-
-            for ( int n = 0; n <  insn->detail->arm.op_count; n++ )
-            {
-                if ( insn->detail->arm.operands[n].type == ARM_OP_IMM )
-                {
-                    *ic |= LE_IC_IMMEDIATE;
-
-                    if ( newaddr )
-                    {
-                        *newaddr = detail->arm.operands[n].imm;
-                    }
-
-                    break;
-                }
-            }
-        }
-
-
-        /* Add classifications ( for debug ) */
-        //if ( *ic )
-        //            {
-        //                fsprintf ( stderr, &op[strlen( op )], " ; %s%s%s%s",  *ic & LE_IC_JUMP ? "JUMP " : "", *ic & LE_IC_CALL ? "CALL " : "", *ic & LE_IC_IMMEDIATE ? "IMM " : "", *ic & LE_IC_IRET ? "IRET " : "" );
-        //            }
-    }
-    else
-    {
-        sprintf( op, "No disassembly" );
-    }
-
-    cs_free( insn, count );
-
-    return op;
+    *ic = e->ic;
+    return e->text;
 }
 
 // ====================================================================================================
@@ -1143,13 +1684,7 @@ struct symbol *symbolAcquire( char *filename, bool loadmem, bool loadsource )
 {
     struct symbol *p = ( struct symbol * )calloc( 1, sizeof( struct symbol ) );
 
-    /* O_BINARY Only needed on platforms that differentiate between binary and text files */
-#ifndef O_BINARY
-
-    if ( ( p->fd = open( filename, O_RDONLY, 0 ) ) < 0 )
-#else
-    if ( ( p->fd = open( filename, O_RDONLY | O_BINARY, 0 ) ) < 0 )
-#endif
+    if ( ( p->fd = _openElf( filename ) ) < 0 )
     {
         free( p );
         return NULL;
@@ -1163,17 +1698,22 @@ struct symbol *symbolAcquire( char *filename, bool loadmem, bool loadsource )
     }
 
     /* Load the functions and source code line mappings if requested */
-    if ( !_readLines( p ) )
+    if ( !_readLines( p, filename ) )
     {
         symbolDelete( p );
         return NULL;
     }
 
-    /* ...finally, the source code if requested. This can only be done if mem or functions we requested */
-    if ( ( loadsource && loadmem )  && !_loadSource( p ) )
+    /* ...finally, make room for the source code if requested. Individual files are only read when they're first used */
+    if ( loadsource && loadmem )
     {
-        symbolDelete( p );
-        return NULL;
+        p->source = ( struct symbolSourcecodeStore ** )calloc( p->tableLen[PT_FILENAME], sizeof( struct symbolSourcecodeStore * ) );
+
+        if ( !p->source )
+        {
+            symbolDelete( p );
+            return NULL;
+        }
     }
 
     return p;
@@ -1245,7 +1785,7 @@ bool _listFile( struct symbol *p, int fileNo )
 
     while ( t = symbolSource( p, fileNo, i++ ) )
     {
-        fprintf( stderr, "%s", t );
+        fprintf( stderr, "%.*s" EOL, ( int )strcspn( t, "\n\r" ), t );
     }
 }
 
@@ -1261,7 +1801,7 @@ bool _disassemble( struct symbol *p, symbolMemaddr a, unsigned int len )
 
     for ( addr = a; addr < a + len; addr += ic & LE_IC_4BYTE ? 4 : 2 )
     {
-        char *u = symbolDisassembleLine( p, &ic, addr, &newaddr );
+        const char *u = symbolDisassembleLine( p, &ic, addr, &newaddr );
         fprintf( stderr, "%s\n", u );
     }
 
@@ -1287,7 +1827,8 @@ void main( int argc, char *argv[] )
     {
         s = symbolLineIndex( p, i );
 
-        fprintf( stderr, "\n%08x ... %08x %s %s", ( uint32_t )s->lowaddr, ( uint32_t )s->highaddr, s->isinline ? "INLINE" : "", symbolSource( p, s->filename, s->startline - 1 ) );
+        const char *t = symbolSource( p, s->filename, s->startline - 1 );
+        fprintf( stderr, "\n%08x ... %08x %s %.*s", ( uint32_t )s->lowaddr, ( uint32_t )s->highaddr, s->isinline ? "INLINE" : "", t ? ( int )strcspn( t, "\n\r" ) : 0, t ? t : "" );
 
         if ( ( s->lowaddr > 0x08000000 ) && ( s->highaddr != -1 ) )
             for ( symbolMemaddr b = s->lowaddr; b < s->highaddr; )
@@ -0,0 +1,191 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+/*
+ * Output Buffer Module
+ * ====================
+ *
+ * Buffered output for text sinks, written out on newline, when full, or
+ * when a latency deadline expires.
+ */
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include "generics.h"
+#include "opbuffer.h"
+
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Internal routines
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+static void _emit( struct OPBuffer *b, const char *s, size_t len )
+
+/* Send data to the stream. Anything it won't take is counted and dropped, and the error cleared */
+/* so the stream carries on working once it will take data again.                              */
+
+{
+    size_t written = fwrite( s, 1, len, b->stream );
+
+    if ( written < len )
+    {
+        b->dropped += len - written;
+        clearerr( b->stream );
+    }
+}
+// ====================================================================================================
+static void _append( struct OPBuffer *b, const char *s, size_t len )
+
+/* Add literal text to the buffer, making room if needed */
+
+{
+    if ( b->used + len > b->size )
+    {
+        OPBufferFlush( b );
+
+        if ( len > b->size )
+        {
+            /* Too big to ever fit, so it goes straight out */
+            _emit( b, s, len );
+            fflush( b->stream );
+            return;
+        }
+    }
+
+    if ( ( !b->used ) && ( len ) )
+    {
+        /* First data into an empty buffer starts the clock */
+        b->deadlineuS = genericsTimestampuS() + b->latencyuS;
+    }
+
+    memcpy( &b->buffer[b->used], s, len );
+    b->used += len;
+}
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Publicly available routines
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+void OPBufferWrite( struct OPBuffer *b, const char *s, size_t len )
+
+/* Write text to the buffer, translating any screen codes in it */
+
+{
+    const char *e = s + len;
+    const char *a;
+    const char *seq;
+    bool newline = ( b->lineFlush ) && ( memchr( s, '\n', len ) );
+
+    assert( b );
+
+    while ( s < e )
+    {
+        /* Send everything up to the next screen code (if there is one) */
+        a = memchr( s, CMD_ALERT[0], e - s );
+        _append( b, s, ( a ? a : e ) - s );
+
+        if ( !a )
+        {
+            break;
+        }
+
+        /* A code that isn't recognised (or is missing) just loses its CMD_ALERT */
+        s = a + 1;
+
+        if ( ( s < e ) && ( ( seq = genericsColourSequence( *s ) ) ) )
+        {
+            _append( b, seq, strlen( seq ) );
+            s++;
+        }
+    }
+
+    if ( newline )
+    {
+        OPBufferFlush( b );
+    }
+}
+// ====================================================================================================
+void OPBufferPuts( struct OPBuffer *b, const char *s )
+
+{
+    OPBufferWrite( b, s, strlen( s ) );
+}
+// ====================================================================================================
+void OPBufferFlush( struct OPBuffer *b )
+
+/* Write out anything that's waiting */
+
+{
+    assert( b );
+
+    if ( b->used )
+    {
+        _emit( b, b->buffer, b->used );
+        b->used = 0;
+    }
+
+    fflush( b->stream );
+}
+// ====================================================================================================
+bool OPBufferPoll( struct OPBuffer *b )
+
+/* Write out the buffer if its deadline has passed, returning true if it was written */
+
+{
+    assert( b );
+
+    if ( ( b->used ) && ( genericsTimestampuS() >= b->deadlineuS ) )
+    {
+        OPBufferFlush( b );
+        return true;
+    }
+
+    return false;
+}
+// ====================================================================================================
+int64_t OPBufferTimeToDeadline( struct OPBuffer *b )
+
+/* Return uS until the buffer must be written, or -1 if there's nothing waiting */
+
+{
+    assert( b );
+
+    if ( !b->used )
+    {
+        return -1;
+    }
+
+    uint64_t now = genericsTimestampuS();
+    return ( now >= b->deadlineuS ) ? 0 : ( int64_t )( b->deadlineuS - now );
+}
+// ====================================================================================================
+void OPBufferInit( struct OPBuffer *b, FILE *stream, size_t size, uint32_t latencymS, bool lineFlush )
+
+{
+    assert( b );
+    assert( stream );
+
+    memset( b, 0, sizeof( struct OPBuffer ) );
+    b->stream     = stream;
+    b->size       = size ? size : OPBUFFER_DEFAULT_LEN;
+    b->latencyuS  = latencymS * 1000ULL;
+    b->lineFlush  = lineFlush;
+    b->buffer     = ( char * )malloc( b->size );
+    MEMCHECKV( b->buffer );
+}
+// ====================================================================================================
+void OPBufferDestroy( struct OPBuffer *b )
+
+{
+    assert( b );
+
+    OPBufferFlush( b );
+    free( b->buffer );
+    b->buffer = NULL;
+    b->size = 0;
+}
+// ====================================================================================================
@@ -17,6 +17,14 @@
 #include <getopt.h>
 #include <time.h>
 #include <signal.h>
+#include <errno.h>
+#include <fcntl.h>
+#if !defined WIN32
+    #include <sys/types.h>
+    #include <sys/stat.h>
+    #include <sys/socket.h>
+    #include <sys/un.h>
+#endif
 
 #include "nw.h"
 #include "git_version_info.h"
@@ -26,6 +34,8 @@
 #include "msgSeq.h"
 #include "stream.h"
 #include "oflow.h"
+#include "opbuffer.h"
+#include "swFormat.h"
 
 #define NUM_CHANNELS  32
 
@@ -33,8 +43,14 @@
 #define DEFAULT_TS_TRIGGER '\n'           /* Default trigger character for timestamp output */
 
 #define MSG_REORDER_BUFLEN  (10)          /* Maximum number of samples to re-order for timekeeping */
+#define DEFAULT_LATENCY_MS  (10)          /* Default maximum time output is held before it's written */
 #define ONE_SEC_IN_USEC     (1000000L)    /* Used for time conversions...usec in one sec */
 
+#define SINK_STDOUT         "-"           /* Sink spec for the (timestamped) standard output */
+#define SINK_FIFO_PREFIX    "fifo:"       /* Sink spec prefix for a named pipe */
+#define SINK_UNIX_PREFIX    "unix:"       /* Sink spec prefix for a unix domain socket */
+#define SINK_FILE_PREFIX    "file:"       /* Sink spec prefix for a file (optional) */
+
 /* Formats for timestamping */
 #define REL_FORMAT            C_TSTAMP "%6" PRIu64 ".%03" PRIu64 "|" C_RESET
 #define REL_FORMAT_INIT       C_TSTAMP " R-Initial|" C_RESET
@@ -53,6 +69,15 @@ enum TSType { TSNone, TSAbsolute, TSRelative, TSDelta, TSStamp, TSStampDelta, TS
 enum Prot { PROT_OFLOW, PROT_ITM, PROT_UNKNOWN };
 const char *protString[] = {"OFLOW", "ITM", NULL};
 
+/* A destination for channel output, other than the standard output */
+struct Sink
+{
+    char *spec;                              /* Where this sink goes, as specified */
+    FILE *stream;                            /* The open sink */
+    struct OPBuffer op;                      /* ...and output buffered for it */
+    bool dropWarned;                         /* A warning has been given that output to it is being dropped */
+};
+
 const char *tsTypeString[TSNumTypes] = { "None", "Absolute", "Relative", "Delta", "System Timestamp", "System Timestamp Delta" };
 
 // Record for options, either defaults or from command line
@@ -67,9 +92,11 @@ struct
     char *tsLineFormat;
     char tsTrigger;
     bool mono;                               /* Supress colour in output */
+    uint32_t latencymS;                      /* Maximum time output is held before it's written */
 
     /* Sink information */
     char *presFormat[NUM_CHANNELS + 1];      /* Format string for each channel */
+    char *sinkSpec[NUM_CHANNELS + 1];        /* Where each channel goes, if not the standard output */
 
     /* Source information */
     int port;                                /* What port to connect to on the server (default to orbuculum) */
@@ -85,7 +112,8 @@ struct
     .tag = 1,
     .port = OFCLIENT_SERVER_PORT,
     .server = "localhost",
-    .tsTrigger = DEFAULT_TS_TRIGGER
+    .tsTrigger = DEFAULT_TS_TRIGGER,
+    .latencymS = DEFAULT_LATENCY_MS
 };
 
 struct
@@ -95,6 +123,11 @@ struct
     struct MSGSeq    d;
     struct ITMPacket h;
     struct OFLOW c;
+    struct OPBuffer op;                  /* Buffered output to stdout */
+    struct SWFormat *swFormat[NUM_CHANNELS]; /* Compiled format for each channel */
+    struct Sink *sink[NUM_CHANNELS];     /* Sink for each channel, NULL for the standard output */
+    struct Sink *sinks;                  /* The distinct sinks that are open */
+    int numSinks;                        /* ...and how many of them there are */
 
     struct Frame cobsPart;               /* Any part frame that has been received */
     enum timeDelay timeStatus;           /* Indicator of if this time is exact */
@@ -247,7 +280,7 @@ static void _outputText( char *p )
         if ( !_r.inLine )
         {
             _printTimestamp( opConstruct );
-            genericsFPrintf( stdout, "%s", opConstruct );
+            OPBufferPuts( &_r.op, opConstruct );
             _r.inLine = true;
         }
 
@@ -257,21 +290,23 @@ static void _outputText( char *p )
         if ( q )
         {
             *q = 0;
-            genericsFPrintf( stdout, "%s" EOL, p );
+            OPBufferPuts( &_r.op, p );
+            OPBufferPuts( &_r.op, EOL );
             /* Once we've output these data then we're not in a line any more */
             _r.inLine = false;
 
             /* ...and if there were any DWT messages to print we'd better output those */
             if ( _r.dwtText[0] )
             {
-                genericsFPrintf( stdout, "%s" EOL, _r.dwtText );
+                OPBufferPuts( &_r.op, _r.dwtText );
+                OPBufferPuts( &_r.op, EOL );
                 _r.dwtText[0] = 0;
             }
         }
         else
         {
             /* Just output the whole of the data we've got, then we're done */
-            genericsFPrintf( stdout, "%s", p );
+            OPBufferPuts( &_r.op, p );
             break;
         }
 
@@ -297,7 +332,7 @@ void _expex( const char *fmt, ... )
     /* See if we exceeded max length...if so then output what we have and start a fresh buffer */
     if ( MAX_STRING_LENGTH - strlen( _r.dwtText ) < 100 )
     {
-        genericsFPrintf( stdout, "%s", _r.dwtText );
+        OPBufferPuts( &_r.op, _r.dwtText );
         _r.dwtText[0] = 0;
     }
 
@@ -311,7 +346,7 @@ void _expex( const char *fmt, ... )
 
     if ( !_r.inLine )
     {
-        genericsFPrintf( stdout, "%s", _r.dwtText );
+        OPBufferPuts( &_r.op, _r.dwtText );
         _r.dwtText[0] = 0;
     }
 }
@@ -427,37 +462,19 @@ static void _handleSW( struct swMsg *m, struct ITMDecoder *i )
     assert( m->msgtype == MSG_SOFTWARE );
     char opConstruct[MAX_STRING_LENGTH];
 
-    char *p = opConstruct;
-
     /* Make sure line is empty by default */
-    *p = 0;
+    *opConstruct = 0;
 
-    /* Print anything we want to output into the buffer */
-    if ( ( m->srcAddr < NUM_CHANNELS ) && ( options.presFormat[m->srcAddr] ) )
+    /* Render anything we want to output into the buffer */
+    if ( ( m->srcAddr < NUM_CHANNELS ) && ( _r.swFormat[m->srcAddr] ) )
     {
-        // formatted output....start with specials
-        if ( strstr( options.presFormat[m->srcAddr], "%f" ) )
-        {
-            /* type punning on same host, after correctly building 32bit val
-             * only unsafe on systems where u32/float have diff byte order */
-            float *nastycast = ( float * )&m->value;
-            p += snprintf( p, MAX_STRING_LENGTH - ( p - opConstruct ), options.presFormat[m->srcAddr], *nastycast, *nastycast, *nastycast, *nastycast );
-        }
-        else if ( strstr( options.presFormat[m->srcAddr], "%c" ) )
-        {
-            /* Format contains %c, so execute repeatedly for all characters in sent data */
-            uint8_t op[4] = {m->value & 0xff, ( m->value >> 8 ) & 0xff, ( m->value >> 16 ) & 0xff, ( m->value >> 24 ) & 0xff};
-            uint32_t l = 0;
+        size_t len = SWFormatRender( _r.swFormat[m->srcAddr], m->value, m->len, opConstruct, MAX_STRING_LENGTH );
 
-            do
-            {
-                p += snprintf( p, MAX_STRING_LENGTH - ( p - opConstruct ), options.presFormat[m->srcAddr], op[l], op[l], op[l] );
-            }
-            while ( ++l < m->len );
-        }
-        else
+        if ( _r.sink[m->srcAddr] )
         {
-            p += snprintf( p, MAX_STRING_LENGTH - ( p - opConstruct ), options.presFormat[m->srcAddr], m->value, m->value, m->value, m->value );
+            /* Channels with their own sink get exactly what was rendered, without timestamps */
+            OPBufferWrite( &_r.sink[m->srcAddr]->op, opConstruct, len );
+            return;
         }
     }
 
@@ -558,7 +575,10 @@ static void _printHelp( const char *const progName )
     genericsFPrintf( stderr, "    -f, --input-file:   <filename> Take input from specified file" EOL );
     genericsFPrintf( stderr, "    -g, --trigger:      <char> to use to trigger timestamp (default is newline)" EOL );
     genericsFPrintf( stderr, "    -h, --help:         This help" EOL );
+    genericsFPrintf( stderr, "    -L, --latency:      <ms> Longest time output is held before it's written (default %d ms)" EOL, DEFAULT_LATENCY_MS );
     genericsFPrintf( stderr, "    -n, --itm-sync:     Enforce sync requirement for ITM (i.e. ITM needs to issue syncs)" EOL );
+    genericsFPrintf( stderr, "    -o, --output:       <Number>,<Sink> to send channel to instead of stdout (repeat per channel)." EOL
+                     "                        Sink is <filename>, fifo:<path>, unix:<socket path> or - for stdout" EOL );
     genericsFPrintf( stderr, "    -p, --protocol:     Protocol to communicate. Defaults to OFLOW if -s is not set, otherwise ITM" EOL );
     genericsFPrintf( stderr, "    -s, --server:       <Server>:<Port> to use" EOL );
     genericsFPrintf( stderr, "    -t, --tag:          <stream>: Which orbflow tag to use (normally 1)" EOL );
@@ -583,8 +603,10 @@ static struct option _longOptions[] =
     {"eof", no_argument, NULL, 'E'},
     {"input-file", required_argument, NULL, 'f'},
     {"help", no_argument, NULL, 'h'},
+    {"latency", required_argument, NULL, 'L'},
     {"trigger", required_argument, NULL, 'g' },
     {"itm-sync", no_argument, NULL, 'n'},
+    {"output", required_argument, NULL, 'o'},
     {"no-colour", no_argument, NULL, 'M'},
     {"no-color", no_argument, NULL, 'M'},
     {"protocol", required_argument, NULL, 'p'},
@@ -609,7 +631,7 @@ bool _processOptions( int argc, char *argv[] )
 
 #define DELIMITER ','
 
-    while ( ( c = getopt_long ( argc, argv, "c:C:Ef:g:hVnMp:s:t:T:v:x", _longOptions, &optionIndex ) ) != -1 )
+    while ( ( c = getopt_long ( argc, argv, "c:C:Ef:g:hL:VnMo:p:s:t:T:v:x", _longOptions, &optionIndex ) ) != -1 )
         switch ( c )
         {
             // ------------------------------------
@@ -649,6 +671,11 @@ bool _processOptions( int argc, char *argv[] )
                 options.tsTrigger = genericsUnescape( optarg )[0];
                 break;
 
+            // ------------------------------------
+            case 'L':
+                options.latencymS = atoi( optarg );
+                break;
+
             // ------------------------------------
             case 'n':
                 options.forceITMSync = false;
@@ -659,6 +686,27 @@ bool _processOptions( int argc, char *argv[] )
                 options.mono = true;
                 break;
 
+            // ------------------------------------
+            case 'o':
+                chan = atoi( optarg );
+                chanIndex = strchr( optarg, DELIMITER );
+
+                if ( chan >= NUM_CHANNELS )
+                {
+                    genericsReport( V_ERROR, "Channel index out of range" EOL );
+                    return false;
+                }
+
+                if ( ( !chanIndex ) || ( !*( chanIndex + 1 ) ) )
+                {
+                    genericsReport( V_ERROR, "No sink for channel %d" EOL, chan );
+                    return false;
+                }
+
+                free( options.sinkSpec[chan] );
+                options.sinkSpec[chan] = strcmp( chanIndex + 1, SINK_STDOUT ) ? strdup( chanIndex + 1 ) : NULL;
+                break;
+
             // ------------------------------------
 
             case 'p':
@@ -854,6 +902,7 @@ bool _processOptions( int argc, char *argv[] )
     genericsReport( V_INFO, "ForceSync  : %s" EOL, options.forceITMSync ? "true" : "false" );
     genericsReport( V_INFO, "Timestamp  : %s" EOL, tsTypeString[options.tsType] );
     genericsReport( V_INFO, "Exceptions : %s" EOL, options.ex ? "On" : "Off" );
+    genericsReport( V_INFO, "Latency    : %d ms" EOL, options.latencymS );
 
     if ( options.cps )
     {
@@ -902,13 +951,206 @@ bool _processOptions( int argc, char *argv[] )
     {
         if ( options.presFormat[g] )
         {
-            genericsReport( V_INFO, "             %02d [%s]" EOL, g, genericsEscape( options.presFormat[g] ) );
+            genericsReport( V_INFO, "             %02d [%s] -> %s" EOL, g, genericsEscape( options.presFormat[g] ), options.sinkSpec[g] ? options.sinkSpec[g] : "stdout" );
         }
     }
 
     return true;
 }
 
+// ====================================================================================================
+static FILE *_openSinkStream( const char *spec )
+
+/* Open the stream for a sink spec, returning NULL if it can't be */
+
+{
+#if !defined WIN32
+    int fd;
+
+    if ( !strncmp( spec, SINK_FIFO_PREFIX, strlen( SINK_FIFO_PREFIX ) ) )
+    {
+        const char *path = spec + strlen( SINK_FIFO_PREFIX );
+
+        if ( ( mkfifo( path, 0666 ) < 0 ) && ( errno != EEXIST ) )
+        {
+            return NULL;
+        }
+
+        /* Opened read/write and non-blocking so that a fifo without a reader can't hold up the other channels. */
+        /* Output that doesn't fit is dropped and counted, so the stream is unbuffered to leave none behind in  */
+        /* stdio (the sink's own buffer collects the output anyway).                                            */
+        if ( ( fd = open( path, O_RDWR | O_NONBLOCK ) ) < 0 )
+        {
+            return NULL;
+        }
+
+        FILE *f = fdopen( fd, "w" );
+
+        if ( f )
+        {
+            setvbuf( f, NULL, _IONBF, 0 );
+        }
+
+        return f;
+    }
+
+    if ( !strncmp( spec, SINK_UNIX_PREFIX, strlen( SINK_UNIX_PREFIX ) ) )
+    {
+        struct sockaddr_un addr = { .sun_family = AF_UNIX };
+        const char *path = spec + strlen( SINK_UNIX_PREFIX );
+
+        if ( strlen( path ) >= sizeof( addr.sun_path ) )
+        {
+            return NULL;
+        }
+
+        strcpy( addr.sun_path, path );
+
+        if ( ( fd = socket( AF_UNIX, SOCK_STREAM, 0 ) ) < 0 )
+        {
+            return NULL;
+        }
+
+        if ( connect( fd, ( struct sockaddr * )&addr, sizeof( addr ) ) < 0 )
+        {
+            close( fd );
+            return NULL;
+        }
+
+        return fdopen( fd, "w" );
+    }
+
+#endif
+
+    if ( !strncmp( spec, SINK_FILE_PREFIX, strlen( SINK_FILE_PREFIX ) ) )
+    {
+        spec += strlen( SINK_FILE_PREFIX );
+    }
+
+    return fopen( spec, "w" );
+}
+// ====================================================================================================
+static void _openSinks( void )
+
+/* Open each distinct sink once, and point the channels that use it at it */
+
+{
+    _r.sinks = ( struct Sink * )calloc( NUM_CHANNELS, sizeof( struct Sink ) );
+    MEMCHECKV( _r.sinks );
+
+    for ( int g = 0; g < NUM_CHANNELS; g++ )
+    {
+        if ( !options.sinkSpec[g] )
+        {
+            continue;
+        }
+
+        if ( !options.presFormat[g] )
+        {
+            genericsReport( V_WARN, "Channel %d has a sink but no format, so nothing will be sent to it" EOL, g );
+            continue;
+        }
+
+        for ( int s = 0; s < _r.numSinks; s++ )
+        {
+            if ( !strcmp( _r.sinks[s].spec, options.sinkSpec[g] ) )
+            {
+                _r.sink[g] = &_r.sinks[s];
+                break;
+            }
+        }
+
+        if ( !_r.sink[g] )
+        {
+            struct Sink *k = &_r.sinks[_r.numSinks];
+
+            if ( !( k->stream = _openSinkStream( options.sinkSpec[g] ) ) )
+            {
+                genericsExit( -1, "Cannot open sink %s for channel %d (%s)" EOL, options.sinkSpec[g], g, strerror( errno ) );
+            }
+
+            k->spec = options.sinkSpec[g];
+            OPBufferInit( &k->op, k->stream, OPBUFFER_DEFAULT_LEN, options.latencymS, false );
+            _r.sink[g] = k;
+            _r.numSinks++;
+        }
+    }
+}
+// ====================================================================================================
+static void _closeSinks( void )
+
+{
+    for ( int s = 0; s < _r.numSinks; s++ )
+    {
+        OPBufferDestroy( &_r.sinks[s].op );
+        fclose( _r.sinks[s].stream );
+
+        if ( _r.sinks[s].op.dropped )
+        {
+            genericsReport( V_WARN, "Sink %s dropped %" PRIu64 " bytes" EOL, _r.sinks[s].spec, _r.sinks[s].op.dropped );
+        }
+    }
+
+    free( _r.sinks );
+    _r.sinks = NULL;
+    _r.numSinks = 0;
+}
+// ====================================================================================================
+static void _checkDrops( struct Sink *k )
+
+/* Warn the first time output to a sink is dropped. The total is reported when it's closed */
+
+{
+    if ( ( k->op.dropped ) && ( !k->dropWarned ) )
+    {
+        genericsReport( V_WARN, "Sink %s isn't keeping up (or has no reader), output to it is being dropped" EOL, k->spec );
+        k->dropWarned = true;
+    }
+}
+// ====================================================================================================
+static int64_t _timeToDeadline( void )
+
+/* Return uS until some output must be written, or -1 if there's nothing waiting */
+
+{
+    int64_t deadline = OPBufferTimeToDeadline( &_r.op );
+
+    for ( int s = 0; s < _r.numSinks; s++ )
+    {
+        int64_t d = OPBufferTimeToDeadline( &_r.sinks[s].op );
+
+        if ( ( d >= 0 ) && ( ( deadline < 0 ) || ( d < deadline ) ) )
+        {
+            deadline = d;
+        }
+    }
+
+    return deadline;
+}
+// ====================================================================================================
+static void _pollOutput( void )
+
+{
+    OPBufferPoll( &_r.op );
+
+    for ( int s = 0; s < _r.numSinks; s++ )
+    {
+        OPBufferPoll( &_r.sinks[s].op );
+        _checkDrops( &_r.sinks[s] );
+    }
+}
+// ====================================================================================================
+static void _flushOutput( void )
+
+{
+    OPBufferFlush( &_r.op );
+
+    for ( int s = 0; s < _r.numSinks; s++ )
+    {
+        OPBufferFlush( &_r.sinks[s].op );
+        _checkDrops( &_r.sinks[s] );
+    }
+}
 // ====================================================================================================
 static struct Stream *_tryOpenStream( void )
 {
@@ -953,14 +1195,17 @@ static void _feedStream( struct Stream *stream )
     {
         size_t receivedSize;
 
+        /* Don't wait for data beyond the point that pending output must be written */
+        int64_t deadline = _timeToDeadline();
         t.tv_sec = 0;
-        t.tv_usec = 100000;
+        t.tv_usec = ( ( deadline >= 0 ) && ( deadline < 100000 ) ) ? deadline : 100000;
         enum ReceiveResult result = stream->receive( stream, cbw, TRANSFER_SIZE, &t, &receivedSize );
 
         if ( result != RECEIVE_RESULT_OK )
         {
             if ( result == RECEIVE_RESULT_EOF && options.endTerminate )
             {
+                _flushOutput();
                 return;
             }
             else if ( result == RECEIVE_RESULT_ERROR )
@@ -990,14 +1235,17 @@ static void _feedStream( struct Stream *stream )
             /* Check if an exception report timed out */
             if ( ( _r.inLine ) && _r.dwtText[0] && ( _timestamp() - _r.dwtte > DWT_TO_US ) )
             {
+                OPBufferFlush( &_r.op );
                 genericsFPrintf( stderr, EOL "%s", _r.dwtText );
                 _r.dwtText[0] = 0;
                 _r.inLine = false;
             }
-
-            fflush( stdout );
         }
+
+        _pollOutput();
     }
+
+    _flushOutput();
 }
 
 // ====================================================================================================
@@ -1020,6 +1268,29 @@ int main( int argc, char *argv[] )
 
     genericsScreenHandling( !options.mono );
 
+    /* Screen codes in the channel formats only need expanding once, now we know if they're wanted, */
+    /* and then the formats are compiled so they aren't parsed again for each message */
+    for ( int g = 0; g < NUM_CHANNELS; g++ )
+    {
+        if ( options.presFormat[g] )
+        {
+            char *f = genericsColourExpand( options.presFormat[g] );
+            free( options.presFormat[g] );
+            options.presFormat[g] = f;
+
+            if ( !( _r.swFormat[g] = SWFormatCompile( f ) ) )
+            {
+                genericsExit( -1, "Cannot use format for channel %d [%s]" EOL, g, genericsEscape( f ) );
+            }
+        }
+    }
+
+    /* Output is written on each line if someone is watching, otherwise when the buffer fills or it gets old */
+    OPBufferInit( &_r.op, stdout, OPBUFFER_DEFAULT_LEN, options.latencymS, isatty( STDOUT_FILENO ) );
+
+    /* Channels can be sent elsewhere, all from this one decode */
+    _openSinks();
+
     /* Reset the handlers before we start */
     ITMDecoderInit( &_r.i, options.forceITMSync );
     OFLOWInit( &_r.c );
@@ -1031,6 +1302,16 @@ int main( int argc, char *argv[] )
         genericsExit( -1, "Failed to establish Int handler" EOL );
     }
 
+#if !defined WIN32
+
+    /* A sink going away shouldn't take us down with it */
+    if ( SIG_ERR == signal( SIGPIPE, SIG_IGN ) )
+    {
+        genericsExit( -1, "Failed to ignore SIGPIPEs" EOL );
+    }
+
+#endif
+
     while ( !_r.ending )
     {
         struct Stream *stream = NULL;
@@ -1079,6 +1360,8 @@ int main( int argc, char *argv[] )
         }
     }
 
+    _closeSinks();
+    OPBufferDestroy( &_r.op );
     return 0;
 }
 // ====================================================================================================
@@ -18,6 +18,7 @@
 #include <signal.h>
 #include <getopt.h>
 #include <unistd.h>
+#include <pthread.h>
 
 #include "git_version_info.h"
 #include "generics.h"
@@ -38,6 +39,12 @@ const char *protString[] = {"OFLOW", "ETM", NULL};
 #define DEFAULT_PM_BUFLEN_K (32)        /* Default size of the Postmortem buffer */
 #define MAX_TAGS            (10)        /* How many tags we will allow */
 
+#define TEXT_CHUNK_SIZE     (1024*1024) /* Size of each chunk of storage for output buffer text */
+#define MIN_OPTEXT_LINES    (4096)      /* Initial allocation of lines in the output buffer */
+#define DECODE_SEGMENT_LEN  (1024*1024) /* Post-mortem buffer is decoded in segments of this size, most recent first */
+#define DECODE_PUMP_LEN     (64*1024)   /* Bytes passed to the decoder between checks for cancellation */
+#define MTB_PAIR_LEN        (8)         /* MTB is decoded in pairs of addresses, so it must be pumped in multiples of this */
+
 #define INTERVAL_TIME_MS    (1000)      /* Intervaltime between acculumator resets */
 #define HANG_TIME_MS        (200)       /* Time without a packet after which we dump the buffer */
 #define TICK_TIME_MS        (100)       /* Time intervals for screen updates and keypress check */
@@ -91,12 +98,51 @@ struct opConstruct
     uint32_t workingAddr;                /* The address we're currently in */
 };
 
+/* Chunk of storage for output buffer text */
+struct textChunk
+{
+    struct textChunk *next;             /* Next chunk in the arena */
+    size_t size;                        /* Space in this chunk */
+    size_t used;                        /* ...and how much of it is in use */
+    char text[];
+};
+
+/* Arena holding the text of the output buffer. Chunks are kept for re-use when it's emptied */
+struct textArena
+{
+    struct textChunk *head;             /* First chunk in the arena */
+    struct textChunk *current;          /* Chunk currently being allocated from */
+};
+
 /* Maximum depth of call stack, defined Section 5.3 or ARM IHI0064H.a ID120820 */
 #define MAX_CALL_STACK (15)
 
+struct RunTime;
+
+/* Decode of one segment of the post-mortem buffer into output lines */
+struct decodeState
+{
+    struct decodeState *next;           /* Next decoded segment waiting for display */
+    struct RunTime *r;                  /* The runtime this decode is being done for */
+
+    struct TRACEDecoder i;              /* Decoder for this segment */
+    bool reported;                      /* Set once the decoder has reported something (i.e. it is in sync) */
+
+    struct opConstruct op;              /* The mechanical elements for creating the output buffer */
+
+    bool traceRunning;                  /* Set if we are currently receiving trace */
+    uint32_t context;                   /* Context we are currently working under */
+    symbolMemaddr callStack[MAX_CALL_STACK]; /* Stack of calls */
+    unsigned int stackDepth;            /* Maximum stack depth */
+    bool stackDelPending;               /* Possibility to remove an entry from the stack, if address not given */
+
+    struct sioline *opText;             /* Lines decoded from this segment */
+    int32_t numLines;                   /* Number of lines decoded */
+    int32_t opTextSize;                 /* Number of lines allocated */
+};
+
 struct RunTime
 {
-    struct TRACEDecoder i;
     struct OFLOW c;
     const char *progName;               /* Name by which this program was called */
 
@@ -115,6 +161,20 @@ struct RunTime
     struct sioline *opText;             /* Text of the output buffer */
     int32_t lineNum;                    /* Current line number in output buffer */
     int32_t numLines;                   /* Number of lines in the output buffer */
+    struct sioline *opTextBase;         /* Allocation holding the output buffer, which has space in front for older lines */
+    int32_t opTextFront;                /* Number of free lines in front of the output buffer */
+    struct textArena text;              /* Storage for the text of non-reference lines, written by the decode thread */
+
+    pthread_t decodeThread;             /* Thread decoding the post-mortem buffer */
+    pthread_mutex_t decodeLock;         /* Protection for the results of the decode */
+    bool decoding;                      /* Set while there's a decode thread to be collected */
+    volatile bool cancelDecode;         /* Request for the decode thread to stop early */
+    bool dumped;                        /* Set once the post-mortem buffer has been submitted for decode */
+    int decodeLen;                      /* Number of bytes of the post-mortem buffer being decoded */
+    int decodedLen;                     /* ...how many of them have been dealt with (under decodeLock) */
+    bool decodeComplete;                /* ...and if the decode thread has finished (under decodeLock) */
+    struct decodeState *decoded;        /* Segments waiting for display, oldest first (under decodeLock) */
+    struct decodeState *decode;         /* Segment the decode thread is working on, for debug reports */
 
     int32_t diveline;                   /* Line number we're currently diving into */
     char *divefile;                     /* Filename we're currently diving into */
@@ -129,15 +189,7 @@ struct RunTime
 
     struct dataBlock rawBlock;          /* Datablock received from distribution */
 
-    struct opConstruct op;              /* The mechanical elements for creating the output buffer */
-
     struct Options *options;            /* Our runtime configuration */
-
-    bool traceRunning;                  /* Set if we are currently receiving trace */
-    uint32_t context;                   /* Context we are currently working under */
-    symbolMemaddr callStack[MAX_CALL_STACK]; /* Stack of calls */
-    unsigned int stackDepth;            /* Maximum stack depth */
-    bool stackDelPending;               /* Possibility to remove an entry from the stack, if address not given */
 } _r;
 
 /* For opening the editor (Shift-Right-Arrow) the following command lines work for a few editors;
@@ -582,43 +634,85 @@ static void _OFLOWpacketRxed ( struct OFLOWFrame *p, void *param )
 }
 
 // ====================================================================================================
-static void _flushBuffer( struct RunTime *r )
+static char *_arenaStore( struct textArena *a, const char *text, size_t len )
 
-/* Empty the output buffer, and de-allocate its memory */
+/* Copy text into the arena, returning where it landed */
 
 {
-    /* Tell the UI there's nothing more to show */
-    SIOsetOutputBuffer( r->sio, 0, 0, NULL, false );
+    struct textChunk *c = a->current;
 
-    /* Remove all of the recorded lines */
-    while ( r->numLines-- )
+    if ( ( !c ) || ( c->used + len + 1 > c->size ) )
     {
-        if ( !r->opText[r->numLines].isRef )
+        /* This chunk is full. Move on to the next one, if it is big enough, otherwise make a new one */
+        if ( ( c ) && ( c->next ) && ( c->next->size >= len + 1 ) )
         {
-            free( r->opText[r->numLines].buffer );
+            c = c->next;
+        }
+        else
+        {
+            size_t size = ( len + 1 > TEXT_CHUNK_SIZE ) ? len + 1 : TEXT_CHUNK_SIZE;
+            struct textChunk *n = ( struct textChunk * )malloc( sizeof( struct textChunk ) + size );
+            MEMCHECK( n, NULL );
+            n->size = size;
+
+            if ( c )
+            {
+                n->next = c->next;
+                c->next = n;
+            }
+            else
+            {
+                n->next = a->head;
+                a->head = n;
+            }
+
+            c = n;
         }
+
+        c->used = 0;
+        a->current = c;
     }
 
-    /* and the opText buffer */
-    free( r->opText );
-    r->opText = NULL;
-    r->numLines = 0;
+    char *r = &c->text[c->used];
+    memcpy( r, text, len );
+    r[len] = 0;
+    c->used += len + 1;
+    return r;
+}
 
-    /* ...and the file/line references */
-    r->op.currentLine = NO_LINE;
-    r->op.currentFileindex = NO_FILE;
-    r->op.currentFunctionptr = NULL;
-    r->op.workingAddr = NO_DESTADDRESS;
+// ====================================================================================================
+static void _arenaEmpty( struct textArena *a )
+
+/* Discard all text in the arena, keeping the chunks for next time */
+
+{
+    a->current = NULL;
+
+    if ( a->head )
+    {
+        a->head->used = 0;
+        a->current = a->head;
+    }
 }
+
 // ====================================================================================================
-// Strdup leak is deliberately ignored. That is the central purpose of this code. It's cleaned
-// upin __flushBuffer above.
-#pragma GCC diagnostic push
-#if !defined(__clang__)
-    #pragma GCC diagnostic ignored "-Wanalyzer-malloc-leak"
-#endif
+static struct sioline *_newOPLine( struct decodeState *d )
 
-static void _appendToOPBuffer( struct RunTime *r, void *dat, int32_t lineno, enum LineType lt, const char *fmt, ... )
+/* Get space for another line at the end of the lines decoded from a segment */
+
+{
+    if ( d->numLines == d->opTextSize )
+    {
+        d->opTextSize = d->opTextSize ? d->opTextSize * 2 : MIN_OPTEXT_LINES;
+        d->opText = ( struct sioline * )realloc( d->opText, sizeof( struct sioline ) * d->opTextSize );
+        MEMCHECK( d->opText, NULL );
+    }
+
+    return &d->opText[d->numLines++];
+}
+
+// ====================================================================================================
+static void _appendToOPBuffer( struct decodeState *d, void *dat, int32_t lineno, enum LineType lt, const char *fmt, ... )
 
 /* Add line to output buffer, in a printf stylee */
 
@@ -634,33 +728,28 @@ static void _appendToOPBuffer( struct RunTime *r, void *dat, int32_t lineno, enu
     /* Make sure we didn't accidentially admit a CR or LF */
     for ( p = construct; ( ( *p ) && ( *p != '\n' ) && ( *p != '\r' ) ); p++ );
 
-    *p = 0;
-
-    r->opText = ( struct sioline * )realloc( r->opText, ( sizeof( struct sioline ) ) * ( r->numLines + 1 ) );
-    r->opText[r->numLines].buffer = strdup( construct );
-    r->opText[r->numLines].lt     = lt;
-    r->opText[r->numLines].line   = lineno;
-    r->opText[r->numLines].isRef  = false;
-    r->opText[r->numLines].dat    = dat;
-    r->numLines++;
+    struct sioline *l = _newOPLine( d );
+    l->buffer = _arenaStore( &d->r->text, construct, p - construct );
+    l->lt     = lt;
+    l->line   = lineno;
+    l->isRef  = false;
+    l->dat    = dat;
 }
-#pragma GCC diagnostic pop
 
 // ====================================================================================================
-static void _appendRefToOPBuffer( struct RunTime *r, void *dat, int32_t lineno, enum LineType lt, const char *ref )
+static void _appendRefToOPBuffer( struct decodeState *d, void *dat, int32_t lineno, enum LineType lt, const char *ref )
 
 /* Add line to output buffer, as a reference (which don't be free'd later) */
 
 {
-    r->opText = ( struct sioline * )realloc( r->opText, ( sizeof( struct sioline ) ) * ( r->numLines + 1 ) );
+    struct sioline *l = _newOPLine( d );
 
     /* This line removes the 'const', but we know to not mess with this line */
-    r->opText[r->numLines].buffer = ( char * )ref;
-    r->opText[r->numLines].lt     = lt;
-    r->opText[r->numLines].line   = lineno;
-    r->opText[r->numLines].isRef  = true;
-    r->opText[r->numLines].dat    = dat;
-    r->numLines++;
+    l->buffer = ( char * )ref;
+    l->lt     = lt;
+    l->line   = lineno;
+    l->isRef  = true;
+    l->dat    = dat;
 }
 // ====================================================================================================
 static void _traceReport( enum verbLevel l, const char *fmt, ... )
@@ -668,7 +757,8 @@ static void _traceReport( enum verbLevel l, const char *fmt, ... )
 /* Debug reporting stream */
 
 {
-    if ( _r.options->withDebugText )
+    /* Reports only arrive from the decoder, which is run by the decode thread for the segment it's working on */
+    if ( ( _r.options->withDebugText ) && ( _r.decode ) )
     {
         static char op[SCRATCH_STRING_LEN];
 
@@ -676,136 +766,136 @@ static void _traceReport( enum verbLevel l, const char *fmt, ... )
         va_start( va, fmt );
         vsnprintf( op, SCRATCH_STRING_LEN, fmt, va );
         va_end( va );
-        _appendToOPBuffer( &_r, NULL, _r.op.currentLine, LT_DEBUG, op );
+        _appendToOPBuffer( _r.decode, NULL, _r.decode->op.currentLine, LT_DEBUG, op );
     }
 }
 // ====================================================================================================
-static void _addRetToStack( struct RunTime *r, symbolMemaddr p )
+static void _addRetToStack( struct decodeState *d, symbolMemaddr p )
 
 {
-    if ( r->stackDepth == MAX_CALL_STACK - 1 )
+    if ( d->stackDepth == MAX_CALL_STACK - 1 )
     {
         /* Stack is full, so make room for a new entry */
-        memmove( &r->callStack[0], &r->callStack[1], sizeof( symbolMemaddr ) * ( MAX_CALL_STACK - 1 ) );
+        memmove( &d->callStack[0], &d->callStack[1], sizeof( symbolMemaddr ) * ( MAX_CALL_STACK - 1 ) );
     }
 
-    r->callStack[r->stackDepth] = p;
-    _traceReport( V_DEBUG, "Pushed %08x to return stack", r->callStack[r->stackDepth] );
+    d->callStack[d->stackDepth] = p;
+    _traceReport( V_DEBUG, "Pushed %08x to return stack", d->callStack[d->stackDepth] );
 
-    if ( r->stackDepth < MAX_CALL_STACK - 1 )
+    if ( d->stackDepth < MAX_CALL_STACK - 1 )
     {
         /* We aren't at max depth, so go ahead and remove this entry */
-        r->stackDepth++;
+        d->stackDepth++;
     }
 }
 // ====================================================================================================
-static void _reportNonflowEvents( struct RunTime *r )
+static void _reportNonflowEvents( struct decodeState *d, struct TRACERecord *rec )
+
+/* Changes that aren't carried in the record end the batch, so the rest of the CPU state is still good for them */
 
 {
-    struct TRACECPUState *cpu = TRACECPUState( &r->i );
+    struct TRACECPUState *cpu = TRACECPUState( &d->i );
 
-    if ( TRACEStateChanged( &r->i, EV_CH_TRACESTART ) )
+    if ( TRACERecordChanged( rec, EV_CH_TRACESTART ) )
     {
-        if ( !r->traceRunning )
+        if ( !d->traceRunning )
         {
-            _appendRefToOPBuffer( r, NULL, r->op.currentLine, LT_EVENT, "========== TRACE START EVENT ==========" );
-            r->traceRunning = true;
+            _appendRefToOPBuffer( d, NULL, d->op.currentLine, LT_EVENT, "========== TRACE START EVENT ==========" );
+            d->traceRunning = true;
         }
     }
 
-    if ( TRACEStateChanged( &r->i, EV_CH_VMID ) )
+    if ( TRACERecordChanged( rec, EV_CH_VMID ) )
     {
-        _appendToOPBuffer( r, NULL, r->op.currentLine, LT_EVENT, "*** VMID Set to %d", cpu->vmid );
+        _appendToOPBuffer( d, NULL, d->op.currentLine, LT_EVENT, "*** VMID Set to %d", cpu->vmid );
     }
 
-    if ( TRACEStateChanged( &r->i, EV_CH_EX_EXIT ) )
+    if ( TRACERecordChanged( rec, EV_CH_EX_EXIT ) )
     {
-        _appendRefToOPBuffer( r, NULL, r->op.currentLine, LT_EVENT, "========== Exception Exit ==========" );
+        _appendRefToOPBuffer( d, NULL, d->op.currentLine, LT_EVENT, "========== Exception Exit ==========" );
     }
 
-    if ( TRACEStateChanged( &r->i, EV_CH_TSTAMP ) )
+    if ( TRACERecordChanged( rec, EV_CH_TSTAMP ) )
     {
-        if ( cpu->ts )
+        if ( rec->ts )
         {
-            if ( cpu->ts != COUNT_UNKNOWN )
+            if ( rec->ts != COUNT_UNKNOWN )
             {
-                _appendToOPBuffer( r, NULL, r->op.currentLine, LT_EVENT, "*** Timestamp %ld", cpu->ts );
+                _appendToOPBuffer( d, NULL, d->op.currentLine, LT_EVENT, "*** Timestamp %ld", rec->ts );
             }
             else
             {
-                _appendToOPBuffer( r, NULL, r->op.currentLine, LT_EVENT, "*** Timestamp unknown" );
+                _appendToOPBuffer( d, NULL, d->op.currentLine, LT_EVENT, "*** Timestamp unknown" );
             }
         }
     }
 
-    if ( TRACEStateChanged( &r->i, EV_CH_TRIGGER ) )
+    if ( TRACERecordChanged( rec, EV_CH_TRIGGER ) )
     {
-        _appendRefToOPBuffer( r, NULL, r->op.currentLine, LT_EVENT, "*** Trigger" );
+        _appendRefToOPBuffer( d, NULL, d->op.currentLine, LT_EVENT, "*** Trigger" );
     }
 
-    if ( TRACEStateChanged( &r->i, EV_CH_CLOCKSPEED ) )
+    if ( TRACERecordChanged( rec, EV_CH_CLOCKSPEED ) )
     {
-        _appendRefToOPBuffer( r, NULL, r->op.currentLine, LT_EVENT, "*** Change Clockspeed" );
+        _appendRefToOPBuffer( d, NULL, d->op.currentLine, LT_EVENT, "*** Change Clockspeed" );
     }
 
-    if ( TRACEStateChanged( &r->i, EV_CH_ISLSIP ) )
+    if ( TRACERecordChanged( rec, EV_CH_ISLSIP ) )
     {
-        _appendRefToOPBuffer( r, NULL, r->op.currentLine, LT_EVENT, "*** ISLSIP Triggered" );
+        _appendRefToOPBuffer( d, NULL, d->op.currentLine, LT_EVENT, "*** ISLSIP Triggered" );
     }
 
-    if ( TRACEStateChanged( &r->i, EV_CH_CYCLECOUNT ) )
+    if ( TRACERecordChanged( rec, EV_CH_CYCLECOUNT ) )
     {
-        _appendToOPBuffer( r, NULL, r->op.currentLine, LT_EVENT, "(Cycle Count %d)", cpu->cycleCount );
+        _appendToOPBuffer( d, NULL, d->op.currentLine, LT_EVENT, "(Cycle Count %d)", rec->cycleCount );
     }
 
-    if ( TRACEStateChanged( &r->i, EV_CH_VMID ) )
+    if ( TRACERecordChanged( rec, EV_CH_VMID ) )
     {
-        _appendToOPBuffer( r, NULL, r->op.currentLine, LT_EVENT, "(VMID is now %d)", cpu->vmid );
+        _appendToOPBuffer( d, NULL, d->op.currentLine, LT_EVENT, "(VMID is now %d)", cpu->vmid );
     }
 
-    if ( TRACEStateChanged( &r->i, EV_CH_CONTEXTID ) )
+    if ( TRACERecordChanged( rec, EV_CH_CONTEXTID ) )
     {
-        if ( r->context != cpu->contextID )
+        if ( d->context != cpu->contextID )
         {
-            _appendToOPBuffer( r, NULL, r->op.currentLine, LT_EVENT, "(Context ID is now %d)", cpu->contextID );
-            r->context = cpu->contextID;
+            _appendToOPBuffer( d, NULL, d->op.currentLine, LT_EVENT, "(Context ID is now %d)", cpu->contextID );
+            d->context = cpu->contextID;
         }
     }
 
-    if ( TRACEStateChanged( &r->i, EV_CH_SECURE ) )
+    if ( TRACERecordChanged( rec, EV_CH_SECURE ) )
     {
-        _appendToOPBuffer( r, NULL, r->op.currentLine, LT_EVENT, "(Non-Secure State is now %s)", cpu->nonSecure ? "True" : "False" );
+        _appendToOPBuffer( d, NULL, d->op.currentLine, LT_EVENT, "(Non-Secure State is now %s)", cpu->nonSecure ? "True" : "False" );
     }
 
-    if ( TRACEStateChanged( &r->i, EV_CH_ALTISA ) )
+    if ( TRACERecordChanged( rec, EV_CH_ALTISA ) )
     {
-        _appendToOPBuffer( r, NULL, r->op.currentLine, LT_EVENT, "(Using AltISA  is now %s)", cpu->altISA ? "True" : "False" );
+        _appendToOPBuffer( d, NULL, d->op.currentLine, LT_EVENT, "(Using AltISA  is now %s)", cpu->altISA ? "True" : "False" );
     }
 
-    if ( TRACEStateChanged( &r->i, EV_CH_HYP ) )
+    if ( TRACERecordChanged( rec, EV_CH_HYP ) )
     {
-        _appendToOPBuffer( r, NULL, r->op.currentLine,  LT_EVENT, "(Using Hypervisor is now %s)", cpu->hyp ? "True" : "False" );
+        _appendToOPBuffer( d, NULL, d->op.currentLine,  LT_EVENT, "(Using Hypervisor is now %s)", cpu->hyp ? "True" : "False" );
     }
 
-    if ( TRACEStateChanged( &r->i, EV_CH_JAZELLE ) )
+    if ( TRACERecordChanged( rec, EV_CH_JAZELLE ) )
     {
-        _appendToOPBuffer( r, NULL, r->op.currentLine, LT_EVENT, "(Using Jazelle is now %s)", cpu->jazelle ? "True" : "False" );
+        _appendToOPBuffer( d, NULL, d->op.currentLine, LT_EVENT, "(Using Jazelle is now %s)", cpu->jazelle ? "True" : "False" );
     }
 
-    if ( TRACEStateChanged( &r->i, EV_CH_THUMB ) )
+    if ( TRACERecordChanged( rec, EV_CH_THUMB ) )
     {
-        _appendToOPBuffer( r, NULL, r->op.currentLine, LT_EVENT, "(Using Thumb is now %s)", cpu->thumb ? "True" : "False" );
+        _appendToOPBuffer( d, NULL, d->op.currentLine, LT_EVENT, "(Using Thumb is now %s)", cpu->thumb ? "True" : "False" );
     }
 }
 
 // ====================================================================================================
-static void _traceCB( void *d )
+static void _traceRecord( struct decodeState *d, struct TRACERecord *rec )
 
-/* Callback function for when valid TRACE decode is detected */
+/* Handle a record of valid TRACE decode */
 
 {
-    struct RunTime *r = ( struct RunTime * )d;
-    struct TRACECPUState *cpu = TRACECPUState( &r->i );
     uint32_t incAddr = 0;
     uint32_t disposition;
     uint32_t targetAddr = 0; /* Just to avoid unitialised variable warning */
@@ -813,23 +903,26 @@ static void _traceCB( void *d )
     enum instructionClass ic;
     symbolMemaddr newaddr;
 
+    /* The decoder only reports once it's in sync, so this is a good place to start from */
+    d->reported = true;
+
     /* 1: Report anything that doesn't affect the flow */
     /* =============================================== */
-    _reportNonflowEvents( r );
+    _reportNonflowEvents( d, rec );
 
     /* 2: Deal with exception entry */
     /* ============================ */
-    if ( TRACEStateChanged( &r->i, EV_CH_EX_ENTRY ) )
+    if ( TRACERecordChanged( rec, EV_CH_EX_ENTRY ) )
     {
-        switch ( r->options->traceProt )
+        switch ( d->r->options->traceProt )
         {
             case TRACE_PROT_ETM35:
-                _appendToOPBuffer( r, NULL, r->op.currentLine, LT_EVENT, "========== Exception Entry%s (%d (%s) at 0x%08x) ==========",
-                                   TRACEStateChanged( &r->i, EV_CH_CANCELLED ) ? ", Last Instruction Cancelled" : "", cpu->exception, TRACEExceptionName( cpu->exception ), cpu->addr );
+                _appendToOPBuffer( d, NULL, d->op.currentLine, LT_EVENT, "========== Exception Entry%s (%d (%s) at 0x%08x) ==========",
+                                   TRACERecordChanged( rec, EV_CH_CANCELLED ) ? ", Last Instruction Cancelled" : "", rec->exception, TRACEExceptionName( rec->exception ), rec->addr );
                 break;
 
             case TRACE_PROT_MTB:
-                _appendRefToOPBuffer( r, NULL, r->op.currentLine, LT_EVENT, "========== Exception Entry ==========" );
+                _appendRefToOPBuffer( d, NULL, d->op.currentLine, LT_EVENT, "========== Exception Entry ==========" );
                 break;
 
 
@@ -838,15 +931,15 @@ static void _traceCB( void *d )
                 /* For the ETM4 case we get a new address with the exception indication. This address is the preferred _return_ address, */
                 /* there will be a further address packet, which is the jump destination, along shortly. Note that _this_ address        */
                 /* change indication will be consumed here, and won't hit the test below (which is correct behaviour.                    */
-                if ( !TRACEStateChanged( &r->i, EV_CH_ADDRESS ) )
+                if ( !TRACERecordChanged( rec, EV_CH_ADDRESS ) )
                 {
                     _traceReport( V_DEBUG, "Exception occured without return address specification" );
                 }
                 else
                 {
-                    _appendToOPBuffer( r, NULL, r->op.currentLine, LT_EVENT, "========== Exception Entry (%d (%s) at 0x%08x return to %08x ) ==========",
-                                       cpu->exception, TRACEExceptionName( cpu->exception ), r->op.workingAddr, cpu->addr );
-                    _addRetToStack( r, cpu->addr );
+                    _appendToOPBuffer( d, NULL, d->op.currentLine, LT_EVENT, "========== Exception Entry (%d (%s) at 0x%08x return to %08x ) ==========",
+                                       rec->exception, TRACEExceptionName( rec->exception ), d->op.workingAddr, rec->addr );
+                    _addRetToStack( d, rec->addr );
                 }
 
                 break;
@@ -860,68 +953,68 @@ static void _traceCB( void *d )
 
     /* 3: Collect flow affecting changes introduced by this event */
     /* ========================================================== */
-    if ( TRACEStateChanged( &r->i, EV_CH_ADDRESS ) )
+    if ( TRACERecordChanged( rec, EV_CH_ADDRESS ) )
     {
         /* Make debug report if calculated and reported addresses differ. This is most useful for testing when exhaustive  */
         /* address reporting is switched on. It will give 'false positives' for uncalculable instructions (e.g. bx lr) but */
         /* it's a decent safety net to be sure the jump decoder is working correctly.                                      */
 
-        if ( r->options->traceProt != TRACE_PROT_MTB )
+        if ( d->r->options->traceProt != TRACE_PROT_MTB )
         {
             _traceReport( V_DEBUG, "%sCommanded CPU Address change (Was:0x%08x Commanded:0x%08x)" EOL,
-                          ( r->op.workingAddr == cpu->addr ) ? "" : "***INCONSISTENT*** ", r->op.workingAddr, cpu->addr );
+                          ( d->op.workingAddr == rec->addr ) ? "" : "***INCONSISTENT*** ", d->op.workingAddr, rec->addr );
         }
 
         /* Return Stack: If we had a stack deletion pending because of a candidate match, it wasn't, so abort */
-        if ( r->stackDelPending )
+        if ( d->stackDelPending )
         {
             _traceReport( V_DEBUG, "Stack delete aborted" );
         }
 
-        r->stackDelPending = false;
+        d->stackDelPending = false;
         /* Whatever the state was, this is an explicit setting of an address, so we need to respect it */
-        r->op.workingAddr = cpu->addr;
+        d->op.workingAddr = rec->addr;
     }
     else
     {
         /* Return Stack: If we had a stack deletion pending because of a candidate match, the match was good, so commit */
-        if ( ( r->stackDelPending == true ) && ( r->stackDepth ) )
+        if ( ( d->stackDelPending == true ) && ( d->stackDepth ) )
         {
-            r->stackDepth--;
+            d->stackDepth--;
             _traceReport( V_DEBUG, "Stack delete comitted" );
         }
 
-        r->stackDelPending = false;
+        d->stackDelPending = false;
     }
 
-    if ( TRACEStateChanged( &r->i, EV_CH_LINEAR ) )
+    if ( TRACERecordChanged( rec, EV_CH_LINEAR ) )
     {
         /* MTB-Specific mechanism: Execute instructions from the marked starting location to the indicated finishing one */
         /* Disposition is all 1's because every instruction is executed.                                                 */
-        r->op.workingAddr = cpu->addr;
-        targetAddr        = cpu->toAddr;
+        d->op.workingAddr = rec->addr;
+        targetAddr        = rec->toAddr;
         linearRun         = true;
         disposition       = 0xffffffff;
-        _traceReport( V_DEBUG, "Linear run 0x%08x to 0x%08x" EOL, cpu->addr, cpu->toAddr );
+        _traceReport( V_DEBUG, "Linear run 0x%08x to 0x%08x" EOL, rec->addr, rec->toAddr );
     }
 
-    if ( TRACEStateChanged( &r->i, EV_CH_ENATOMS ) )
+    if ( TRACERecordChanged( rec, EV_CH_ENATOMS ) )
     {
         /* Atoms represent instruction steps...some of which will have been executed, some stepped over. The number of steps is the   */
         /* total of the eatoms (executed) and natoms (not executed) and the disposition bitfield shows if each individual instruction */
         /* was executed or not. For ETM3 each 'run' of instructions is a single instruction with the disposition bit telling you if   */
         /* it was executed or not. For ETM4 each 'run' of instructions is from the current address to the next possible change of     */
         /* program flow (and which point the disposition bit tells you if that jump was taken or not).                                */
-        incAddr = cpu->eatoms + cpu->natoms;
-        disposition = cpu->disposition;
+        incAddr = rec->eatoms + rec->natoms;
+        disposition = rec->disposition;
     }
 
     /* 4: Execute the flow instructions */
     /* ================================ */
-    while ( ( incAddr && !linearRun ) || ( ( r->op.workingAddr <= targetAddr ) && linearRun ) )
+    while ( ( incAddr && !linearRun ) || ( ( d->op.workingAddr <= targetAddr ) && linearRun ) )
     {
         /* Firstly, lets get the source code line...*/
-        struct symbolLineStore *l = symbolLineAt( r->s, r->op.workingAddr );
+        struct symbolLineStore *l = symbolLineAt( d->r->s, d->op.workingAddr );
 
         if ( l )
         {
@@ -929,37 +1022,37 @@ static void _traceCB( void *d )
             if ( l->function )
             {
                 /* There is a valid function tag recognised here. If it's a change highlight it in the output. */
-                if ( ( l->function->filename != r->op.currentFileindex ) || ( l->function != r->op.currentFunctionptr ) )
+                if ( ( l->function->filename != d->op.currentFileindex ) || ( l->function != d->op.currentFunctionptr ) )
                 {
-                    _appendToOPBuffer( r, l, r->op.currentLine, LT_FILE, "%s::%s", symbolGetFilename( r->s, l->function->filename ), l->function->funcname );
-                    r->op.currentFileindex     = l->function->filename;
-                    r->op.currentFunctionptr   = l->function;
-                    r->op.currentLine = NO_LINE;
+                    _appendToOPBuffer( d, l, d->op.currentLine, LT_FILE, "%s::%s", symbolGetFilename( d->r->s, l->function->filename ), l->function->funcname );
+                    d->op.currentFileindex     = l->function->filename;
+                    d->op.currentFunctionptr   = l->function;
+                    d->op.currentLine = NO_LINE;
                 }
             }
             else
             {
                 /* We didn't find a valid function, but we might have some information to work with.... */
-                if ( ( NO_FILE != r->op.currentFileindex ) || ( NULL != r->op.currentFunctionptr ) )
+                if ( ( NO_FILE != d->op.currentFileindex ) || ( NULL != d->op.currentFunctionptr ) )
                 {
-                    _appendToOPBuffer( r, l, r->op.currentLine, LT_FILE, "Unknown function" );
-                    r->op.currentFileindex     = NO_FILE;
-                    r->op.currentFunctionptr   = NULL;
-                    r->op.currentLine = NO_LINE;
+                    _appendToOPBuffer( d, l, d->op.currentLine, LT_FILE, "Unknown function" );
+                    d->op.currentFileindex     = NO_FILE;
+                    d->op.currentFunctionptr   = NULL;
+                    d->op.currentLine = NO_LINE;
                 }
             }
         }
 
         /* If we have changed line then output the new one */
-        if ( l && ( ( l->startline != r->op.currentLine ) ) )
+        if ( l && ( ( l->startline != d->op.currentLine ) ) )
         {
-            const char *v = symbolSource( r->s, l->filename, l->startline - 1 );
-            r->op.currentLine = l->startline;
-            _appendRefToOPBuffer( r, l, r->op.currentLine, LT_SOURCE, v );
+            const char *v = symbolSource( d->r->s, l->filename, l->startline - 1 );
+            d->op.currentLine = l->startline;
+            _appendRefToOPBuffer( d, l, d->op.currentLine, LT_SOURCE, v );
         }
 
         /* Now output the matching assembly, and location updates */
-        char *a = symbolDisassembleLine( r->s, &ic, r->op.workingAddr, &newaddr );
+        const char *a = symbolDisassembleLine( d->r->s, &ic, d->op.workingAddr, &newaddr );
 
         if ( a )
         {
@@ -969,23 +1062,24 @@ static void _traceCB( void *d )
             /*   * MTB   : Everything except jumps are executed, jumps are executed only if they are the last instruction in a run */
             bool insExecuted = (
                                            /* ETM3.5 case - dependent on disposition */
-                                           ( ( !linearRun )  && ( r->i.protocol == TRACE_PROT_ETM35 ) && ( disposition & 1 ) ) ||
+                                           ( ( !linearRun )  && ( d->i.protocol == TRACE_PROT_ETM35 ) && ( disposition & 1 ) ) ||
 
                                            /* ETM4 case - either not a branch or disposition is 1 */
-                                           ( ( !linearRun ) && ( r->i.protocol == TRACE_PROT_ETM4 ) && ( ( !( ic & LE_IC_JUMP ) ) || ( disposition & 1 ) ) ) ||
+                                           ( ( !linearRun ) && ( d->i.protocol == TRACE_PROT_ETM4 ) && ( ( !( ic & LE_IC_JUMP ) ) || ( disposition & 1 ) ) ) ||
 
                                            /* MTB case - a linear run to last address */
-                                           ( ( linearRun ) && ( r->i.protocol == TRACE_PROT_MTB ) &&
-                                             ( ( ( r->op.workingAddr != targetAddr ) && ( ! ( ic & LE_IC_JUMP ) ) )  ||
-                                               ( r->op.workingAddr == targetAddr )
+                                           ( ( linearRun ) && ( d->i.protocol == TRACE_PROT_MTB ) &&
+                                             ( ( ( d->op.workingAddr != targetAddr ) && ( ! ( ic & LE_IC_JUMP ) ) )  ||
+                                               ( d->op.workingAddr == targetAddr )
                                              ) ) );
-            _appendToOPBuffer( r, l, r->op.currentLine, insExecuted ? LT_ASSEMBLY : LT_NASSEMBLY, a );
+            /* Disassembly text is held by the symbol set for as long as it's loaded, so it can be referenced */
+            _appendRefToOPBuffer( d, l, d->op.currentLine, insExecuted ? LT_ASSEMBLY : LT_NASSEMBLY, a );
 
 
             /* Move addressing along */
-            if ( ( r->i.protocol != TRACE_PROT_ETM4 ) || ( ic & LE_IC_JUMP ) )
+            if ( ( d->i.protocol != TRACE_PROT_ETM4 ) || ( ic & LE_IC_JUMP ) )
             {
-                if ( r->i.protocol == TRACE_PROT_ETM4 )
+                if ( d->i.protocol == TRACE_PROT_ETM4 )
                 {
                     _traceReport( V_DEBUG, "Consumed, %sexecuted (%d left)", insExecuted ? "" : "not ", incAddr - 1 );
                 }
@@ -1000,10 +1094,10 @@ static void _traceCB( void *d )
                 {
                     /* Push the instruction after this if it's a subroutine or ISR */
                     _traceReport( V_DEBUG, "Call to %08x", newaddr );
-                    _addRetToStack( r, r->op.workingAddr + ( ( ic & LE_IC_4BYTE ) ? 4 : 2 ) );
+                    _addRetToStack( d, d->op.workingAddr + ( ( ic & LE_IC_4BYTE ) ? 4 : 2 ) );
                 }
 
-                r->op.workingAddr = insExecuted ? newaddr : r->op.workingAddr + ( ( ic & LE_IC_4BYTE ) ? 4 : 2 );
+                d->op.workingAddr = insExecuted ? newaddr : d->op.workingAddr + ( ( ic & LE_IC_4BYTE ) ? 4 : 2 );
             }
             else if ( ic & LE_IC_JUMP )
             {
@@ -1016,51 +1110,301 @@ static void _traceCB( void *d )
                     {
                         _traceReport( V_DEBUG, "Immediate address %8x", newaddr );
                         /* We have a good address, so update with it */
-                        r->op.workingAddr = newaddr;
+                        d->op.workingAddr = newaddr;
                     }
                     else
                     {
                         /* We didn't get the address, so need to park the call stack address if we've got one. Either we won't      */
                         /* get an address (in which case this one was correct), or we wont (in which case, don't unstack this one). */
-                        if ( r->stackDepth )
+                        if ( d->stackDepth )
                         {
-                            r->op.workingAddr = r->callStack[r->stackDepth - 1];
-                            _traceReport( V_DEBUG, "Return with stacked candidate to %08x", r->op.workingAddr );
+                            d->op.workingAddr = d->callStack[d->stackDepth - 1];
+                            _traceReport( V_DEBUG, "Return with stacked candidate to %08x", d->op.workingAddr );
                         }
                         else
                         {
                             _traceReport( V_DEBUG, "Return with no stacked candidate" );
                         }
 
-                        r->stackDelPending = true;
+                        d->stackDelPending = true;
                     }
                 }
                 else
                 {
                     /* The branch wasn't taken, so just move along */
-                    r->op.workingAddr += ( ic & LE_IC_4BYTE ) ? 4 : 2;
+                    d->op.workingAddr += ( ic & LE_IC_4BYTE ) ? 4 : 2;
                 }
             }
             else
             {
                 /* Just a regular instruction, so just move along */
-                r->op.workingAddr += ( ic & LE_IC_4BYTE ) ? 4 : 2;
+                d->op.workingAddr += ( ic & LE_IC_4BYTE ) ? 4 : 2;
             }
         }
         else
         {
-            _appendToOPBuffer( r, l, r->op.currentLine, LT_ASSEMBLY, "%8x:\tASSEMBLY NOT FOUND" EOL, r->op.workingAddr );
-            r->op.workingAddr += 2;
+            _appendToOPBuffer( d, l, d->op.currentLine, LT_ASSEMBLY, "%8x:\tASSEMBLY NOT FOUND" EOL, d->op.workingAddr );
+            d->op.workingAddr += 2;
             disposition >>= 1;
             incAddr--;
         }
     }
 }
 
+// ====================================================================================================
+static void _traceCB( struct TRACERecord *rec, int n, void *p )
+
+/* Callback function for when a batch of valid TRACE decode is available */
+
+{
+    struct decodeState *d = ( struct decodeState * )p;
+
+    while ( n-- )
+    {
+        _traceRecord( d, rec++ );
+    }
+}
+// ====================================================================================================
+static struct decodeState *_newDecodeState( struct RunTime *r )
+
+/* Create a fresh decoder and line store for a segment of the post-mortem buffer */
+
+{
+    struct decodeState *d = ( struct decodeState * )calloc( 1, sizeof( struct decodeState ) );
+    MEMCHECK( d, NULL );
+
+    d->r = r;
+    TRACEDecoderInit( &d->i, r->options->traceProt, !( r->options->noAltAddr ), _traceReport );
+
+    /* Decoder reports only go into the output buffer, and then only if debug text was asked for */
+    TRACEDecoderSetReportLevel( &d->i, r->options->withDebugText ? V_DEBUG : V_ERROR );
+
+    d->op.currentLine = NO_LINE;
+    d->op.currentFileindex = NO_FILE;
+    d->op.currentFunctionptr = NULL;
+    d->op.workingAddr = NO_DESTADDRESS;
+
+    return d;
+}
+// ====================================================================================================
+static void _deleteDecodeState( struct decodeState *d )
+
+{
+    TRACEDecoderDestroy( &d->i );
+    free( d->opText );
+    free( d );
+}
+// ====================================================================================================
+static int _decodeRange( struct decodeState *d, int from, int to, int step, bool untilReport )
+
+/* Pump a range of the post-mortem buffer (offsets from rp) through the decoder step bytes at a time, stopping */
+/* early if cancelled, or at the first report if untilReport is set. Returns the offset that was reached.       */
+
+{
+    struct RunTime *r = d->r;
+
+    while ( ( from < to ) && ( !r->cancelDecode ) && ( !( untilReport && d->reported ) ) )
+    {
+        int p = ( r->rp + from ) % r->options->buflen;
+        int len = to - from;
+
+        /* Don't go past the end of the ring, or pump too much at once */
+        len = ( len > r->options->buflen - p ) ? r->options->buflen - p : len;
+        len = ( len > step ) ? step : len;
+
+        TRACEDecoderPumpRecords( &d->i, &r->pmBuffer[p], len, _traceCB, d );
+        from += len;
+    }
+
+    return from;
+}
+// ====================================================================================================
+static void *_decodeThread( void *arg )
+
+/* Decode the post-mortem buffer in segments, most recent first, handing each one over for display as it's done. */
+/* Each segment is decoded with a fresh decoder from the first point that it's able to report, up to the point   */
+/* where the following segment started reporting, so every part of the buffer is decoded once.                   */
+
+{
+    struct RunTime *r = ( struct RunTime * )arg;
+    int syncStep = ( r->options->traceProt == TRACE_PROT_MTB ) ? MTB_PAIR_LEN : 1;
+    int end = r->decodeLen;
+    int start = ( r->decodeLen ) ? ( ( r->decodeLen - 1 ) / DECODE_SEGMENT_LEN ) * DECODE_SEGMENT_LEN : -1;
+
+    while ( ( start >= 0 ) && ( !r->cancelDecode ) )
+    {
+        struct decodeState *d = _newDecodeState( r );
+        r->decode = d;
+
+        /* Find where this segment starts making sense. The data completing the first report belongs to this */
+        /* segment, so the previous one finishes just before it.                                              */
+        int syncPoint = _decodeRange( d, start, end, syncStep, true );
+        _decodeRange( d, syncPoint, end, DECODE_PUMP_LEN, false );
+        r->decode = NULL;
+
+        int prevEnd = ( d->reported ) ? syncPoint - syncStep : syncPoint;
+
+        pthread_mutex_lock( &r->decodeLock );
+
+        if ( ( d->numLines ) && ( !r->cancelDecode ) )
+        {
+            /* Each segment is older than the ones before it, so it goes on the front */
+            d->next = r->decoded;
+            r->decoded = d;
+            d = NULL;
+        }
+
+        r->decodedLen = r->decodeLen - start;
+        pthread_mutex_unlock( &r->decodeLock );
+
+        if ( d )
+        {
+            _deleteDecodeState( d );
+        }
+
+        end = prevEnd;
+        start -= DECODE_SEGMENT_LEN;
+    }
+
+    pthread_mutex_lock( &r->decodeLock );
+    r->decodeComplete = true;
+    pthread_mutex_unlock( &r->decodeLock );
+
+    return NULL;
+}
+// ====================================================================================================
+static void _prependLines( struct RunTime *r, struct decodeState *d )
+
+/* Put lines from the list of decoded segments in front of the output buffer, making room if needed */
+
+{
+    int32_t n = 0;
+
+    for ( struct decodeState *i = d; i; i = i->next )
+    {
+        n += i->numLines;
+    }
+
+    if ( n > r->opTextFront )
+    {
+        /* Not enough room, so move to a new allocation with at least as much space in front as we're using */
+        int32_t front = n + ( ( r->numLines + n > MIN_OPTEXT_LINES ) ? r->numLines + n : MIN_OPTEXT_LINES );
+        struct sioline *newBase = ( struct sioline * )malloc( sizeof( struct sioline ) * ( front + r->numLines ) );
+        MEMCHECKV( newBase );
+
+        if ( r->numLines )
+        {
+            memcpy( &newBase[front], r->opText, sizeof( struct sioline ) * r->numLines );
+        }
+
+        free( r->opTextBase );
+        r->opTextBase  = newBase;
+        r->opTextFront = front;
+        r->opText      = &newBase[front];
+    }
+
+    r->opTextFront -= n;
+    r->opText      -= n;
+    r->numLines    += n;
+
+    for ( struct sioline *l = r->opText; d; d = d->next )
+    {
+        memcpy( l, d->opText, sizeof( struct sioline ) * d->numLines );
+        l += d->numLines;
+    }
+}
+// ====================================================================================================
+static void _collectDecode( struct RunTime *r )
+
+/* Move any segments that have been decoded into the output buffer, and update the progress indication */
+
+{
+    struct decodeState *d;
+    bool complete;
+    int progress;
+
+    if ( ( !r->decoding ) || ( r->diving ) )
+    {
+        return;
+    }
+
+    pthread_mutex_lock( &r->decodeLock );
+    d = r->decoded;
+    r->decoded = NULL;
+    complete = r->decodeComplete;
+    progress = ( r->decodeLen ) ? ( int )( ( 100LL * r->decodedLen ) / r->decodeLen ) : 100;
+    pthread_mutex_unlock( &r->decodeLock );
+
+    if ( d )
+    {
+        int32_t oldLines = r->numLines;
+        _prependLines( r, d );
+        SIOextendOutputBuffer( r->sio, r->numLines, r->numLines - oldLines );
+
+        while ( d )
+        {
+            struct decodeState *n = d->next;
+            _deleteDecodeState( d );
+            d = n;
+        }
+    }
+
+    if ( complete )
+    {
+        pthread_join( r->decodeThread, NULL );
+        r->decoding = false;
+        SIOsetProgress( r->sio, SIO_NO_PROGRESS );
+    }
+    else
+    {
+        SIOsetProgress( r->sio, progress );
+    }
+}
+// ====================================================================================================
+static void _stopDecode( struct RunTime *r )
+
+/* Stop any decode in progress, discarding what it hasn't delivered yet */
+
+{
+    if ( r->decoding )
+    {
+        r->cancelDecode = true;
+        pthread_join( r->decodeThread, NULL );
+
+        while ( r->decoded )
+        {
+            struct decodeState *n = r->decoded->next;
+            _deleteDecodeState( r->decoded );
+            r->decoded = n;
+        }
+
+        r->decoding = false;
+        r->cancelDecode = false;
+        SIOsetProgress( r->sio, SIO_NO_PROGRESS );
+    }
+}
+// ====================================================================================================
+static void _flushBuffer( struct RunTime *r )
+
+/* Empty the output buffer. Its memory is retained for the next time it is filled */
+
+{
+    _stopDecode( r );
+
+    /* Tell the UI there's nothing more to show */
+    SIOsetOutputBuffer( r->sio, 0, 0, NULL, false );
+
+    /* Remove all of the recorded lines ... they're all in the arena so they go in one hit */
+    _arenaEmpty( &r->text );
+    r->opText += r->numLines;
+    r->opTextFront += r->numLines;
+    r->numLines = 0;
+    r->dumped = false;
+}
 // ====================================================================================================
 static bool _dumpBuffer( struct RunTime *r )
 
-/* Dump received data buffer into text buffer */
+/* Start decode of received data buffer into text buffer, which continues in the background */
 
 {
     _flushBuffer( r );
@@ -1078,24 +1422,23 @@ static bool _dumpBuffer( struct RunTime *r )
         genericsReport( V_DEBUG, "Loaded %s" EOL, r->options->elffile );
     }
 
-    /* Pump the received messages through the TRACE decoder, it will callback to _traceCB with complete sentences */
-    int bytesAvailable = ( ( r->wp + r->options->buflen ) - r->rp ) % r->options->buflen;
+    /* Each segment starts with a fresh decoder, so sync state is always found from the data itself */
+    r->decodeLen = ( ( r->wp + r->options->buflen ) - r->rp ) % r->options->buflen;
+    r->decodedLen = 0;
+    r->decodeComplete = false;
+    r->dumped = true;
+
+    /* Lines are made available to the UI as they're decoded */
+    SIOsetOutputBuffer( r->sio, 0, 0, &r->opText, false );
+    SIOsetProgress( r->sio, 0 );
 
-    /* If we started wrapping (i.e. the rx ring buffer got full) then any guesses about sync status are invalid */
-    if ( ( bytesAvailable == r->options->buflen - 1 ) && ( !r->singleShot ) )
+    if ( pthread_create( &r->decodeThread, NULL, &_decodeThread, r ) )
     {
-        TRACEDecoderForceSync( &r->i, false );
+        genericsReport( V_ERROR, "Failed to create decode thread" EOL );
+        return false;
     }
 
-    /* Two calls in case buffer is wrapped - submit both parts */
-    TRACEDecoderPump( &r->i, &r->pmBuffer[r->rp], r->options->buflen - r->rp, _traceCB, r );
-
-    /* The length of this second buffer can be 0 for case buffer is not wrapped */
-    TRACEDecoderPump( &r->i, &r->pmBuffer[0], r->wp, _traceCB, r );
-
-    /* Submit this constructed buffer for display */
-    SIOsetOutputBuffer( r->sio, r->numLines, r->numLines - 1, &r->opText, false );
-
+    r->decoding = true;
     return true;
 }
 // ====================================================================================================
@@ -1167,6 +1510,13 @@ static void _doFileDive( struct RunTime *r )
         return;
     }
 
+    /* The decode thread is still using the symbols, and loading source isn't safe alongside it */
+    if ( r->decoding )
+    {
+        SIOalert( r->sio, "Decode in progress" );
+        return;
+    }
+
     /* There should be no file read in at the moment */
     assert( !r->fileopText );
     assert( !r->filenumLines );
@@ -1295,6 +1645,13 @@ static void _doExit( void )
 
 {
     _r.ending = true;
+
+    /* Collect any decode in progress, unless it's the decode thread itself that is leaving */
+    if ( ( _r.decoding ) && ( !pthread_equal( pthread_self(), _r.decodeThread ) ) )
+    {
+        _stopDecode( &_r );
+    }
+
     /* Give them a bit of time, then we're leaving anyway */
     usleep( 200 );
     SIOterminate( _r.sio );
@@ -1375,7 +1732,7 @@ int main( int argc, char *argv[] )
     /* Create the buffer memory */
     _r.pmBuffer = ( uint8_t * )calloc( 1, _r.options->buflen );
 
-    TRACEDecoderInit( &_r.i, _r.options->traceProt, !( _r.options->noAltAddr ), _traceReport );
+    pthread_mutex_init( &_r.decodeLock, NULL );
 
     OFLOWInit( &_r.c );
 
@@ -1460,6 +1817,9 @@ int main( int argc, char *argv[] )
                 }
             }
 
+            /* Pick up anything the decode thread has finished with */
+            _collectDecode( &_r );
+
             /* Update the outputs and deal with any keys that made it up this high */
             /* =================================================================== */
             switch ( ( s = SIOHandler( _r.sio, ( genericsTimestampmS() - lastTTime ) > TICK_TIME_MS, _r.oldTotalIntervalBytes, _r.options->withDebugText ) ) )
@@ -1471,14 +1831,14 @@ int main( int argc, char *argv[] )
 
                         if ( !_r.held )
                         {
-                            _r.wp = _r.rp = 0;
-
                             if ( _r.diving )
                             {
                                 _doFilesurface( &_r );
                             }
 
+                            /* This stops any decode, so it has to be done before the buffer is reset */
                             _flushBuffer( &_r );
+                            _r.wp = _r.rp = 0;
                         }
 
                         /* Flag held status to the UI */
@@ -1584,6 +1944,17 @@ int main( int argc, char *argv[] )
                     _doFilesurface( &_r );
                     break;
 
+                case SIO_EV_CANCEL: // ----------------------- Request to cancel decode ---------------------------------
+                    if ( _r.decoding )
+                    {
+                        /* Keep whatever has been decoded so far */
+                        _collectDecode( &_r );
+                        _stopDecode( &_r );
+                        SIOalert( _r.sio, "Decode cancelled" );
+                    }
+
+                    break;
+
                 case SIO_EV_QUIT: // ------------------------- Request to exit ------------------------------------------
                     _r.ending = true;
                     break;
@@ -1593,7 +1964,7 @@ int main( int argc, char *argv[] )
             }
 
             /* Deal with possible timeout on sampling, or if this is a read-from-file that is finished */
-            if ( ( !_r.numLines )  &&
+            if ( ( !_r.dumped )  &&
                     (
                                 ( _r.options->file && !stream ) ||
                                 ( ( ( genericsTimestampmS() - lastHTime ) > HANG_TIME_MS ) &&
@@ -1658,6 +2029,18 @@ int main( int argc, char *argv[] )
         }
     }
 
+    /* A file run gets to see its decode through before we go, unless it's diving, which won't collect it */
+    if ( _r.options->fileTerminate )
+    {
+        while ( ( _r.decoding ) && ( !_r.diving ) )
+        {
+            usleep( TICK_TIME_MS * 100 );
+            _collectDecode( &_r );
+        }
+    }
+
+    /* Any decode still running is using the symbols, so it has to stop before they go */
+    _stopDecode( &_r );
     symbolDelete( _r.s );
     return OK;
 }
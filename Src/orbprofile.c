@@ -16,6 +16,7 @@
 #include <pthread.h>
 #include <assert.h>
 #include <getopt.h>
+#include <stdatomic.h>
 
 #include "git_version_info.h"
 #include "uthash.h"
@@ -30,23 +31,83 @@
 #define TICK_TIME_MS        (1)          /* Time intervals for checks */
 #define DEFAULT_DURATION_MS (1000)       /* Default time to sample, in mS */
 #define HANDLE_MASK         (0xFFFFFF)   /* cachegrind cannot cope with large file handle numbers */
+#define DEFAULT_STACK_NODES (65536)      /* Default limit on the number of distinct call stacks tracked */
+#define MAX_FILENAME_LEN    (1024)       /* Longest numbered output filename */
 
 enum Prot { PROT_OFLOW, PROT_ETM, PROT_UNKNOWN };
 const char *protString[] = {"OFLOW", "ETM", NULL};
 
-/* How many transfer buffers from the source to allocate */
-#define NUM_RAW_BLOCKS (1000)
+/* Default memory for received data waiting to be processed, in MBytes */
+#define DEFAULT_BUFFER_MB (32)
+
+/* How many places where data were dropped can be waiting for the processor to reach them */
+#define MAX_RX_GAPS (64)
 
 #define DBG_OUT(...) fprintf(stderr,__VA_ARGS__)
 //#define DBG_OUT(...)
 
+/* Records in each chunk of a record arena, and initial slots in an index table (a power of 2) */
+#define ARENA_CHUNK_RECORDS (1024)
+#define INITIAL_TABLE_SLOTS (1024)
+
+/* Initial depth of the call stack, it doubles whenever it fills */
+#define INITIAL_SUBSTACK (64)
+
 struct _subcallAccount
 {
     struct subcallSig sig;
     uint64_t inTicks;
+    uint64_t inCycles;                   /* Cycles attributed when the call was made */
+    uint32_t node;                       /* Call stack tree node of the caller */
+};
+
+/* Records are allocated from a grow-only arena of fixed size chunks. They never move once they're */
+/* placed, so they can be pointed to, and they're all discarded at once by rewinding the arena.    */
+struct recordArena
+{
+    size_t recSize;                      /* Size of each record */
+    uint32_t count;                      /* Records in use */
+    uint32_t chunkCount;                 /* Chunks allocated, kept when the arena is rewound */
+    uint32_t chunksAlloc;                /* Room for chunk pointers */
+    uint8_t **chunks;
+};
+
+/* Slots of the open addressed index tables. Keys are held in the slot, so probing never touches the records */
+struct instSlot
+{
+    uint32_t addr;
+    struct execEntryHash *h;             /* NULL for an empty slot */
+};
+
+struct callSlot
+{
+    struct subcallSig sig;
+    struct subcall *s;                   /* NULL for an empty slot */
+};
+
+/* Instructions executed and calls made, with their indexes */
+struct profileTables
+{
+    struct recordArena insts;            /* Instructions executed */
+    struct recordArena calls;            /* Calls made */
+    struct instSlot *instTable;          /* Instructions by address */
+    uint32_t instMask;                   /* Table slots - 1 */
+    struct callSlot *callTable;          /* Calls by source/dest pair */
+    uint32_t callMask;
 };
 
 
+/* Tables collected over a sample period, handed over for output */
+struct profileSnapshot
+{
+    struct profileTables t;              /* Instructions executed and calls made */
+    struct stackNode *stackTree;         /* Call stacks seen */
+    uint32_t stackNodes;                 /* ...and how many of them there are */
+    uint32_t stackNodesAlloc;
+    uint64_t timelen;                    /* Instructions executed over the period */
+    uint32_t seq;                        /* Sequence number of this period, for numbering files */
+};
+
 /* ---------- CONFIGURATION ----------------- */
 struct Options                           /* Record for options, either defaults or from command line */
 {
@@ -62,6 +123,13 @@ struct Options                           /* Record for options, either defaults
 
     char *dotfile;                       /* File to output dot information */
     char *profile;                       /* File to output profile information */
+    char *foldedfile;                    /* File to output folded call stacks */
+    char *ssfile;                        /* File to output speedscope call stacks */
+    uint32_t stackNodes;                 /* Limit on the number of distinct call stacks tracked */
+    bool continuous;                     /* Keep sampling, writing numbered output files every sampleDuration */
+    bool cycles;                         /* Trace is cycle accurate, attribute cycles to instructions and calls */
+    uint32_t bufferMB;                   /* Memory for received data waiting to be processed */
+    char *spillfile;                     /* File to spill received data to when there's no room for it */
     int  sampleDuration;                 /* How long we are going to sample for */
     bool mono;                           /* Supress colour in output */
     bool noaltAddr;                      /* Dont use alternate addressing */
@@ -77,6 +145,8 @@ struct Options                           /* Record for options, either defaults
 {
     .demangle       = true,
     .sampleDuration = DEFAULT_DURATION_MS,
+    .stackNodes     = DEFAULT_STACK_NODES,
+    .bufferMB       = DEFAULT_BUFFER_MB,
     .port           = OFCLIENT_SERVER_PORT,
     .tProtocol      = TRACE_PROT_ETM35,
     .tag            = 2,
@@ -96,15 +166,54 @@ struct opConstruct
     uint64_t firsttstamp;                /* First timestamp we recorded (that was valid) */
     uint64_t lasttstamp;                 /* Last timestamp we recorded (that was valid) */
 
+    uint64_t cycles;                     /* Cycles attributed to instructions so far */
+    uint64_t pendingCycles;              /* Cycles reported that are waiting for instructions to be attributed to */
+    uint64_t cycleShare;                 /* Cycles for each instruction of the current record */
+    uint64_t cycleExtra;                 /* ...and the remainder, which goes to the first of them */
+
     bool isExceptReturn;                 /* Is this flagged as an exception return? */
     bool isException;                    /* Is this flagged as an exception? */
 };
 
-/* A block of received data */
-struct dataBlock
+/* Received data pass from the receiver to the processor through a single producer, single consumer   */
+/* ring of bytes. Each side only moves its own position, publishing it with release semantics and      */
+/* reading the other's with acquire, so neither side takes a lock while data are flowing. A side only  */
+/* sleeps when it can't make progress, and is only woken (under the mutex) if it said it was sleeping. */
+struct rxRing
 {
-    ssize_t fillLevel;
-    uint8_t buffer[TRANSFER_SIZE];
+    uint8_t *buffer;                     /* The ring itself */
+    size_t size;                         /* ...and its size in bytes */
+    _Atomic size_t wp;                   /* Total bytes written into the ring, only moved by the receiver */
+    _Atomic size_t rp;                   /* Total bytes read from the ring, only moved by the processor */
+    atomic_bool closed;                  /* Receiver has finished, nothing more will arrive */
+
+    pthread_mutex_t m;                   /* Sleeping and waking of either side */
+    pthread_cond_t c;
+    atomic_bool consumerWaiting;         /* Processor is going to sleep for want of data */
+    atomic_bool producerWaiting;         /* Receiver is going to sleep for want of space */
+
+    /* What happens when there's no room for data that arrive */
+    uint64_t dropped;                    /* Bytes dropped because there wasn't room for them */
+    bool lost;                           /* Data were dropped since the last write into the ring */
+    size_t gaps[MAX_RX_GAPS];            /* Ring positions following dropped data, where decode must resync */
+    _Atomic uint32_t gapw;               /* Gaps recorded, only moved by the receiver */
+    _Atomic uint32_t gapr;               /* Gaps reached, only moved by the processor */
+    FILE *spillw;                        /* Spill file, receiver side */
+    FILE *spillr;                        /* ...and processor side */
+    _Atomic uint64_t spillWritten;       /* Total bytes written to the spill file */
+    _Atomic uint64_t spillRead;          /* Total bytes read back from it */
+    uint8_t *overflowBuffer;             /* Receive buffer used when there's no room in the ring */
+    uint8_t *spillBuffer;                /* Buffer for data read back from the spill file */
+};
+
+/* A DOT file being written on a thread of its own, alongside the profile */
+struct dotJob
+{
+    char *dotfile;                       /* File to write */
+    struct subcall **calls;              /* Calls to write, which this job sorts */
+    uint32_t callCount;                  /* ...and how many there are */
+    struct SymbolSet *ss;                /* Symbols to name them from */
+    bool ok;                             /* Result of writing */
 };
 
 /* ----------- LIVE STATE ----------------- */
@@ -115,17 +224,27 @@ struct RunTime
 
     /* Subsystem data support */
     struct TRACEDecoder i;
+    struct TRACERecord *rec;                    /* Trace record being processed */
+    uint32_t heldChanges;                       /* Changes from earlier records that haven't been acted on yet */
     struct SymbolSet *s;                        /* Symbols read from elf */
     struct OFLOW c;
 
     /* Calls related info */
     struct edge *calls;                         /* Call data table */
-    struct subcall *subhead;                    /* Calls onstruct data */
-    struct execEntryHash *insthead;             /* Exec table handle for hash */
+    struct profileTables t;                     /* Instructions executed and calls made */
 
     /* Subroutine related info...the call stack and its length */
     struct _subcallAccount *substack;           /* Calls stack data */
     uint32_t substacklen;                       /* Calls stack length */
+    uint32_t substackAlloc;                     /* Calls stack entries allocated */
+
+    /* Call stacks seen, as a tree of frames with the instructions executed in each */
+    struct stackNode *stackTree;                /* Tree of frames, the root is entry 0 */
+    uint32_t stackNodes;                        /* Number of frames in use */
+    uint32_t stackNodesAlloc;                   /* Number of frames allocated */
+    uint32_t stackNode;                         /* Frame of the code executing now */
+    uint32_t stackFn;                           /* Function of the code executing now */
+    uint64_t stackFull;                         /* Number of new frames folded into their caller cos the tree was full */
 
     /* Stats about the run */
     int instCount;                              /* Number of instruction locations */
@@ -137,16 +256,22 @@ struct RunTime
 
     /* Subprocess control and interworking */
     pthread_t processThread;                    /* Thread handling received data flow */
-    pthread_cond_t dataForClients;              /* Semaphore counting data for clients */
-    pthread_mutex_t dataForClients_m;           /* Mutex for counting data for clients */
 
     /* Ring buffer for samples ... this 'pads' the rate data arrive and how fast they can be processed */
-    int wp;                                     /* Read and write pointers into transfer buffers */
-    int rp;
-    struct dataBlock rawBlock[NUM_RAW_BLOCKS];  /* Transfer buffers from the receiver */
+    struct rxRing q;
+
+    /* Continuous mode. The processor hands the tables for a period over to the writer and starts afresh */
+    pthread_t writerThread;                     /* Thread writing output files */
+    pthread_cond_t snapshotReady;               /* Signal to writer that a snapshot is ready */
+    pthread_mutex_t snapshotReady_m;            /* ...and its mutex, also covering snapshotBusy */
+    volatile bool snapshotRequested;            /* End of period, tables should be handed over */
+    bool snapshotBusy;                          /* Writer still has the last snapshot */
+    struct profileSnapshot snapshot;            /* Snapshot being written */
+    uint32_t snapshotSeq;                       /* Sequence number of the next snapshot */
+    uint64_t snapshotsMissed;                   /* Periods merged into the next one cos writer was busy */
 
     /* State info */
-    volatile bool ending;                       /* Flag indicating app is terminating */
+    atomic_bool ending;                         /* Flag indicating app is terminating */
     bool     sampling;                          /* Are we actively sampling at the moment */
     uint32_t starttime;                         /* At what time did we start sampling? */
 
@@ -165,34 +290,265 @@ struct RunTime
 // ====================================================================================================
 // ====================================================================================================
 // ====================================================================================================
-static void _callEvent( struct RunTime *r, uint32_t retAddr, uint32_t to )
+static void *_arenaAlloc( struct recordArena *a )
 
-/* This is a call or a return, manipulate stack tracking appropriately */
+/* Return a new zeroed record, only going to the heap when all of the chunks are in use */
 
 {
-    struct TRACECPUState *cpu = TRACECPUState( &r->i );
-    struct subcall *s;
+    if ( a->count == a->chunkCount * ARENA_CHUNK_RECORDS )
+    {
+        if ( a->chunkCount == a->chunksAlloc )
+        {
+            a->chunksAlloc = a->chunksAlloc ? a->chunksAlloc * 2 : 16;
+            a->chunks = ( uint8_t ** )realloc( a->chunks, a->chunksAlloc * sizeof( uint8_t * ) );
+            MEMCHECK( a->chunks, NULL );
+        }
 
-    /* ...add it to the call stack */
-    r->substack = ( struct _subcallAccount * )realloc( r->substack, ( r->substacklen + 1 ) * sizeof( struct _subcallAccount ) );
+        a->chunks[a->chunkCount] = ( uint8_t * )malloc( ARENA_CHUNK_RECORDS * a->recSize );
+        MEMCHECK( a->chunks[a->chunkCount], NULL );
+        a->chunkCount++;
+    }
 
-    /* This is a call */
-    r->substack[r->substacklen].sig.src     = retAddr;
-    r->substack[r->substacklen].sig.dst     = to;
-    r->substack[r->substacklen].inTicks     = cpu->instCount;
+    void *rec = &a->chunks[a->count / ARENA_CHUNK_RECORDS][( a->count % ARENA_CHUNK_RECORDS ) * a->recSize];
+    a->count++;
+    memset( rec, 0, a->recSize );
+    return rec;
+}
+// ====================================================================================================
+static void *_arenaRecord( struct recordArena *a, uint32_t i )
+
+/* Return the i'th record allocated */
+
+{
+    return &a->chunks[i / ARENA_CHUNK_RECORDS][( i % ARENA_CHUNK_RECORDS ) * a->recSize];
+}
+// ====================================================================================================
+static inline uint32_t _hashMix( uint32_t x )
+
+/* Spread the bits of a key, so nearby addresses don't cluster in the tables */
+
+{
+    x ^= x >> 16;
+    x *= 0x45d9f3b;
+    x ^= x >> 16;
+    x *= 0x45d9f3b;
+    return x ^ ( x >> 16 );
+}
+// ====================================================================================================
+static inline uint32_t _sigHash( struct subcallSig *sig )
+
+{
+    return _hashMix( sig->src ^ _hashMix( sig->dst ) );
+}
+// ====================================================================================================
+static struct execEntryHash *_instFind( struct profileTables *t, uint32_t addr )
+
+/* Find the record for an address, or NULL if it's not been seen */
+
+{
+    for ( uint32_t i = _hashMix( addr ) & t->instMask; t->instTable[i].h; i = ( i + 1 ) & t->instMask )
+    {
+        if ( t->instTable[i].addr == addr )
+        {
+            return t->instTable[i].h;
+        }
+    }
+
+    return NULL;
+}
+// ====================================================================================================
+static struct subcall *_callFind( struct profileTables *t, struct subcallSig *sig )
+
+/* Find the record for a source/dest pair, or NULL if it's not been seen */
+
+{
+    for ( uint32_t i = _sigHash( sig ) & t->callMask; t->callTable[i].s; i = ( i + 1 ) & t->callMask )
+    {
+        if ( ( t->callTable[i].sig.src == sig->src ) && ( t->callTable[i].sig.dst == sig->dst ) )
+        {
+            return t->callTable[i].s;
+        }
+    }
+
+    return NULL;
+}
+// ====================================================================================================
+static void _instIndex( struct profileTables *t, struct execEntryHash *h )
+
+/* Add a record to the instruction index, which must not already contain its address */
+
+{
+    uint32_t i;
+
+    for ( i = _hashMix( h->addr ) & t->instMask; t->instTable[i].h; i = ( i + 1 ) & t->instMask )
+    {}
+
+    t->instTable[i].addr = h->addr;
+    t->instTable[i].h    = h;
+}
+// ====================================================================================================
+static void _callIndex( struct profileTables *t, struct subcall *s )
+
+/* Add a record to the call index, which must not already contain its source/dest pair */
+
+{
+    uint32_t i;
+
+    for ( i = _sigHash( &s->sig ) & t->callMask; t->callTable[i].s; i = ( i + 1 ) & t->callMask )
+    {}
+
+    t->callTable[i].sig = s->sig;
+    t->callTable[i].s   = s;
+}
+// ====================================================================================================
+static bool _tablesGrow( struct profileTables *t )
+
+/* Keep the indexes no more than half full, doubling them and re-indexing the records when they get there */
+
+{
+    if ( t->insts.count * 2 > t->instMask )
+    {
+        free( t->instTable );
+        t->instMask = t->instMask * 2 + 1;
+        t->instTable = ( struct instSlot * )calloc( t->instMask + 1, sizeof( struct instSlot ) );
+        MEMCHECK( t->instTable, false );
+
+        for ( uint32_t i = 0; i < t->insts.count; i++ )
+        {
+            _instIndex( t, ( struct execEntryHash * )_arenaRecord( &t->insts, i ) );
+        }
+    }
+
+    if ( t->calls.count * 2 > t->callMask )
+    {
+        free( t->callTable );
+        t->callMask = t->callMask * 2 + 1;
+        t->callTable = ( struct callSlot * )calloc( t->callMask + 1, sizeof( struct callSlot ) );
+        MEMCHECK( t->callTable, false );
+
+        for ( uint32_t i = 0; i < t->calls.count; i++ )
+        {
+            _callIndex( t, ( struct subcall * )_arenaRecord( &t->calls, i ) );
+        }
+    }
+
+    return true;
+}
+// ====================================================================================================
+static void _tablesInit( struct profileTables *t )
+
+/* Establish an empty set of tables */
+
+{
+    t->insts.recSize = sizeof( struct execEntryHash );
+    t->calls.recSize = sizeof( struct subcall );
+    t->instMask = t->callMask = INITIAL_TABLE_SLOTS - 1;
+    t->instTable = ( struct instSlot * )calloc( INITIAL_TABLE_SLOTS, sizeof( struct instSlot ) );
+    MEMCHECKV( t->instTable );
+    t->callTable = ( struct callSlot * )calloc( INITIAL_TABLE_SLOTS, sizeof( struct callSlot ) );
+    MEMCHECKV( t->callTable );
+}
+// ====================================================================================================
+static void _tablesEmpty( struct profileTables *t )
+
+/* Discard everything in the tables, keeping their memory for re-use */
+
+{
+    t->insts.count = 0;
+    t->calls.count = 0;
+    memset( t->instTable, 0, ( t->instMask + 1 ) * sizeof( struct instSlot ) );
+    memset( t->callTable, 0, ( t->callMask + 1 ) * sizeof( struct callSlot ) );
+}
+// ====================================================================================================
+static void _hashFindOrCreate( struct RunTime *r, uint32_t addr, struct execEntryHash **h )
+{
+    struct nameEntry n;
+
+    *h = _instFind( &r->t, addr );
+
+    if ( !( *h ) )
+    {
+        /* We don't have this address captured yet, do it now */
+        if ( SymbolLookup( r->s, addr, &n ) )
+        {
+            if ( n.assyLine == ASSY_NOT_FOUND )
+            {
+                genericsExit( -1, "No assembly for function at address %08x, %s" EOL, addr, SymbolFunction( r->s, n.functionindex ) );
+            }
+
+            *h = ( struct execEntryHash * )_arenaAlloc( &r->t.insts );
+            MEMCHECKV( *h );
 
-    /* Find a record for this source/dest pair */
-    HASH_FIND( hh, r->subhead, &r->substack[r->substacklen].sig, sizeof( struct subcallSig ), s );
+            ( *h )->addr          = addr;
+            ( *h )->fileindex     = n.fileindex;
+            ( *h )->line          = n.line;
+            ( *h )->functionindex = n.functionindex;
+            ( *h )->isJump        = n.assy[n.assyLine].isJump;
+            ( *h )->isSubCall     = n.assy[n.assyLine].isSubCall;
+            ( *h )->isReturn      = n.assy[n.assyLine].isReturn;
+            ( *h )->jumpdest      = n.assy[n.assyLine].jumpdest;
+            ( *h )->is4Byte       = n.assy[n.assyLine].is4Byte;
+            ( *h )->codes         = n.assy[n.assyLine].codes;
+            ( *h )->assyText      = n.assy[n.assyLine].lineText;
+        }
+        else
+        {
+            genericsExit( -1, "No symbol for address %08x" EOL, addr );
+        }
+
+        _instIndex( &r->t, *h );
+        _tablesGrow( &r->t );
+    }
+}
+// ====================================================================================================
+static struct subcall *_subcallFindOrCreate( struct RunTime *r, struct subcallSig *sig, struct execEntryHash *srch )
+
+/* Find the record for this source/dest pair, or create it with srch as its calling side */
+
+{
+    struct subcall *s;
+
+    s = _callFind( &r->t, sig );
 
     if ( !s )
     {
         /* This call entry doesn't exist (i.e. it's the first time this from/to pair have been seen...let's create it */
-        s = ( struct subcall * )calloc( 1, sizeof( struct subcall ) );
-        MEMCHECKV( s );
-        memcpy( &s->sig, &r->substack[r->substacklen].sig, sizeof( struct subcallSig ) );
-        HASH_ADD( hh, r->subhead, sig, sizeof( struct subcallSig ), s );
+        s = ( struct subcall * )_arenaAlloc( &r->t.calls );
+        MEMCHECK( s, NULL );
+        memcpy( &s->sig, sig, sizeof( struct subcallSig ) );
+        s->srch = srch;
+        _callIndex( &r->t, s );
+        _tablesGrow( &r->t );
+        _hashFindOrCreate( r, sig->dst, &s->dsth );
+    }
+
+    return s;
+}
+// ====================================================================================================
+static void _callEvent( struct RunTime *r, uint32_t retAddr, uint32_t to )
+
+/* This is a call or a return, manipulate stack tracking appropriately */
+
+{
+    /* ...add it to the call stack, making room if needed */
+    if ( r->substacklen == r->substackAlloc )
+    {
+        r->substackAlloc = r->substackAlloc ? r->substackAlloc * 2 : INITIAL_SUBSTACK;
+        r->substack = ( struct _subcallAccount * )realloc( r->substack, r->substackAlloc * sizeof( struct _subcallAccount ) );
+        MEMCHECKV( r->substack );
     }
 
+    /* This is a call */
+    r->substack[r->substacklen].sig.src     = retAddr;
+    r->substack[r->substacklen].sig.dst     = to;
+    r->substack[r->substacklen].inTicks     = r->rec->instCount;
+    r->substack[r->substacklen].inCycles    = r->op.cycles;
+    r->substack[r->substacklen].node        = r->stackNode;
+
+    /* Make sure there's a record for this source/dest pair. The calling side is the instruction */
+    /* that made the call, or the interrupt source if we haven't executed anything yet.          */
+    _subcallFindOrCreate( r, &r->substack[r->substacklen].sig, r->op.h ? r->op.h : r->op.inth );
+
     r->substacklen++;
 
     for ( uint32_t g = 0; g < r->substacklen; g++ )
@@ -208,13 +564,14 @@ static void _returnEvent( struct RunTime *r, uint32_t to )
 /* This is a return, manipulate stack tracking appropriately */
 
 {
-    struct TRACECPUState *cpu = TRACECPUState( &r->i );
     struct subcall *s;
     uint32_t orig = r->substacklen;
 
     /* Cover the startup case that we happen to hit a return before a call */
     if ( !r->substack )
     {
+        r->stackNode = STACK_ROOT;
+        r->stackFn   = NO_FUNCTION;
         return;
     }
 
@@ -236,15 +593,20 @@ static void _returnEvent( struct RunTime *r, uint32_t to )
         }
 
         DBG_OUT( " DEC:%3d %08x " EOL, r->substacklen + 1, r->substack[r->substacklen].sig.src );
-        HASH_FIND( hh, r->subhead, &r->substack[r->substacklen].sig, sizeof( struct subcallSig ), s );
+        s = _callFind( &r->t, &r->substack[r->substacklen].sig );
         assert( s );
 
-        /* We don't bother deallocating memory here cos it'll be done the next time we make a call */
-        s->myCost += cpu->instCount - r->substack[r->substacklen].inTicks;
+        s->myCost += r->rec->instCount - r->substack[r->substacklen].inTicks;
+        s->myCycles += r->op.cycles - r->substack[r->substacklen].inCycles;
         s->count++;
     }
     while ( to != r->substack[r->substacklen].sig.src );
 
+    /* We're back in the frame that made the outermost call popped. If nothing was popped then we */
+    /* don't know who called us, so the code we return to starts a new stack.                      */
+    r->stackNode = ( r->substacklen != orig ) ? r->substack[r->substacklen].node : STACK_ROOT;
+    r->stackFn   = r->stackTree[r->stackNode].functionindex;
+
     /* Check function we popped back to matches where we think we should be */
     if ( to != r->substack[r->substacklen].sig.src )
     {
@@ -257,44 +619,55 @@ static void _returnEvent( struct RunTime *r, uint32_t to )
     }
 }
 // ====================================================================================================
-static void _hashFindOrCreate( struct RunTime *r, uint32_t addr, struct execEntryHash **h )
-{
-    struct nameEntry n;
+static uint32_t _stackFrame( struct RunTime *r, uint32_t node, struct execEntryHash *h )
 
-    HASH_FIND_INT( r->insthead, &addr, *h );
+/* Find the frame for the function of h, entered from the frame node. Recursion folds back onto */
+/* the earlier frame for the function, so the tree only grows with distinct call stacks.        */
 
-    if ( !( *h ) )
+{
+    struct stackNode *f;
+    uint32_t n;
+
+    for ( n = node; n != STACK_ROOT; n = r->stackTree[n].parent )
     {
-        /* We don't have this address captured yet, do it now */
-        if ( SymbolLookup( r->s, r->op.workingAddr, &n ) )
+        if ( r->stackTree[n].functionindex == h->functionindex )
         {
-            if ( n.assyLine == ASSY_NOT_FOUND )
-            {
-                genericsExit( -1, "No assembly for function at address %08x, %s" EOL, r->op.workingAddr, SymbolFunction( r->s, n.functionindex ) );
-            }
-
-            *h = calloc( 1, sizeof( struct execEntryHash ) );
-            MEMCHECKV( *h );
-
-            ( *h )->addr          = r->op.workingAddr;
-            ( *h )->fileindex     = n.fileindex;
-            ( *h )->line          = n.line;
-            ( *h )->functionindex = n.functionindex;
-            ( *h )->isJump        = n.assy[n.assyLine].isJump;
-            ( *h )->isSubCall     = n.assy[n.assyLine].isSubCall;
-            ( *h )->isReturn      = n.assy[n.assyLine].isReturn;
-            ( *h )->jumpdest      = n.assy[n.assyLine].jumpdest;
-            ( *h )->is4Byte       = n.assy[n.assyLine].is4Byte;
-            ( *h )->codes         = n.assy[n.assyLine].codes;
-            ( *h )->assyText      = n.assy[n.assyLine].lineText;
+            return n;
         }
-        else
+    }
+
+    for ( n = r->stackTree[node].child; n != STACK_ROOT; n = r->stackTree[n].sibling )
+    {
+        if ( r->stackTree[n].functionindex == h->functionindex )
         {
-            genericsExit( -1, "No symbol for address %08x" EOL, r->op.workingAddr );
+            return n;
         }
+    }
+
+    /* This is a new call stack, so it needs a frame of its own if there's room for it */
+    if ( r->stackNodes == r->options->stackNodes )
+    {
+        r->stackFull++;
+        return node;
+    }
 
-        HASH_ADD_INT( r->insthead, addr, ( *h ) );
+    if ( r->stackNodes == r->stackNodesAlloc )
+    {
+        r->stackNodesAlloc = ( r->stackNodesAlloc * 2 < r->options->stackNodes ) ? r->stackNodesAlloc * 2 : r->options->stackNodes;
+        r->stackTree = ( struct stackNode * )realloc( r->stackTree, r->stackNodesAlloc * sizeof( struct stackNode ) );
+        MEMCHECK( r->stackTree, node );
     }
+
+    n = r->stackNodes++;
+    f = &r->stackTree[n];
+    f->functionindex = h->functionindex;
+    f->fileindex     = h->fileindex;
+    f->parent        = node;
+    f->child         = STACK_ROOT;
+    f->sibling       = r->stackTree[node].child;
+    f->count         = 0;
+    r->stackTree[node].child = n;
+    return n;
 }
 // ====================================================================================================
 static void _handleInstruction( struct RunTime *r, bool actioned )
@@ -315,6 +688,21 @@ static void _handleInstruction( struct RunTime *r, bool actioned )
     /* OK, by hook or by crook we've got an address entry now, so increment the number of executions */
     r->op.h->count++;
 
+    /* ...and add the cycles it took, when the trace tells us */
+    uint64_t cycles = r->op.cycleShare + r->op.cycleExtra;
+    r->op.cycleExtra = 0;
+    r->op.h->cycles += cycles;
+    r->op.cycles += cycles;
+
+    /* ...and account it to the call stack, moving to a new frame if we've arrived in a different function */
+    if ( r->op.h->functionindex != r->stackFn )
+    {
+        r->stackNode = _stackFrame( r, r->stackNode, r->op.h );
+        r->stackFn   = r->op.h->functionindex;
+    }
+
+    r->stackTree[r->stackNode].count++;
+
     /* If source postion changed then update source code line visitation counts too */
     if ( ( r->op.oldh ) && ( ( r->op.h->line != r->op.oldh->line ) || ( r->op.h->functionindex != r->op.oldh->functionindex ) ) )
     {
@@ -341,7 +729,7 @@ static void _checkJumps( struct RunTime *r )
     if ( r->op.h )
     {
 
-        if ( ( TRACEStateChanged( &r->i, EV_CH_EX_EXIT ) ) || ( r->op.h->isReturn ) )
+        if ( ( TRACERecordChanged( r->rec, EV_CH_EX_EXIT ) ) || ( r->op.h->isReturn ) )
         {
             _returnEvent( r, r->op.workingAddr );
         }
@@ -353,13 +741,28 @@ static void _checkJumps( struct RunTime *r )
     }
 }
 // ====================================================================================================
-static void _traceCB( void *d )
+static void _addInterruptEntry( struct RunTime *r )
+
+/* Create false entry for an interrupt source */
+
+{
+    r->op.inth = ( struct execEntryHash * )_arenaAlloc( &r->t.insts );
+
+    MEMCHECKV( r->op.inth );
+    r->op.inth->addr          = INTERRUPT;
+    r->op.inth->fileindex     = INTERRUPT;
+    r->op.inth->line          = NO_LINE;
+    r->op.inth->count         = 0;
+    r->op.inth->functionindex = INTERRUPT;
+    _instIndex( &r->t, r->op.inth );
+    _tablesGrow( &r->t );
+}
+// ====================================================================================================
+static void _traceRecord( struct RunTime *r, struct TRACERecord *rec )
 
-/* Callback function for when valid TRACE decode is detected */
+/* Handle a record of valid TRACE decode */
 
 {
-    struct RunTime *r       = ( struct RunTime * )d;
-    struct TRACECPUState *cpu = TRACECPUState( &r->i );
     static uint32_t incAddr        = 0;
     static uint32_t disposition    = 0;
 
@@ -367,39 +770,33 @@ static void _traceCB( void *d )
     /* if these are the first data, then reset counters etc.  */
     if ( !r->sampling )
     {
-        r->op.firsttstamp = cpu->instCount;
+        r->op.firsttstamp = rec->instCount;
         genericsReport( V_INFO, "Sampling" EOL );
         /* Fill in a time to start from */
         r->starttime = genericsTimestampmS();
 
-        if ( TRACEStateChanged( &r->i, EV_CH_ADDRESS ) )
+        if ( TRACERecordChanged( rec, EV_CH_ADDRESS ) )
         {
-            r->op.workingAddr = cpu->addr;
+            r->op.workingAddr = rec->addr;
             DBG_OUT( "Got initial address %08x" EOL, r->op.workingAddr );
             r->sampling  = true;
         }
 
-        /* Create false entry for an interrupt source */
-        r->op.inth = calloc( 1, sizeof( struct execEntryHash ) );
-
-        MEMCHECKV( r->op.inth );
-        r->op.inth->addr          = INTERRUPT;
-        r->op.inth->fileindex     = INTERRUPT;
-        r->op.inth->line          = NO_LINE;
-        r->op.inth->count         = NO_LINE;
-        r->op.inth->functionindex = INTERRUPT;
-        HASH_ADD_INT( r->insthead, addr, r->op.inth );
+        if ( !r->op.inth )
+        {
+            _addInterruptEntry( r );
+        }
     }
 
-    r->op.lasttstamp = cpu->instCount;
+    r->op.lasttstamp = rec->instCount;
 
     /* Pull changes introduced by this event ============================== */
 
-    if ( TRACEStateChanged( &r->i, EV_CH_ENATOMS ) )
+    if ( TRACERecordChanged( rec, EV_CH_ENATOMS ) )
     {
         /* We are going to execute some instructions. Check if the last of the old batch of    */
         /* instructions was cancelled and, if it wasn't and it's still outstanding, action it. */
-        if ( TRACEStateChanged( &r->i, EV_CH_CANCELLED ) )
+        if ( TRACERecordChanged( rec, EV_CH_CANCELLED ) )
         {
             DBG_OUT( "CANCELLED" EOL );
         }
@@ -412,10 +809,10 @@ static void _traceCB( void *d )
 
                 if ( ( r->op.h->isJump ) || ( r->op.h->isSubCall ) || ( r->op.h->isReturn ) )
                 {
-                    if ( TRACEStateChanged( &r->i, EV_CH_ADDRESS ) )
+                    if ( TRACERecordChanged( rec, EV_CH_ADDRESS ) )
                     {
-                        DBG_OUT( "New addr %08x" EOL, cpu->addr );
-                        r->op.workingAddr = cpu->addr;
+                        DBG_OUT( "New addr %08x" EOL, rec->addr );
+                        r->op.workingAddr = rec->addr;
                     }
 
                     _checkJumps( r );
@@ -423,24 +820,38 @@ static void _traceCB( void *d )
             }
         }
 
-        if ( TRACEStateChanged( &r->i, EV_CH_ADDRESS ) )
+        if ( TRACERecordChanged( rec, EV_CH_ADDRESS ) )
         {
-            if ( TRACEStateChanged( &r->i, EV_CH_EX_ENTRY ) )
+            if ( TRACERecordChanged( rec, EV_CH_EX_ENTRY ) )
             {
                 DBG_OUT( "INTERRUPT!!" EOL );
-                _callEvent( r, r->op.workingAddr, cpu->addr );
+                _callEvent( r, r->op.workingAddr, rec->addr );
             }
 
-            r->op.workingAddr = cpu->addr;
-            DBG_OUT( "A:%08x" EOL, cpu->addr );
+            r->op.workingAddr = rec->addr;
+            DBG_OUT( "A:%08x" EOL, rec->addr );
         }
 
         /* ================================================ */
         /* OK, now collect the next iterations worth of fun */
         /* ================================================ */
-        incAddr     = cpu->eatoms + cpu->natoms;
-        disposition = cpu->disposition;
-        DBG_OUT( "E:%d N:%d" EOL, cpu->eatoms, cpu->natoms );
+        incAddr     = rec->eatoms + rec->natoms;
+        disposition = rec->disposition;
+        DBG_OUT( "E:%d N:%d" EOL, rec->eatoms, rec->natoms );
+
+        /* In cycle accurate trace each cycle is reported alongside the atoms it was spent on. They're  */
+        /* shared between the instructions of these atoms, or wait for the next ones if there are none. */
+        if ( TRACERecordChanged( rec, EV_CH_WATOMS ) )
+        {
+            r->op.pendingCycles += rec->watoms;
+        }
+
+        if ( incAddr )
+        {
+            r->op.cycleShare    = r->op.pendingCycles / incAddr;
+            r->op.cycleExtra    = r->op.pendingCycles % incAddr;
+            r->op.pendingCycles = 0;
+        }
 
         /* Action those changes, except the last one */
         while ( incAddr > 1 )
@@ -453,24 +864,49 @@ static void _traceCB( void *d )
     }
 }
 
+// ====================================================================================================
+static void _traceCB( struct TRACERecord *rec, int n, void *d )
+
+/* Callback function for when a batch of valid TRACE decode is available */
+
+{
+    struct RunTime *r = ( struct RunTime * )d;
+
+    while ( n-- )
+    {
+        /* Changes are only acted on alongside atoms, so anything a record reported that wasn't used */
+        /* (e.g. the address from a branch packet) is carried into the next one.                    */
+        r->rec = rec++;
+        r->rec->changes |= r->heldChanges;
+        _traceRecord( r, r->rec );
+        r->heldChanges = r->rec->changes;
+    }
+}
 // ====================================================================================================
 static void _printHelp( const char *const progName )
 
 {
     genericsFPrintf( stderr, "Usage: %s [options]" EOL, progName );
     genericsFPrintf( stderr, "    -A, --alt-addr-enc: Switch off alternate address decoding (on by default)" EOL );
+    genericsFPrintf( stderr, "    -c, --cycles:       Trace is cycle accurate, add cycles spent to the profile" EOL );
+    genericsFPrintf( stderr, "    -C, --continuous:   Keep sampling, writing numbered output files every interval" EOL );
     genericsFPrintf( stderr, "    -D, --no-demangle:  Switch off C++ symbol demangling" EOL );
     genericsFPrintf( stderr, "    -d, --del-prefix:   <String> Material to delete off front of filenames" EOL );
     genericsFPrintf( stderr, "    -e, --elf-file:     <ElfFile> to use for symbols" EOL );
     genericsFPrintf( stderr, "    -E, --eof:          When reading from file, terminate at EOF" EOL );
     genericsFPrintf( stderr, "    -f, --input-file:   Take input from specified file" EOL );
+    genericsFPrintf( stderr, "    -F, --folded-file:  <Filename> folded call stacks output, for flame graphs" EOL );
     genericsFPrintf( stderr, "    -h, --help:         This help" EOL );
     genericsFPrintf( stderr, "    -I, --interval:     <Interval> Time between samples (in ms)" EOL );
+    genericsFPrintf( stderr, "    -m, --buffer-mem:   <MBytes> Memory for received data waiting to be processed, default %d" EOL, DEFAULT_BUFFER_MB );
     genericsFPrintf( stderr, "    -M, --no-colour:    Supress colour in output" EOL );
+    genericsFPrintf( stderr, "    -N, --stack-nodes:  <Count> Limit on distinct call stacks tracked, default %d" EOL, DEFAULT_STACK_NODES );
+    genericsFPrintf( stderr, "    -o, --spill-file:   <Filename> Spill received data here when buffer is full, rather than dropping them" EOL );
     genericsFPrintf( stderr, "    -O, --objdump-opts: <options> Options to pass directly to objdump" EOL );
     genericsFPrintf( stderr, "    -P, --trace-proto:  {ETM35|MTB} trace protocol to use, default is ETM35" EOL );
     genericsFPrintf( stderr, "    -p, --protocol:     Protocol to communicate. Defaults to OFLOW if -s is not set, otherwise raw ETM" EOL );
     genericsFPrintf( stderr, "    -s, --server:       <Server>:<Port> to use" EOL );
+    genericsFPrintf( stderr, "    -S, --speedscope:   <Filename> speedscope call stacks output" EOL );
     genericsFPrintf( stderr, "    -t, --tag:          <stream>: Which OFLOW tag to use (normally 2)" EOL );
     genericsFPrintf( stderr, "    -T, --all-truncate: truncate -d material off all references (i.e. make output relative)" EOL );
     genericsFPrintf( stderr, "    -v, --verbose:      <level> Verbose mode 0(errors)..3(debug)" EOL );
@@ -489,19 +925,26 @@ void _printVersion( void )
 static struct option _longOptions[] =
 {
     {"alt-addr-enc", no_argument, NULL, 'A'},
+    {"cycles", no_argument, NULL, 'c'},
+    {"continuous", no_argument, NULL, 'C'},
     {"no-demangle", required_argument, NULL, 'D'},
     {"del-prefix", required_argument, NULL, 'd'},
     {"elf-file", required_argument, NULL, 'e'},
     {"eof", no_argument, NULL, 'E'},
     {"input-file", required_argument, NULL, 'f'},
+    {"folded-file", required_argument, NULL, 'F'},
     {"help", no_argument, NULL, 'h'},
     {"interval", required_argument, NULL, 'I'},
+    {"buffer-mem", required_argument, NULL, 'm'},
     {"no-colour", no_argument, NULL, 'M'},
     {"no-color", no_argument, NULL, 'M'},
+    {"stack-nodes", required_argument, NULL, 'N'},
+    {"spill-file", required_argument, NULL, 'o'},
     {"objdump-opts", required_argument, NULL, 'O'},
     {"trace-proto", required_argument, NULL, 'P'},
     {"protocol", required_argument, NULL, 'p'},
     {"server", required_argument, NULL, 's'},
+    {"speedscope", required_argument, NULL, 'S'},
     {"all-truncate", no_argument, NULL, 'T'},
     {"tag", required_argument, NULL, 't'},
     {"verbose", required_argument, NULL, 'v'},
@@ -518,7 +961,7 @@ static bool _processOptions( int argc, char *argv[], struct RunTime *r )
     bool protExplicit = false;
     bool serverExplicit = false;
 
-    while ( ( c = getopt_long ( argc, argv, "ADd:e:Ef:hVI:MO:P:p:s:t:Tv:y:z:", _longOptions, &optionIndex ) ) != -1 )
+    while ( ( c = getopt_long ( argc, argv, "AcCDd:e:Ef:F:hVI:m:MN:o:O:P:p:s:S:t:Tv:y:z:", _longOptions, &optionIndex ) ) != -1 )
 
         switch ( c )
         {
@@ -527,6 +970,16 @@ static bool _processOptions( int argc, char *argv[], struct RunTime *r )
                 r->options->noaltAddr = true;
                 break;
 
+            // ------------------------------------
+            case 'c':
+                r->options->cycles = true;
+                break;
+
+            // ------------------------------------
+            case 'C':
+                r->options->continuous = true;
+                break;
+
             // ------------------------------------
             case 'd':
                 r->options->deleteMaterial = optarg;
@@ -552,6 +1005,11 @@ static bool _processOptions( int argc, char *argv[], struct RunTime *r )
                 r->options->file = optarg;
                 break;
 
+            // ------------------------------------
+            case 'F':
+                r->options->foldedfile = optarg;
+                break;
+
             // ------------------------------------
             case 'h':
                 _printHelp( r->progName );
@@ -563,6 +1021,16 @@ static bool _processOptions( int argc, char *argv[], struct RunTime *r )
                 r->options->mono = true;
                 break;
 
+            // ------------------------------------
+            case 'm':
+                r->options->bufferMB = atoi( optarg );
+                break;
+
+            // ------------------------------------
+            case 'N':
+                r->options->stackNodes = atoi( optarg );
+                break;
+
             // ------------------------------------
             case 'V':
                 _printVersion();
@@ -573,6 +1041,11 @@ static bool _processOptions( int argc, char *argv[], struct RunTime *r )
                 r->options->sampleDuration = atoi( optarg );
                 break;
 
+            // ------------------------------------
+            case 'o':
+                r->options->spillfile = optarg;
+                break;
+
             // ------------------------------------
 
             case 'O':
@@ -640,6 +1113,11 @@ static bool _processOptions( int argc, char *argv[], struct RunTime *r )
 
                 break;
 
+            // ------------------------------------
+            case 'S':
+                r->options->ssfile = optarg;
+                break;
+
             // ------------------------------------
             case 't':
                 r->options->tag = atoi( optarg );
@@ -707,21 +1185,41 @@ static bool _processOptions( int argc, char *argv[], struct RunTime *r )
         genericsExit( -2, "Illegal sample duration" EOL );
     }
 
+    if ( r->options->stackNodes < 2 )
+    {
+        genericsExit( -2, "Illegal stack node limit" EOL );
+    }
+
+    if ( ( r->options->bufferMB < 1 ) || ( r->options->bufferMB > 65536 ) )
+    {
+        genericsExit( -2, "Illegal buffer memory size" EOL );
+    }
+
     if ( r->options->tProtocol >= TRACE_PROT_NONE )
     {
         genericsExit( V_ERROR, "Unrecognised decode protocol" EOL );
     }
 
+    if ( ( r->options->cycles ) && ( r->options->tProtocol != TRACE_PROT_ETM35 ) )
+    {
+        genericsExit( -2, "Cycle accurate profiling needs ETM35 trace" EOL );
+    }
+
 
     genericsReport( V_INFO, "orbprofile version " GIT_DESCRIBE EOL );
     genericsReport( V_INFO, "Server          : %s:%d" EOL, r->options->server, r->options->port );
     genericsReport( V_INFO, "Delete Material : %s" EOL, r->options->deleteMaterial ? r->options->deleteMaterial : "None" );
     genericsReport( V_INFO, "Elf File        : %s (%s Names)" EOL, r->options->elffile, r->options->truncateDeleteMaterial ? "Truncate" : "Don't Truncate" );
     genericsReport( V_INFO, "Objdump options : %s" EOL, r->options->odoptions ? r->options->odoptions : "None" );
-    genericsReport( V_INFO, "Protocol        : %s" EOL, TRACEDecodeGetProtocolName( r->options->tProtocol ) );
+    genericsReport( V_INFO, "Protocol        : %s%s" EOL, TRACEDecodeGetProtocolName( r->options->tProtocol ), r->options->cycles ? " (Cycle Accurate)" : "" );
     genericsReport( V_INFO, "Orbflow Tag     : %d" EOL, r->options->tag );
     genericsReport( V_INFO, "DOT file        : %s" EOL, r->options->dotfile ? r->options->dotfile : "None" );
-    genericsReport( V_INFO, "Sample Duration : %d mS" EOL, r->options->sampleDuration );
+    genericsReport( V_INFO, "Folded file     : %s" EOL, r->options->foldedfile ? r->options->foldedfile : "None" );
+    genericsReport( V_INFO, "Speedscope file : %s" EOL, r->options->ssfile ? r->options->ssfile : "None" );
+    genericsReport( V_INFO, "Stack nodes     : %u" EOL, r->options->stackNodes );
+    genericsReport( V_INFO, "Buffer memory   : %u MBytes" EOL, r->options->bufferMB );
+    genericsReport( V_INFO, "Spill file      : %s" EOL, r->options->spillfile ? r->options->spillfile : "None (Drop on overflow)" );
+    genericsReport( V_INFO, "Sample Duration : %d mS%s" EOL, r->options->sampleDuration, r->options->continuous ? " (Continuous)" : "" );
 
     switch ( r->options->protocol )
     {
@@ -773,65 +1271,601 @@ static void _OFLOWpacketRxed ( struct OFLOWFrame *p, void *param )
     {
         if ( p->tag == _r.options->tag )
         {
-            TRACEDecoderPump( &_r.i, p->d, p->len, _traceCB, &_r );
+            TRACEDecoderPumpRecords( &_r.i, p->d, p->len, _traceCB, &_r );
         }
     }
 }
 // ====================================================================================================
-static void *_processBlocks( void *params )
+static const char *_numberedName( char *buffer, const char *base, struct profileSnapshot *p, bool numbered )
 
-/* Generic block processor for received data. This runs in a task parallel to the receiver and *
- * processes all of the data that arrive.                                                      */
+/* Return the name of an output file, numbered by period in continuous mode */
 
 {
-    struct RunTime *r = ( struct RunTime * )params;
+    if ( ( !base ) || ( !numbered ) )
+    {
+        return base;
+    }
 
-    while ( true )
+    snprintf( buffer, MAX_FILENAME_LEN, "%s.%u", base, p->seq );
+    return buffer;
+}
+// ====================================================================================================
+static void *_writeDot( void *params )
+
+/* Write a DOT file, on whichever thread calls this */
+
+{
+    struct dotJob *j = ( struct dotJob * )params;
+
+    j->ok = ext_ff_outputDot( j->dotfile, j->calls, j->callCount, j->ss );
+    return NULL;
+}
+// ====================================================================================================
+static void _outputSnapshot( struct RunTime *r, struct profileSnapshot *p, bool numbered )
+
+/* Write the requested output files for a snapshot */
+
+{
+    char dotfile[MAX_FILENAME_LEN];
+    char profile[MAX_FILENAME_LEN];
+    char foldedfile[MAX_FILENAME_LEN];
+    char ssfile[MAX_FILENAME_LEN];
+
+    if ( ext_ff_outputFolded( ( char * )_numberedName( foldedfile, r->options->foldedfile, p, numbered ), p->stackTree, p->stackNodes, r->s ) )
+    {
+        genericsReport( V_INFO, "Output folded call stacks" EOL );
+    }
+    else
     {
-        pthread_cond_wait( &r->dataForClients, &r->dataForClients_m );
+        if ( r->options->foldedfile )
+        {
+            genericsExit( -1, "Failed to output folded call stacks" EOL );
+        }
+    }
 
-        if ( r->rp != ( volatile int )r->wp )
+    if ( ext_ff_outputSpeedscope( ( char * )_numberedName( ssfile, r->options->ssfile, p, numbered ), r->options->elffile, p->stackTree, p->stackNodes, r->s ) )
+    {
+        genericsReport( V_INFO, "Output speedscope call stacks" EOL );
+    }
+    else
+    {
+        if ( r->options->ssfile )
         {
-            genericsReport( V_DEBUG, "RXED Packet of %d bytes" EOL, r->rawBlock[r->rp].fillLevel );
+            genericsExit( -1, "Failed to output speedscope call stacks" EOL );
+        }
+    }
+
+    if ( p->t.calls.count )
+    {
+        /* The writers take arrays of the records, which they sort */
+        struct execEntryHash **insts = ( struct execEntryHash ** )malloc( p->t.insts.count * sizeof( struct execEntryHash * ) );
+        MEMCHECKV( insts );
+        struct subcall **calls = ( struct subcall ** )malloc( p->t.calls.count * sizeof( struct subcall * ) );
+        MEMCHECKV( calls );
 
-            /* Check to see if we've finished (a zero length packet */
-            if ( !r->rawBlock[r->rp].fillLevel )
+        for ( uint32_t i = 0; i < p->t.insts.count; i++ )
+        {
+            insts[i] = ( struct execEntryHash * )_arenaRecord( &p->t.insts, i );
+        }
+
+        for ( uint32_t i = 0; i < p->t.calls.count; i++ )
+        {
+            calls[i] = ( struct subcall * )_arenaRecord( &p->t.calls, i );
+        }
+
+        /* The DOT file and the profile each sort their own copy of the calls, so if both are wanted */
+        /* then the DOT file is written on a thread of its own while the profile is written here.    */
+        struct dotJob dot = { .dotfile = ( char * )_numberedName( dotfile, r->options->dotfile, p, numbered ), .calls = calls, .callCount = p->t.calls.count, .ss = r->s };
+        pthread_t dotThread;
+        bool dotThreaded = false;
+
+        if ( ( dot.dotfile ) && ( r->options->profile ) )
+        {
+            dot.calls = ( struct subcall ** )malloc( p->t.calls.count * sizeof( struct subcall * ) );
+            MEMCHECKV( dot.calls );
+            memcpy( dot.calls, calls, p->t.calls.count * sizeof( struct subcall * ) );
+            dotThreaded = !pthread_create( &dotThread, NULL, &_writeDot, &dot );
+        }
+
+        if ( ( dot.dotfile ) && ( !dotThreaded ) )
+        {
+            _writeDot( &dot );
+        }
+
+        if ( ext_ff_outputProfile( ( char * )_numberedName( profile, r->options->profile, p, numbered ), r->options->elffile,
+                                   r->options->truncateDeleteMaterial ? r->options->deleteMaterial : NULL,
+                                   true,
+                                   r->options->cycles,
+                                   p->timelen,
+                                   insts, p->t.insts.count,
+                                   calls, p->t.calls.count,
+                                   r->s ) )
+        {
+            genericsReport( V_INFO, "Output Profile" EOL );
+        }
+        else
+        {
+            if ( r->options->profile )
             {
-                break;
+                genericsExit( -1, "Failed to output profile" EOL );
             }
+        }
+
+        if ( dotThreaded )
+        {
+            pthread_join( dotThread, NULL );
+        }
+
+        if ( dot.dotfile )
+        {
+            if ( dot.ok )
+            {
+                genericsReport( V_INFO, "Output DOT" EOL );
+            }
+            else
+            {
+                genericsExit( -1, "Failed to output DOT" EOL );
+            }
+        }
+
+        if ( dot.calls != calls )
+        {
+            free( dot.calls );
+        }
+
+        free( insts );
+        free( calls );
+    }
+}
+// ====================================================================================================
+static void _takeSnapshot( struct RunTime *r )
+
+/* Hand the tables for this period over to the writer and start afresh. This runs in the processing  */
+/* thread, between blocks, and never waits for the writer. If the writer still has the last snapshot */
+/* then this period just carries on into the next one. Entries that live state refers to (the last   */
+/* instruction executed and the calls still outstanding) are carried into the new tables. The tables */
+/* swap with the ones the writer emptied last time, so their memory is re-used from period to period */
+
+{
+    struct profileSnapshot *p = &r->snapshot;
+    struct profileTables spare;
+    struct execEntryHash *oldinth = r->op.inth;
+    struct execEntryHash *srch;
+    struct subcall *s;
+
+    r->snapshotRequested = false;
+
+    pthread_mutex_lock( &r->snapshotReady_m );
+
+    if ( r->snapshotBusy )
+    {
+        pthread_mutex_unlock( &r->snapshotReady_m );
+        r->snapshotsMissed++;
+        return;
+    }
+
+    /* The writer has finished emptying these, so they're ours to re-use */
+    spare = p->t;
+    pthread_mutex_unlock( &r->snapshotReady_m );
+
+    p->t        = r->t;
+    p->timelen  = r->op.lasttstamp - r->op.firsttstamp;
+    p->seq      = r->snapshotSeq++;
+
+    /* The call stack tree keeps its shape, since live state refers into it, but starts counting again */
+    if ( p->stackNodesAlloc < r->stackNodes )
+    {
+        p->stackNodesAlloc = r->stackNodesAlloc;
+        p->stackTree = ( struct stackNode * )realloc( p->stackTree, p->stackNodesAlloc * sizeof( struct stackNode ) );
+        MEMCHECKV( p->stackTree );
+    }
+
+    memcpy( p->stackTree, r->stackTree, r->stackNodes * sizeof( struct stackNode ) );
+    p->stackNodes = r->stackNodes;
+
+    for ( uint32_t n = 0; n < r->stackNodes; n++ )
+    {
+        r->stackTree[n].count = 0;
+    }
+
+    /* Start new tables, with whatever the live state needs from the old ones */
+    r->t = spare;
+    r->op.firsttstamp = r->op.lasttstamp;
+    r->op.oldh = NULL;
+
+    if ( oldinth )
+    {
+        _addInterruptEntry( r );
+    }
+
+    if ( r->op.h )
+    {
+        _hashFindOrCreate( r, r->op.h->addr, &r->op.h );
+    }
+
+    for ( uint32_t i = 0; i < r->substacklen; i++ )
+    {
+        s = _callFind( &p->t, &r->substack[i].sig );
+        assert( s );
+
+        if ( s->srch == oldinth )
+        {
+            srch = r->op.inth;
+        }
+        else
+        {
+            _hashFindOrCreate( r, s->srch->addr, &srch );
+        }
+
+        _subcallFindOrCreate( r, &r->substack[i].sig, srch );
+    }
+
+    pthread_mutex_lock( &r->snapshotReady_m );
+    r->snapshotBusy = true;
+    pthread_cond_broadcast( &r->snapshotReady );
+    pthread_mutex_unlock( &r->snapshotReady_m );
+}
+// ====================================================================================================
+static void _waitSnapshotWritten( struct RunTime *r )
+
+/* Wait until the writer has finished with the last snapshot */
+
+{
+    pthread_mutex_lock( &r->snapshotReady_m );
+
+    while ( r->snapshotBusy )
+    {
+        pthread_cond_wait( &r->snapshotReady, &r->snapshotReady_m );
+    }
+
+    pthread_mutex_unlock( &r->snapshotReady_m );
+}
+// ====================================================================================================
+static void *_writeSnapshots( void *params )
+
+/* Output file writer for continuous mode. This runs in a task parallel to the processor, writing */
+/* out each snapshot that it hands over.                                                         */
+
+{
+    struct RunTime *r = ( struct RunTime * )params;
+
+    while ( true )
+    {
+        pthread_mutex_lock( &r->snapshotReady_m );
+
+        while ( !r->snapshotBusy )
+        {
+            pthread_cond_wait( &r->snapshotReady, &r->snapshotReady_m );
+        }
+
+        pthread_mutex_unlock( &r->snapshotReady_m );
+
+        genericsReport( V_INFO, "Writing period %u, %" PRIu64 " instructions" EOL, r->snapshot.seq, r->snapshot.timelen );
+        _outputSnapshot( r, &r->snapshot, true );
+        _tablesEmpty( &r->snapshot.t );
+
+        pthread_mutex_lock( &r->snapshotReady_m );
+        r->snapshotBusy = false;
+        pthread_cond_broadcast( &r->snapshotReady );
+        pthread_mutex_unlock( &r->snapshotReady_m );
+    }
+
+    return NULL;
+}
+// ====================================================================================================
+static bool _ringInit( struct rxRing *q, uint32_t mbytes, char *spillfile )
+
+/* Establish the ring between receiver and processor, and the spill file if there is one */
+
+{
+    q->size = ( size_t )mbytes * 1024 * 1024;
+    q->buffer = ( uint8_t * )malloc( q->size );
+    MEMCHECK( q->buffer, false );
+    q->overflowBuffer = ( uint8_t * )malloc( TRANSFER_SIZE );
+    MEMCHECK( q->overflowBuffer, false );
+
+    if ( ( pthread_mutex_init( &q->m, NULL ) != 0 ) || ( pthread_cond_init( &q->c, NULL ) != 0 ) )
+    {
+        return false;
+    }
+
+    if ( spillfile )
+    {
+        q->spillBuffer = ( uint8_t * )malloc( TRANSFER_SIZE );
+        MEMCHECK( q->spillBuffer, false );
+        q->spillw = fopen( spillfile, "wb" );
+        q->spillr = fopen( spillfile, "rb" );
+
+        if ( ( !q->spillw ) || ( !q->spillr ) )
+        {
+            genericsReport( V_ERROR, "Couldn't open spill file %s" EOL, spillfile );
+            return false;
+        }
+    }
+
+    return true;
+}
+// ====================================================================================================
+static void _ringKick( struct rxRing *q )
+
+/* Wake whichever side is sleeping */
+
+{
+    pthread_mutex_lock( &q->m );
+    pthread_cond_broadcast( &q->c );
+    pthread_mutex_unlock( &q->m );
+}
+// ====================================================================================================
+static void _ringWake( struct rxRing *q, atomic_bool *waiting )
+
+/* Wake the other side if it's said that it's sleeping. The position that was just moved is stored before */
+/* this flag is read, and the sleeper sets it before checking positions, so one of them sees the other.  */
+
+{
+    if ( atomic_load( waiting ) )
+    {
+        _ringKick( q );
+    }
+}
+// ====================================================================================================
+static size_t _ringSpace( struct rxRing *q, uint8_t **p )
+
+/* Contiguous room available for the receiver to write into, and where it is */
+
+{
+    size_t wp = atomic_load_explicit( &q->wp, memory_order_relaxed );
+    size_t rp = atomic_load( &q->rp );
+    size_t contig = q->size - ( wp % q->size );
+    size_t space = q->size - ( wp - rp );
+
+    /* If the resync point after dropped data can't be recorded, then keep dropping until it can */
+    if ( ( q->lost ) &&
+            ( atomic_load_explicit( &q->gapw, memory_order_relaxed ) - atomic_load_explicit( &q->gapr, memory_order_acquire ) == MAX_RX_GAPS ) )
+    {
+        space = 0;
+    }
+
+    *p = &q->buffer[wp % q->size];
+    return ( space < contig ) ? space : contig;
+}
+// ====================================================================================================
+static void _ringCommit( struct rxRing *q, size_t len )
+
+/* Hand len bytes written at the space returned by _ringSpace over to the processor */
+
+{
+    size_t wp = atomic_load_explicit( &q->wp, memory_order_relaxed );
+
+    if ( q->lost )
+    {
+        /* These are the first data after a drop, so the decoder has to pick up sync again here */
+        uint32_t gapw = atomic_load_explicit( &q->gapw, memory_order_relaxed );
+        q->gaps[gapw % MAX_RX_GAPS] = wp;
+        atomic_store_explicit( &q->gapw, gapw + 1, memory_order_release );
+        q->lost = false;
+    }
+
+    atomic_store( &q->wp, wp + len );
+    _ringWake( q, &q->consumerWaiting );
+}
+// ====================================================================================================
+static bool _ringSpilling( struct rxRing *q )
+
+/* Data are going to the spill file while it still has anything in it, so they stay in order */
+
+{
+    return ( q->spillr ) && ( atomic_load_explicit( &q->spillWritten, memory_order_relaxed ) != atomic_load_explicit( &q->spillRead, memory_order_acquire ) );
+}
+// ====================================================================================================
+static void _ringOverflow( struct rxRing *q, uint8_t *buffer, size_t len )
+
+/* Data that arrived with no room in the ring either get spilled or dropped */
+
+{
+    if ( q->spillw )
+    {
+        if ( ( fwrite( buffer, 1, len, q->spillw ) == len ) && ( !fflush( q->spillw ) ) )
+        {
+            atomic_store( &q->spillWritten, atomic_load_explicit( &q->spillWritten, memory_order_relaxed ) + len );
+            _ringWake( q, &q->consumerWaiting );
+            return;
+        }
+
+        genericsReport( V_WARN, "Failed writing spill file, dropping data from now on" EOL );
+        fclose( q->spillw );
+        q->spillw = NULL;
+    }
+
+    q->dropped += len;
+    q->lost = true;
+}
+// ====================================================================================================
+static void _ringWaitSpace( struct rxRing *q )
+
+/* Receiver sleeps until the processor has made room. This is bounded so the caller still gets to */
+/* look around every tick, since CTRL-C doesn't wake it.                                          */
+
+{
+    struct timespec ts;
+    uint8_t *p;
+
+    atomic_store( &q->producerWaiting, true );
+
+    if ( !_ringSpace( q, &p ) )
+    {
+        clock_gettime( CLOCK_REALTIME, &ts );
+        ts.tv_nsec += TICK_TIME_MS * 1000000;
+
+        if ( ts.tv_nsec >= 1000000000 )
+        {
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000000000;
+        }
+
+        pthread_mutex_lock( &q->m );
+
+        while ( ( !_ringSpace( q, &p ) ) && ( pthread_cond_timedwait( &q->c, &q->m, &ts ) == 0 ) )
+        {}
+
+        pthread_mutex_unlock( &q->m );
+    }
+
+    atomic_store( &q->producerWaiting, false );
+}
+// ====================================================================================================
+static void _pumpData( struct RunTime *r, uint8_t *buffer, size_t len )
+
+/* Send a chunk of received data through the decoder */
+
+{
+    genericsReport( V_DEBUG, "RXED Packet of %zu bytes" EOL, len );
 
 #ifdef DUMP_BLOCK
-            uint8_t *c = r->rawBlock[r->rp].buffer;
-            uint32_t y = r->rawBlock[r->rp].fillLevel;
+    uint8_t *c = buffer;
+    size_t y = len;
 
-            DBG_OUT( EOL );
+    DBG_OUT( EOL );
 
-            while ( y-- )
-            {
-                DBG_OUT( "%02X ", *c++ );
+    while ( y-- )
+    {
+        DBG_OUT( "%02X ", *c++ );
 
-                if ( !( y % 16 ) )
-                {
-                    DBG_OUT( EOL );
-                }
-            }
+        if ( !( y % 16 ) )
+        {
+            DBG_OUT( EOL );
+        }
+    }
 
 #endif
 
-            if ( PROT_OFLOW == r->options->protocol )
+    if ( PROT_OFLOW == r->options->protocol )
+    {
+        OFLOWPump( &r->c, buffer, len, _OFLOWpacketRxed, r );
+    }
+    else
+    {
+        /* Pump all of the data through the protocol handler */
+        TRACEDecoderPumpRecords( &r->i, buffer, len, _traceCB, r );
+    }
+}
+// ====================================================================================================
+static bool _ringProcess( struct RunTime *r )
+
+/* Process the next chunk of data waiting, returning false if there wasn't any. The ring always */
+/* goes first since anything in it arrived before whatever is in the spill file.                */
+
+{
+    struct rxRing *q = &r->q;
+    size_t rp = atomic_load_explicit( &q->rp, memory_order_relaxed );
+    size_t wp = atomic_load_explicit( &q->wp, memory_order_acquire );
+
+    if ( wp != rp )
+    {
+        size_t len = q->size - ( rp % q->size );
+
+        if ( len > wp - rp )
+        {
+            len = wp - rp;
+        }
+
+        if ( len > TRANSFER_SIZE )
+        {
+            len = TRANSFER_SIZE;
+        }
+
+        /* Stop at the next place data were dropped, and once there start decode over again */
+        uint32_t gapr = atomic_load_explicit( &q->gapr, memory_order_relaxed );
+
+        if ( gapr != atomic_load_explicit( &q->gapw, memory_order_acquire ) )
+        {
+            size_t gap = q->gaps[gapr % MAX_RX_GAPS];
+
+            if ( gap == rp )
             {
-                OFLOWPump( &_r.c, r->rawBlock[r->rp].buffer, r->rawBlock[r->rp].fillLevel, _OFLOWpacketRxed, &_r );
+                genericsReport( V_INFO, "Resync after dropped data" EOL );
+                TRACEDecoderForceSync( &r->i, false );
+                atomic_store_explicit( &q->gapr, gapr + 1, memory_order_release );
+                return true;
             }
-            else
+            else if ( gap - rp < len )
             {
-                /* Pump all of the data through the protocol handler */
-                TRACEDecoderPump( &r->i, r->rawBlock[r->rp].buffer, r->rawBlock[r->rp].fillLevel, _traceCB, &_r );
+                len = gap - rp;
             }
+        }
+
+        _pumpData( r, &q->buffer[rp % q->size], len );
+        atomic_store( &q->rp, rp + len );
+        _ringWake( q, &q->producerWaiting );
+        return true;
+    }
+
+    if ( q->spillr )
+    {
+        uint64_t spillRead = atomic_load_explicit( &q->spillRead, memory_order_relaxed );
+        uint64_t waiting = atomic_load_explicit( &q->spillWritten, memory_order_acquire ) - spillRead;
 
-            r->rp = ( r->rp + 1 ) % NUM_RAW_BLOCKS;
+        if ( waiting )
+        {
+            size_t len = fread( q->spillBuffer, 1, ( waiting < TRANSFER_SIZE ) ? waiting : TRANSFER_SIZE, q->spillr );
+            clearerr( q->spillr );
+
+            if ( len )
+            {
+                _pumpData( r, q->spillBuffer, len );
+                atomic_store( &q->spillRead, spillRead + len );
+                return true;
+            }
         }
     }
 
+    return false;
+}
+// ====================================================================================================
+static void *_processBlocks( void *params )
+
+/* Generic block processor for received data. This runs in a task parallel to the receiver and *
+ * processes all of the data that arrive.                                                      */
+
+{
+    struct RunTime *r = ( struct RunTime * )params;
+    struct rxRing *q = &r->q;
+
+    while ( true )
+    {
+        /* If a period has ended then hand the tables over before doing anything more */
+        if ( ( r->snapshotRequested ) && ( r->sampling ) )
+        {
+            _takeSnapshot( r );
+        }
+
+        /* Closed is read first, so once it's set an empty ring really does mean we're done */
+        bool closed = atomic_load( &q->closed );
+
+        if ( _ringProcess( r ) )
+        {
+            continue;
+        }
+
+        if ( closed )
+        {
+            break;
+        }
+
+        /* Nothing to do, so sleep until the receiver says there is */
+        atomic_store( &q->consumerWaiting, true );
+        pthread_mutex_lock( &q->m );
+
+        while ( ( atomic_load( &q->rp ) == atomic_load( &q->wp ) ) &&
+                ( atomic_load( &q->spillRead ) == atomic_load( &q->spillWritten ) ) &&
+                ( !atomic_load( &q->closed ) ) && ( !r->snapshotRequested ) )
+        {
+            pthread_cond_wait( &q->c, &q->m );
+        }
+
+        pthread_mutex_unlock( &q->m );
+        atomic_store( &q->consumerWaiting, false );
+    }
+
     return NULL;
 }
 // ====================================================================================================
@@ -841,6 +1875,7 @@ int main( int argc, char *argv[] )
     struct timeval tv;
     struct Stream *stream = NULL;
     enum symbolErr r;
+    bool processing = false;
 
     DBG_OUT( "This utility is in development. Use at your own risk!!" EOL );
 
@@ -848,14 +1883,9 @@ int main( int argc, char *argv[] )
     _r.progName = genericsBasename( argv[0] );
     _r.options = &_options;
 
-    if ( pthread_mutex_init( &_r.dataForClients_m, NULL ) != 0 )
+    if ( ( pthread_mutex_init( &_r.snapshotReady_m, NULL ) != 0 ) || ( pthread_cond_init( &_r.snapshotReady, NULL ) != 0 ) )
     {
-        genericsExit( -1, "Failed to establish mutex for condition variablee" EOL );
-    }
-
-    if ( pthread_cond_init( &_r.dataForClients, NULL ) != 0 )
-    {
-        genericsExit( -1, "Failed to establish condition variablee" EOL );
+        genericsExit( -1, "Failed to establish snapshot signalling" EOL );
     }
 
     if ( !_processOptions( argc, argv, &_r ) )
@@ -866,6 +1896,11 @@ int main( int argc, char *argv[] )
 
     genericsScreenHandling( !_r.options->mono );
 
+    if ( !_ringInit( &_r.q, _r.options->bufferMB, _r.options->spillfile ) )
+    {
+        genericsExit( -1, "Failed to establish receive buffer" EOL );
+    }
+
     /* Make sure any cleanup happens at the end */
     atexit( _doExit );
 
@@ -886,6 +1921,27 @@ int main( int argc, char *argv[] )
 #endif
 
     TRACEDecoderInit( &_r.i, _r.options->tProtocol, !_r.options->noaltAddr, genericsReport );
+    TRACEDecoderSetCycleAccurate( &_r.i, _r.options->cycles );
+
+    /* Every instruction is stepped through from its atom, with addresses only taken from the trace, */
+    /* so runs of atoms can be delivered folded together.                                           */
+    TRACEDecoderSetFoldAtoms( &_r.i, true );
+
+    /* The call stack tree starts out with just its root, which is where code with no known caller runs */
+    _r.stackNodesAlloc = ( _r.options->stackNodes < 1024 ) ? _r.options->stackNodes : 1024;
+    _r.stackTree = ( struct stackNode * )calloc( _r.stackNodesAlloc, sizeof( struct stackNode ) );
+    MEMCHECK( _r.stackTree, -1 );
+    _r.stackTree[STACK_ROOT].functionindex = NO_FUNCTION;
+    _r.stackTree[STACK_ROOT].fileindex     = NO_FILE;
+    _r.stackNodes = 1;
+    _r.stackFn    = NO_FUNCTION;
+
+    _tablesInit( &_r.t );
+
+    if ( _r.options->continuous )
+    {
+        _tablesInit( &_r.snapshot.t );
+    }
     OFLOWInit( &_r.c );
 
     while ( !_r.ending )
@@ -900,7 +1956,7 @@ int main( int argc, char *argv[] )
             {
                 stream = streamCreateSocket( _r.options->server, _r.options->port );
 
-                if ( !stream )
+                if ( stream )
                 {
                     break;
                 }
@@ -937,10 +1993,19 @@ int main( int argc, char *argv[] )
             genericsReport( V_WARN, "Loaded %s" EOL, _r.options->elffile );
         }
 
-        _r.intervalBytes = 0;
+        /* Now start the result processing task, and the writer if we're going to need it. These carry on across reconnections */
+        if ( !processing )
+        {
+            _r.intervalBytes = 0;
+            pthread_create( &_r.processThread, NULL, &_processBlocks, &_r );
+
+            if ( _r.options->continuous )
+            {
+                pthread_create( &_r.writerThread, NULL, &_writeSnapshots, &_r );
+            }
 
-        /* Now start the result processing task */
-        pthread_create( &_r.processThread, NULL, &_processBlocks, &_r );
+            processing = true;
+        }
 
         /* ----------------------------------------------------------------------------- */
         /* This is the main active loop...only break out of this when ending or on error */
@@ -952,51 +2017,67 @@ int main( int argc, char *argv[] )
             tv.tv_sec = 0;
             tv.tv_usec  = TICK_TIME_MS * 1000;
 
+            /* Receive straight into the ring when there's room, and nothing is queued up in the spill file */
+            uint8_t *rxBuffer;
+            size_t rxSize = _ringSpilling( &_r.q ) ? 0 : _ringSpace( &_r.q, &rxBuffer );
 
-            struct dataBlock *rxBlock = &_r.rawBlock[_r.wp];
-
-            enum ReceiveResult result = stream->receive( stream, rxBlock->buffer, TRANSFER_SIZE, &tv, ( size_t * )&rxBlock->fillLevel );
-
-            if ( ( result == RECEIVE_RESULT_EOF ) || ( result == RECEIVE_RESULT_ERROR ) )
+            if ( rxSize > TRANSFER_SIZE )
             {
-                break;
+                rxSize = TRANSFER_SIZE;
             }
 
-            if ( rxBlock->fillLevel <= 0 )
+            if ( ( !rxSize ) && ( _r.options->file != NULL ) && ( !_ringSpilling( &_r.q ) ) )
             {
-                /* We are at EOF (Probably the descriptor closed) */
-                break;
+                /* A file will wait for us, so there's no need to lose anything */
+                _ringWaitSpace( &_r.q );
             }
+            else
+            {
+                if ( !rxSize )
+                {
+                    rxBuffer = _r.q.overflowBuffer;
+                    rxSize = TRANSFER_SIZE;
+                }
 
-            /* ...record the fact that we received some data */
-            _r.intervalBytes += rxBlock->fillLevel;
+                size_t receivedSize = 0;
+                enum ReceiveResult result = stream->receive( stream, rxBuffer, rxSize, &tv, &receivedSize );
 
-            int nwp = ( _r.wp + 1 ) % NUM_RAW_BLOCKS;
+                if ( ( result == RECEIVE_RESULT_EOF ) || ( result == RECEIVE_RESULT_ERROR ) )
+                {
+                    break;
+                }
 
-            if ( nwp == ( volatile int )_r.rp )
-            {
-                genericsExit( -1, "Overflow" EOL );
-            }
+                /* A timeout just means nothing arrived this time around */
+                if ( receivedSize > 0 )
+                {
+                    /* ...record the fact that we received some data */
+                    _r.intervalBytes += receivedSize;
 
-            _r.wp = nwp;
-            pthread_cond_signal( &_r.dataForClients );
+                    if ( rxBuffer == _r.q.overflowBuffer )
+                    {
+                        _ringOverflow( &_r.q, rxBuffer, receivedSize );
+                    }
+                    else
+                    {
+                        _ringCommit( &_r.q, receivedSize );
+                    }
+                }
+            }
 
             /* Update the intervals */
             if ( ( ( volatile bool ) _r.sampling ) && ( ( genericsTimestampmS() - ( volatile uint32_t )_r.starttime ) > _r.options->sampleDuration ) )
             {
-                _r.ending = true;
-
-                /* Post an empty data packet to flag to packet processor that it's done */
-                int nwp = ( _r.wp + 1 ) % NUM_RAW_BLOCKS;
-
-                if ( nwp == ( volatile int )_r.rp )
+                if ( _r.options->continuous )
                 {
-                    genericsExit( -1, "Overflow" EOL );
+                    /* Ask the processor to hand over what it's got so far, and wake it in case it's idle */
+                    _r.starttime += _r.options->sampleDuration;
+                    _r.snapshotRequested = true;
+                    _ringKick( &_r.q );
+                }
+                else
+                {
+                    _r.ending = true;
                 }
-
-                _r.rawBlock[_r.wp].fillLevel = 0;
-                _r.wp = nwp;
-                pthread_cond_signal( &_r.dataForClients );
             }
         }
 
@@ -1004,45 +2085,69 @@ int main( int argc, char *argv[] )
         free( stream );
     }
 
-    /* Wait for data processing to be completed */
-    pthread_join( _r.processThread, NULL );
+    if ( processing )
+    {
+        /* Flag to packet processor that nothing more is coming, so it finishes once it's caught up */
+        atomic_store( &_r.q.closed, true );
+        _ringKick( &_r.q );
+
+        /* Wait for data processing to be completed */
+        pthread_join( _r.processThread, NULL );
+    }
 
     /* Data are collected, now process and report */
-    genericsReport( V_INFO, "Received %d raw sample bytes, %ld function changes, %ld distinct addresses" EOL,
-                    _r.intervalBytes, HASH_COUNT( _r.subhead ), HASH_COUNT( _r.insthead ) );
+    genericsReport( V_INFO, "Received %" PRIu64 " raw sample bytes, %u function changes, %u distinct addresses" EOL,
+                    _r.intervalBytes, _r.t.calls.count, _r.t.insts.count );
 
-    if ( HASH_COUNT( _r.subhead ) )
+    if ( _r.options->cycles )
     {
-        if ( ext_ff_outputDot( _r.options->dotfile, _r.subhead, _r.s ) )
+        if ( _r.op.cycles )
         {
-            genericsReport( V_INFO, "Output DOT" EOL );
+            genericsReport( V_INFO, "%" PRIu64 " cycles attributed" EOL, _r.op.cycles );
         }
         else
         {
-            if ( _r.options->dotfile )
-            {
-                genericsExit( -1, "Failed to output DOT" EOL );
-            }
+            genericsReport( V_WARN, "No cycles seen, is the ETM set for cycle accurate trace?" EOL );
         }
+    }
 
-        if ( ext_ff_outputProfile( _r.options->profile, _r.options->elffile,
-                                   _r.options->truncateDeleteMaterial ? _r.options->deleteMaterial : NULL,
-                                   true,
-                                   _r.op.lasttstamp - _r.op.firsttstamp,
-                                   _r.insthead,
-                                   _r.subhead,
-                                   _r.s ) )
+    if ( _r.q.dropped )
+    {
+        genericsReport( V_WARN, "Receive buffer overflowed, %" PRIu64 " bytes were dropped" EOL, _r.q.dropped );
+    }
+
+    if ( _r.stackFull )
+    {
+        genericsReport( V_WARN, "Call stack tree full, %" PRIu64 " frames were folded into their callers" EOL, _r.stackFull );
+    }
+
+    if ( _r.options->continuous )
+    {
+        /* Whatever has been collected since the last period ends up in a file of its own */
+        if ( _r.sampling )
         {
-            genericsReport( V_INFO, "Output Profile" EOL );
+            _waitSnapshotWritten( &_r );
+            _takeSnapshot( &_r );
+            _waitSnapshotWritten( &_r );
         }
-        else
+
+        if ( _r.snapshotsMissed )
         {
-            if ( _r.options->profile )
-            {
-                genericsExit( -1, "Failed to output profile" EOL );
-            }
+            genericsReport( V_WARN, "%" PRIu64 " periods were merged into the next cos output was still being written" EOL, _r.snapshotsMissed );
         }
     }
+    else
+    {
+        struct profileSnapshot p =
+        {
+            .t          = _r.t,
+            .stackTree  = _r.stackTree,
+            .stackNodes = _r.stackNodes,
+            .timelen    = _r.op.lasttstamp - _r.op.firsttstamp
+        };
+
+        _outputSnapshot( &_r, &p, false );
+    }
 
     return OK;
 }
@@ -872,16 +872,36 @@ int main( int argc, char *argv[] )
 
     if ( HASH_COUNT( _r.subhead ) )
     {
-        if ( ext_ff_outputDot( _r.options->dotfile, _r.subhead, _r.s ) )
+        /* The writers take arrays of the entries */
+        uint32_t callCount = 0, instCount = 0;
+        struct subcall **calls = ( struct subcall ** )malloc( HASH_COUNT( _r.subhead ) * sizeof( struct subcall * ) );
+        struct execEntryHash **insts = ( struct execEntryHash ** )malloc( HASH_COUNT( _r.insthead ) * sizeof( struct execEntryHash * ) );
+        MEMCHECK( calls, -1 );
+        MEMCHECK( insts, -1 );
+
+        for ( struct subcall *s = _r.subhead; s; s = s->hh.next )
+        {
+            calls[callCount++] = s;
+        }
+
+        for ( struct execEntryHash *h = _r.insthead; h; h = h->hh.next )
+        {
+            insts[instCount++] = h;
+        }
+
+        if ( ext_ff_outputDot( _r.options->dotfile, calls, callCount, _r.s ) )
         {
             genericsReport( V_WARN, "Output DOT" EOL );
         }
 
-        if ( ext_ff_outputProfile( _r.options->profile, _r.options->elffile, _r.options->truncateDeleteMaterial ? _r.options->deleteMaterial : NULL, false,
-                                   _r.tcount - _r.starttcount, _r.insthead, _r.subhead, _r.s ) )
+        if ( ext_ff_outputProfile( _r.options->profile, _r.options->elffile, _r.options->truncateDeleteMaterial ? _r.options->deleteMaterial : NULL, false, false,
+                                   _r.tcount - _r.starttcount, insts, instCount, calls, callCount, _r.s ) )
         {
             genericsReport( V_WARN, "Output Profile" EOL );
         }
+
+        free( calls );
+        free( insts );
     }
 
     return OK;
@@ -16,10 +16,10 @@
 #include <assert.h>
 #include <inttypes.h>
 #include <getopt.h>
+#include <math.h>
 
 #include "cJSON.h"
 #include "generics.h"
-#include "uthash.h"
 #include "git_version_info.h"
 #include "itmDecoder.h"
 #include "oflow.h"
@@ -29,6 +29,16 @@
 #include "stream.h"
 
 #define CUTOFF              (10)             /* Default cutoff at 0.1% */
+#define TOP_ENTRIES         (10000/CUTOFF)   /* Most entries that can make the cutoff, so most we report */
+#define ADDR_CACHE_SIZE     (4096)           /* Entries in address to report key cache (power of 2) */
+#define DECAY_FLOOR         (0.05)           /* Decayed counts below this are forgotten */
+
+#define TS_MAGIC            "ORBTOPTS"       /* Time series file header, followed by version byte */
+#define TS_VERSION          (1)
+#define TS_TAG_STRING       ('S')            /* Time series record tags */
+#define TS_TAG_INTERVAL     ('I')
+#define TS_MAX_NAME         (512)            /* Longest symbol name written to the dictionary */
+#define TS_EX_COLUMNS       (11)             /* Statistics recorded for each exception */
 #define TOP_UPDATE_INTERVAL (1000)           /* Interval between each on screen update */
 
 #define MAX_EXCEPTIONS      (512)            /* Maximum number of exceptions to be considered */
@@ -36,27 +46,60 @@
 
 #define MSG_REORDER_BUFLEN  (10)             /* Maximum number of samples to re-order for timekeeping */
 
+#define HIST_SUB_BITS       (5)              /* Log-linear histogram: 32 linear steps per power of two (<=3% error) */
+#define HIST_MAX_BITS       (40)             /* ...covering exception durations up to 2^40 ticks */
+#define HIST_BUCKETS        ((HIST_MAX_BITS-HIST_SUB_BITS+1)<<HIST_SUB_BITS)
+
 #define DWT_NUM_EVENTS 6
 const char *evName[DWT_NUM_EVENTS] = {"CPI", "Exc", "Slp", "LSU", "Fld", "Cyc"};
 
-struct visitedAddr                           /* Structure for Hashmap of visited/observed addresses */
-{
-    uint64_t visits;
-    struct nameEntry *n;
+/* Samples are counted against a report key. Each source line entry in the symbol set has a key, */
+/* shared by all entries that aggregate into the same report line, followed by a few specials.    */
+enum { KEY_INTERRUPT, KEY_UNKNOWN, KEY_SLEEPING, KEY_NUM_SPECIALS };
+#define NO_KEY              (0xFFFFFFFF)
 
-    UT_hash_handle hh;
+struct addrCacheEntry                        /* Direct mapped cache of address to report key */
+{
+    uint32_t addr;
+    uint32_t key;
 };
 
 struct reportLine
 
 {
     uint64_t count;
-    struct nameEntry *n;
+    uint32_t key;
+    struct nameEntry n;
+};
+
+struct keyCount                              /* Samples against a report key in one interval */
+{
+    uint32_t key;
+    uint64_t count;
+};
+
+struct intervalCounts                        /* Sparse record of one interval, for the sliding window */
+{
+    uint32_t n;
+    struct keyCount *e;
 };
 
+enum Aggregate { AGG_INTERVAL, AGG_WINDOW, AGG_DECAY };
+
 enum Prot { PROT_OFLOW, PROT_ITM, PROT_UNKNOWN };
 const char *protString[] = {"OFLOW", "ITM", NULL};
 
+struct latencyHist                           /* Log-linear (HDR style) histogram of exception durations */
+
+{
+    uint64_t count;
+    int64_t min;
+    int64_t max;
+    double sum;                              /* Sums for mean and jitter (standard deviation) */
+    double sumSq;
+    uint32_t *bucket;                        /* HIST_BUCKETS counters, allocated on first use */
+};
+
 struct exceptionRecord                       /* Record of exception activity */
 
 {
@@ -66,6 +109,8 @@ struct exceptionRecord                       /* Record of exception activity */
     int64_t maxTime;
     int64_t maxWallTime;
     uint32_t maxDepth;
+    struct latencyHist hist;                 /* Distribution of times over this interval... */
+    struct latencyHist runHist;              /* ...and over the whole run */
 
     /* Elements used in calcuation */
     int64_t entryTime;
@@ -94,6 +139,7 @@ struct                                       /* Record for options, either defau
     char *json;                              /* Output in JSON format rather than human readable, either '-' for screen or filename */
     char *outfile;                           /* File to output current information */
     char *logfile;                           /* File to output historic information */
+    char *tsfile;                            /* File to record binary time series into */
     bool mono;                               /* Supress colour in output */
     int paceDelay;                           /* Delay between blocks of data transmission in file readout */
     uint32_t cutscreen;                      /* Cut screen output after specified number of lines */
@@ -101,6 +147,9 @@ struct                                       /* Record for options, either defau
     bool lineDisaggregation;                 /* Aggregate per line or per function? */
     bool demangle;                           /* Do we want to demangle any C++ we come across? */
     int64_t displayInterval;                 /* What is the display interval? */
+    enum Aggregate aggregate;                /* How samples are combined across intervals */
+    double window;                           /* Sliding window length in seconds */
+    double halfLife;                         /* Half life of decayed counts in seconds */
 
     int port;                                /* Source information */
     char *server;
@@ -134,7 +183,29 @@ struct
     struct SymbolSet *s;                               /* Symbols read from elf */
     struct nameEntry *n;                               /* Current table of recognised names */
 
-    struct visitedAddr *addresses;                     /* Addresses we received in the SWV */
+    uint32_t keyCount;                                 /* Number of report keys for current symbol set */
+    uint32_t *key;                                     /* Report key for each source line entry */
+    uint64_t *count;                                   /* Samples against each report key this interval */
+    uint32_t *active;                                  /* Report keys with samples this interval */
+    uint32_t activeCount;
+    struct addrCacheEntry addrCache[ADDR_CACHE_SIZE];  /* Recently seen addresses and their keys */
+
+    double *agg;                                       /* Samples against each key over the window, or decayed */
+    uint32_t *aggActive;                               /* Keys with a non-zero aggregate... */
+    uint32_t *aggPos;                                  /* ...and where each key is in that list, or NO_KEY */
+    uint32_t aggActiveCount;
+    struct intervalCounts *ring;                       /* Per interval samples making up the window */
+    uint32_t ringLen;
+    uint32_t ringPos;
+    double decay;                                      /* Factor to apply to decayed counts each interval */
+
+    FILE *tsfile;                                      /* Time series being recorded */
+    struct intervalCounts tsInterval;                  /* Samples this interval, before any aggregation */
+    uint32_t *tsId;                                    /* Dictionary id for each key, or NO_KEY if not written yet */
+    uint32_t tsNextId;                                 /* Next dictionary id to allocate */
+    uint8_t *tsBuf;                                    /* Record under construction */
+    size_t tsLen;
+    size_t tsSize;
 
     struct exceptionRecord er[MAX_EXCEPTIONS];         /* Exceptions we received on this interval */
     uint32_t currentException;                         /* Exception we are currently embedded in */
@@ -173,51 +244,251 @@ int64_t _timestamp( void )
     return microseconds;
 }
 // ====================================================================================================
-int _addresses_sort_fn( void *a, void *b )
+static int _sourceKey_fn( const void *a, const void *b )
+
+/* Order source line entries so that those which aggregate into the same report line are adjacent */
 
 {
-    if ( ( ( ( struct visitedAddr * )a )->n->addr ) < ( ( ( struct visitedAddr * )b )->n->addr ) )
+    const struct sourceLineEntry *sa = &_r.s->sources[*( const uint32_t * )a];
+    const struct sourceLineEntry *sb = &_r.s->sources[*( const uint32_t * )b];
+
+    if ( ( options.reportFilenames ) && ( sa->fileIdx != sb->fileIdx ) )
+    {
+        return ( sa->fileIdx < sb->fileIdx ) ? -1 : 1;
+    }
+
+    if ( sa->functionIdx != sb->functionIdx )
     {
-        return -1;
+        return ( sa->functionIdx < sb->functionIdx ) ? -1 : 1;
     }
 
-    if ( ( ( ( struct visitedAddr * )a )->n->addr ) > ( ( ( struct visitedAddr * )b )->n->addr ) )
+    if ( ( options.lineDisaggregation ) && ( sa->lineNo != sb->lineNo ) )
     {
-        return 1;
+        return ( sa->lineNo < sb->lineNo ) ? -1 : 1;
     }
 
     return 0;
 }
 // ====================================================================================================
-int _routines_sort_fn( void *a, void *b )
+static int _report_sort_fn( const void *a, const void *b )
 
 {
-    int r;
+    const struct reportLine *ra = ( const struct reportLine * )a;
+    const struct reportLine *rb = ( const struct reportLine * )b;
+
+    if ( ra->count != rb->count )
+    {
+        return ( ra->count < rb->count ) ? 1 : -1;
+    }
+
+    return ( ra->key < rb->key ) ? -1 : ( ra->key > rb->key );
+}
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Exception latency histograms
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+static inline uint32_t _histIndex( int64_t v )
+
+/* Values below 2^(HIST_SUB_BITS+1) get a bucket each, above that every power of two is split into  */
+/* 2^HIST_SUB_BITS equal steps, so the bucket is found from the position of the top bit alone.       */
+
+{
+    if ( v <= 0 )
+    {
+        return 0;
+    }
+
+    if ( v >= ( 1LL << HIST_MAX_BITS ) )
+    {
+        v = ( 1LL << HIST_MAX_BITS ) - 1;
+    }
+
+    int shift = ( 63 - __builtin_clzll( v ) ) - HIST_SUB_BITS;
+
+    if ( shift < 0 )
+    {
+        shift = 0;
+    }
+
+    return ( shift << HIST_SUB_BITS ) + ( v >> shift );
+}
+// ====================================================================================================
+static int64_t _histValue( uint32_t idx )
+
+/* Highest value that would be counted into bucket idx */
+
+{
+    int shift = ( idx >> HIST_SUB_BITS ) - 1;
+
+    if ( shift <= 0 )
+    {
+        return idx;
+    }
+
+    return ( ( int64_t )( idx - ( shift << HIST_SUB_BITS ) + 1 ) << shift ) - 1;
+}
+// ====================================================================================================
+static void _histAlloc( struct latencyHist *h )
+
+{
+    if ( !h->bucket )
+    {
+        h->bucket = ( uint32_t * )calloc( HIST_BUCKETS, sizeof( uint32_t ) );
+        MEMCHECKV( h->bucket );
+    }
+}
+// ====================================================================================================
+static void _histRecord( struct latencyHist *h, int64_t v )
+
+{
+    _histAlloc( h );
+
+    if ( ( !h->count ) || ( v < h->min ) )
+    {
+        h->min = v;
+    }
+
+    if ( ( !h->count ) || ( v > h->max ) )
+    {
+        h->max = v;
+    }
+
+    h->count++;
+    h->sum += v;
+    h->sumSq += ( double )v * v;
+    h->bucket[_histIndex( v )]++;
+}
+// ====================================================================================================
+static void _histMerge( struct latencyHist *d, struct latencyHist *s )
+
+/* Fold histogram s into d. Histograms share one bucket layout, so this is a straight sum */
+
+{
+    if ( !s->count )
+    {
+        return;
+    }
+
+    _histAlloc( d );
+
+    if ( ( !d->count ) || ( s->min < d->min ) )
+    {
+        d->min = s->min;
+    }
+
+    if ( ( !d->count ) || ( s->max > d->max ) )
+    {
+        d->max = s->max;
+    }
+
+    d->count += s->count;
+    d->sum += s->sum;
+    d->sumSq += s->sumSq;
+
+    for ( uint32_t b = 0; b < HIST_BUCKETS; b++ )
+    {
+        d->bucket[b] += s->bucket[b];
+    }
+}
+// ====================================================================================================
+static void _histReset( struct latencyHist *h )
+
+{
+    if ( h->bucket )
+    {
+        memset( h->bucket, 0, HIST_BUCKETS * sizeof( uint32_t ) );
+    }
+
+    h->count = h->min = h->max = 0;
+    h->sum = h->sumSq = 0;
+}
+// ====================================================================================================
+static int64_t _histPercentile( struct latencyHist *h, double pc )
+
+/* Value at or below which pc percent of the samples fall, to within one bucket */
+
+{
+    if ( !h->count )
+    {
+        return 0;
+    }
+
+    uint64_t target = ( uint64_t )( ( pc / 100.0 ) * h->count + 0.5 );
+    uint64_t seen = 0;
+
+    if ( !target )
+    {
+        target = 1;
+    }
 
-    if ( ( options.reportFilenames ) && ( ( ( ( struct visitedAddr * )a )->n->fileindex ) && ( ( ( struct visitedAddr * )b )->n->fileindex ) ) )
+    for ( uint32_t b = 0; b < HIST_BUCKETS; b++ )
     {
-        r = ( ( int )( ( struct visitedAddr * )a )->n->fileindex ) - ( ( int )( ( struct visitedAddr * )b )->n->fileindex );
+        seen += h->bucket[b];
 
-        if ( r )
+        if ( seen >= target )
         {
-            return r;
+            int64_t v = _histValue( b );
+            return ( v > h->max ) ? h->max : ( v < h->min ) ? h->min : v;
         }
     }
 
-    r = ( ( int )( ( struct visitedAddr * )a )->n->functionindex ) - ( ( int )( ( struct visitedAddr * )b )->n->functionindex );
+    return h->max;
+}
+// ====================================================================================================
+static int64_t _histJitter( struct latencyHist *h )
+
+/* Standard deviation of the recorded values */
+
+{
+    if ( h->count < 2 )
+    {
+        return 0;
+    }
 
-    if ( r )
+    double mean = h->sum / h->count;
+    double var = h->sumSq / h->count - mean * mean;
+
+    if ( var < 1 )
     {
-        return r;
+        return 0;
     }
 
-    return ( ( int )( ( struct visitedAddr * )a )->n->line ) - ( ( int )( ( struct visitedAddr * )b )->n->line );
+    /* Integer square root by Newton iteration, avoids pulling in libm */
+    uint64_t v = ( uint64_t )var;
+    uint64_t x = v;
+    uint64_t y = ( x + 1 ) / 2;
+
+    while ( y < x )
+    {
+        x = y;
+        y = ( x + v / x ) / 2;
+    }
+
+    return x;
 }
 // ====================================================================================================
-int _report_sort_fn( const void *a, const void *b )
+static void _histJson( cJSON *j, struct latencyHist *h )
+
+/* Add the summary of a histogram to a JSON object */
 
 {
-    return ( ( struct reportLine * )b )->count - ( ( struct reportLine * )a )->count;
+    cJSON *jsonElement;
+
+    jsonElement = cJSON_CreateNumber( _histPercentile( h, 50 ) );
+    assert( jsonElement );
+    cJSON_AddItemToObject( j, "p50", jsonElement );
+    jsonElement = cJSON_CreateNumber( _histPercentile( h, 99 ) );
+    assert( jsonElement );
+    cJSON_AddItemToObject( j, "p99", jsonElement );
+    jsonElement = cJSON_CreateNumber( _histPercentile( h, 99.9 ) );
+    assert( jsonElement );
+    cJSON_AddItemToObject( j, "p999", jsonElement );
+    jsonElement = cJSON_CreateNumber( _histJitter( h ) );
+    assert( jsonElement );
+    cJSON_AddItemToObject( j, "jitter", jsonElement );
 }
 // ====================================================================================================
 // ====================================================================================================
@@ -269,6 +540,8 @@ void _exitEx( int64_t ts )
         _r.er[_r.currentException].maxDepth = _r.erDepth;
     }
 
+    _histRecord( &_r.er[_r.currentException].hist, _r.er[_r.currentException].thisTime );
+
     /* Step out of this exception */
     _r.currentException = _r.er[_r.currentException].prev;
 
@@ -368,99 +641,285 @@ void _handleSW( struct ITMDecoder *i, struct ITMPacket *p )
 }
 // ====================================================================================================
 // ====================================================================================================
-// Outputter routines
+// Aggregation of samples across intervals
 // ====================================================================================================
 // ====================================================================================================
-uint32_t _consolodateReport( struct reportLine **returnReport, uint32_t *returnReportLines )
+static void _aggReset( void )
+
+/* Forget everything aggregated so far (e.g. because the report keys have changed) */
 
 {
-    struct nameEntry *n;
-    struct visitedAddr *a;
+    for ( uint32_t i = 0; i < _r.ringLen; i++ )
+    {
+        free( _r.ring[i].e );
+        _r.ring[i].e = NULL;
+        _r.ring[i].n = 0;
+    }
 
-    uint32_t reportLines = 0;
-    struct reportLine *report = NULL;
+    for ( uint32_t i = 0; i < _r.aggActiveCount; i++ )
+    {
+        _r.agg[_r.aggActive[i]] = 0;
+        _r.aggPos[_r.aggActive[i]] = NO_KEY;
+    }
+
+    _r.aggActiveCount = 0;
+    _r.ringPos = 0;
+}
+// ====================================================================================================
+static void _aggAdd( uint32_t key, double v )
+
+{
+    if ( _r.aggPos[key] == NO_KEY )
+    {
+        _r.aggPos[key] = _r.aggActiveCount;
+        _r.aggActive[_r.aggActiveCount++] = key;
+    }
+
+    _r.agg[key] += v;
+}
+// ====================================================================================================
+static void _aggregate( struct reportLine **returnReport, uint32_t *returnReportLines, uint32_t *returnTotal )
+
+/* Fold this interval's report lines into the sliding window or decayed counts, and replace them   */
+/* with lines for the aggregate. Only keys that have an aggregate are visited.                    */
+
+{
+    struct reportLine *report = *returnReport;
+    uint32_t reportLines = *returnReportLines;
     uint32_t total = 0;
 
+    if ( options.aggregate == AGG_WINDOW )
+    {
+        /* The oldest interval drops out of the window... */
+        struct intervalCounts *old = &_r.ring[_r.ringPos];
 
-    /* Put the address into order of the file and function names */
-    HASH_SORT( _r.addresses, _routines_sort_fn );
+        for ( uint32_t i = 0; i < old->n; i++ )
+        {
+            _r.agg[old->e[i].key] -= old->e[i].count;
+        }
 
-    /* Now merge them together */
-    for ( a = _r.addresses; a != NULL; a = a->hh.next )
+        /* ...and this one takes its place */
+        old->e = ( struct keyCount * )realloc( old->e, sizeof( struct keyCount ) * reportLines );
+        MEMCHECKV( old->e );
+        old->n = reportLines;
+
+        for ( uint32_t i = 0; i < reportLines; i++ )
+        {
+            old->e[i].key = report[i].key;
+            old->e[i].count = report[i].count;
+        }
+
+        _r.ringPos = ( _r.ringPos + 1 ) % _r.ringLen;
+    }
+    else
     {
-        if ( !a->visits )
+        for ( uint32_t i = 0; i < _r.aggActiveCount; i++ )
         {
+            _r.agg[_r.aggActive[i]] *= _r.decay;
+        }
+    }
+
+    for ( uint32_t i = 0; i < reportLines; i++ )
+    {
+        _aggAdd( report[i].key, report[i].count );
+    }
+
+    report = ( struct reportLine * )realloc( report, sizeof( struct reportLine ) * ( _r.aggActiveCount + 1 ) );
+    MEMCHECKV( report );
+    reportLines = 0;
+
+    /* Collect the aggregate, removing any keys that have fallen out of it */
+    for ( uint32_t i = 0; i < _r.aggActiveCount; )
+    {
+        uint32_t key = _r.aggActive[i];
+
+        if ( _r.agg[key] < ( ( options.aggregate == AGG_WINDOW ) ? 0.5 : DECAY_FLOOR ) )
+        {
+            _r.agg[key] = 0;
+            _r.aggPos[key] = NO_KEY;
+            _r.aggActive[i] = _r.aggActive[--_r.aggActiveCount];
+            _r.aggPos[_r.aggActive[i]] = i;
             continue;
         }
 
-        if ( ( reportLines == 0 ) ||
-                ( ( options.reportFilenames ) &&  ( report[reportLines - 1].n->fileindex != a->n->fileindex ) ) ||
-                ( report[reportLines - 1].n->functionindex != a->n->functionindex ) ||
-                ( ( report[reportLines - 1].n->line != a->n->line ) && ( options.lineDisaggregation ) ) )
+        report[reportLines].key = key;
+        report[reportLines].count = ( uint64_t )( _r.agg[key] + 0.5 );
+        total += report[reportLines].count;
+        reportLines++;
+        i++;
+    }
+
+    *returnReport = report;
+    *returnReportLines = reportLines;
+    *returnTotal = total;
+}
+// ====================================================================================================
+// ====================================================================================================
+// Outputter routines
+// ====================================================================================================
+// ====================================================================================================
+static void _nameForKey( uint32_t key, struct nameEntry *n )
+
+/* Fill in the name details to report against a key */
+
+{
+    memset( n, 0, sizeof( struct nameEntry ) );
+
+    if ( key < _r.keyCount - KEY_NUM_SPECIALS )
+    {
+        n->fileindex = _r.s->sources[key].fileIdx;
+        n->functionindex = _r.s->sources[key].functionIdx;
+        n->line = _r.s->sources[key].lineNo;
+        n->addr = _r.s->sources[key].startAddr;
+        n->index = key;
+        return;
+    }
+
+    switch ( key - ( _r.keyCount - KEY_NUM_SPECIALS ) )
+    {
+        case KEY_INTERRUPT:
+            n->fileindex = n->functionindex = n->addr = INTERRUPT;
+            break;
+
+        case KEY_SLEEPING:
+            n->fileindex = NO_FILE;
+            n->functionindex = n->addr = FN_SLEEPING;
+            break;
+
+        default:
+            /* Not found, so report against the symbol set's placeholder file and function (index 0) */
+            break;
+    }
+}
+// ====================================================================================================
+static void _selectTop( struct reportLine *r, uint32_t lines, uint32_t k )
+
+/* Partially order r so that the k highest counts are in r[0..k-1], in no particular order. This is */
+/* Hoare's selection (as C++ nth_element), expected linear in lines.                              */
+
+{
+    int lo = 0;
+    int hi = lines - 1;
+    int target = k - 1;
+    struct reportLine t;
+
+    while ( lo < hi )
+    {
+        uint64_t pivot = r[lo + ( hi - lo ) / 2].count;
+        int i = lo;
+        int j = hi;
+
+        while ( i <= j )
         {
-            /* Make room for a report line */
-            reportLines++;
-            report = ( struct reportLine * )realloc( report, sizeof( struct reportLine ) * ( reportLines ) );
+            while ( r[i].count > pivot )
+            {
+                i++;
+            }
 
-            if ( !report )
+            while ( r[j].count < pivot )
             {
-                genericsExit( -1, "Out of memory" EOL );
+                j--;
             }
 
-            report[reportLines - 1].n = a->n;
-            report[reportLines - 1].count = 0;
+            if ( i <= j )
+            {
+                t = r[i];
+                r[i++] = r[j];
+                r[j--] = t;
+            }
         }
 
-        report[reportLines - 1].count += a->visits;
-        total += a->visits;
-        a->visits = 0;
+        /* Now r[lo..j] >= pivot >= r[i..hi], with anything between equal to the pivot */
+        if ( target <= j )
+        {
+            hi = j;
+        }
+        else if ( target >= i )
+        {
+            lo = i;
+        }
+        else
+        {
+            break;
+        }
     }
+}
+// ====================================================================================================
+uint32_t _consolodateReport( struct reportLine **returnReport, uint32_t *returnReportLines )
 
+/* Collect the keys sampled this interval into report lines, aggregate them with earlier intervals if */
+/* requested, and put them in order. JSON reports every line, but if that isn't wanted then only the */
+/* highest TOP_ENTRIES are kept, since nothing below them can make the cutoff on screen.             */
 
-    /* Now fold in any sleeping entries */
-    report = ( struct reportLine * )realloc( report, sizeof( struct reportLine ) * ( reportLines + 1 ) );
+{
+    uint32_t reportLines = 0;
+    struct reportLine *report;
+    uint32_t total = 0;
+
+    /* One line for each key we've seen, and one for sleeping */
+    report = ( struct reportLine * )malloc( sizeof( struct reportLine ) * ( _r.activeCount + 1 ) );
 
     if ( !report )
     {
         genericsExit( -1, "Out of memory" EOL );
     }
 
-    uint32_t addr = FN_SLEEPING;
-    HASH_FIND_INT( _r.addresses, &addr, a );
-
-    if ( a )
+    for ( uint32_t i = 0; i < _r.activeCount; i++ )
     {
-        n = a->n;
-    }
-    else
-    {
-        a = ( struct visitedAddr * )calloc( 1, sizeof( struct visitedAddr ) );
-        MEMCHECKV( a );
-        a->visits = _r.sleeps;
-
-        n = ( struct nameEntry * )malloc( sizeof( struct nameEntry ) );
-        n->fileindex = NO_FILE;
-        n->functionindex = FN_SLEEPING;
-        n->addr = FN_SLEEPING;
-        n->line = 0;
+        uint32_t key = _r.active[i];
 
-        a->n = n;
-        HASH_ADD_INT( _r.addresses, n->addr, a );
+        report[reportLines].key = key;
+        report[reportLines].count = _r.count[key];
+        total += _r.count[key];
+        _r.count[key] = 0;
+        reportLines++;
     }
 
-    report[reportLines].n = n;
+    _r.activeCount = 0;
+
+    /* Now fold in any sleeping entries */
+    report[reportLines].key = _r.keyCount - KEY_NUM_SPECIALS + KEY_SLEEPING;
     report[reportLines].count = _r.sleeps;
     reportLines++;
     total += _r.sleeps;
     _r.sleeps = 0;
 
-    /* Now put the whole thing into order of number of samples */
+    /* The time series records every key seen, whatever makes it into the report */
+    if ( _r.tsfile )
+    {
+        _r.tsInterval.e = ( struct keyCount * )realloc( _r.tsInterval.e, sizeof( struct keyCount ) * reportLines );
+        MEMCHECK( _r.tsInterval.e, 0 );
+        _r.tsInterval.n = reportLines;
+
+        for ( uint32_t i = 0; i < reportLines; i++ )
+        {
+            _r.tsInterval.e[i].key = report[i].key;
+            _r.tsInterval.e[i].count = report[i].count;
+        }
+    }
+
+    if ( options.aggregate != AGG_INTERVAL )
+    {
+        _aggregate( &report, &reportLines, &total );
+    }
+
+    /* Only the top entries can be shown, so if that's all that is reported only they need putting into order */
+    if ( ( !options.json ) && ( reportLines > TOP_ENTRIES ) )
+    {
+        _selectTop( report, reportLines, TOP_ENTRIES );
+        reportLines = TOP_ENTRIES;
+    }
+
     qsort( report, reportLines, sizeof( struct reportLine ), _report_sort_fn );
 
+    for ( uint32_t i = 0; i < reportLines; i++ )
+    {
+        _nameForKey( report[i].key, &report[i].n );
+    }
+
     *returnReport = report;
     *returnReportLines = reportLines;
 
-
     return total;
 }
 // ====================================================================================================
@@ -476,6 +935,7 @@ static void _outputJson( FILE *f, uint32_t total, uint32_t reportLines, struct r
     cJSON *jsonStatsTable;
     cJSON *jsonTableEntry;
     cJSON *jsonIntTable;
+    cJSON *jsonRunEntry;
     char *opString;
 
     /* Start of frame  ====================================================== */
@@ -526,17 +986,17 @@ static void _outputJson( FILE *f, uint32_t total, uint32_t reportLines, struct r
             jsonElement = cJSON_CreateNumber( report[n].count );
             assert( jsonElement );
             cJSON_AddItemToObject( jsonTableEntry, "count", jsonElement );
-            jsonElement = cJSON_CreateString( SymbolFilename( _r.s, report[n].n->fileindex ) );
+            jsonElement = cJSON_CreateString( SymbolFilename( _r.s, report[n].n.fileindex ) );
             assert( jsonElement );
             cJSON_AddItemToObject( jsonTableEntry, "filename", jsonElement );
 
-            jsonElement = cJSON_CreateString(  d ? d : SymbolFunction( _r.s, report[n].n->functionindex ) );
+            jsonElement = cJSON_CreateString(  d ? d : SymbolFunction( _r.s, report[n].n.functionindex ) );
             assert( jsonElement );
             cJSON_AddItemToObject( jsonTableEntry, "function", jsonElement );
 
             if ( options.lineDisaggregation )
             {
-                jsonElement = cJSON_CreateNumber( report[n].n->line ? report[n].n->line : 0 );
+                jsonElement = cJSON_CreateNumber( report[n].n.line ? report[n].n.line : 0 );
                 assert( jsonElement );
                 cJSON_AddItemToObject( jsonTableEntry, "line", jsonElement );
             }
@@ -552,7 +1012,7 @@ static void _outputJson( FILE *f, uint32_t total, uint32_t reportLines, struct r
 
     for ( uint32_t e = 0; e < MAX_EXCEPTIONS; e++ )
     {
-        if ( _r.er[e].visits )
+        if ( ( _r.er[e].visits ) || ( _r.er[e].runHist.count ) )
         {
             jsonTableEntry = cJSON_CreateObject();
             assert( jsonTableEntry );
@@ -578,6 +1038,22 @@ static void _outputJson( FILE *f, uint32_t total, uint32_t reportLines, struct r
             jsonElement = cJSON_CreateNumber( _r.er[e].maxWallTime );
             assert( jsonElement );
             cJSON_AddItemToObject( jsonTableEntry, "maxwt", jsonElement );
+            _histJson( jsonTableEntry, &_r.er[e].hist );
+
+            /* ...and the distribution since we started, including this interval */
+            jsonRunEntry = cJSON_CreateObject();
+            assert( jsonRunEntry );
+            cJSON_AddItemToObject( jsonTableEntry, "run", jsonRunEntry );
+            jsonElement = cJSON_CreateNumber( _r.er[e].runHist.count );
+            assert( jsonElement );
+            cJSON_AddItemToObject( jsonRunEntry, "count", jsonElement );
+            jsonElement = cJSON_CreateNumber( _r.er[e].runHist.min );
+            assert( jsonElement );
+            cJSON_AddItemToObject( jsonRunEntry, "mint", jsonElement );
+            jsonElement = cJSON_CreateNumber( _r.er[e].runHist.max );
+            assert( jsonElement );
+            cJSON_AddItemToObject( jsonRunEntry, "maxt", jsonElement );
+            _histJson( jsonRunEntry, &_r.er[e].runHist );
         }
     }
 
@@ -616,7 +1092,6 @@ static void _outputTop( uint32_t total, uint32_t reportLines, struct reportLine
 /* Produce the output */
 
 {
-    uint64_t samples = 0;
     uint64_t dispSamples = 0;
     uint32_t percentage;
     uint32_t totPercent = 0;
@@ -644,7 +1119,6 @@ static void _outputTop( uint32_t total, uint32_t reportLines, struct reportLine
         for ( uint32_t n = 0; n < reportLines; n++ )
         {
             percentage = ( report[n].count * 10000 ) / total;
-            samples += report[n].count;
 
             if ( report[n].count )
             {
@@ -658,18 +1132,18 @@ static void _outputTop( uint32_t total, uint32_t reportLines, struct reportLine
                     genericsFPrintf( stdout, C_DATA "%3d.%02d%% " C_SUPPORT " %7" PRIu64 " ", percentage / 100, percentage % 100, report[n].count );
 
 
-                    if ( ( options.reportFilenames ) && ( report[n].n->fileindex != NO_FILE ) )
+                    if ( ( options.reportFilenames ) && ( report[n].n.fileindex != NO_FILE ) )
                     {
-                        genericsFPrintf( stdout, C_CONTEXT "%s" C_RESET "::", SymbolFilename( _r.s, report[n].n->fileindex ) );
+                        genericsFPrintf( stdout, C_CONTEXT "%s" C_RESET "::", SymbolFilename( _r.s, report[n].n.fileindex ) );
                     }
 
-                    if ( ( options.lineDisaggregation ) && ( report[n].n->line ) )
+                    if ( ( options.lineDisaggregation ) && ( report[n].n.line ) )
                     {
-                        genericsFPrintf( stdout, C_SUPPORT2 "%s" C_RESET "::" C_CONTEXT "%d" EOL, d ? d : SymbolFunction( _r.s, report[n].n->functionindex ), report[n].n->line );
+                        genericsFPrintf( stdout, C_SUPPORT2 "%s" C_RESET "::" C_CONTEXT "%d" EOL, d ? d : SymbolFunction( _r.s, report[n].n.functionindex ), report[n].n.line );
                     }
                     else
                     {
-                        genericsFPrintf( stdout, C_SUPPORT2 "%s" C_RESET EOL, d ? d : SymbolFunction( _r.s, report[n].n->functionindex ) );
+                        genericsFPrintf( stdout, C_SUPPORT2 "%s" C_RESET EOL, d ? d : SymbolFunction( _r.s, report[n].n.functionindex ) );
                     }
 
                     printed++;
@@ -682,24 +1156,24 @@ static void _outputTop( uint32_t total, uint32_t reportLines, struct reportLine
                     {
                         if ( ( p ) && ( n < options.maxRoutines ) )
                         {
-                            fprintf( p, "%s,%3d.%02d" EOL, d ? d : SymbolFunction( _r.s, report[n].n->functionindex ), percentage / 100, percentage % 100 );
+                            fprintf( p, "%s,%3d.%02d" EOL, d ? d : SymbolFunction( _r.s, report[n].n.functionindex ), percentage / 100, percentage % 100 );
                         }
 
                         if ( q )
                         {
-                            fprintf( q, "%s,%3d.%02d" EOL, d ? d : SymbolFunction( _r.s, report[n].n->functionindex ), percentage / 100, percentage % 100 );
+                            fprintf( q, "%s,%3d.%02d" EOL, d ? d : SymbolFunction( _r.s, report[n].n.functionindex ), percentage / 100, percentage % 100 );
                         }
                     }
                     else
                     {
                         if ( ( p ) && ( n < options.maxRoutines ) )
                         {
-                            fprintf( p, "%s::%d,%3d.%02d" EOL, d ? d : SymbolFunction( _r.s, report[n].n->functionindex ), report[n].n->line, percentage / 100, percentage % 100 );
+                            fprintf( p, "%s::%d,%3d.%02d" EOL, d ? d : SymbolFunction( _r.s, report[n].n.functionindex ), report[n].n.line, percentage / 100, percentage % 100 );
                         }
 
                         if ( q )
                         {
-                            fprintf( q, "%s::%d,%3d.%02d" EOL, d ? d : SymbolFunction( _r.s, report[n].n->functionindex ), report[n].n->line, percentage / 100, percentage % 100 );
+                            fprintf( q, "%s::%d,%3d.%02d" EOL, d ? d : SymbolFunction( _r.s, report[n].n.functionindex ), report[n].n.line, percentage / 100, percentage % 100 );
                         }
                     }
 
@@ -711,7 +1185,7 @@ static void _outputTop( uint32_t total, uint32_t reportLines, struct reportLine
 
     genericsFPrintf( stdout, C_RESET "-----------------" EOL );
 
-    genericsFPrintf( stdout, C_DATA "%3d.%02d%% " C_SUPPORT " %7" PRIu64 " " C_RESET "of "C_DATA" %" PRIu64 " "C_RESET" Samples" EOL, totPercent / 100, totPercent % 100, dispSamples, samples );
+    genericsFPrintf( stdout, C_DATA "%3d.%02d%% " C_SUPPORT " %7" PRIu64 " " C_RESET "of "C_DATA" %" PRIu64 " "C_RESET" Samples" EOL, totPercent / 100, totPercent % 100, dispSamples, ( uint64_t )total );
 
     if ( p )
     {
@@ -749,8 +1223,8 @@ static void _outputTop( uint32_t total, uint32_t reportLines, struct reportLine
             genericsFPrintf( stdout, EOL );
         }
 
-        genericsFPrintf( stdout, EOL " Exception         |   Count  |  MaxD | TotalTicks  |   %%   |  AveTicks  |  minTicks  |  maxTicks  |  maxWall " EOL );
-        genericsFPrintf( stdout, /**/"-------------------+----------+-------+-------------+-------+------------+------------+------------+----------" EOL );
+        genericsFPrintf( stdout, EOL " Exception         |   Count  |  MaxD | TotalTicks  |   %%   |  AveTicks  |  minTicks  |  maxTicks  |  maxWall  |    p50    |    p99    |   p99.9   |  Jitter " EOL );
+        genericsFPrintf( stdout, /**/"-------------------+----------+-------+-------------+-------+------------+------------+------------+-----------+-----------+-----------+-----------+----------" EOL );
 
         for ( uint32_t e = 0; e < MAX_EXCEPTIONS; e++ )
         {
@@ -771,8 +1245,9 @@ static void _outputTop( uint32_t total, uint32_t reportLines, struct reportLine
                 const float util_percent = ( float )_r.er[e].totalTime / ( _r.timeStamp - _r.lastReportTicks ) * 100.0f;
                 genericsFPrintf( stdout, C_DATA "%3" PRId32 " %-14s" C_RESET " | " C_DATA "%8" PRIu64 C_RESET " |" C_DATA " %5"
                                  PRIu32 C_RESET " | "C_DATA " %9" PRIu64 C_RESET "  |" C_DATA "%6.1f" C_RESET " |  " C_DATA "%9" PRIu64 C_RESET " | " C_DATA "%9" PRIu64 C_RESET "  | " C_DATA" %9" PRIu64 C_RESET " | " C_DATA "%9"
-                                 PRIu64 C_RESET EOL,
-                                 e, exceptionName, _r.er[e].visits, _r.er[e].maxDepth, _r.er[e].totalTime, util_percent, _r.er[e].totalTime / _r.er[e].visits, _r.er[e].minTime, _r.er[e].maxTime, _r.er[e].maxWallTime );
+                                 PRIu64 C_RESET " | " C_DATA "%9" PRId64 C_RESET " | " C_DATA "%9" PRId64 C_RESET " | " C_DATA "%9" PRId64 C_RESET " | " C_DATA "%9" PRId64 C_RESET EOL,
+                                 e, exceptionName, _r.er[e].visits, _r.er[e].maxDepth, _r.er[e].totalTime, util_percent, _r.er[e].totalTime / _r.er[e].visits, _r.er[e].minTime, _r.er[e].maxTime, _r.er[e].maxWallTime,
+                                 _histPercentile( &_r.er[e].hist, 50 ), _histPercentile( &_r.er[e].hist, 99 ), _histPercentile( &_r.er[e].hist, 99.9 ), _histJitter( &_r.er[e].hist ) );
             }
         }
     }
@@ -799,61 +1274,333 @@ static void _outputTop( uint32_t total, uint32_t reportLines, struct reportLine
 }
 
 // ====================================================================================================
-void _handlePCSample( struct pcSampleMsg *m, struct ITMDecoder *i )
+// ====================================================================================================
+// Binary time series recorder
+// ====================================================================================================
+// ====================================================================================================
+// The file is TS_MAGIC and a version byte, followed by records of a one byte tag, a varint body
+// length and the body. All integers are unsigned LEB128 varints. Readers should skip unknown tags.
+//
+// TS_TAG_STRING   : id, then the name as the rest of the body. Names are written before first use.
+// TS_TAG_INTERVAL : time (us), interval (us), interval (ticks), ITM overflows, syncs and errors
+//                   (the decoder counters are cumulative), then n, n ascending string id deltas
+//                   and n sample counts, then m followed by one column of m values for each of
+//                   exception number, count, max depth, total, min, max, max wall, p50, p99, p99.9
+//                   and jitter ticks.
+// ====================================================================================================
+static void _tsReserve( size_t len )
 
 {
-    assert( m->msgtype == MSG_PC_SAMPLE );
+    while ( _r.tsLen + len > _r.tsSize )
+    {
+        _r.tsSize = _r.tsSize ? _r.tsSize * 2 : 4096;
+        _r.tsBuf = ( uint8_t * )realloc( _r.tsBuf, _r.tsSize );
+        MEMCHECKV( _r.tsBuf );
+    }
+}
+// ====================================================================================================
+static void _tsPutVar( uint64_t v )
 
-    struct visitedAddr *a;
+{
+    _tsReserve( 10 );
 
-    if ( m->sleep )
+    while ( v >= 0x80 )
     {
-        /* This is a sleep packet */
-        _r.sleeps++;
+        _r.tsBuf[_r.tsLen++] = ( v & 0x7f ) | 0x80;
+        v >>= 7;
+    }
+
+    _r.tsBuf[_r.tsLen++] = v;
+}
+// ====================================================================================================
+static void _tsFlushRecord( uint8_t tag, size_t start )
+
+/* Write out the record whose body has been built from start in the buffer */
+
+{
+    size_t len = _r.tsLen - start;
+    size_t h = 0;
+    uint8_t hdr[11];
+
+    hdr[h++] = tag;
+
+    do
+    {
+        hdr[h] = len & 0x7f;
+        len >>= 7;
+        hdr[h++] |= len ? 0x80 : 0;
+    }
+    while ( len );
+
+    fwrite( hdr, 1, h, _r.tsfile );
+    fwrite( &_r.tsBuf[start], 1, _r.tsLen - start, _r.tsfile );
+    _r.tsLen = start;
+}
+// ====================================================================================================
+static uint32_t _tsNameId( uint32_t key )
+
+/* Return the dictionary id for a key, writing its name out if this is the first time it's used */
+
+{
+    struct nameEntry n;
+    char name[TS_MAX_NAME];
+    size_t start = _r.tsLen;
+    int l = 0;
+
+    if ( _r.tsId[key] != NO_KEY )
+    {
+        return _r.tsId[key];
+    }
+
+    _nameForKey( key, &n );
+
+    /* Name entries the same way as the live report */
+    if ( ( options.reportFilenames ) && ( n.fileindex != NO_FILE ) && ( n.fileindex != INTERRUPT ) )
+    {
+        l = snprintf( name, TS_MAX_NAME, "%s::", SymbolFilename( _r.s, n.fileindex ) );
+    }
+
+    if ( ( options.lineDisaggregation ) && ( n.line ) )
+    {
+        snprintf( &name[l], TS_MAX_NAME - l, "%s::%d", SymbolFunction( _r.s, n.functionindex ), n.line );
     }
     else
     {
-        HASH_FIND_INT( _r.addresses, &m->pc, a );
+        snprintf( &name[l], TS_MAX_NAME - l, "%s", SymbolFunction( _r.s, n.functionindex ) );
+    }
+
+    _r.tsId[key] = _r.tsNextId++;
+    _tsPutVar( _r.tsId[key] );
+
+    l = strlen( name );
+    _tsReserve( l );
+    memcpy( &_r.tsBuf[_r.tsLen], name, l );
+    _r.tsLen += l;
+
+    _tsFlushRecord( TS_TAG_STRING, start );
+    return _r.tsId[key];
+}
+// ====================================================================================================
+static int _tsId_sort_fn( const void *a, const void *b )
+
+{
+    const uint32_t ka = _r.tsId[( ( const struct keyCount * )a )->key];
+    const uint32_t kb = _r.tsId[( ( const struct keyCount * )b )->key];
+
+    return ( ka < kb ) ? -1 : ( ka > kb );
+}
+// ====================================================================================================
+static void _outputTimeSeries( int64_t timeStamp )
+
+/* Append a row for this interval to the time series */
+
+{
+    static uint64_t exStats[MAX_EXCEPTIONS][TS_EX_COLUMNS];
+    struct intervalCounts *t = &_r.tsInterval;
+    uint32_t exceptions = 0;
+    uint32_t lastId = 0;
+
+    /* Make sure every name this row refers to is in the dictionary ahead of it */
+    for ( uint32_t i = 0; i < t->n; i++ )
+    {
+        _tsNameId( t->e[i].key );
+    }
+
+    qsort( t->e, t->n, sizeof( struct keyCount ), _tsId_sort_fn );
+
+    _tsPutVar( timeStamp );
+    _tsPutVar( timeStamp - _r.lastReportus );
+    _tsPutVar( _r.timeStamp - _r.lastReportTicks );
+    _tsPutVar( ITMDecoderGetStats( &_r.i )->overflow );
+    _tsPutVar( ITMDecoderGetStats( &_r.i )->syncCount );
+    _tsPutVar( ITMDecoderGetStats( &_r.i )->ErrorPkt );
 
-        if ( a )
+    _tsPutVar( t->n );
+
+    for ( uint32_t i = 0; i < t->n; i++ )
+    {
+        _tsPutVar( _r.tsId[t->e[i].key] - lastId );
+        lastId = _r.tsId[t->e[i].key];
+    }
+
+    for ( uint32_t i = 0; i < t->n; i++ )
+    {
+        _tsPutVar( t->e[i].count );
+    }
+
+    t->n = 0;
+
+    /* Exception statistics, gathered a row at a time and then written column by column */
+    for ( uint32_t e = 0; e < MAX_EXCEPTIONS; e++ )
+    {
+        if ( _r.er[e].visits )
         {
-            a->visits++;
+            uint64_t *c = exStats[exceptions++];
+
+            c[0] = e;
+            c[1] = _r.er[e].visits;
+            c[2] = _r.er[e].maxDepth;
+            c[3] = _r.er[e].totalTime;
+            c[4] = _r.er[e].minTime;
+            c[5] = _r.er[e].maxTime;
+            c[6] = _r.er[e].maxWallTime;
+            c[7] = _histPercentile( &_r.er[e].hist, 50 );
+            c[8] = _histPercentile( &_r.er[e].hist, 99 );
+            c[9] = _histPercentile( &_r.er[e].hist, 99.9 );
+            c[10] = _histJitter( &_r.er[e].hist );
         }
-        else
+    }
+
+    _tsPutVar( exceptions );
+
+    for ( uint32_t col = 0; col < TS_EX_COLUMNS; col++ )
+    {
+        for ( uint32_t e = 0; e < exceptions; e++ )
         {
-            struct nameEntry n;
+            _tsPutVar( exStats[e][col] );
+        }
+    }
 
-            /* Find a matching name record if there is one */
-            SymbolLookup( _r.s, m->pc, &n );
+    _tsFlushRecord( TS_TAG_INTERVAL, 0 );
+    fflush( _r.tsfile );
+}
+// ====================================================================================================
+static void _resetCounts( void )
+
+/* Discard any samples collected so far this interval */
+
+{
+    for ( uint32_t i = 0; i < _r.activeCount; i++ )
+    {
+        _r.count[_r.active[i]] = 0;
+    }
 
-            /* This is a new entry - record it */
+    _r.activeCount = 0;
+}
+// ====================================================================================================
+static void _buildKeys( void )
 
-            a = ( struct visitedAddr * )calloc( 1, sizeof( struct visitedAddr ) );
-            MEMCHECKV( a );
-            a->visits = 1;
+/* Assign report keys for the current symbol set. Source line entries which aggregate into the same */
+/* report line (same function, file and line as selected by options) share the key of the first.  */
 
-            a->n = ( struct nameEntry * )malloc( sizeof( struct nameEntry ) );
-            MEMCHECKV( a->n );
-            memcpy( a->n, &n, sizeof( struct nameEntry ) );
-            HASH_ADD_INT( _r.addresses, n->addr, a );
-        }
+{
+    uint32_t sources = _r.s ? _r.s->sourceCount : 0;
+    uint32_t *order;
+
+    _aggReset();
+
+    free( _r.key );
+    free( _r.count );
+    free( _r.active );
+    free( _r.agg );
+    free( _r.aggActive );
+    free( _r.aggPos );
+    free( _r.tsId );
+
+    _r.keyCount = sources + KEY_NUM_SPECIALS;
+    _r.activeCount = 0;
+    _r.key = ( uint32_t * )malloc( sizeof( uint32_t ) * _r.keyCount );
+    MEMCHECKV( _r.key );
+    _r.count = ( uint64_t * )calloc( _r.keyCount, sizeof( uint64_t ) );
+    MEMCHECKV( _r.count );
+    _r.active = ( uint32_t * )malloc( sizeof( uint32_t ) * _r.keyCount );
+    MEMCHECKV( _r.active );
+    _r.agg = ( double * )calloc( _r.keyCount, sizeof( double ) );
+    MEMCHECKV( _r.agg );
+    _r.aggActive = ( uint32_t * )malloc( sizeof( uint32_t ) * _r.keyCount );
+    MEMCHECKV( _r.aggActive );
+    _r.aggPos = ( uint32_t * )malloc( sizeof( uint32_t ) * _r.keyCount );
+    MEMCHECKV( _r.aggPos );
+    _r.tsId = ( uint32_t * )malloc( sizeof( uint32_t ) * _r.keyCount );
+    MEMCHECKV( _r.tsId );
+
+    order = ( uint32_t * )malloc( sizeof( uint32_t ) * ( sources + 1 ) );
+    MEMCHECKV( order );
+
+    for ( uint32_t i = 0; i < sources; i++ )
+    {
+        order[i] = i;
+    }
+
+    qsort( order, sources, sizeof( uint32_t ), _sourceKey_fn );
+
+    for ( uint32_t i = 0; i < sources; i++ )
+    {
+        _r.key[order[i]] = ( ( i ) && ( !_sourceKey_fn( &order[i - 1], &order[i] ) ) ) ? _r.key[order[i - 1]] : order[i];
+    }
+
+    free( order );
+
+    for ( uint32_t i = sources; i < _r.keyCount; i++ )
+    {
+        _r.key[i] = i;
+    }
+
+    /* Names for the new keys will be written to the time series as new dictionary entries */
+    for ( uint32_t i = 0; i < _r.keyCount; i++ )
+    {
+        _r.aggPos[i] = _r.tsId[i] = NO_KEY;
+    }
+
+    _r.tsInterval.n = 0;
+
+    /* Any cached keys belong to the old symbol set */
+    for ( uint32_t i = 0; i < ADDR_CACHE_SIZE; i++ )
+    {
+        _r.addrCache[i].key = NO_KEY;
     }
 }
 // ====================================================================================================
-void _flushHash( void )
+static uint32_t _addrKey( uint32_t addr )
+
+/* Find the report key for an address, via the cache if it's been seen recently */
 
 {
-    struct visitedAddr *a, *tmp;
+    struct addrCacheEntry *c = &_r.addrCache[( addr >> 1 ) & ( ADDR_CACHE_SIZE - 1 )];
+    struct nameEntry n;
+
+    if ( ( c->key != NO_KEY ) && ( c->addr == addr ) )
+    {
+        return c->key;
+    }
+
+    c->addr = addr;
+
+    if ( !SymbolLookup( _r.s, addr, &n ) )
+    {
+        c->key = _r.keyCount - KEY_NUM_SPECIALS + KEY_UNKNOWN;
+    }
+    else if ( n.functionindex == INTERRUPT )
+    {
+        c->key = _r.keyCount - KEY_NUM_SPECIALS + KEY_INTERRUPT;
+    }
+    else
+    {
+        c->key = _r.key[n.index];
+    }
 
-    HASH_ITER( hh, _r.addresses, a, tmp )
+    return c->key;
+}
+// ====================================================================================================
+void _handlePCSample( struct pcSampleMsg *m, struct ITMDecoder *i )
+
+{
+    assert( m->msgtype == MSG_PC_SAMPLE );
+
+    if ( m->sleep )
+    {
+        /* This is a sleep packet */
+        _r.sleeps++;
+    }
+    else
     {
-        if ( a->n )
+        uint32_t key = _addrKey( m->pc );
+
+        /* Note the first time we see a key in this interval, so reporting needn't scan them all */
+        if ( !_r.count[key]++ )
         {
-            free( a->n );
+            _r.active[_r.activeCount++] = key;
         }
-
-        HASH_DEL( _r.addresses, a );
-        free( a );
     }
 }
 // ====================================================================================================
@@ -927,6 +1674,7 @@ void _printHelp( const char *const progName )
     genericsFPrintf( stderr, "    -f, --input-file:   <filename> Take input from specified file" EOL );
     genericsFPrintf( stderr, "    -g, --record-file:  <LogFile> append historic records to specified file" EOL );
     genericsFPrintf( stderr, "    -h, --help:         This help" EOL );
+    genericsFPrintf( stderr, "    -H, --half-life:    <seconds> Report counts decayed with this half life rather than per interval" EOL );
     genericsFPrintf( stderr, "    -I, --interval:     <interval> Display interval in milliseconds (defaults to %dms)" EOL, TOP_UPDATE_INTERVAL );
     genericsFPrintf( stderr, "    -j, --json-file:    <filename> Output to file in JSON format (or screen if <filename> is '-')" EOL );
     genericsFPrintf( stderr, "    -l, --agg-lines:    Aggregate per line rather than per function" EOL );
@@ -940,8 +1688,10 @@ void _printHelp( const char *const progName )
     genericsFPrintf( stderr, "    -R, --report-files: Report filenames as part of function discriminator" EOL );
     genericsFPrintf( stderr, "    -s, --server:       <Server>:<Port> to use" EOL );
     genericsFPrintf( stderr, "    -t, --tag:          <stream> Which OFLOW tag to use (normally 1)" EOL );
+    genericsFPrintf( stderr, "    -T, --time-series:  <filename> Record every interval to specified file in compact binary form" EOL );
     genericsFPrintf( stderr, "    -v, --verbose:      <level> Verbose mode 0(errors)..3(debug)" EOL );
     genericsFPrintf( stderr, "    -V, --version:      Print version and exit" EOL );
+    genericsFPrintf( stderr, "    -W, --window:       <seconds> Report counts over a sliding window rather than per interval" EOL );
     genericsFPrintf( stderr, EOL "Environment Variables;" EOL );
     genericsFPrintf( stderr, "  OBJDUMP: to use non-standard obbdump binary" EOL );
 }
@@ -962,6 +1712,7 @@ static struct option _longOptions[] =
     {"input-file", required_argument, NULL, 'f'},
     {"record-file", required_argument, NULL, 'g'},
     {"help", no_argument, NULL, 'h'},
+    {"half-life", required_argument, NULL, 'H'},
     {"interval", required_argument, NULL, 'I'},
     {"json-file", required_argument, NULL, 'j'},
     {"agg-lines", no_argument, NULL, 'l'},
@@ -976,8 +1727,10 @@ static struct option _longOptions[] =
     {"report-files", no_argument, NULL, 'R'},
     {"server", required_argument, NULL, 's'},
     {"tag", required_argument, NULL, 't'},
+    {"time-series", required_argument, NULL, 'T'},
     {"verbose", required_argument, NULL, 'v'},
     {"version", no_argument, NULL, 'V'},
+    {"window", required_argument, NULL, 'W'},
     {NULL, no_argument, NULL, 0}
 };
 // ====================================================================================================
@@ -988,7 +1741,7 @@ errcode _processOptions( int argc, char *argv[] )
     bool protExplicit = false;
     bool serverExplicit = false;
 
-    while ( ( c = getopt_long ( argc, argv, "c:d:DEe:f:g:hVI:j:lMnO:o:p:P:r:Rs:t:v:", _longOptions, &optionIndex ) ) != -1 )
+    while ( ( c = getopt_long ( argc, argv, "c:d:DEe:f:g:hH:VI:j:lMnO:o:p:P:r:Rs:t:T:v:W:", _longOptions, &optionIndex ) ) != -1 )
         switch ( c )
         {
             // ------------------------------------
@@ -1026,6 +1779,19 @@ errcode _processOptions( int argc, char *argv[] )
                 options.demangle = false;
                 break;
 
+            // ------------------------------------
+            case 'H':
+                options.aggregate = AGG_DECAY;
+                options.halfLife = atof( optarg );
+
+                if ( options.halfLife <= 0 )
+                {
+                    genericsReport( V_ERROR, "Half life is out of range" EOL );
+                    return ERR;
+                }
+
+                break;
+
             // ------------------------------------
             case 'I':
                 options.displayInterval = ( int64_t ) ( atof( optarg ) ) * 1000;
@@ -1121,11 +1887,29 @@ errcode _processOptions( int argc, char *argv[] )
                 options.tag = atoi( optarg );
                 break;
 
+            // ------------------------------------
+            case 'T':
+                options.tsfile = optarg;
+                break;
+
             // ------------------------------------
             case 'R':
                 options.reportFilenames = true;
                 break;
 
+            // ------------------------------------
+            case 'W':
+                options.aggregate = AGG_WINDOW;
+                options.window = atof( optarg );
+
+                if ( options.window <= 0 )
+                {
+                    genericsReport( V_ERROR, "Window is out of range" EOL );
+                    return ERR;
+                }
+
+                break;
+
             // ------------------------------------
             case 's':
                 options.server = optarg;
@@ -1212,7 +1996,24 @@ errcode _processOptions( int argc, char *argv[] )
     genericsReport( V_INFO, "ForceSync        : %s" EOL, options.forceITMSync ? "true" : "false" );
     genericsReport( V_INFO, "C++ Demangle     : %s" EOL, options.demangle ? "true" : "false" );
     genericsReport( V_INFO, "Display Interval : %d ms" EOL, options.displayInterval / 1000 );
+
+    switch ( options.aggregate )
+    {
+        case AGG_WINDOW:
+            genericsReport( V_INFO, "Aggregation      : %.1fs sliding window" EOL, options.window );
+            break;
+
+        case AGG_DECAY:
+            genericsReport( V_INFO, "Aggregation      : %.1fs half life" EOL, options.halfLife );
+            break;
+
+        default:
+            genericsReport( V_INFO, "Aggregation      : Per interval" EOL );
+            break;
+    }
+
     genericsReport( V_INFO, "Log File         : %s" EOL, options.logfile ? options.logfile : "None" );
+    genericsReport( V_INFO, "Time Series File : %s" EOL, options.tsfile ? options.tsfile : "None" );
     genericsReport( V_INFO, "Objdump options  : %s" EOL, options.odoptions ? options.odoptions : "None" );
 
     switch ( options.protocol )
@@ -1236,6 +2037,12 @@ errcode _processOptions( int argc, char *argv[] )
         return ERR;
     }
 
+    if ( ( options.window ) && ( options.halfLife ) )
+    {
+        genericsReport( V_ERROR, "Choose either a sliding window or a half life, not both" EOL );
+        return ERR;
+    }
+
     return OK;
 }
 // ====================================================================================================
@@ -1312,6 +2119,19 @@ int main( int argc, char *argv[] )
 
     genericsScreenHandling( !options.mono );
 
+    /* Set up aggregation across intervals, both are measured in display intervals */
+    if ( options.aggregate == AGG_WINDOW )
+    {
+        _r.ringLen = ( uint32_t )( ( options.window * 1000000 ) / options.displayInterval + 0.5 );
+        _r.ringLen = _r.ringLen ? _r.ringLen : 1;
+        _r.ring = ( struct intervalCounts * )calloc( _r.ringLen, sizeof( struct intervalCounts ) );
+        MEMCHECK( _r.ring, -ENOMEM );
+    }
+    else if ( options.aggregate == AGG_DECAY )
+    {
+        _r.decay = pow( 0.5, options.displayInterval / ( options.halfLife * 1000000 ) );
+    }
+
     /* Check we've got _some_ symbols to start from */
     r = SymbolSetCreate( &_r.s, options.elffile, options.deleteMaterial, options.demangle, true, true, options.odoptions );
 
@@ -1334,6 +2154,7 @@ int main( int argc, char *argv[] )
     }
 
     genericsReport( V_WARN, "Loaded %s" EOL, options.elffile );
+    _buildKeys();
 
     if ( _r.s )
     {
@@ -1375,6 +2196,21 @@ int main( int argc, char *argv[] )
         }
     }
 
+    /* ...and for the time series */
+    if ( options.tsfile )
+    {
+        _r.tsfile = fopen( options.tsfile, "wb" );
+
+        if ( !_r.tsfile )
+        {
+            perror( "Couldn't open time series output file" );
+            return -ENOENT;
+        }
+
+        fwrite( TS_MAGIC, 1, strlen( TS_MAGIC ), _r.tsfile );
+        fputc( TS_VERSION, _r.tsfile );
+    }
+
     while ( !_r.ending )
     {
         struct Stream *stream = _openStream();
@@ -1399,7 +2235,7 @@ int main( int argc, char *argv[] )
         }
 
         /* ...just in case we have any readings from a previous incantation */
-        _flushHash( );
+        _resetCounts();
 
         thisTime = _r.lastReportus = _timestamp();
 
@@ -1436,7 +2272,7 @@ int main( int argc, char *argv[] )
             if ( !SymbolSetValid( &_r.s, options.elffile ) )
             {
                 /* Make sure old references are invalidated */
-                _flushHash();
+                _resetCounts();
 
                 r = SymbolSetCreate( &_r.s, options.elffile, options.deleteMaterial, options.demangle, true, true, options.odoptions );
 
@@ -1465,6 +2301,7 @@ int main( int argc, char *argv[] )
                 }
 
                 genericsReport( V_WARN, "Loaded %s" EOL, options.elffile );
+                _buildKeys();
 
                 if ( _r.s )
                 {
@@ -1499,6 +2336,12 @@ int main( int argc, char *argv[] )
                 /* Create the report that we will output */
                 total = _consolodateReport( &report, &reportLines );
 
+                /* Fold this interval into the whole-run exception distributions */
+                for ( uint32_t e = 0; e < MAX_EXCEPTIONS; e++ )
+                {
+                    _histMerge( &_r.er[e].runHist, &_r.er[e].hist );
+                }
+
                 if ( options.json )
                 {
                     _outputJson( _r.jsonfile, total, reportLines, report, thisTime );
@@ -1509,15 +2352,19 @@ int main( int argc, char *argv[] )
                     _outputTop( total, reportLines, report, thisTime );
                 }
 
+                if ( _r.tsfile )
+                {
+                    _outputTimeSeries( thisTime );
+                }
+
                 /* ... and we are done with the report now, get rid of it */
                 free( report );
-                /* and, the hash of seen addresses! */
-                _flushHash();
 
                 /* ...and zero the exception records */
                 for ( uint32_t e = 0; e < MAX_EXCEPTIONS; e++ )
                 {
                     _r.er[e].visits = _r.er[e].maxDepth = _r.er[e].totalTime = _r.er[e].minTime = _r.er[e].maxTime = _r.er[e].maxWallTime = 0;
+                    _histReset( &_r.er[e].hist );
                 }
 
                 /* ... and the event counters */
@@ -18,6 +18,8 @@
 #include "itmDecoder.h"
 #include "msgDecoder.h"
 #include "oflow.h"
+#include "swFormat.h"
+#include "zmqEvents.h"
 
 #define NUM_CHANNELS  32
 #define HWFIFO_NAME "hwevent"
@@ -25,15 +27,31 @@
 
 #define DEFAULT_ZMQ_BIND_URL "tcp://*:3442"  /* by default bind to all source interfaces */
 
+#define MIN_BATCH_LEN      (256)             /* Smallest batch that can be requested */
+#define DEFAULT_LATENCY_MS (10)              /* Default maximum time a batch is held before it's published */
+#define BATCH_RECORD_HDR   (2)               /* Each record in a batch is preceded by its length (16 bit, little endian) */
+#define MAX_WAIT_US        (100000)          /* Longest time to wait for data when batches could be pending */
+
 enum Prot { PROT_OFLOW, PROT_ITM, PROT_UNKNOWN };
 const char *protString[] = {"OFLOW", "ITM", NULL};
 
 // Record for options, either defaults or from command line
 
+/* Messages waiting to be published together on one topic */
+struct Batch
+{
+    const char *topic;                                  /* Topic messages are published on */
+    uint8_t *buffer;                                    /* Records waiting to be published */
+    size_t used;                                        /* ...and how much of the buffer they fill */
+    uint64_t deadlineuS;                                /* Time by which they must be published */
+};
+
 struct Channel
 {
     char *topic;
     char *format;
+    struct SWFormat *compiled;                          /* The format, ready for rendering */
+    struct Batch batch;                                 /* Publishing for this channel */
 };
 
 struct
@@ -56,8 +74,12 @@ struct
     char *file;                                         /* File host connection */
     bool endTerminate;                                  /* Terminate when file/socket "ends" */
 
+    bool binary;                                        /* Publish hardware events in binary rather than text */
+    size_t batchLen;                                    /* Size of batches to publish, 0 for one message at a time */
+    uint32_t latencymS;                                 /* Longest time a batch is held before it's published */
 } options =
 {
+    .latencymS = DEFAULT_LATENCY_MS,
     .forceITMSync = true,
     .tag = 1,
     .bindUrl = DEFAULT_ZMQ_BIND_URL,
@@ -81,15 +103,10 @@ struct
     void *zmqSocket;
     bool ending;
 
+    struct Batch hwBatch[HWEVENT_UNUSED];         /* Publishing for each hardware event topic */
 } _r;
 
 // ====================================================================================================
-void _publishMessage( const char *topic, void *payload, size_t size )
-{
-    zmq_send( _r.zmqSocket, topic, strlen( topic ), ZMQ_SNDMORE );
-    zmq_send( _r.zmqSocket, payload, size, 0 );
-}
-
 static const char *hwEventNames[] =
 {
     [HWEVENT_TS] = HWFIFO_NAME "TS",
@@ -103,6 +120,140 @@ static const char *hwEventNames[] =
     [HWEVENT_NISYNC] = NULL,
 };
 
+// ====================================================================================================
+static void _freeBatch( void *data, void *hint )
+
+/* Called by ZeroMQ once it's finished with a batch it was handed */
+
+{
+    free( data );
+}
+// ====================================================================================================
+static void _publishBatch( struct Batch *b )
+
+/* Publish whatever the batch holds, handing the buffer over to ZeroMQ rather than copying it */
+
+{
+    zmq_msg_t msg;
+
+    if ( !b->used )
+    {
+        return;
+    }
+
+    zmq_send( _r.zmqSocket, b->topic, strlen( b->topic ), ZMQ_SNDMORE );
+
+    if ( zmq_msg_init_data( &msg, b->buffer, b->used, _freeBatch, NULL ) )
+    {
+        genericsExit( -1, "Failed to create batch message (%s)" EOL, zmq_strerror( zmq_errno() ) );
+    }
+
+    if ( zmq_msg_send( &msg, _r.zmqSocket, 0 ) < 0 )
+    {
+        /* Ownership only passes to ZeroMQ when the send succeeds */
+        zmq_msg_close( &msg );
+    }
+
+    b->buffer = ( uint8_t * )malloc( options.batchLen );
+    MEMCHECKV( b->buffer );
+    b->used = 0;
+}
+// ====================================================================================================
+static void _publishMessage( struct Batch *b, void *payload, size_t size )
+
+{
+    if ( !options.batchLen )
+    {
+        /* One message at a time, topic then payload */
+        zmq_send( _r.zmqSocket, b->topic, strlen( b->topic ), ZMQ_SNDMORE );
+        zmq_send( _r.zmqSocket, payload, size, 0 );
+        return;
+    }
+
+    if ( b->used + BATCH_RECORD_HDR + size > options.batchLen )
+    {
+        _publishBatch( b );
+    }
+
+    if ( !b->used )
+    {
+        /* First record into an empty batch starts the clock */
+        b->deadlineuS = genericsTimestampuS() + options.latencymS * 1000ULL;
+    }
+
+    b->buffer[b->used++] = size & 0xff;
+    b->buffer[b->used++] = ( size >> 8 ) & 0xff;
+    memcpy( &b->buffer[b->used], payload, size );
+    b->used += size;
+}
+// ====================================================================================================
+static void _initBatch( struct Batch *b, const char *topic )
+
+{
+    b->topic = topic;
+    b->used = 0;
+
+    if ( options.batchLen )
+    {
+        b->buffer = ( uint8_t * )malloc( options.batchLen );
+        MEMCHECKV( b->buffer );
+    }
+}
+// ====================================================================================================
+static void _initBatches( void )
+
+{
+    for ( int g = 0; g < NUM_CHANNELS; g++ )
+    {
+        if ( options.channel[g].topic )
+        {
+            _initBatch( &options.channel[g].batch, options.channel[g].topic );
+        }
+    }
+
+    for ( int g = 0; g < HWEVENT_UNUSED; g++ )
+    {
+        _initBatch( &_r.hwBatch[g], hwEventNames[g] );
+    }
+}
+// ====================================================================================================
+static int64_t _pollBatches( bool flush )
+
+/* Publish any batches that are due (or all of them if flushing), returning uS to the next deadline, or -1 if none */
+
+{
+    uint64_t now = genericsTimestampuS();
+    int64_t next = -1;
+    struct Batch *b;
+
+    if ( !options.batchLen )
+    {
+        return -1;
+    }
+
+    for ( int g = 0; g < NUM_CHANNELS + HWEVENT_UNUSED; g++ )
+    {
+        b = ( g < NUM_CHANNELS ) ? &options.channel[g].batch : &_r.hwBatch[g - NUM_CHANNELS];
+
+        if ( !b->used )
+        {
+            continue;
+        }
+
+        if ( ( flush ) || ( now >= b->deadlineuS ) )
+        {
+            _publishBatch( b );
+        }
+        else if ( ( next < 0 ) || ( b->deadlineuS - now < next ) )
+        {
+            next = b->deadlineuS - now;
+        }
+    }
+
+    return next;
+}
+
+
 // ====================================================================================================
 // Decoders for each message
 // ====================================================================================================
@@ -114,40 +265,21 @@ void _handleSW( struct swMsg *m, struct ITMDecoder *i )
     if ( ( m->srcAddr < NUM_CHANNELS ) && ( options.channel[m->srcAddr].topic ) )
     {
         struct Channel *channel = &options.channel[m->srcAddr];
-        char formatted[30];
-        size_t size = 0;
+        char formatted[MAX_STRING_LENGTH];
+        size_t size;
 
-        // formatted output....start with specials
-        if ( channel->format == NULL )
+        if ( channel->compiled == NULL )
         {
+            /* No format, so the raw message is sent */
             memcpy( formatted, &m->value, m->len );
             size = m->len;
         }
-        else if ( strstr( channel->format, "%f" ) )
-        {
-            /* type punning on same host, after correctly building 32bit val
-             * only unsafe on systems where u32/float have diff byte order */
-            float *nastycast = ( float * )&m->value;
-            size = snprintf( formatted, sizeof( formatted ), channel->format, *nastycast, *nastycast, *nastycast, *nastycast );
-        }
-        else if ( strstr( channel->format, "%c" ) )
-        {
-            /* Format contains %c, so execute repeatedly for all characters in sent data */
-            uint8_t op[4] = {m->value & 0xff, ( m->value >> 8 ) & 0xff, ( m->value >> 16 ) & 0xff, ( m->value >> 24 ) & 0xff};
-            uint32_t l = 0;
-
-            do
-            {
-                size += snprintf( formatted + size, sizeof( formatted ) - size, channel->format, op[l], op[l], op[l] );
-            }
-            while ( ++l < m->len );
-        }
         else
         {
-            size = snprintf( formatted, sizeof( formatted ), channel->format, m->value, m->value, m->value, m->value );
+            size = SWFormatRender( channel->compiled, m->value, m->len, formatted, sizeof( formatted ) );
         }
 
-        _publishMessage( channel->topic, formatted, size );
+        _publishMessage( &channel->batch, formatted, size );
     }
 }
 void _handleException( struct excMsg *m )
@@ -171,6 +303,13 @@ void _handleException( struct excMsg *m )
 
     _r.lastHWExceptionTS = m->ts;
 
+    if ( options.binary )
+    {
+        struct zmqEvException e = { { ZMQEV_VERSION, ZMQEV_EXCEPTION, m->ts }, m->exceptionNumber, m->eventType };
+        _publishMessage( &_r.hwBatch[HWEVENT_EXCEPTION], &e, sizeof( e ) );
+        return;
+    }
+
     if ( m->exceptionNumber < 16 )
     {
         /* This is a system based exception */
@@ -182,7 +321,7 @@ void _handleException( struct excMsg *m )
         opLen = snprintf( outputString, MAX_STRING_LENGTH, "%" PRIu64 ",%s,External,%d", eventdifftS, exEvent[m->eventType & 0x03], m->exceptionNumber - 16 );
     }
 
-    _publishMessage( hwEventNames[HWEVENT_EXCEPTION], outputString, opLen );
+    _publishMessage( &_r.hwBatch[HWEVENT_EXCEPTION], outputString, opLen );
 }
 // ====================================================================================================
 void _handleDWTEvent( struct dwtMsg *m )
@@ -203,6 +342,14 @@ void _handleDWTEvent( struct dwtMsg *m )
     uint64_t eventdifftS = m->ts - _r.lastHWExceptionTS;
 
     _r.lastHWExceptionTS = m->ts;
+
+    if ( options.binary )
+    {
+        struct zmqEvDWT e = { { ZMQEV_VERSION, ZMQEV_DWT, m->ts }, m->event };
+        _publishMessage( &_r.hwBatch[HWEVENT_DWT], &e, sizeof( e ) );
+        return;
+    }
+
     opLen = snprintf( outputString, MAX_STRING_LENGTH, "%" PRIu64, eventdifftS );
 
     for ( uint32_t i = 0; i < NUM_EVENTS; i++ )
@@ -221,7 +368,7 @@ void _handleDWTEvent( struct dwtMsg *m )
         }
     }
 
-    _publishMessage( hwEventNames[HWEVENT_DWT], outputString, opLen );
+    _publishMessage( &_r.hwBatch[HWEVENT_DWT], outputString, opLen );
 }
 // ====================================================================================================
 void _handlePCSample( struct pcSampleMsg *m )
@@ -242,6 +389,13 @@ void _handlePCSample( struct pcSampleMsg *m )
 
     _r.lastHWExceptionTS = m->ts;
 
+    if ( options.binary )
+    {
+        struct zmqEvPCSample e = { { ZMQEV_VERSION, ZMQEV_PCSAMPLE, m->ts }, m->pc, m->sleep };
+        _publishMessage( &_r.hwBatch[HWEVENT_PCSample], &e, sizeof( e ) );
+        return;
+    }
+
     if ( m->sleep )
     {
         /* This is a sleep packet */
@@ -252,7 +406,7 @@ void _handlePCSample( struct pcSampleMsg *m )
         opLen = snprintf( outputString, ( MAX_STRING_LENGTH - 1 ), "%" PRIu64 ",0x%08x", eventdifftS, m->pc );
     }
 
-    _publishMessage( hwEventNames[HWEVENT_PCSample], outputString, opLen );
+    _publishMessage( &_r.hwBatch[HWEVENT_PCSample], outputString, opLen );
 }
 // ====================================================================================================
 void _handleDataRWWP( struct watchMsg *m )
@@ -273,8 +427,15 @@ void _handleDataRWWP( struct watchMsg *m )
 
     _r.lastHWExceptionTS = m->ts;
 
+    if ( options.binary )
+    {
+        struct zmqEvRWWT e = { { ZMQEV_VERSION, ZMQEV_RWWT, m->ts }, m->comp, m->isWrite, m->data };
+        _publishMessage( &_r.hwBatch[HWEVENT_RWWT], &e, sizeof( e ) );
+        return;
+    }
+
     opLen = snprintf( outputString, MAX_STRING_LENGTH, "%" PRIu64 ",%d,%s,0x%x", eventdifftS, m->comp, m->isWrite ? "Write" : "Read", m->data );
-    _publishMessage( hwEventNames[HWEVENT_RWWT], outputString, opLen );
+    _publishMessage( &_r.hwBatch[HWEVENT_RWWT], outputString, opLen );
 }
 // ====================================================================================================
 void _handleDataAccessWP( struct wptMsg *m )
@@ -295,8 +456,16 @@ void _handleDataAccessWP( struct wptMsg *m )
     uint64_t eventdifftS = m->ts - _r.lastHWExceptionTS;
 
     _r.lastHWExceptionTS = m->ts;
+
+    if ( options.binary )
+    {
+        struct zmqEvAWP e = { { ZMQEV_VERSION, ZMQEV_AWP, m->ts }, m->comp, m->data };
+        _publishMessage( &_r.hwBatch[HWEVENT_AWP], &e, sizeof( e ) );
+        return;
+    }
+
     opLen = snprintf( outputString, MAX_STRING_LENGTH, "%" PRIu64 ",%d,0x%08x", eventdifftS, m->comp, m->data );
-    _publishMessage( hwEventNames[HWEVENT_AWP], outputString, opLen );
+    _publishMessage( &_r.hwBatch[HWEVENT_AWP], outputString, opLen );
 }
 // ====================================================================================================
 void _handleDataOffsetWP( struct oswMsg *m )
@@ -316,8 +485,16 @@ void _handleDataOffsetWP( struct oswMsg *m )
     uint64_t eventdifftS = m->ts - _r.lastHWExceptionTS;
 
     _r.lastHWExceptionTS = m->ts;
+
+    if ( options.binary )
+    {
+        struct zmqEvOFS e = { { ZMQEV_VERSION, ZMQEV_OFS, m->ts }, m->comp, m->offset };
+        _publishMessage( &_r.hwBatch[HWEVENT_OFS], &e, sizeof( e ) );
+        return;
+    }
+
     opLen = snprintf( outputString, MAX_STRING_LENGTH, "%" PRIu64 ",%d,0x%04x", eventdifftS, m->comp, m->offset );
-    _publishMessage( hwEventNames[HWEVENT_OFS], outputString, opLen );
+    _publishMessage( &_r.hwBatch[HWEVENT_OFS], outputString, opLen );
 }
 // ====================================================================================================
 void _handleTS( struct TSMsg *m )
@@ -339,8 +516,15 @@ void _handleTS( struct TSMsg *m )
     _r.timeStamp += m->timeInc;
     _r.timeStatus = m->timeStatus;
 
+    if ( options.binary )
+    {
+        struct zmqEvTS e = { { ZMQEV_VERSION, ZMQEV_TS, m->ts }, m->timeStatus, m->timeInc };
+        _publishMessage( &_r.hwBatch[HWEVENT_TS], &e, sizeof( e ) );
+        return;
+    }
+
     opLen = snprintf( outputString, MAX_STRING_LENGTH, "%d,%" PRIu32, m->timeStatus, m->timeInc );
-    _publishMessage( hwEventNames[HWEVENT_TS], outputString, opLen );
+    _publishMessage( &_r.hwBatch[HWEVENT_TS], outputString, opLen );
 }
 // ====================================================================================================
 void _itmPumpProcess( char c )
@@ -415,11 +599,14 @@ void _printHelp( const char *const progName )
 
 {
     genericsFPrintf( stderr, "Usage: %s [options]" EOL, progName );
+    genericsFPrintf( stderr, "    -b, --batch:      <bytes> Publish messages for each topic in batches of up to this size" EOL );
+    genericsFPrintf( stderr, "    -B, --binary:     Publish hwevents as binary records (see zmqEvents.h) rather than text" EOL );
     genericsFPrintf( stderr, "    -c, --channel:    <Number>,<Name>,<Format> of channel to populate (repeat per channel)" EOL );
     genericsFPrintf( stderr, "    -e, --hwevent:    Comma-separated list of published hwevents" EOL );
     genericsFPrintf( stderr, "    -E, --eof:        Terminate when the file/socket ends/is closed, otherwise wait to reconnect" EOL );
     genericsFPrintf( stderr, "    -f, --input-file: <filename> Take input from specified file" EOL );
     genericsFPrintf( stderr, "    -h, --help:       This help" EOL );
+    genericsFPrintf( stderr, "    -L, --latency:    <ms> Longest time a batch is held before it's published (default %d ms)" EOL, DEFAULT_LATENCY_MS );
     genericsFPrintf( stderr, "    -M, --no-colour:  Supress colour in output" EOL );
     genericsFPrintf( stderr, "    -n, --itm-sync:   Enforce sync requirement for ITM (i.e. ITM needs to issue syncs)" EOL );
     genericsFPrintf( stderr, "    -p, --protocol:   Protocol to communicate. Defaults to OFLOW if -s is not set, otherwise ITM" EOL );
@@ -499,11 +686,14 @@ static int32_t _parseHWEventsArg( char *s )
 static struct option _longOptions[] =
 {
     {"zbind", required_argument, NULL, 'z'},
+    {"batch", required_argument, NULL, 'b'},
+    {"binary", no_argument, NULL, 'B'},
     {"channel", required_argument, NULL, 'c'},
     {"hwevent", required_argument, NULL, 'e'},
     {"eof", no_argument, NULL, 'E'},
     {"input-file", required_argument, NULL, 'f'},
     {"help", no_argument, NULL, 'h'},
+    {"latency", required_argument, NULL, 'L'},
     {"itm-sync", no_argument, NULL, 'n'},
     {"no-colour", no_argument, NULL, 'M'},
     {"no-color", no_argument, NULL, 'M'},
@@ -534,7 +724,7 @@ bool _processOptions( int argc, char *argv[] )
         options.channel[g].topic = NULL;
     }
 
-    while ( ( c = getopt_long ( argc, argv, "c:e:Ef:hnp:s:t:v:Vz:", _longOptions, &optionIndex ) ) != -1 )
+    while ( ( c = getopt_long ( argc, argv, "b:Bc:e:Ef:hL:np:s:t:v:Vz:", _longOptions, &optionIndex ) ) != -1 )
     {
         switch ( c )
         {
@@ -548,11 +738,33 @@ bool _processOptions( int argc, char *argv[] )
                 _printVersion();
                 return false;
 
+            // ------------------------------------
+            case 'b':
+                options.batchLen = atoi( optarg );
+
+                if ( ( options.batchLen < MIN_BATCH_LEN ) || ( options.batchLen > ( 1 << 24 ) ) )
+                {
+                    genericsReport( V_ERROR, "Batch size out of range (%d..%d)" EOL, MIN_BATCH_LEN, 1 << 24 );
+                    return false;
+                }
+
+                break;
+
+            // ------------------------------------
+            case 'B':
+                options.binary = true;
+                break;
+
             // ------------------------------------
             case 'E':
                 options.endTerminate = true;
                 break;
 
+            // ------------------------------------
+            case 'L':
+                options.latencymS = atoi( optarg );
+                break;
+
             // ------------------------------------
             case 'f':
                 options.file = optarg;
@@ -690,6 +902,13 @@ bool _processOptions( int argc, char *argv[] )
                 if ( strcmp( chanIndex, "" ) != 0 )
                 {
                     options.channel[chan].format = strdup( genericsUnescape( chanIndex ) );
+
+                    if ( !( options.channel[chan].compiled = SWFormatCompile( options.channel[chan].format ) ) )
+                    {
+                        genericsReport( V_ERROR, "Cannot use format for channel %d" EOL, chan );
+                        free( chanConfig );
+                        return false;
+                    }
                 }
 
                 break;
@@ -762,6 +981,14 @@ bool _processOptions( int argc, char *argv[] )
 
     genericsReport( V_INFO, "Tag         : " EOL, options.tag );
     genericsReport( V_INFO, "ZeroMQ bind : %s" EOL, options.bindUrl );
+
+    genericsReport( V_INFO, "HW events   : %s" EOL, options.binary ? "Binary" : "Text" );
+
+    if ( options.batchLen )
+    {
+        genericsReport( V_INFO, "Batching    : %d bytes, %d ms" EOL, ( int )options.batchLen, options.latencymS );
+    }
+
     genericsReport( V_INFO, "Channels    :" EOL );
 
     for ( int g = 0; g < NUM_CHANNELS; g++ )
@@ -846,22 +1073,30 @@ static void _feedStream( struct Stream *stream )
 {
     unsigned char cbw[TRANSFER_SIZE];
 
+    struct timeval t;
+
     while ( !_r.ending )
     {
         size_t receivedSize;
-        enum ReceiveResult result = stream->receive( stream, cbw, TRANSFER_SIZE, NULL, &receivedSize );
+
+        /* When batching, don't wait for data beyond the point that a batch must be published */
+        int64_t deadline = _pollBatches( false );
+        t.tv_sec = 0;
+        t.tv_usec = ( ( deadline >= 0 ) && ( deadline < MAX_WAIT_US ) ) ? deadline : MAX_WAIT_US;
+        enum ReceiveResult result = stream->receive( stream, cbw, TRANSFER_SIZE, options.batchLen ? &t : NULL, &receivedSize );
 
         if ( result != RECEIVE_RESULT_OK )
         {
             if ( result == RECEIVE_RESULT_EOF && options.endTerminate )
             {
+                _pollBatches( true );
                 return;
             }
             else if ( result == RECEIVE_RESULT_ERROR )
             {
                 break;
             }
-            else
+            else if ( result != RECEIVE_RESULT_TIMEOUT )
             {
                 usleep( 100000 );
             }
@@ -883,6 +1118,8 @@ static void _feedStream( struct Stream *stream )
             fflush( stdout );
         }
     }
+
+    _pollBatches( true );
 }
 
 // ====================================================================================================
@@ -913,6 +1150,7 @@ int main( int argc, char *argv[] )
 
     /* Reset the OFLOW handler before we start */
     OFLOWInit( &_r.c );
+    _initBatches();
 
     /* This ensures the signal handler gets called */
     if ( SIG_ERR == signal( SIGINT, _intHandler ) )
@@ -968,5 +1206,8 @@ int main( int argc, char *argv[] )
         }
     }
 
+    /* Closing down lets anything still queued (including batches) go out */
+    zmq_close( _r.zmqSocket );
+    zmq_ctx_destroy( _r.zmqContext );
     return 0;
 }
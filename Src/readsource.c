@@ -1,8 +1,16 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <stdbool.h>
+#if !defined(WIN32)
+    #include <fcntl.h>
+    #include <unistd.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+#endif
 #include "generics.h"
+#include "readsource.h"
 
 #define BLOCKSIZE    (65536)
 #define MAX_LINE_LEN (4095)
@@ -17,9 +25,10 @@
 
 #if defined(WIN32)
 
-char *readsourcefile( char *path, size_t *l )
+char *readsourcefile( char *path, size_t *l, bool *ismapped )
 {
     *l = 0;
+    *ismapped = false;
     FILE *f = fopen( path, "r" );
 
     if ( f == NULL )
@@ -59,17 +68,100 @@ char *readsourcefile( char *path, size_t *l )
     return retBuffer;
 }
 
+// ====================================================================================================
+
+void releasesourcefile( char *buffer, size_t l, bool ismapped )
+{
+    free( buffer );
+}
+
 #else
 
-char *readsourcefile( char *path, size_t *l )
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Internal routines
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+
+static char *_mapsourcefile( char *path, size_t *l, bool *ismapped )
+
+/* Map the file read-only into memory. Only the pages that are actually touched get read in. */
+
+{
+    struct stat st;
+    char *retBuffer;
+    int fd = open( path, O_RDONLY );
+
+    if ( fd < 0 )
+    {
+        return NULL;
+    }
+
+    if ( ( fstat( fd, &st ) ) || ( !S_ISREG( st.st_mode ) ) || ( !st.st_size ) )
+    {
+        close( fd );
+        return NULL;
+    }
+
+    retBuffer = ( char * )mmap( NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+    close( fd );
+
+    if ( retBuffer == MAP_FAILED )
+    {
+        return NULL;
+    }
+
+    *l = st.st_size;
+    *ismapped = true;
+
+    /* Lines end at a newline or a 0. If the last line has neither then it gets terminated by the zero fill */
+    /* at the end of the last page of the mapping...unless the file exactly fills that page, in which case   */
+    /* there's nothing for it but to take a copy.                                                            */
+    if ( retBuffer[*l - 1] != '\n' )
+    {
+        if ( *l % sysconf( _SC_PAGESIZE ) )
+        {
+            ( *l )++;
+        }
+        else
+        {
+            char *copy = ( char * )malloc( *l + 1 );
+
+            if ( !copy )
+            {
+                genericsExit( -1, "Out of memory" EOL );
+            }
+
+            memcpy( copy, retBuffer, *l );
+            munmap( retBuffer, *l );
+            copy[( *l )++] = 0;
+            retBuffer = copy;
+            *ismapped = false;
+        }
+    }
+
+    return retBuffer;
+}
 
-/* Return either a malloced buffer containing the source file, or NULL if the file isn't available */
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Externally Available routines
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+
+char *readsourcefile( char *path, size_t *l, bool *ismapped )
+
+/* Return either a buffer containing the source file, or NULL if the file isn't available. The buffer is */
+/* malloced when it came via the prettyprinter, otherwise it's a direct mapping of the file.              */
 
 {
     FILE *fd = NULL;
     static bool prettyPrinterTested = false;
     char commandLine[MAX_LINE_LEN];
-    bool isProcess = true;
 
     char *retBuffer = ( char * )malloc( BLOCKSIZE );
     size_t insize = 0;
@@ -94,6 +186,8 @@ char *readsourcefile( char *path, size_t *l )
         insize = fread( retBuffer, 1, BLOCKSIZE, fd );
     }
 
+    *ismapped = false;
+
     if ( !insize )
     {
         if ( fd )
@@ -101,13 +195,12 @@ char *readsourcefile( char *path, size_t *l )
             pclose( fd );
         }
 
-        isProcess = false;
         prettyPrinterTested = true;
 
-        if ( ( fd = fopen( path, "r" ) ) )
-        {
-            insize = fread( retBuffer, 1, BLOCKSIZE, fd );
-        }
+        /* No prettyprinter, so there's no need to copy the file at all...just map it */
+        free( retBuffer );
+        *l = 0;
+        return _mapsourcefile( path, l, ismapped );
     }
 
     /* Record what we managed to read, by whichever mechanism */
@@ -131,11 +224,8 @@ char *readsourcefile( char *path, size_t *l )
     /* Make sure we terminate with a 0 .. there will always be space for this */
     retBuffer[( *l )++] = 0;
 
-    /* Close the process or file, depending on what it was that actually got opened */
-    if ( fd )
-    {
-        isProcess ? pclose( fd ) : fclose( fd );
-    }
+    /* Close the prettyprinter process */
+    pclose( fd );
 
     /* Resize the memory to what was actually read in */
     if ( *l )
@@ -156,6 +246,23 @@ char *readsourcefile( char *path, size_t *l )
     return retBuffer;
 }
 
+// ====================================================================================================
+
+void releasesourcefile( char *buffer, size_t l, bool ismapped )
+
+/* Return the memory used by a source file that was collected by readsourcefile */
+
+{
+    if ( ismapped )
+    {
+        munmap( buffer, l );
+    }
+    else
+    {
+        free( buffer );
+    }
+}
+
 #endif
 
 // ====================================================================================================
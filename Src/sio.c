@@ -98,6 +98,7 @@ struct SIOInstance
     bool outputDebug;                   /* Output debug tagged lines */
     bool isFile;                        /* Indicator that we're reading from a file */
     const char *ttext;                  /* Tagline text (if any) */
+    int progress;                       /* Percentage of background decode completed, or SIO_NO_PROGRESS */
 
     const char *progName;
     const char *elffile;
@@ -201,6 +202,7 @@ static void _outputHelp( struct SIOInstance *sio )
     wprintw( sio->outputWindow, "  CTRL-F: Search forwards, CTRL-F again for next match" EOL );
     wprintw( sio->outputWindow, "       p: Step backwards through execution history of current window" EOL );
     wprintw( sio->outputWindow, "       n: Step forwards through execution history of current window" EOL );
+    wprintw( sio->outputWindow, "       X: Cancel decode of the sample buffer while it is in progress" EOL );
     wprintw( sio->outputWindow, EOL "  Use PgUp/PgDown/Home/End and the arrow keys to move around the sample buffer" EOL );
     wprintw( sio->outputWindow, "  Shift-PgUp and Shift-PgDown move more quickly" EOL );
     wprintw( sio->outputWindow, EOL "       <?> again to leave this help screen." EOL );
@@ -780,6 +782,11 @@ static void _outputStatus( struct SIOInstance *sio, uint64_t oldintervalBytes )
         }
     }
 
+    if ( sio->progress != SIO_NO_PROGRESS )
+    {
+        mvwprintw( sio->statusWindow, 1, COLS - 48, "Decoding %d%% (X to cancel)", sio->progress );
+    }
+
     /* We only output the tags while not in a diving buffer */
     if ( ! sio->amDiving )
     {
@@ -906,6 +913,7 @@ struct SIOInstance *SIOsetup( const char *progname, const char *elffile, bool is
     sio->progName = progname;
     sio->elffile = elffile;
     sio->isFile  = isFile;
+    sio->progress = SIO_NO_PROGRESS;
 
     initscr();
     sio->lines = LINES;
@@ -1042,6 +1050,49 @@ void SIOsetOutputBuffer( struct SIOInstance *sio, int32_t numLines, int32_t curr
     SIOrequestRefresh( sio );
 }
 // ====================================================================================================
+void SIOextendOutputBuffer( struct SIOInstance *sio, int32_t numLines, int32_t linesPrepended )
+
+/* Lines have been added to the current output buffer, linesPrepended of them at the start and the rest at the end.   */
+/* The cursor and tags stay with the lines they were on, unless the cursor was following the end, when it still does. */
+
+{
+    assert( sio );
+
+    if ( ( !sio->opTextWline ) || ( sio->opTextRline == sio->opTextWline - 1 ) )
+    {
+        sio->opTextRline = numLines - 1;
+    }
+    else
+    {
+        sio->opTextRline += linesPrepended;
+    }
+
+    for ( uint32_t t = 0; ( linesPrepended ) && ( t < MAX_TAGS ); t++ )
+    {
+        if ( sio->tag[t] )
+        {
+            sio->tag[t] += linesPrepended;
+        }
+    }
+
+    sio->opTextWline = numLines;
+    SIOrequestRefresh( sio );
+}
+// ====================================================================================================
+void SIOsetProgress( struct SIOInstance *sio, int progress )
+
+/* Show how far a background decode has got, or remove the indication with SIO_NO_PROGRESS */
+
+{
+    assert( sio );
+
+    if ( sio->progress != progress )
+    {
+        sio->progress = progress;
+        SIOrequestRefresh( sio );
+    }
+}
+// ====================================================================================================
 void SIOtagText ( struct SIOInstance *sio, const char *ttext )
 
 {
@@ -1143,6 +1194,11 @@ enum SIOEvent SIOHandler( struct SIOInstance *sio, bool isTick, uint64_t oldinte
                     op = SIO_EV_NEXT;
                     break;
 
+                case 'x':
+                case 'X':
+                    op = SIO_EV_CANCEL;
+                    break;
+
                 case 'q':
                 case 'Q':
                     op = SIO_EV_QUIT;
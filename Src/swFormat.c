@@ -0,0 +1,447 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+/*
+ * Software Message Formatter Module
+ * =================================
+ *
+ * Compile printf style formats for software messages once, then render
+ * each message with a simple switch over the compiled steps.
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "generics.h"
+#include "swFormat.h"
+
+#define MAX_DIGITS (24)             /* Longest digit string for a 64 bit number (octal) */
+
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Internal routines
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+static void _addLiteral( struct SWFormat *f, char **t, const char *s, uint32_t len )
+
+/* Add literal text to the program, extending the previous step if it's also literal */
+
+{
+    struct SWFormatStep *last = f->numSteps ? &f->step[f->numSteps - 1] : NULL;
+
+    if ( ( !last ) || ( last->op != SWF_LITERAL ) || ( last->text + last->len != *t ) )
+    {
+        last = &f->step[f->numSteps++];
+        memset( last, 0, sizeof( struct SWFormatStep ) );
+        last->op   = SWF_LITERAL;
+        last->text = *t;
+    }
+
+    memcpy( *t, s, len );
+    *t += len;
+    last->len += len;
+}
+// ====================================================================================================
+static const char *_parseConversion( struct SWFormat *f, char **t, const char *s )
+
+/* Parse the conversion starting at s (which points at the %), returning where it ends or NULL on error */
+
+{
+    struct SWFormatStep *step = &f->step[f->numSteps];
+    const char *start = s++;
+
+    memset( step, 0, sizeof( struct SWFormatStep ) );
+    step->precision = -1;
+    step->bits = 32;
+
+    /* Flags */
+    while ( ( *s ) && ( strchr( "-0+ #", *s ) ) )
+    {
+        step->flags |= ( *s == '-' ) ? SWF_FLAG_LEFT : ( *s == '0' ) ? SWF_FLAG_ZERO : ( *s == '+' ) ? SWF_FLAG_PLUS : ( *s == ' ' ) ? SWF_FLAG_SPACE : SWF_FLAG_ALT;
+        s++;
+    }
+
+    /* Width and precision...there's only one argument, so they can't be taken from the arguments */
+    while ( ( *s >= '0' ) && ( *s <= '9' ) )
+    {
+        step->width = step->width * 10 + ( *s++ - '0' );
+    }
+
+    if ( *s == '.' )
+    {
+        s++;
+        step->precision = 0;
+
+        while ( ( *s >= '0' ) && ( *s <= '9' ) )
+        {
+            step->precision = step->precision * 10 + ( *s++ - '0' );
+        }
+    }
+
+    /* Length modifiers */
+    if ( ( *s == 'h' ) && ( *( s + 1 ) == 'h' ) )
+    {
+        step->bits = 8;
+        s += 2;
+    }
+    else if ( *s == 'h' )
+    {
+        step->bits = 16;
+        s++;
+    }
+    else if ( ( *s == 'l' ) && ( *( s + 1 ) == 'l' ) )
+    {
+        step->bits = 64;
+        s += 2;
+    }
+    else if ( ( *s ) && ( strchr( "ljztLq", *s ) ) )
+    {
+        step->bits = 64;
+        s++;
+    }
+
+    switch ( *s )
+    {
+        case 'd':
+        case 'i':
+            step->op = SWF_SIGNED;
+            break;
+
+        case 'u':
+            step->op = SWF_UNSIGNED;
+            break;
+
+        case 'o':
+            step->op = SWF_OCTAL;
+            break;
+
+        case 'x':
+            step->op = SWF_HEX;
+            break;
+
+        case 'X':
+            step->op = SWF_HEXUPPER;
+            break;
+
+        case 'c':
+            step->op = SWF_CHAR;
+
+            if ( f->mode != SWF_MODE_FLOAT )
+            {
+                f->mode = SWF_MODE_BYTES;
+            }
+
+            break;
+
+        case 'f':
+        case 'F':
+        case 'e':
+        case 'E':
+        case 'g':
+        case 'G':
+        case 'a':
+        case 'A':
+            /* Floats are rendered by the library, so keep the spec, without any length modifier */
+            step->op = SWF_FLOAT;
+            step->text = *t;
+            memcpy( *t, start, s - start );
+            *t += s - start;
+
+            while ( ( *( *t - 1 ) == 'l' ) || ( *( *t - 1 ) == 'L' ) || ( *( *t - 1 ) == 'h' ) || ( *( *t - 1 ) == 'q' ) ||
+                    ( *( *t - 1 ) == 'j' ) || ( *( *t - 1 ) == 'z' ) || ( *( *t - 1 ) == 't' ) )
+            {
+                ( *t )--;
+            }
+
+            *( *t )++ = *s;
+            *( *t )++ = 0;
+            f->mode = SWF_MODE_FLOAT;
+            break;
+
+        default:
+            genericsReport( V_ERROR, "Unsupported conversion '%.*s' in format" EOL, ( int )( s - start + ( *s ? 1 : 0 ) ), start );
+            return NULL;
+    }
+
+    f->numSteps++;
+    return s + 1;
+}
+// ====================================================================================================
+static char *_pad( char *p, char *e, char c, int32_t n )
+
+{
+    while ( ( n-- > 0 ) && ( p < e ) )
+    {
+        *p++ = c;
+    }
+
+    return p;
+}
+// ====================================================================================================
+static char *_text( char *p, char *e, const char *s, uint32_t len )
+
+{
+    if ( len > e - p )
+    {
+        len = e - p;
+    }
+
+    memcpy( p, s, len );
+    return p + len;
+}
+// ====================================================================================================
+static char *_renderInt( const struct SWFormatStep *step, uint32_t value, char *p, char *e )
+
+/* Render an integer conversion, following the printf rules for flags, width and precision */
+
+{
+    char digits[MAX_DIGITS];
+    char prefix[2];
+    int32_t numDigits = 0;
+    int32_t numPrefix = 0;
+    int32_t zeros = 0;
+    uint64_t v;
+    bool negative = false;
+
+    /* Apply the length modifier. Longer than 32 bits gets the value zero extended */
+    if ( step->op == SWF_SIGNED )
+    {
+        int64_t s = ( step->bits == 8 ) ? ( int8_t )value : ( step->bits == 16 ) ? ( int16_t )value : ( step->bits == 32 ) ? ( int32_t )value : ( int64_t )value;
+        negative = ( s < 0 );
+        v = negative ? -s : s;
+    }
+    else
+    {
+        v = ( step->bits == 8 ) ? ( uint8_t )value : ( step->bits == 16 ) ? ( uint16_t )value : value;
+    }
+
+    uint32_t base = ( step->op == SWF_OCTAL ) ? 8 : ( ( step->op == SWF_HEX ) || ( step->op == SWF_HEXUPPER ) ) ? 16 : 10;
+    const char *set = ( step->op == SWF_HEXUPPER ) ? "0123456789ABCDEF" : "0123456789abcdef";
+    bool isZero = !v;
+
+    /* Digits come out least significant first */
+    while ( v )
+    {
+        digits[numDigits++] = set[v % base];
+        v /= base;
+    }
+
+    /* Precision is the minimum number of digits, which defaults to 1 */
+    int32_t precision = ( step->precision < 0 ) ? 1 : step->precision;
+
+    if ( numDigits < precision )
+    {
+        zeros = precision - numDigits;
+    }
+
+    if ( step->op == SWF_SIGNED )
+    {
+        if ( negative )
+        {
+            prefix[numPrefix++] = '-';
+        }
+        else if ( step->flags & SWF_FLAG_PLUS )
+        {
+            prefix[numPrefix++] = '+';
+        }
+        else if ( step->flags & SWF_FLAG_SPACE )
+        {
+            prefix[numPrefix++] = ' ';
+        }
+    }
+
+    if ( step->flags & SWF_FLAG_ALT )
+    {
+        if ( ( step->op == SWF_OCTAL ) && ( !zeros ) )
+        {
+            /* Alternate octal always starts with a zero */
+            zeros = 1;
+        }
+        else if ( ( ( step->op == SWF_HEX ) || ( step->op == SWF_HEXUPPER ) ) && ( !isZero ) )
+        {
+            prefix[numPrefix++] = '0';
+            prefix[numPrefix++] = ( step->op == SWF_HEX ) ? 'x' : 'X';
+        }
+    }
+
+    int32_t pad = step->width - ( numPrefix + zeros + numDigits );
+
+    if ( ( !( step->flags & SWF_FLAG_LEFT ) ) && ( ( !( step->flags & SWF_FLAG_ZERO ) ) || ( step->precision >= 0 ) ) )
+    {
+        p = _pad( p, e, ' ', pad );
+        pad = 0;
+    }
+
+    p = _text( p, e, prefix, numPrefix );
+
+    if ( !( step->flags & SWF_FLAG_LEFT ) )
+    {
+        /* Zero padding (if there's any left) goes between the prefix and the digits */
+        zeros += ( pad > 0 ) ? pad : 0;
+        pad = 0;
+    }
+
+    p = _pad( p, e, '0', zeros );
+
+    while ( ( numDigits ) && ( p < e ) )
+    {
+        *p++ = digits[--numDigits];
+    }
+
+    return _pad( p, e, ' ', pad );
+}
+// ====================================================================================================
+static char *_renderOne( const struct SWFormat *f, uint32_t arg, float fl, char *p, char *e )
+
+/* Run the program once for the given argument */
+
+{
+    for ( const struct SWFormatStep *step = f->step; ( step < &f->step[f->numSteps] ) && ( p < e ); step++ )
+    {
+        switch ( step->op )
+        {
+            case SWF_LITERAL:
+                p = _text( p, e, step->text, step->len );
+                break;
+
+            case SWF_SIGNED:
+            case SWF_UNSIGNED:
+            case SWF_OCTAL:
+            case SWF_HEX:
+            case SWF_HEXUPPER:
+                p = _renderInt( step, arg, p, e );
+                break;
+
+            case SWF_CHAR:
+                if ( !( step->flags & SWF_FLAG_LEFT ) )
+                {
+                    p = _pad( p, e, ' ', step->width - 1 );
+                }
+
+                p = _pad( p, e, ( char )arg, 1 );
+
+                if ( step->flags & SWF_FLAG_LEFT )
+                {
+                    p = _pad( p, e, ' ', step->width - 1 );
+                }
+
+                break;
+
+            case SWF_FLOAT:
+                {
+                    /* Room for the terminating zero is always reserved beyond e */
+                    int l = snprintf( p, e - p + 1, step->text, fl );
+                    p = ( l < 0 ) ? p : ( l > e - p ) ? e : p + l;
+                }
+                break;
+        }
+    }
+
+    return p;
+}
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Publicly available routines
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+struct SWFormat *SWFormatCompile( const char *fmt )
+
+/* Compile format into a program, returning NULL if it can't be */
+
+{
+    size_t fmtLen = strlen( fmt );
+    struct SWFormat *f = ( struct SWFormat * )calloc( 1, sizeof( struct SWFormat ) );
+    MEMCHECK( f, NULL );
+
+    /* Every step uses at least one character, and every float spec needs at most one more for its terminator */
+    f->step = ( struct SWFormatStep * )calloc( fmtLen + 1, sizeof( struct SWFormatStep ) );
+    f->text = ( char * )malloc( 2 * fmtLen + 1 );
+    MEMCHECK( f->step, NULL );
+    MEMCHECK( f->text, NULL );
+
+    char *t = f->text;
+    const char *s = fmt;
+
+    while ( *s )
+    {
+        if ( *s != '%' )
+        {
+            const char *e = strchr( s, '%' );
+            e = e ? e : s + strlen( s );
+            _addLiteral( f, &t, s, e - s );
+            s = e;
+        }
+        else if ( *( s + 1 ) == '%' )
+        {
+            _addLiteral( f, &t, s, 1 );
+            s += 2;
+        }
+        else if ( !( s = _parseConversion( f, &t, s ) ) )
+        {
+            SWFormatDelete( f );
+            return NULL;
+        }
+    }
+
+    return f;
+}
+// ====================================================================================================
+size_t SWFormatRender( const struct SWFormat *f, uint32_t value, uint32_t len, char *op, size_t opLen )
+
+/* Render a message into op, which is always zero terminated. Returns the number of characters rendered */
+
+{
+    assert( f );
+    assert( opLen );
+
+    char *p = op;
+    char *e = op + opLen - 1;
+
+    switch ( f->mode )
+    {
+        case SWF_MODE_VALUE:
+            p = _renderOne( f, value, 0, p, e );
+            break;
+
+        case SWF_MODE_BYTES:
+            {
+                /* Repeat for each byte of the message */
+                uint32_t l = 0;
+
+                do
+                {
+                    p = _renderOne( f, ( value >> ( 8 * l ) ) & 0xff, 0, p, e );
+                }
+                while ( ( ++l < len ) && ( l < 4 ) );
+            }
+            break;
+
+        case SWF_MODE_FLOAT:
+            {
+                /* type punning on same host, after correctly building 32bit val */
+                float fl;
+                memcpy( &fl, &value, sizeof( float ) );
+                p = _renderOne( f, value, fl, p, e );
+            }
+            break;
+    }
+
+    *p = 0;
+    return p - op;
+}
+// ====================================================================================================
+void SWFormatDelete( struct SWFormat *f )
+
+{
+    if ( f )
+    {
+        free( f->step );
+        free( f->text );
+        free( f );
+    }
+}
+// ====================================================================================================
@@ -193,7 +193,7 @@ static bool _find_symbol( struct SymbolSet *s, uint32_t workingAddr,
                           uint32_t *fileindex, uint32_t *functionindex, uint32_t *pline,
                           uint16_t *linesInBlock, const char **psource,
                           const struct assyLineEntry **assy,
-                          uint32_t *assyLine )
+                          uint32_t *assyLine, uint32_t *index )
 
 /* Find symbol and return pointers to contents */
 
@@ -209,6 +209,7 @@ static bool _find_symbol( struct SymbolSet *s, uint32_t workingAddr,
         *assy          = found->assy;
         *fileindex     = found->fileIdx;
         *functionindex = found->functionIdx;
+        *index         = found - s->sources;
 
         /* If there is assembly then match the line too */
         for ( *assyLine = 0; *assyLine < found->assyLines; ( *assyLine )++ )
@@ -925,6 +926,7 @@ bool SymbolLookup( struct SymbolSet *s, uint32_t addr, struct nameEntry *n )
     uint32_t assyLine;
     uint16_t linesInBlock;
     uint32_t line;
+    uint32_t index;
 
     memset( n, 0, sizeof( struct nameEntry ) );
     assert( s );
@@ -937,7 +939,7 @@ bool SymbolLookup( struct SymbolSet *s, uint32_t addr, struct nameEntry *n )
         return true;
     }
 
-    if ( _find_symbol( s, addr, &fileindex, &functionindex, &line, &linesInBlock, &source, &assy, &assyLine ) )
+    if ( _find_symbol( s, addr, &fileindex, &functionindex, &line, &linesInBlock, &source, &assy, &assyLine, &index ) )
     {
         n->fileindex = fileindex;
         n->functionindex = functionindex;
@@ -947,6 +949,7 @@ bool SymbolLookup( struct SymbolSet *s, uint32_t addr, struct nameEntry *n )
         n->addr = addr;
         n->line = line;
         n->linesInBlock = linesInBlock;
+        n->index = index;
         return true;
     }
 
@@ -111,34 +111,96 @@ void TRACEDecoderPump( struct TRACEDecoder *i, uint8_t *buf, int len, traceDecod
 
     /* len can arrive as 0 for the case of an unwrapped buffer */
 
-    if ( i->engine->action )
+    while ( len-- )
     {
-        while ( len-- )
+        if ( i->engine->action(  i->engine, &i->cpu, *( buf++ ) ) )
         {
-            if ( i->engine->action(  i->engine, &i->cpu, *( buf++ ) ) )
-            {
-                /* Something worthy of being reported happened */
-                cb( d );
-            }
+            /* Something worthy of being reported happened */
+            cb( d );
         }
-
     }
-    else if ( i->engine->actionPair )
+}
+// ====================================================================================================
+void TRACEDecoderPumpRecords( struct TRACEDecoder *i, uint8_t *buf, int len, traceDecodeRecordCB cb, void *d )
+
+/* Pump a whole buffer through the decoder, delivering what it finds as batches of records */
+
+{
+    struct TRACERecordBatch b;
+    int used;
+
+    assert( i );
+    assert( buf );
+    assert( cb );
+
+    b.n = 0;
+    b.flush = false;
+    b.foldAtoms = i->foldAtoms;
+
+    while ( len > 0 )
     {
-        while ( len > 7 )
+        if ( i->engine->actionRecords )
+        {
+            used = i->engine->actionRecords( i->engine, &i->cpu, buf, len, &b );
+        }
+        else
         {
-            /* MTB processes two words at a time...a from and to address */
-            /* (yes, that could be +1 on a uint32_t increment, but I prefer being explicit) */
-            if ( i->engine->actionPair( i->engine, &i->cpu, *( uint32_t * )buf, *( uint32_t * )( buf + 4 ) ) )
+            /* Engine that only knows about bytes, so feed it one at a time */
+            for ( used = 0; ( used < len ) && ( !b.flush ); used++ )
             {
-                /* Something worthy of being reported happened */
-                cb( d );
+                if ( i->engine->action( i->engine, &i->cpu, buf[used] ) )
+                {
+                    TRACERecordAdd( &i->cpu, &b );
+                }
             }
+        }
 
-            buf += 8;
-            len -= 8;
+        buf += used;
+        len -= used;
+
+        if ( b.flush )
+        {
+            cb( b.r, b.n, d );
+            b.n = 0;
+            b.flush = false;
         }
     }
+
+    if ( b.n )
+    {
+        cb( b.r, b.n, d );
+    }
+}
+// ====================================================================================================
+void TRACEDecoderSetReportLevel( struct TRACEDecoder *i, enum verbLevel l )
+
+/* Set the most verbose level that will be passed to the report callback (defaults to the generics level) */
+
+{
+    i->cpu.reportLevel = l;
+}
+// ====================================================================================================
+void TRACEDecoderSetCycleAccurate( struct TRACEDecoder *i, bool cycleAccurate )
+
+/* Tell the decoder that trace is (or isn't) cycle accurate, for protocols that can't tell from the stream */
+
+{
+    assert( i );
+    assert( i->engine );
+
+    if ( i->engine->cycleAccurate )
+    {
+        i->engine->cycleAccurate( i->engine, cycleAccurate );
+    }
+}
+// ====================================================================================================
+void TRACEDecoderSetFoldAtoms( struct TRACEDecoder *i, bool foldAtoms )
+
+/* Allow (or stop) TRACEDecoderPumpRecords folding runs of atoms into single records */
+
+{
+    assert( i );
+    i->foldAtoms = foldAtoms;
 }
 // ====================================================================================================
 void TRACEDecoderInit( struct TRACEDecoder *i, enum TRACEprotocol protocol, bool usingAltAddrEncodeSet, genericsReportCB report )
@@ -154,6 +216,7 @@ void TRACEDecoderInit( struct TRACEDecoder *i, enum TRACEprotocol protocol, bool
     i->cpu.addr = ADDRESS_UNKNOWN;
     i->cpu.cycleCount = COUNT_UNKNOWN;
     i->cpu.report = report;
+    i->cpu.reportLevel = genericsGetReportLevel();
     i->protocol = protocol;
 
     i->engine = _engine[ protocol ]();
@@ -164,4 +227,18 @@ void TRACEDecoderInit( struct TRACEDecoder *i, enum TRACEprotocol protocol, bool
     }
 }
 // ====================================================================================================
+void TRACEDecoderDestroy( struct TRACEDecoder *i )
 
+/* Release the resources held by a TRACEDecoder instance */
+
+{
+    assert( i );
+
+    if ( ( i->engine ) && ( i->engine->destroy ) )
+    {
+        i->engine->destroy( i->engine );
+    }
+
+    i->engine = NULL;
+}
+// ====================================================================================================
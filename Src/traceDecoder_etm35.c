@@ -12,6 +12,7 @@
 #include <string.h>
 #include <assert.h>
 #include <stdlib.h>
+#include <pthread.h>
 #include "msgDecoder.h"
 #include "traceDecoder.h"
 #include "generics.h"
@@ -64,7 +65,36 @@ struct ETM35DecodeState
     bool cycleAccurate;                  /* Using cycle accurate mode */
 };
 
-#define DEBUG(...) { if ( cpu->report ) cpu->report( V_DEBUG, __VA_ARGS__); }
+/* Decode of a P-header, one entry for each header byte in each of the normal and cycle accurate modes */
+struct ETM35PHeader
+{
+    bool valid;                          /* This is a P-header we know how to decode */
+    uint8_t fmt;                         /* Format of the header, for reporting */
+    uint8_t eatoms;                      /* Executed atoms */
+    uint8_t natoms;                      /* Not executed atoms */
+    uint8_t watoms;                      /* Wait atoms, cycle accurate mode only */
+    uint8_t inst;                        /* Increment to instruction count */
+    uint32_t changes;                    /* Changes to flag for this header */
+    bool setsDisposition;                /* Header carries a disposition */
+    uint32_t disposition;                /* ...of which instructions were executed */
+};
+
+/* Assembly of one byte of a branch address into the address under construction */
+struct ETM35BranchByte
+{
+    uint32_t keep;                       /* Bits of the address that this byte leaves alone */
+    uint8_t bits;                        /* Bits of the byte that carry address */
+    uint8_t rsh;                         /* ...shifted right by this */
+    uint8_t lsh;                         /* ...and then left by this to put them in place */
+};
+
+#define MAX_BRANCH_BYTES (5)
+
+static struct ETM35PHeader _pheader[2][256];                                      /* [cycleAccurate][header] */
+static struct ETM35BranchByte _branchByte[2][3][MAX_BRANCH_BYTES][2];              /* [altEncode][addrMode][byteCount][continued] */
+static pthread_once_t _tablesOnce = PTHREAD_ONCE_INIT;                           /* Tables are shared by all decoders, so build them once */
+
+#define DEBUG(...) TRACE_DEBUG( cpu, __VA_ARGS__ )
 // ====================================================================================================
 // ====================================================================================================
 // ====================================================================================================
@@ -78,6 +108,215 @@ static void _stateChange( struct TRACECPUState *cpu, enum TRACEchanges c )
     cpu->changeRecord |= ( 1 << c );
 }
 // ====================================================================================================
+
+static void _buildPHeader( struct ETM35PHeader *h, bool cycleAccurate, uint8_t c )
+
+/* Decode a P-header byte into its table entry, Section D4.4.2 */
+
+{
+    memset( h, 0, sizeof( struct ETM35PHeader ) );
+
+    if ( ( c & 0b10000001 ) != 0b10000000 )
+    {
+        return;
+    }
+
+    h->valid = true;
+    h->setsDisposition = true;
+
+    if ( !cycleAccurate )
+    {
+        h->changes = ( 1 << EV_CH_ENATOMS );
+
+        if ( ( c & 0b10000011 ) == 0b10000000 )
+        {
+            /* Format-1 P-header */
+            h->fmt = 1;
+            h->eatoms = ( c & 0x3C ) >> 2;
+            h->natoms = ( c & ( 1 << 6 ) ) ? 1 : 0;
+            h->inst = h->eatoms + h->natoms;
+
+            /* Put a 1 in each element of disposition if was executed */
+            h->disposition = ( 1 << h->eatoms ) - 1;
+        }
+        else if ( ( c & 0b11110011 ) == 0b10000010 )
+        {
+            /* Format-2 P-header */
+            h->fmt = 2;
+            h->eatoms = ( ( c & ( 1 << 2 ) ) == 0 ) + ( ( c & ( 1 << 3 ) ) == 0 );
+            h->natoms = 2 - h->eatoms;
+            h->inst = h->eatoms + h->natoms;
+            h->disposition = ( ( c & ( 1 << 3 ) ) == 0 ) |
+                             ( ( ( c & ( 1 << 2 ) ) == 0 ) << 1 );
+        }
+        else
+        {
+            h->valid = false;
+        }
+    }
+    else
+    {
+        h->changes = ( 1 << EV_CH_ENATOMS ) | ( 1 << EV_CH_WATOMS );
+
+        if ( c == 0b10000000 )
+        {
+            /* Format 0 cycle-accurate P-header */
+            h->fmt = 0;
+            h->watoms = 1;
+            h->inst = h->watoms;
+            h->setsDisposition = false;
+        }
+        else if ( ( c & 0b10100011 ) == 0b10000000 )
+        {
+            /* Format 1 cycle-accurate P-header */
+            h->fmt = 1;
+            h->eatoms = ( c & 0x1c ) >> 2;
+            h->natoms = ( c & 0x40 ) != 0;
+            h->watoms = h->eatoms + h->natoms;
+            h->inst = h->watoms;
+            h->disposition = ( 1 << h->eatoms ) - 1;
+        }
+        else if ( ( c & 0b11110011 ) == 0b10000010 )
+        {
+            /* Format 2 cycle-accurate P-header */
+            h->fmt = 2;
+            h->eatoms = ( ( c & ( 1 << 2 ) ) != 0 ) + ( ( c & ( 1 << 3 ) ) != 0 );
+            h->natoms = 2 - h->eatoms;
+            h->watoms = 1;
+            h->inst = h->watoms;
+            h->disposition = ( ( c & ( 1 << 3 ) ) != 0 ) | ( ( c & ( 1 << 2 ) ) != 0 );
+        }
+        else if ( ( c & 0b10100000 ) == 0b10100000 )
+        {
+            /* Format 3 cycle-accurate P-header */
+            h->fmt = 3;
+            h->eatoms = ( c & 0x40 ) != 0;
+            h->watoms = ( c & 0x1c ) >> 2;
+            h->inst = h->watoms;
+            /* Either 1 or 0 eatoms */
+            h->disposition = h->eatoms;
+        }
+        else if ( ( c & 0b11111011 ) == 0b10010010 )
+        {
+            /* Format 4 cycle-accurate P-header */
+            h->fmt = 4;
+            h->eatoms = ( c & 0x4 ) != 0;
+            h->natoms = ( c & 0x4 ) == 0;
+            /* Either 1 or 0 eatoms */
+            h->disposition = h->eatoms;
+        }
+        else
+        {
+            h->valid = false;
+        }
+    }
+}
+
+// ====================================================================================================
+
+static void _buildBranchByte( struct ETM35BranchByte *b, bool altEncode, enum Mode addrMode, int byteCount, bool continued )
+
+/* Work out where the address bits of a branch address byte land, Section D4.4.4 */
+
+{
+    /* Offset of the bits in the address depends on the alignment of the instruction set */
+    int ofs = ( addrMode == TRACE_ADDRMODE_ARM ) ? 1 : ( addrMode == TRACE_ADDRMODE_THUMB ) ? 0 : -1;
+    int shift = 7 * byteCount + ofs;
+
+    if ( !byteCount )
+    {
+        /* The first byte is the branch header, with address in bits 1..6 */
+        b->bits = 0b01111110;
+    }
+    else if ( altEncode )
+    {
+        /* The last byte of the alt encoding has exception information in bit 6 */
+        b->bits = continued ? 0x7f : 0x3f;
+    }
+    else
+    {
+        /* This will potentially collect too many bits in the last byte, but they drop off the top */
+        b->bits = 0x7f;
+    }
+
+    b->rsh = ( shift < 0 ) ? -shift : 0;
+    b->lsh = ( shift > 0 ) ? shift : 0;
+    b->keep = ~( uint32_t )( ( ( uint64_t )b->bits >> b->rsh ) << b->lsh );
+}
+
+// ====================================================================================================
+
+static void _buildTables( void )
+
+/* Precompute P-header decode and branch address assembly for every mode we might be in */
+
+{
+    for ( int ca = 0; ca < 2; ca++ )
+    {
+        for ( int c = 0; c < 256; c++ )
+        {
+            _buildPHeader( &_pheader[ca][c], ca, c );
+        }
+    }
+
+    for ( int alt = 0; alt < 2; alt++ )
+    {
+        for ( enum Mode m = TRACE_ADDRMODE_THUMB; m <= TRACE_ADDRMODE_JAZELLE; m++ )
+        {
+            for ( int bc = 0; bc < MAX_BRANCH_BYTES; bc++ )
+            {
+                _buildBranchByte( &_branchByte[alt][m][bc][0], alt, m, bc, false );
+                _buildBranchByte( &_branchByte[alt][m][bc][1], alt, m, bc, true );
+            }
+        }
+    }
+}
+
+// ====================================================================================================
+
+static inline void _addBranchByte( struct ETM35DecodeState *j, struct TRACECPUState *cpu, uint8_t c )
+
+/* Fold this byte of branch address into the address under construction */
+
+{
+    const struct ETM35BranchByte *b = &_branchByte[j->usingAltAddrEncode][cpu->addrMode][j->byteCount][( c & 0x80 ) != 0];
+
+    j->addrConstruct = ( j->addrConstruct & b->keep ) | ( ( ( uint32_t )( c & b->bits ) >> b->rsh ) << b->lsh );
+}
+
+// ====================================================================================================
+
+static inline bool _takeAtoms( struct ETM35DecodeState *j, struct TRACECPUState *cpu, uint8_t c )
+
+/* Apply a P-header from the table, returning false if it isn't one we can decode */
+
+{
+    const struct ETM35PHeader *h = &_pheader[j->cycleAccurate][c];
+
+    if ( !h->valid )
+    {
+        return false;
+    }
+
+    cpu->eatoms = h->eatoms;
+    cpu->natoms = h->natoms;
+    cpu->instCount += h->inst;
+
+    if ( j->cycleAccurate )
+    {
+        cpu->watoms = h->watoms;
+    }
+
+    if ( h->setsDisposition )
+    {
+        cpu->disposition = h->disposition;
+    }
+
+    cpu->changeRecord |= h->changes;
+    DEBUG( "%sPHdr FMT%d (%02x E=%d, N=%d W=%d)" EOL, j->cycleAccurate ? "CA " : "", h->fmt, c, cpu->eatoms, cpu->natoms, cpu->watoms );
+    return true;
+}
+// ====================================================================================================
 // ====================================================================================================
 // ====================================================================================================
 // Externally available routines
@@ -91,13 +330,18 @@ static bool _pumpAction( struct TRACEDecoderEngine *e, struct TRACECPUState *cpu
 {
     bool C;                               /* Is address packet continued? */
     bool X = false;                       /* Is there exception information following address */
-    int8_t ofs;                           /* Offset for bits in address calculation */
-    uint8_t mask;                         /* Mask for bits in address calculation */
 
     struct ETM35DecodeState *j = ( struct ETM35DecodeState * )e;
     enum TRACE_ETM35protoState newState = j->p;
     enum TRACEDecoderPumpEvent retVal = TRACE_EV_NONE;
 
+    /* Back to back P-headers are the bulk of the stream, so take them straight from the table. A run of */
+    /* zeros might be about to turn 0x80 into an A-Sync though, so leave that to the full decode.        */
+    if ( ( j->p == TRACE_IDLE ) && ( !j->asyncCount ) && ( _takeAtoms( j, cpu, c ) ) )
+    {
+        return j->rxedISYNC;
+    }
+
     /* Perform A-Sync accumulation check */
     if ( ( j->asyncCount >= 5 ) && ( c == 0x80 ) )
     {
@@ -124,22 +368,8 @@ static bool _pumpAction( struct TRACEDecoderEngine *e, struct TRACECPUState *cpu
                 if ( c & 0b1 )
                 {
                     /* The lowest order 6 bits of address info... */
-
-                    switch ( cpu->addrMode )
-                    {
-                        case TRACE_ADDRMODE_ARM:
-                            j->addrConstruct = ( j->addrConstruct & ~( 0b11111100 ) ) | ( ( c & 0b01111110 ) << 1 );
-                            break;
-
-                        case TRACE_ADDRMODE_THUMB:
-                            j->addrConstruct = ( j->addrConstruct & ~( 0b01111111 ) ) | ( c & 0b01111110 );
-                            break;
-
-                        case TRACE_ADDRMODE_JAZELLE:
-                            j->addrConstruct = ( j->addrConstruct & ~( 0b00111111 ) ) | ( ( c & 0b01111110 ) >> 1 );
-                            break;
-                    }
-
+                    j->byteCount = 0;
+                    _addBranchByte( j, cpu, c );
                     j->byteCount = 1;
                     C = ( c & 0x80 ) != 0;
                     X = false;
@@ -288,125 +518,13 @@ static bool _pumpAction( struct TRACEDecoderEngine *e, struct TRACECPUState *cpu
                 // *************************************************
                 if ( ( c & 0b10000001 ) == 0b10000000 )
                 {
-                    if ( !j->cycleAccurate )
+                    if ( _takeAtoms( j, cpu, c ) )
                     {
-                        if ( ( c & 0b10000011 ) == 0b10000000 )
-                        {
-                            /* Format-1 P-header */
-                            cpu->eatoms = ( c & 0x3C ) >> 2;
-                            cpu->natoms = ( c & ( 1 << 6 ) ) ? 1 : 0;
-                            cpu->instCount += cpu->eatoms + cpu->natoms;
-
-                            /* Put a 1 in each element of disposition if was executed */
-                            cpu->disposition = ( 1 << cpu->eatoms ) - 1;
-                            _stateChange( cpu, EV_CH_ENATOMS );
-                            retVal = TRACE_EV_MSG_RXED;
-                            DEBUG( "PHdr FMT1 (%02x E=%d, N=%d)" EOL, c, cpu->eatoms, cpu->natoms );
-                            break;
-                        }
-
-                        if ( ( c & 0b11110011 ) == 0b10000010 )
-                        {
-                            /* Format-2 P-header */
-                            cpu->eatoms = ( ( c & ( 1 << 2 ) ) == 0 ) + ( ( c & ( 1 << 3 ) ) == 0 );
-                            cpu->natoms = 2 - cpu->eatoms;
-
-                            cpu->disposition = ( ( c & ( 1 << 3 ) ) == 0 ) |
-                                               ( ( ( c & ( 1 << 2 ) ) == 0 ) << 1 );
-
-                            _stateChange( cpu, EV_CH_ENATOMS );
-                            cpu->instCount += cpu->eatoms + cpu->natoms;
-                            retVal = TRACE_EV_MSG_RXED;
-
-                            DEBUG( "PHdr FMT2 (E=%d, N=%d)" EOL, cpu->eatoms, cpu->natoms );
-                            break;
-                        }
-
-                        DEBUG( "Unprocessed P-Header (%02X)" EOL, c );
+                        retVal = TRACE_EV_MSG_RXED;
                     }
                     else
                     {
-                        if ( c == 0b10000000 )
-                        {
-                            /* Format 0 cycle-accurate P-header */
-                            cpu->watoms = 1;
-                            cpu->instCount += cpu->watoms;
-                            cpu->eatoms = cpu->natoms = 0;
-                            _stateChange( cpu, EV_CH_ENATOMS );
-                            _stateChange( cpu, EV_CH_WATOMS );
-                            retVal = TRACE_EV_MSG_RXED;
-
-                            DEBUG( "CA PHdr FMT0 (W=%d)" EOL, cpu->watoms );
-                            break;
-                        }
-
-                        if ( ( c & 0b10100011 ) == 0b10000000 )
-                        {
-                            /* Format 1 cycle-accurate P-header */
-                            cpu->eatoms = ( c & 0x1c ) >> 2;
-                            cpu->natoms = ( c & 0x40 ) != 0;
-                            cpu->watoms = cpu->eatoms + cpu->natoms;
-                            cpu->instCount += cpu->watoms;
-                            cpu->disposition = ( 1 << cpu->eatoms ) - 1;
-                            _stateChange( cpu, EV_CH_ENATOMS );
-                            _stateChange( cpu, EV_CH_WATOMS );
-                            retVal = TRACE_EV_MSG_RXED;
-
-                            DEBUG( "CA PHdr FMT1 (E=%d, N=%d)" EOL, cpu->eatoms, cpu->natoms );
-                            break;
-                        }
-
-                        if ( ( c & 0b11110011 ) == 0b10000010 )
-                        {
-                            /* Format 2 cycle-accurate P-header */
-                            cpu->eatoms = ( ( c & ( 1 << 2 ) ) != 0 ) + ( ( c & ( 1 << 3 ) ) != 0 );
-                            cpu->natoms = 2 - cpu->eatoms;
-                            cpu->watoms = 1;
-                            cpu->instCount += cpu->watoms;
-                            cpu->disposition = ( ( c & ( 1 << 3 ) ) != 0 ) | ( ( c & ( 1 << 2 ) ) != 0 );
-                            _stateChange( cpu, EV_CH_ENATOMS );
-                            _stateChange( cpu, EV_CH_WATOMS );
-                            retVal = TRACE_EV_MSG_RXED;
-
-                            DEBUG( "CA PHdr FMT2 (E=%d, N=%d, W=1)" EOL, cpu->eatoms, cpu->natoms );
-                            break;
-                        }
-
-                        if ( ( c & 0b10100000 ) == 0b10100000 )
-                        {
-                            /* Format 3 cycle-accurate P-header */
-                            cpu->eatoms = ( c & 0x40 ) != 0;
-                            cpu->natoms = 0;
-                            cpu->watoms = ( c & 0x1c ) >> 2;
-                            cpu->instCount += cpu->watoms;
-                            /* Either 1 or 0 eatoms */
-                            cpu->disposition = cpu->eatoms;
-                            _stateChange( cpu, EV_CH_ENATOMS );
-                            _stateChange( cpu, EV_CH_WATOMS );
-                            retVal = TRACE_EV_MSG_RXED;
-
-                            DEBUG( "CA PHdr FMT3 (E=%d, N=%d W=%d)" EOL, cpu->eatoms, cpu->natoms, cpu->watoms );
-                            break;
-                        }
-
-                        if ( ( c & 0b11111011 ) == 0b10010010 )
-                        {
-                            /* Format 4 cycle-accurate P-header */
-                            cpu->eatoms = ( c & 0x4 ) != 0;
-                            cpu->natoms = ( c & 0x4 ) == 0;
-                            cpu->watoms = 0;
-
-                            /* Either 1 or 0 eatoms */
-                            cpu->disposition = cpu->eatoms;
-                            _stateChange( cpu, EV_CH_ENATOMS );
-                            _stateChange( cpu, EV_CH_WATOMS );
-                            retVal = TRACE_EV_MSG_RXED;
-
-                            DEBUG( "CA PHdr FMT4 (E=%d, N=%d W=%d)" EOL, cpu->eatoms, cpu->natoms, cpu->watoms );
-                            break;
-                        }
-
-                        DEBUG( "Unprocessed Cycle-accurate P-Header (%02X)" EOL, c );
+                        DEBUG( "Unprocessed %sP-Header (%02X)" EOL, j->cycleAccurate ? "Cycle-accurate " : "", c );
                     }
 
                     break;
@@ -421,14 +539,8 @@ static bool _pumpAction( struct TRACEDecoderEngine *e, struct TRACECPUState *cpu
 
             case TRACE_COLLECT_BA_ALT_FORMAT: /* Collecting a branch address, alt format */
                 C = c & 0x80;
-                /* This is a proper mess. Mask and collect bits according to address mode in use and */
-                /* if it's the last byte of the sequence */
-                mask = C ? 0x7f : 0x3f;
-                ofs = ( cpu->addrMode == TRACE_ADDRMODE_ARM ) ? 1 : ( cpu->addrMode == TRACE_ADDRMODE_THUMB ) ? 0 : -1;
-
-
-                j->addrConstruct = ( j->addrConstruct &   ~( mask << ( 7 * j->byteCount + ofs ) ) )
-                                   | ( ( c & mask ) << ( 7 * j->byteCount + ofs ) );
+                /* Bits collected depend on address mode in use and if it's the last byte of the sequence */
+                _addBranchByte( j, cpu, c );
                 /* There is exception information only if no continuation and bit 6 set */
                 X = ( ( !C ) && ( c & 0x40 ) );
                 j->byteCount++;
@@ -437,9 +549,7 @@ static bool _pumpAction( struct TRACEDecoderEngine *e, struct TRACECPUState *cpu
             // -----------------------------------------------------
 
             case TRACE_COLLECT_BA_STD_FORMAT: /* Collecting a branch address, standard format */
-                /* This will potentially collect too many bits, but that is OK */
-                ofs = ( cpu->addrMode == TRACE_ADDRMODE_ARM ) ? 1 : ( cpu->addrMode == TRACE_ADDRMODE_THUMB ) ? 0 : -1;
-                j->addrConstruct = ( j->addrConstruct &  ~( 0x7F << ( ( 7 * j->byteCount ) + ofs ) ) ) | ( c & ( 0x7F <<  ( ( 7 * j->byteCount ) + ofs ) ) );
+                _addBranchByte( j, cpu, c );
                 j->byteCount++;
                 C = ( j->byteCount < 5 ) ? c & 0x80 : c & 0x40;
                 X = ( j->byteCount == 5 ) && C;
@@ -832,6 +942,25 @@ static bool _pumpAction( struct TRACEDecoderEngine *e, struct TRACECPUState *cpu
 
 // ====================================================================================================
 
+static int _pumpRecords( struct TRACEDecoderEngine *e, struct TRACECPUState *cpu, const uint8_t *buf, int len, struct TRACERecordBatch *b )
+
+/* Pump bytes into the protocol decoder until they're used or the batch needs delivering */
+
+{
+    const uint8_t *p = buf;
+
+    while ( ( p < buf + len ) && ( !b->flush ) )
+    {
+        if ( _pumpAction( e, cpu, *p++ ) )
+        {
+            TRACERecordAdd( cpu, b );
+        }
+    }
+
+    return p - buf;
+}
+// ====================================================================================================
+
 static void _pumpDestroy( struct TRACEDecoderEngine *e )
 
 {
@@ -858,6 +987,14 @@ static void _usingAltAddrEncode( struct TRACEDecoderEngine *e, bool using )
 
 // ====================================================================================================
 
+static void _cycleAccurate( struct TRACEDecoderEngine *e, bool using )
+
+{
+    ( ( struct ETM35DecodeState * )e )->cycleAccurate = using;
+}
+
+// ====================================================================================================
+
 static void _forceSync(  struct TRACEDecoderEngine *e, bool isSynced )
 
 {
@@ -883,11 +1020,14 @@ struct TRACEDecoderEngine *ETM35DecoderPumpCreate( void )
 {
 
     struct TRACEDecoderEngine *e = ( struct TRACEDecoderEngine * )calloc( 1, sizeof( struct ETM35DecodeState ) );
+    pthread_once( &_tablesOnce, _buildTables );
     e->action        = _pumpAction;
+    e->actionRecords = _pumpRecords;
     e->destroy       = _pumpDestroy;
     e->synced        = _synced;
     e->forceSync     = _forceSync;
     e->altAddrEncode = _usingAltAddrEncode;
+    e->cycleAccurate = _cycleAccurate;
     return e;
 }
 
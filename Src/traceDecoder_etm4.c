@@ -112,7 +112,113 @@ struct ETM4DecodeState
     } q[3];                      /* Address queue for pushed addresses */
 };
 
-#define DEBUG(...) { if ( cpu->report ) cpu->report( V_DEBUG, __VA_ARGS__); }
+#define DEBUG(...) TRACE_DEBUG( cpu, __VA_ARGS__ )
+
+/* Classification of a header byte received in TRACE_IDLE */
+enum ETM4HeaderClass
+{
+    H_RESERVED,                  /* Not a header we know about */
+    H_IGNORE,                    /* Recognised, but carries nothing we report */
+    H_ATOM,                      /* Atom packet, formats 1 to 6 */
+    H_PAYLOAD,                   /* Payload follows, collected in the next state */
+    H_ELEMENT,                   /* Single byte element which reports a change */
+    H_EVENT,                     /* Event tracing */
+    H_EXACT_MATCH,               /* Exact match address from the queue */
+    H_SHORT_ADDR,                /* Short address, payload follows */
+    H_LONG_ADDR,                 /* Long address, payload follows */
+    H_TIMESTAMP,                 /* Timestamp, payload follows */
+    H_DSYNC,                     /* Data sync mark */
+    H_UDSYNC,                    /* Unnumbered data sync mark */
+    H_RESYNC                     /* Resynchronisation */
+};
+
+struct ETM4Header
+{
+    uint8_t cls;                 /* Packet class, an enum ETM4HeaderClass */
+    uint8_t next;                /* State that collects the payload, an enum TRACE_ETM4protoState */
+    uint8_t idx;                 /* Starting bit for address payloads */
+    uint8_t inst;                /* Instruction set for addresses */
+    uint8_t ctx;                 /* Long address is followed by context */
+    uint32_t mask;               /* Bits of the previous address that a long address starts from */
+    uint8_t change;              /* Change reported by a single byte element */
+    uint8_t fmt;                 /* Atom format */
+    uint8_t atoms;               /* Number of atoms in an atom packet */
+    uint8_t eatoms;              /* ...the number of them that were executed */
+    uint32_t disposition;        /* ...and which ones they were, one bit per atom */
+};
+
+#define _BITS5(d)         ( ( (d) & 1 ) + ( ( (d) >> 1 ) & 1 ) + ( ( (d) >> 2 ) & 1 ) + ( ( (d) >> 3 ) & 1 ) + ( ( (d) >> 4 ) & 1 ) )
+#define ATOM(f, n, d)     { .cls = H_ATOM, .fmt = (f), .atoms = (n), .eatoms = _BITS5( d ), .disposition = (d) }
+
+/* Atom Format 6 is c&0x1f+4 executed atoms, with the last one being not executed if bit 5 is set */
+#define _A6_N(c)          ( ( (c) & 0x1f ) + 4 )
+#define _A6_X(c)          ( ( (c) >> 5 ) & 1 )
+#define ATOM6(c)          [c] = { .cls = H_ATOM, .fmt = 6, .atoms = _A6_N( c ), .eatoms = _A6_N( c ) - _A6_X( c ), \
+                                  .disposition = ( ( 1U << _A6_N( c ) ) - 1 ) & ~( _A6_X( c ) << ( _A6_N( c ) - 1 ) ) }
+#define ATOM6x4(c)        ATOM6( c ), ATOM6( c + 1 ), ATOM6( c + 2 ), ATOM6( c + 3 )
+
+#define PAYLOAD(s)        { .cls = H_PAYLOAD, .next = (s) }
+#define ELEMENT(e)        { .cls = H_ELEMENT, .change = (e) }
+#define SHORT_ADDR(i)     { .cls = H_SHORT_ADDR, .next = TRACE_GET_SHORT_ADDR, .idx = ( (i) == IS0 ) ? 2 : 1, .inst = (i) }
+#define LONG_ADDR(s,i,x)  { .cls = H_LONG_ADDR, .next = (s), .idx = ( (i) == IS0 ) ? 2 : 1, .inst = (i), .ctx = (x), \
+                            .mask = ( ( (i) == IS1 ) && ( (s) == TRACE_GET_32BIT_ADDR ) ) ? 0xFFFFFFFE : 0xFFFFFFFC }
+#define IGNORE            { .cls = H_IGNORE }
+
+/* Header byte lookup for TRACE_IDLE, Chapter 6. Anything not listed is reserved. */
+static const struct ETM4Header _header[256] =
+{
+    [0b00000000]                = PAYLOAD( TRACE_EXTENSION ),
+    [0b00000001]                = PAYLOAD( TRACE_GET_INFO_PLCTL ),                 /* Trace info, Figure 6-2, Pg 6-258 */
+    [0b00000010 ... 0b00000011] = { .cls = H_TIMESTAMP, .next = TRACE_GET_TIMESTAMP }, /* Timestamp, Figure 6-7, Pg 6-264 */
+    [0b00000100]                = ELEMENT( EV_CH_TRACESTART ),                    /* Trace On, Figure 6.3, Pg 6-261 */
+    [0b00000101]                = ELEMENT( EV_CH_FNRETURN ),                      /* Function return element, Figure 6-9, Pg 6-265 */
+    [0b00000110]                = PAYLOAD( TRACE_GET_EXCEPTIONINFO1 ),            /* Exception, Figure 6-10, Pg 6-267 */
+    [0b00000111]                = ELEMENT( EV_CH_EXRETURN ),                      /* Exception Return element, Figure 6-11, Pg 6-271 */
+    [0b00001000]                = { .cls = H_RESYNC, .next = TRACE_UNSYNCED },    /* Resynchronisation, Figure 6-6, Pg 6-263 */
+    [0b00100000 ... 0b00100111] = { .cls = H_DSYNC },                             /* Data sync mark, Figure 6-15, Pg 6-275 */
+    [0b00101000 ... 0b00101100] = { .cls = H_UDSYNC },                            /* Unnumbered data sync mark, Figure 6-16, Pg 6-275 */
+    [0b00101101]                = PAYLOAD( TRACE_COMMIT ),                        /* Commit, Figure 6-17, Pg 6-277 */
+    [0b00110000 ... 0b00110011] = IGNORE,                                         /* Mispredict, Figure 6-21, Pg 6-279 */
+    [0b01110000]                = IGNORE,                                         /* Ignore packet, Figure 6-30, Pg 6-289 */
+    [0b01110001 ... 0b01111111] = { .cls = H_EVENT },                             /* Event tracing, Figure 6-31, Pg 6-289 */
+    [0b10000000]                = IGNORE,                                         /* Context with no payload, Figure 6-36, Pg 6-297 */
+    [0b10000001]                = PAYLOAD( TRACE_GET_CONTEXT ),                   /* Context with payload, Figure 6-36, Pg 6-297 */
+    [0b10000010]                = LONG_ADDR( TRACE_GET_32BIT_ADDR, IS0, true ),   /* Address with context, Figure 6-37, Pg 6-299 */
+    [0b10000011]                = LONG_ADDR( TRACE_GET_32BIT_ADDR, IS1, true ),
+    [0b10000101]                = LONG_ADDR( TRACE_GET_64BIT_ADDR, IS0, true ),   /* Address with context, Figure 6-38, Pg 6-300 */
+    [0b10000110]                = LONG_ADDR( TRACE_GET_64BIT_ADDR, IS1, true ),
+    [0b10001000]                = IGNORE,                                         /* Timestamp marker, Figure 6-8, Pg 6-265 */
+    [0b10010000 ... 0b10010010] = { .cls = H_EXACT_MATCH },                       /* Exact match address, Pg 6-293 */
+    [0b10010101]                = SHORT_ADDR( IS0 ),                              /* Short address, Figure 6-32, Pg 6-294 */
+    [0b10010110]                = SHORT_ADDR( IS1 ),
+    [0b10011010]                = LONG_ADDR( TRACE_GET_32BIT_ADDR, IS0, false ),  /* Long address, Figure 6.33 Pg 6-295 */
+    [0b10011011]                = LONG_ADDR( TRACE_GET_32BIT_ADDR, IS1, false ),
+    [0b10011101]                = LONG_ADDR( TRACE_GET_64BIT_ADDR, IS0, false ),  /* Long address, Figure 6.34 Pg 6-295 */
+    [0b10011110]                = LONG_ADDR( TRACE_GET_64BIT_ADDR, IS1, false ),
+    [0b10100000 ... 0b10101111] = IGNORE,                                         /* Q instruction trace, Figure 6-45, Pg 6-308 */
+
+    /* Atom Format 1, Figure 6-39, Pg 6-304 */
+    [0b11110110] = ATOM( 1, 1, 0 ), [0b11110111] = ATOM( 1, 1, 1 ),
+
+    /* Atom Format 2, Figure 6-40, Pg 6-304 */
+    [0b11011000] = ATOM( 2, 2, 0 ), [0b11011001] = ATOM( 2, 2, 1 ), [0b11011010] = ATOM( 2, 2, 2 ), [0b11011011] = ATOM( 2, 2, 3 ),
+
+    /* Atom Format 3, Figure 6-41, Pg 6-305 */
+    [0b11111000] = ATOM( 3, 3, 0 ), [0b11111001] = ATOM( 3, 3, 1 ), [0b11111010] = ATOM( 3, 3, 2 ), [0b11111011] = ATOM( 3, 3, 3 ),
+    [0b11111100] = ATOM( 3, 3, 4 ), [0b11111101] = ATOM( 3, 3, 5 ), [0b11111110] = ATOM( 3, 3, 6 ), [0b11111111] = ATOM( 3, 3, 7 ),
+
+    /* Atom Format 4, Figure 6-42, Pg 6-305 */
+    [0b11011100] = ATOM( 4, 4, 0b1110 ), [0b11011101] = ATOM( 4, 4, 0b0000 ),
+    [0b11011110] = ATOM( 4, 4, 0b1010 ), [0b11011111] = ATOM( 4, 4, 0b0101 ),
+
+    /* Atom format 5, Figure 6-43, Pg 6-306 ... uses bits 5, 1 and 0 */
+    [0b11110101] = ATOM( 5, 5, 0b11110 ), [0b11010101] = ATOM( 5, 5, 0b00000 ),
+    [0b11010110] = ATOM( 5, 5, 0b01010 ), [0b11010111] = ATOM( 5, 5, 0b10101 ),
+
+    /* Atom format 6, Figure 6-44, Pg 6.307 */
+    ATOM6x4( 0b11000000 ), ATOM6x4( 0b11000100 ), ATOM6x4( 0b11001000 ), ATOM6x4( 0b11001100 ), ATOM6x4( 0b11010000 ), ATOM6( 0b11010100 ),
+    ATOM6x4( 0b11100000 ), ATOM6x4( 0b11100100 ), ATOM6x4( 0b11101000 ), ATOM6x4( 0b11101100 ), ATOM6x4( 0b11110000 ), ATOM6( 0b11110100 )
+};
 
 // ====================================================================================================
 // ====================================================================================================
@@ -169,6 +275,7 @@ static bool _pumpAction( struct TRACEDecoderEngine *e, struct TRACECPUState *cpu
 {
 
     enum TRACEDecoderPumpEvent retVal = TRACE_EV_NONE;
+    const struct ETM4Header *h;
     int match;
 
     struct ETM4DecodeState *j = ( struct ETM4DecodeState * )e;
@@ -176,6 +283,27 @@ static bool _pumpAction( struct TRACEDecoderEngine *e, struct TRACECPUState *cpu
 
     assert( j );
 
+    h = &_header[c];
+
+    /* Atoms are the bulk of the stream, so expand them straight from the table before anything else */
+    if ( ( j->p == TRACE_IDLE ) && ( h->cls == H_ATOM ) )
+    {
+        j->asyncCount = 0;
+        cpu->eatoms = h->eatoms;
+        cpu->natoms = h->atoms - h->eatoms;
+        cpu->instCount += h->atoms;
+        cpu->disposition = h->disposition;
+        DEBUG( "Atom Format %d [%d %08x]", h->fmt, h->atoms, cpu->disposition );
+
+        if ( cpu->addr != ADDRESS_UNKNOWN )
+        {
+            _stateChange( cpu, EV_CH_ENATOMS );
+            return j->rxedISYNC;
+        }
+
+        return false;
+    }
+
     /* Perform A-Sync accumulation check ( Section 6.4.2 ) */
     if ( ( j->asyncCount == 11 ) && ( c == 0x80 ) )
     {
@@ -201,182 +329,21 @@ static bool _pumpAction( struct TRACEDecoderEngine *e, struct TRACECPUState *cpu
 
             // -----------------------------------------------------
             case TRACE_IDLE:
-                switch ( c )
+                switch ( h->cls )
                 {
-                    case 0b00000001:
-                        newState = TRACE_GET_INFO_PLCTL;
-                        break;
-
-                    case 0b01110000: /* Ignore packet, Figure 6-30, Pg 6-289 */
-                        break;
-
-                    case 0b11110110 ... 0b11110111: /* Atom Format 1, Figure 6-39, Pg 6-304 */
-                        cpu->eatoms = ( 0 != ( c & 1 ) );
-                        cpu->natoms = !cpu->eatoms;
-                        cpu->instCount += 1;
-                        cpu->disposition = c & 1;
-                        DEBUG( "Atom Format 1 [%b]", cpu->disposition );
-
-
-                        if ( cpu->addr != ADDRESS_UNKNOWN )
-                        {
-                            retVal = TRACE_EV_MSG_RXED;
-                            _stateChange( cpu, EV_CH_ENATOMS );
-                        }
-
-                        break;
-
-                    case 0b11011000 ... 0b11011011: /* Atom Format 2, Figure 6-40, Pg 6-304 */
-                        cpu->eatoms = ( 0 != ( c & 2 ) ) + ( 0 != ( c & 1 ) );
-                        cpu->natoms = 2 - cpu->eatoms;
-                        cpu->instCount += 2;
-
-                        /* Put a 1 in each element of disposition if was executed */
-                        cpu->disposition = c & 3;
-                        DEBUG( "Atom Format 2 [%02b]", cpu->disposition );
-
-                        if ( cpu->addr != ADDRESS_UNKNOWN )
-                        {
-                            retVal = TRACE_EV_MSG_RXED;
-                            _stateChange( cpu, EV_CH_ENATOMS );
-                        }
-
-                        break;
-
-                    case 0b11111000 ... 0b11111111: /* Atom Format 3, Figure 6-41, Pg 6-305 */
-                        cpu->eatoms = ( 0 != ( c & 1 ) ) + ( 0 != ( c & 2 ) ) + ( 0 != ( c & 4 ) );
-                        cpu->natoms = 3 - cpu->eatoms;
-                        cpu->instCount += 3;
-
-                        /* Put a 1 in each element of disposition if was executed */
-                        cpu->disposition = c & 7;
-                        DEBUG( "Atom Format 3 [%03b]", cpu->disposition );
-
-                        if ( cpu->addr != ADDRESS_UNKNOWN )
-                        {
-                            retVal = TRACE_EV_MSG_RXED;
-                            _stateChange( cpu, EV_CH_ENATOMS );
-                        }
-
-                        break;
-
-                    case 0b11011100 ... 0b11011111: /* Atom Format 4, Figure 6-42, Pg 6-305 */
-                        switch ( c & 3 )
-                        {
-                            case 0b00:
-                                cpu->natoms = 1;
-                                cpu->disposition = 0b1110;
-                                break;
-
-                            case 0b01:
-                                cpu->natoms = 4;
-                                cpu->disposition = 0b0000;
-                                break;
-
-                            case 0b10:
-                                cpu->natoms = 2;
-                                cpu->disposition = 0b1010;
-                                break;
-
-                            case 0b11:
-                                cpu->natoms = 2;
-                                cpu->disposition = 0b0101;
-                                break;
-                        }
-
-                        cpu->eatoms = 4 - cpu->natoms;
-                        cpu->instCount += 4;
-                        DEBUG( "Atom Format 4 [%04b]", cpu->disposition );
-
-                        if ( cpu->addr != ADDRESS_UNKNOWN )
-                        {
-                            retVal = TRACE_EV_MSG_RXED;
-                            _stateChange( cpu, EV_CH_ENATOMS );
-                        }
-
-                        break;
-
-
-                    case 0b11010101:
-                    case 0b11010110:
-                    case 0b11010111:
-                    case 0b11110101: /* Atom format 5, Figure 6-43, Pg 6-306 ... use bits 5, 1 and 0 */
-                        switch ( ( ( 0 != ( c & ( 1 << 5 ) ) ) << 2 ) | ( ( 0 != ( c & ( 1 << 1 ) ) ) << 1 ) | ( ( 0 != ( c & ( 1 << 0 ) ) ) << 0 ) )
-                        {
-                            case 0b101:
-                                cpu->natoms = 1;
-                                cpu->disposition = 0b11110;
-                                break;
-
-                            case 0b001:
-                                cpu->natoms = 5;
-                                cpu->disposition = 0b00000;
-                                break;
-
-                            case 0b010:
-                                cpu->natoms = 3;
-                                cpu->disposition = 0b01010;
-                                break;
-
-                            case 0b011:
-                                cpu->natoms = 2;
-                                cpu->disposition = 0b10101;
-                                break;
-
-                            default:
-                                DEBUG( "Illegal value for Atom type 5 (0x%02x)" EOL, c );
-                                break;
-                        }
-
-                        cpu->eatoms = 5 - cpu->natoms;
-                        cpu->instCount += 5;
-                        DEBUG( "Atom Format 5 [%05b]", cpu->disposition );
-
-                        if ( cpu->addr != ADDRESS_UNKNOWN )
-                        {
-                            retVal = TRACE_EV_MSG_RXED;
-                            _stateChange( cpu, EV_CH_ENATOMS );
-                        }
-
+                    case H_IGNORE:
                         break;
 
-                    case 0b11000000 ... 0b11010100:
-                    case 0b11100000 ... 0b11110100: /* Atom format 6, Figure 6-44, Pg 6.307 */
-                        cpu->eatoms = ( c & 0x1f ) + 4;
-                        cpu->instCount = cpu->eatoms;
-                        cpu->disposition = ( 1 << ( cpu->eatoms ) ) - 1;
-
-                        /* Deal with last instruction to be executed */
-                        if ( c & ( 1 << 5 ) )
-                        {
-                            DEBUG( "Got a non-execute" );
-                            cpu->disposition &= ~( 1 << ( cpu->eatoms - 1 ) );
-                            cpu->eatoms--;
-                            cpu->natoms = 1;
-                        }
-                        else
-                        {
-                            cpu->natoms = 0;
-                        }
-
-                        char construct[30];
-                        sprintf( construct, "Atom Format 6 [%%ld %%%" PRId64 "b]", cpu->instCount );
-                        DEBUG( construct, cpu->instCount, cpu->disposition );
-
-                        if ( cpu->addr != ADDRESS_UNKNOWN )
-                        {
-                            retVal = TRACE_EV_MSG_RXED;
-                            _stateChange( cpu, EV_CH_ENATOMS );
-                        }
-
+                    case H_PAYLOAD:
+                        newState = h->next;
                         break;
 
-
-                    case 0b10100000 ... 0b10101111: /* Q instruction trace packet, Figure 6-45, Pg 6-308 */
-
+                    case H_ELEMENT:
+                        retVal = TRACE_EV_MSG_RXED;
+                        _stateChange( cpu, h->change );
                         break;
 
-                    case 0b01110001 ... 0b01111111: /* Event tracing, Figure 6-31, Pg 6-289 */
+                    case H_EVENT: /* Event tracing, Figure 6-31, Pg 6-289 */
                         if ( c & 0b0001 )
                         {
                             _stateChange( cpu, EV_CH_EVENT0 );
@@ -399,14 +366,8 @@ static bool _pumpAction( struct TRACEDecoderEngine *e, struct TRACECPUState *cpu
 
                         break;
 
-                    case 0b00000100: /* Trace On, Figure 6.3, Pg 6-261 */
-                        retVal = TRACE_EV_MSG_RXED;
-                        _stateChange( cpu, EV_CH_TRACESTART );
-                        break;
-
-                    case 0b10010000 ... 0b10010011: /* Exact Match Address */
+                    case H_EXACT_MATCH: /* Exact Match Address */
                         match = c & 0x03;
-                        assert( c != 3 ); /* This value is reserved */
                         cpu->addr = j->q[match].addr;
                         retVal = TRACE_EV_MSG_RXED;
                         _stateChange( cpu, EV_CH_ADDRESS );
@@ -414,116 +375,23 @@ static bool _pumpAction( struct TRACEDecoderEngine *e, struct TRACECPUState *cpu
                         j->q[0].addr = cpu->addr;
                         break;
 
-                    case 0b10010101: /* Short address, IS0 short, Figure 6-32, Pg 6-294 */
-                        j->idx = 2;
-                        _stackQ( j );
-                        newState = TRACE_GET_SHORT_ADDR;
-                        break;
-
-                    case 0b10010110: /* Short address, IS1 short, Figure 6-32, Pg 6-294 */
-                        j->idx = 1;
-                        _stackQ( j );
-                        newState = TRACE_GET_SHORT_ADDR;
-                        break;
-
-                    case 0b10011010: /* Long address, 32 bit, IS0, Figure 6.33 Pg 6-295 */
-                        j->idx = 2;
-                        j->haveContext = false;
-                        _stackQ( j );
-                        j->q[0].inst = IS0;
-                        j->q[0].addr &= 0xFFFFFFFC;
-                        newState = TRACE_GET_32BIT_ADDR;
-                        break;
-
-                    case 0b10011011: /* Long address, 32 bit, IS1, Figure 6.33 Pg 6-295 */
-                        j->idx = 1;
-                        j->haveContext = false;
-                        _stackQ( j );
-                        j->q[0].inst = IS1;
-                        j->q[0].addr &= 0xFFFFFFFE;
-                        newState = TRACE_GET_32BIT_ADDR;
-                        break;
-
-                    case 0b10011101: /* Long address, 64 bit, IS0, Figure 6.34 Pg 6-295 */
-                        j->idx = 2;
-                        j->haveContext = false;
-                        _stackQ( j );
-                        j->q[0].inst = IS0;
-                        j->q[0].addr &= 0xFFFFFFFC;
-                        newState = TRACE_GET_64BIT_ADDR;
-                        break;
-
-
-                    case 0b10011110: /* Long address, 64 bit, IS0, Figure 6.34 Pg 6-295 */
-                        j->idx = 1;
-                        _stackQ( j );
-                        j->haveContext = false;
-                        j->q[0].inst = IS1;
-                        j->q[0].addr &= 0xFFFFFFFC;
-                        newState = TRACE_GET_64BIT_ADDR;
-                        break;
-
-                    case 0b10000000: /* Context element with no payload, Figure 6-36, Pg 6-297 */
-                        /* Context is same as prevously, nothing to report */
-                        break;
-
-                    case 0b10000001: /* Context element with payload, Figure 6-36, Pg 6-297*/
-                        newState = TRACE_GET_CONTEXT;
-                        break;
-
-                    case 0b10000010: /* Long address, 32 bit, IS0, Figure 6-37 case 1, Pg 6-299 */
-                        j->haveContext = true;
-                        j->idx = 2;
-                        _stackQ( j );
-                        j->q[0].inst = IS0;
-                        j->q[0].addr &= 0xFFFFFFFC;
-                        newState = TRACE_GET_32BIT_ADDR;
-                        break;
-
-
-                    case 0b10000011: /* Long address, 32 bit, IS1, Figure 6-37 case 2, Pg 6-299 */
-                        j->idx = 1;
-                        j->haveContext = true;
+                    case H_SHORT_ADDR: /* Short address, Figure 6-32, Pg 6-294 */
+                        j->idx = h->idx;
                         _stackQ( j );
-                        j->q[0].inst = IS1;
-                        j->q[0].addr &= 0xFFFFFFFE;
-                        newState = TRACE_GET_32BIT_ADDR;
+                        newState = h->next;
                         break;
 
-                    case 0b10000101: /* Long address, 64 bit, IS0, Figure 6-38 case 1, Pg 6-300 */
-                        j->idx = 2;
-                        j->haveContext = true;
+                    case H_LONG_ADDR: /* Long address, with or without context, Figures 6-33, 6-34, 6-37 and 6-38 */
+                        j->idx = h->idx;
+                        j->haveContext = h->ctx;
                         _stackQ( j );
-                        j->q[0].inst = IS0;
-                        j->q[0].addr &= 0xFFFFFFFC;
-                        newState = TRACE_GET_64BIT_ADDR;
-                        break;
-
-
-                    case 0b10000110: /* Long address, 64 bit, IS1, Figure 6-38 case 2, Pg 6-300 */
-                        j->idx = 1;
-                        _stackQ( j );
-                        j->haveContext = true;
-                        j->q[0].inst = IS1;
-                        j->q[0].addr &= 0xFFFFFFFC;
-                        newState = TRACE_GET_64BIT_ADDR;
-                        break;
-
-                    case 0b00000000:
-                        newState = TRACE_EXTENSION;
-                        break;
-
-                    case 0b00001000: /* Resynchronisation, Figure 6-6, Pg 6-263 */
-                        j->rxedISYNC = false;
-                        newState = TRACE_UNSYNCED;
+                        j->q[0].inst = h->inst;
+                        j->q[0].addr &= h->mask;
+                        newState = h->next;
                         break;
 
-                    case 0b00000110: /* Exception instruction trace packet Figure 6-10, Pg 6-267 */
-                        newState = TRACE_GET_EXCEPTIONINFO1;
-                        break;
-
-                    case 0b00000010 ... 0b00000011: /* Timestamp, Figure 6-7, Pg 6-264 */
-                        newState = TRACE_GET_TIMESTAMP;
+                    case H_TIMESTAMP: /* Timestamp, Figure 6-7, Pg 6-264 */
+                        newState = h->next;
                         j->cc_follows = ( 0 != ( c & 1 ) );
 
                         if ( !j->cc_follows )
@@ -534,36 +402,21 @@ static bool _pumpAction( struct TRACEDecoderEngine *e, struct TRACECPUState *cpu
                         j->idx = 0;
                         break;
 
-                    case 0b10001000: /* Timestamp marker element, Figure 6-8, Pg 6-265 */
-                        break;
-
-                    case 0b00000101: /* Function return element, Figure 6-9, Pg 6-265 */
-                        retVal = TRACE_EV_MSG_RXED;
-                        _stateChange( cpu, EV_CH_FNRETURN );
-                        break;
-
-                    case 0b00000111: /* Exception Return element, Figure 6-11, Pg 6-271 */
-                        retVal = TRACE_EV_MSG_RXED;
-                        _stateChange( cpu, EV_CH_EXRETURN );
-                        break;
-
-                    case 0b00100000 ... 0b00100111: /* Data sync mark, Figure 6-15, Pg 6-275 */
+                    case H_DSYNC: /* Data sync mark, Figure 6-15, Pg 6-275 */
                         cpu->dsync_mark = c & 0x07;
                         retVal = TRACE_EV_MSG_RXED;
                         _stateChange( cpu, EV_CH_DATASYNC );
                         break;
 
-                    case 0b00101000 ... 0b00101100: /* Unnumbered data sync mark, Figure 6-16, Pg 6-275 */
+                    case H_UDSYNC: /* Unnumbered data sync mark, Figure 6-16, Pg 6-275 */
                         cpu->udsync_mark = c & 0x07;
                         retVal = TRACE_EV_MSG_RXED;
                         _stateChange( cpu, EV_CH_UDATASYNC );
                         break;
 
-                    case 0b00110000 ... 0b00110011: /* Mispredict instruction, Figure 6-21, Pg 6-279 */
-                        break;
-
-                    case 0b00101101: /* Commit instruction trace packet, Figure 6-17, Pg 6-277 */
-                        newState = TRACE_COMMIT;
+                    case H_RESYNC: /* Resynchronisation, Figure 6-6, Pg 6-263 */
+                        j->rxedISYNC = false;
+                        newState = h->next;
                         break;
 
                     default:
@@ -987,6 +840,25 @@ static bool _pumpAction( struct TRACEDecoderEngine *e, struct TRACECPUState *cpu
 }
 // ====================================================================================================
 
+static int _pumpRecords( struct TRACEDecoderEngine *e, struct TRACECPUState *cpu, const uint8_t *buf, int len, struct TRACERecordBatch *b )
+
+/* Pump bytes into the protocol decoder until they're used or the batch needs delivering */
+
+{
+    const uint8_t *p = buf;
+
+    while ( ( p < buf + len ) && ( !b->flush ) )
+    {
+        if ( _pumpAction( e, cpu, *p++ ) )
+        {
+            TRACERecordAdd( cpu, b );
+        }
+    }
+
+    return p - buf;
+}
+// ====================================================================================================
+
 static void _pumpDestroy( struct TRACEDecoderEngine *e )
 
 {
@@ -1023,10 +895,11 @@ struct TRACEDecoderEngine *ETM4DecoderPumpCreate( void )
 {
 
     struct TRACEDecoderEngine *e = ( struct TRACEDecoderEngine * )calloc( 1, sizeof( struct ETM4DecodeState ) );
-    e->action    = _pumpAction;
-    e->destroy   = _pumpDestroy;
-    e->synced    = _synced;
-    e->forceSync = _forceSync;
+    e->action        = _pumpAction;
+    e->actionRecords = _pumpRecords;
+    e->destroy       = _pumpDestroy;
+    e->synced        = _synced;
+    e->forceSync     = _forceSync;
     return e;
 }
 
@@ -25,9 +25,12 @@ struct MTBDecodeState
 {
     struct TRACEDecoderEngine e; /* Must be first to allow object method access */
     enum TRACE_MTBprotoState p;  /* Current state of the receiver */
+
+    uint8_t partial[8];          /* Part of a source/dest pair carried over from the last buffer */
+    int partialLen;              /* ...and how much of it there is */
 };
 
-#define REPORT(...) { if ( cpu->report ) cpu->report( V_DEBUG, __VA_ARGS__); }
+#define REPORT(...) TRACE_DEBUG( cpu, __VA_ARGS__ )
 
 // ====================================================================================================
 // ====================================================================================================
@@ -43,7 +46,16 @@ static void _stateChange( struct TRACECPUState *cpu, enum TRACEchanges c )
 }
 
 // ====================================================================================================
-static bool _pumpActionPair( struct TRACEDecoderEngine *e, struct TRACECPUState *cpu, uint32_t source, uint32_t dest )
+static inline uint32_t _load32( const uint8_t *b )
+
+/* MTB words are little endian, and there's no reason for them to be aligned in the buffer */
+
+{
+    return b[0] | ( b[1] << 8 ) | ( b[2] << 16 ) | ( ( uint32_t )b[3] << 24 );
+}
+
+// ====================================================================================================
+static inline bool _pumpActionPair( struct TRACEDecoderEngine *e, struct TRACECPUState *cpu, uint32_t source, uint32_t dest )
 
 /* Pump next words through the protocol decoder */
 
@@ -112,6 +124,64 @@ static bool _pumpActionPair( struct TRACEDecoderEngine *e, struct TRACECPUState
     return ( retVal != TRACE_EV_NONE );
 }
 // ====================================================================================================
+static bool _pumpAction( struct TRACEDecoderEngine *e, struct TRACECPUState *cpu, uint8_t c )
+
+/* Pump next byte through the protocol decoder, a pair at a time */
+
+{
+    struct MTBDecodeState *j = ( struct MTBDecodeState * )e;
+
+    j->partial[j->partialLen++] = c;
+
+    if ( j->partialLen < 8 )
+    {
+        return false;
+    }
+
+    j->partialLen = 0;
+    return _pumpActionPair( e, cpu, _load32( j->partial ), _load32( &j->partial[4] ) );
+}
+// ====================================================================================================
+static int _pumpRecords( struct TRACEDecoderEngine *e, struct TRACECPUState *cpu, const uint8_t *buf, int len, struct TRACERecordBatch *b )
+
+/* Decode as many whole pairs as possible straight from the buffer, carrying any part pair over to next time */
+
+{
+    struct MTBDecodeState *j = ( struct MTBDecodeState * )e;
+    const uint8_t *p = buf;
+    const uint8_t *end = buf + len;
+
+    /* Finish off anything left from last time */
+    while ( ( j->partialLen ) && ( p < end ) && ( !b->flush ) )
+    {
+        if ( _pumpAction( e, cpu, *p++ ) )
+        {
+            TRACERecordAdd( cpu, b );
+        }
+    }
+
+    while ( ( end - p >= 8 ) && ( !b->flush ) )
+    {
+        if ( _pumpActionPair( e, cpu, _load32( p ), _load32( p + 4 ) ) )
+        {
+            TRACERecordAdd( cpu, b );
+        }
+
+        p += 8;
+    }
+
+    /* ...and keep what's left over for next time */
+    if ( !b->flush )
+    {
+        while ( p < end )
+        {
+            j->partial[j->partialLen++] = *p++;
+        }
+    }
+
+    return p - buf;
+}
+// ====================================================================================================
 
 static void _pumpDestroy( struct TRACEDecoderEngine *e )
 
@@ -133,6 +203,11 @@ static bool _synced( struct TRACEDecoderEngine *e )
 static void _forceSync(  struct TRACEDecoderEngine *e, bool isSynced )
 
 {
+    if ( !isSynced )
+    {
+        ( ( struct MTBDecodeState * )e )->partialLen = 0;
+    }
+
     ( ( struct MTBDecodeState * )e )->p = ( isSynced ) ? TRACE_IDLE : TRACE_UNSYNCED;
 }
 
@@ -149,7 +224,8 @@ struct TRACEDecoderEngine *MTBDecoderPumpCreate( void )
 {
 
     struct TRACEDecoderEngine *e = ( struct TRACEDecoderEngine * )calloc( 1, sizeof( struct MTBDecodeState ) );
-    e->actionPair    = _pumpActionPair;
+    e->action        = _pumpAction;
+    e->actionRecords = _pumpRecords;
     e->destroy       = _pumpDestroy;
     e->synced        = _synced;
     e->forceSync     = _forceSync;
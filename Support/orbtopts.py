@@ -0,0 +1,101 @@
+#!/usr/bin/env python3
+# Reader for orbtop time series files (orbtop -T <file>)
+#
+# The file is the magic 'ORBTOPTS' and a version byte, followed by records of
+# a one byte tag, a LEB128 varint body length and the body. Integers in bodies
+# are LEB128 varints too.
+#
+# 'S' records name a symbol: its dictionary id, then the name as the rest of the body.
+# 'I' records hold one interval: time (us), length (us), length (ticks), the
+#     cumulative ITM overflow, sync and error counts, then the samples as a
+#     count n, n ascending dictionary id deltas and n counts, then the exceptions
+#     as a count m and one column of m values for each of EXCEPTION_FIELDS.
+#
+# Samples are keyed by dictionary id rather than by name, since names needn't be
+# unique (static functions, or symbols reloaded part way through a recording).
+#
+# Run with a filename to get the samples as CSV (time,id,name,count), or with -e
+# to get the exception statistics instead.
+
+import sys
+
+MAGIC = b'ORBTOPTS'
+INTERVAL_FIELDS = ['time', 'interval', 'ticks', 'overflow', 'itmsync', 'errors']
+EXCEPTION_FIELDS = ['ex', 'count', 'maxd', 'totalt', 'mint', 'maxt', 'maxwt', 'p50', 'p99', 'p999', 'jitter']
+
+def varint(b, i):
+    """Return the varint at b[i] and the index following it"""
+    v = shift = 0
+    while True:
+        c = b[i]
+        i += 1
+        v |= (c & 0x7f) << shift
+        shift += 7
+        if not c & 0x80:
+            return v, i
+
+def intervals(data):
+    """Yield a dict for each interval recorded in the file contents. Its 'samples'
+    map dictionary ids to counts, and its 'names' map ids to the names seen so far"""
+    if data[:len(MAGIC)] != MAGIC:
+        raise ValueError('Not an orbtop time series')
+    names = {}
+    i = len(MAGIC) + 1
+    while i < len(data):
+        tag = data[i]
+        n, i = varint(data, i + 1)
+        body, i = data[i:i + n], i + n
+        if tag == ord('S'):
+            ident, j = varint(body, 0)
+            names[ident] = body[j:].decode(errors='replace')
+        elif tag == ord('I'):
+            vals = []
+            j = 0
+            for _ in INTERVAL_FIELDS:
+                v, j = varint(body, j)
+                vals.append(v)
+            r = dict(zip(INTERVAL_FIELDS, vals))
+
+            n, j = varint(body, j)
+            ids = []
+            ident = 0
+            for _ in range(n):
+                d, j = varint(body, j)
+                ident += d
+                ids.append(ident)
+            counts = []
+            for _ in range(n):
+                c, j = varint(body, j)
+                counts.append(c)
+            r['samples'] = dict(zip(ids, counts))
+            r['names'] = names
+
+            m, j = varint(body, j)
+            cols = []
+            for _ in EXCEPTION_FIELDS:
+                col = []
+                for _ in range(m):
+                    v, j = varint(body, j)
+                    col.append(v)
+                cols.append(col)
+            r['exceptions'] = [dict(zip(EXCEPTION_FIELDS, e)) for e in zip(*cols)]
+            yield r
+
+if __name__ == '__main__':
+    args = [a for a in sys.argv[1:] if a != '-e']
+    if len(args) != 1:
+        sys.exit(f'Usage: {sys.argv[0]} [-e] <filename>')
+
+    with open(args[0], 'rb') as f:
+        data = f.read()
+
+    if '-e' in sys.argv:
+        print(','.join(['time'] + EXCEPTION_FIELDS))
+        for r in intervals(data):
+            for e in r['exceptions']:
+                print(','.join(str(v) for v in [r['time']] + [e[k] for k in EXCEPTION_FIELDS]))
+    else:
+        print('time,id,name,count')
+        for r in intervals(data):
+            for ident, count in r['samples'].items():
+                print(f'{r["time"]},{ident},"{r["names"][ident]}",{count}')
@@ -0,0 +1,31 @@
+# Decoder for batched orbzmq output (orbzmq -b <bytes>)
+#
+# In batched mode each published message is a topic frame followed by one
+# frame holding any number of records for that topic. Each record is a 16 bit
+# little endian length followed by that many bytes of payload, which is exactly
+# what would have been sent as a single message without batching.
+
+import sys
+import zmq
+
+def records(batch):
+    """Yield the payload of each record in a batch"""
+    i = 0
+    while i + 2 <= len(batch):
+        n = batch[i] | (batch[i + 1] << 8)
+        i += 2
+        yield batch[i:i + n]
+        i += n
+
+if __name__ == '__main__':
+    ctx = zmq.Context()
+    sock = ctx.socket(zmq.SUB)
+
+    sock.connect(sys.argv[1] if len(sys.argv) > 1 else 'tcp://localhost:3442')
+    for topic in (sys.argv[2:] or ['']):
+        sock.setsockopt(zmq.SUBSCRIBE, topic.encode())
+
+    while True:
+        [topic, batch] = sock.recv_multipart()
+        for msg in records(batch):
+            print(f'{topic.decode()}: {msg}')
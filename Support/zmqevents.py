@@ -0,0 +1,48 @@
+# Decoder for binary orbzmq hwevents (orbzmq -B)
+#
+# Each hwevent payload is a packed record, laid out as in Inc/zmqEvents.h; a header
+# of version, type and timestamp followed by the fields for that type of event.
+# Works with batched output too (orbzmq -b), using zmqbatch.records() to split them.
+
+import struct
+import sys
+import zmq
+
+from zmqbatch import records
+
+ZMQEV_VERSION = 1
+
+HEADER = struct.Struct('<BBQ')
+
+# Fields following the header for each event type
+EVENTS = {
+    0: ('TS',   struct.Struct('<BI'),  ('timeStatus', 'timeInc')),
+    1: ('EXCP', struct.Struct('<IB'),  ('exceptionNumber', 'eventType')),
+    2: ('PC',   struct.Struct('<IB'),  ('pc', 'sleep')),
+    3: ('DWT',  struct.Struct('<B'),   ('event',)),
+    4: ('RWWT', struct.Struct('<BBI'), ('comp', 'isWrite', 'data')),
+    5: ('AWP',  struct.Struct('<BI'),  ('comp', 'data')),
+    6: ('OFS',  struct.Struct('<BI'),  ('comp', 'offset')),
+}
+
+def decode(payload):
+    """Return (name, ts, {field: value}) for a binary hwevent payload"""
+    version, evtype, ts = HEADER.unpack_from(payload)
+    if version != ZMQEV_VERSION:
+        raise ValueError(f'Unsupported event schema version {version}')
+    name, body, fields = EVENTS[evtype]
+    return name, ts, dict(zip(fields, body.unpack_from(payload, HEADER.size)))
+
+if __name__ == '__main__':
+    batched = '-b' in sys.argv
+    args = [a for a in sys.argv[1:] if a != '-b']
+
+    ctx = zmq.Context()
+    sock = ctx.socket(zmq.SUB)
+    sock.connect(args[0] if args else 'tcp://localhost:3442')
+    sock.setsockopt(zmq.SUBSCRIBE, b'hwevent')
+
+    while True:
+        [topic, msg] = sock.recv_multipart()
+        for payload in (records(msg) if batched else [msg]):
+            print(decode(payload))
@@ -0,0 +1,141 @@
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Heap Allocation Counter
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+
+/* Build with;
+ * gcc -shared -fPIC -O2 Tests/bench_allocs.c -o bench_allocs.so -lpthread
+ * Execute with (for example);
+ * LD_PRELOAD=./bench_allocs.so orbprofile -e firmware.elf -p ETM -f capture.bin -I 10000 -z out.prof
+ *
+ * This is preloaded into a tool (glibc only) and counts the calls it makes to the heap allocator.
+ * Every second it reports the allocations made over that second, and when the tool exits it
+ * reports the total. The counts over the first few seconds are from startup (loading symbols and
+ * so on), whereas the later ones show what the steady state of decode and processing costs. To
+ * compare changes to the flow tracker, replay the same recorded capture through both versions.
+ * Set BENCH_ALLOCS_MS to change the reporting interval.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <time.h>
+
+/* glibc's own entry points, which the replacements pass through to */
+extern void *__libc_malloc( size_t size );
+extern void *__libc_calloc( size_t n, size_t size );
+extern void *__libc_realloc( void *p, size_t size );
+extern void __libc_free( void *p );
+
+static _Atomic uint64_t _allocs;
+static _Atomic uint64_t _bytes;
+static double _start;
+
+// ====================================================================================================
+static double _now( void )
+
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+// ====================================================================================================
+static void _count( size_t size )
+
+{
+    atomic_fetch_add_explicit( &_allocs, 1, memory_order_relaxed );
+    atomic_fetch_add_explicit( &_bytes, size, memory_order_relaxed );
+}
+// ====================================================================================================
+void *malloc( size_t size )
+
+{
+    _count( size );
+    return __libc_malloc( size );
+}
+// ====================================================================================================
+void *calloc( size_t n, size_t size )
+
+{
+    _count( n * size );
+    return __libc_calloc( n, size );
+}
+// ====================================================================================================
+void *realloc( void *p, size_t size )
+
+{
+    _count( size );
+    return __libc_realloc( p, size );
+}
+// ====================================================================================================
+void free( void *p )
+
+{
+    __libc_free( p );
+}
+// ====================================================================================================
+static void *_reporter( void *params )
+
+/* Report the allocations made in each interval. The reports themselves don't allocate */
+
+{
+    uint32_t intervalMs = ( uint32_t )( uintptr_t )params;
+    uint64_t lastAllocs = 0, lastBytes = 0;
+    char line[128];
+
+    while ( true )
+    {
+        usleep( intervalMs * 1000 );
+
+        uint64_t allocs = atomic_load( &_allocs );
+        uint64_t bytes  = atomic_load( &_bytes );
+        int len = snprintf( line, sizeof( line ), "[%7.2fs] %10" PRIu64 " allocations, %12" PRIu64 " bytes\n",
+                            _now() - _start, allocs - lastAllocs, bytes - lastBytes );
+
+        if ( write( STDERR_FILENO, line, len ) < 0 )
+        {
+            break;
+        }
+
+        lastAllocs = allocs;
+        lastBytes  = bytes;
+    }
+
+    return NULL;
+}
+// ====================================================================================================
+static void __attribute__( ( destructor ) ) _finish( void )
+
+{
+    char line[128];
+    int len = snprintf( line, sizeof( line ), "[%7.2fs] %10" PRIu64 " allocations, %12" PRIu64 " bytes in total\n",
+                        _now() - _start, atomic_load( &_allocs ), atomic_load( &_bytes ) );
+
+    if ( write( STDERR_FILENO, line, len ) < 0 )
+    {}
+}
+// ====================================================================================================
+static void __attribute__( ( constructor ) ) _begin( void )
+
+{
+    pthread_t t;
+    char *e = getenv( "BENCH_ALLOCS_MS" );
+    uint32_t intervalMs = e ? atoi( e ) : 1000;
+
+    _start = _now();
+
+    if ( intervalMs )
+    {
+        pthread_create( &t, NULL, _reporter, ( void * )( uintptr_t )intervalMs );
+        pthread_detach( t );
+    }
+}
+// ====================================================================================================
@@ -0,0 +1,187 @@
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Software Message Formatter Checks and Benchmark
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+
+/* Build with;
+ * gcc Src/swFormat.c Src/generics.c Tests/bench_swformat.c -IInc -include uicolours_default.h -O2
+ * Execute with;
+ * ./a.out
+ *
+ * Checks that compiled formats render the same as the printf based rendering they replace,
+ * then reports messages per second for each.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "swFormat.h"
+
+#define BENCH_ITERATIONS (2000000)
+#define OP_LEN (256)
+
+/* Formats covering the three rendering modes and the flags, width and precision rules */
+static const char *_formats[] =
+{
+    "%d", "%u", "%x", "%X", "%o", "%i", "%08x", "%-8d|", "%+d", "% d", "%#x", "%#X", "%#o", "%.0d", "%.5d", "%08.3d",
+    "%-+6d|", "%010u", "%hhd", "%hd", "%hhx", "%hu", "%#.0o", "0x%08X %u %d\n", "%%d %d%%", "plain text",
+    "%c", "%3c|", "%-3c|", "[%c]", "%02x ", "%c%c",
+    "%f", "%5.2f\n", "%e", "%g", "%-10.3f|", "%+.1f %f",
+    NULL
+};
+
+static const uint32_t _values[] = { 0, 1, 7, 42, 0x41, 0x7f, 0x80, 0xff, 0x1234, 0x8000, 0xffff, 0x414243, 0x41424344, 0x7fffffff, 0x80000000, 0xffffffff, 0x3fc00000 };
+
+// ====================================================================================================
+
+static int _reference( const char *fmt, uint32_t value, uint32_t len, char *op, size_t opLen )
+
+/* The printf based rendering, as it was done in orbcat */
+
+{
+    int w = 0;
+
+    if ( strpbrk( fmt, "feEgGaA" ) )
+    {
+        float fl;
+        memcpy( &fl, &value, sizeof( float ) );
+        w = snprintf( op, opLen, fmt, fl, fl, fl, fl );
+    }
+    else if ( strstr( fmt, "%c" ) || strstr( fmt, "c|" ) || strstr( fmt, "c]" ) )
+    {
+        uint32_t l = 0;
+
+        do
+        {
+            uint8_t c = ( value >> ( 8 * l ) ) & 0xff;
+            w += snprintf( op + w, opLen - w, fmt, c, c, c );
+        }
+        while ( ++l < len );
+    }
+    else
+    {
+        w = snprintf( op, opLen, fmt, value, value, value, value );
+    }
+
+    return w;
+}
+// ====================================================================================================
+static double _now( void )
+
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+// ====================================================================================================
+
+int main( int argc, char **argv )
+
+{
+    char want[OP_LEN];
+    char got[OP_LEN];
+    int fails = 0;
+    int checks = 0;
+
+    fprintf( stderr, "Checking rendering matches printf;\n" );
+
+    for ( const char **fmt = _formats; *fmt; fmt++ )
+    {
+        struct SWFormat *f = SWFormatCompile( *fmt );
+
+        if ( !f )
+        {
+            fprintf( stderr, "*********FAILED to compile \"%s\"\n", *fmt );
+            fails++;
+            continue;
+        }
+
+        for ( int v = 0; v < sizeof( _values ) / sizeof( _values[0] ); v++ )
+        {
+            for ( uint32_t len = 1; len <= 4; len++ )
+            {
+                /* Byte rendering can include zeros, so compare by length */
+                int w = _reference( *fmt, _values[v], len, want, OP_LEN );
+                size_t l = SWFormatRender( f, _values[v], len, got, OP_LEN );
+                checks++;
+
+                if ( ( l != w ) || ( memcmp( want, got, l + 1 ) ) )
+                {
+                    fprintf( stderr, "*********FAILED \"%s\" value %08x len %d\nWanted:[%s]\nRecevd:[%s]\n", *fmt, _values[v], len, want, got );
+                    fails++;
+                }
+            }
+        }
+
+        SWFormatDelete( f );
+    }
+
+    fprintf( stderr, "%d checks, %d failures\n", checks, fails );
+
+    /* Formats that can't be rendered from a single value are rejected */
+    const char *bad[] = { "%s", "%n", "%p", "%*d", "%.*d", "%", "%q", NULL };
+
+    for ( const char **fmt = bad; *fmt; fmt++ )
+    {
+        struct SWFormat *f = SWFormatCompile( *fmt );
+
+        if ( f )
+        {
+            fprintf( stderr, "*********FAILED \"%s\" should not compile\n", *fmt );
+            SWFormatDelete( f );
+            fails++;
+        }
+    }
+
+    /* A short output buffer is truncated and terminated, not overrun */
+    struct SWFormat *f = SWFormatCompile( "%08x:%08x:%08x" );
+    size_t l = SWFormatRender( f, 0x12345678, 4, got, 10 );
+
+    if ( ( l != 9 ) || ( strcmp( got, "12345678:" ) ) )
+    {
+        fprintf( stderr, "*********FAILED truncation, got %zu [%s]\n", l, got );
+        fails++;
+    }
+
+    SWFormatDelete( f );
+
+    fprintf( stderr, "Benchmarking (messages/sec);\n" );
+
+    /* Formats, and the names to print them as */
+    const char *benchFormats[] = { "%d\n", "0x%08X %u\n", "%c", "%5.2f\n", NULL };
+    const char *benchNames[] = { "%d\\n", "0x%08X %u\\n", "%c", "%5.2f\\n" };
+
+    for ( const char **fmt = benchFormats; *fmt; fmt++ )
+    {
+        struct SWFormat *f = SWFormatCompile( *fmt );
+        volatile size_t sink = 0;
+
+        double t = _now();
+
+        for ( uint32_t i = 0; i < BENCH_ITERATIONS; i++ )
+        {
+            sink += _reference( *fmt, i * 2654435761u, 4, got, OP_LEN );
+        }
+
+        double tRef = _now() - t;
+        t = _now();
+
+        for ( uint32_t i = 0; i < BENCH_ITERATIONS; i++ )
+        {
+            sink += SWFormatRender( f, i * 2654435761u, 4, got, OP_LEN );
+        }
+
+        double tComp = _now() - t;
+        fprintf( stderr, "%-16s printf %12.0f compiled %12.0f (x%.1f)\n", benchNames[fmt - benchFormats], BENCH_ITERATIONS / tRef, BENCH_ITERATIONS / tComp, tRef / tComp );
+        SWFormatDelete( f );
+    }
+
+    return fails ? -1 : 0;
+}
+
+// ====================================================================================================
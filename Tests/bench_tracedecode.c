@@ -0,0 +1,321 @@
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Trace Decoder Throughput Benchmark
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+
+/* Build with;
+ * gcc Src/traceDecoder.c Src/traceDecoder_etm35.c Src/traceDecoder_etm4.c Src/traceDecoder_mtb.c Src/generics.c \
+ *     Tests/bench_tracedecode.c -IInc -include uicolours_default.h -O2
+ * ...and add -DNO_TRACE_DEBUG to see the throughput with debug reporting compiled out.
+ * Execute with;
+ * ./a.out [ETM35|ETM4|MTB] [capture file]
+ *
+ * Without a capture file a synthetic stream of sync, address and atom packets is decoded.
+ * A capture is raw trace for the chosen protocol, as recorded from the probe (after TPIU
+ * has been removed). This is the same decode that orbmortem and orbprofile run, so to
+ * compare changes to a decoder build this against both versions of it and replay the
+ * same capture through each.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <time.h>
+#include <inttypes.h>
+
+#include "traceDecoder.h"
+
+#define SYNTHETIC_LEN (16*1024*1024)
+#define RUN_SECONDS   (5.0)
+
+/* What a client makes of the decode, which should be the same however it's delivered */
+struct Consumed
+{
+    uint64_t reports;
+    uint64_t atoms;
+    uint64_t addresses;
+    uint64_t exceptions;
+};
+
+static struct Consumed _c;
+
+// ====================================================================================================
+
+static void _report( enum verbLevel l, const char *fmt, ... )
+
+/* Stands in for an application report routine that discards what it's given */
+
+{
+    va_list va;
+    va_start( va, fmt );
+    va_end( va );
+}
+// ====================================================================================================
+static void _cb( void *d )
+
+/* Consume a report the way orbprofile does, by polling the changes */
+
+{
+    struct TRACEDecoder *i = ( struct TRACEDecoder * )d;
+
+    _c.reports++;
+
+    if ( TRACEStateChanged( i, EV_CH_EX_ENTRY ) )
+    {
+        _c.exceptions++;
+    }
+
+    if ( TRACEStateChanged( i, EV_CH_ADDRESS ) )
+    {
+        _c.addresses++;
+    }
+
+    if ( TRACEStateChanged( i, EV_CH_ENATOMS ) )
+    {
+        _c.atoms += i->cpu.eatoms + i->cpu.natoms;
+    }
+}
+// ====================================================================================================
+static void _cbRecords( struct TRACERecord *r, int n, void *d )
+
+/* Consume a batch of records in the same way */
+
+{
+    while ( n-- )
+    {
+        _c.reports++;
+
+        if ( TRACERecordChanged( r, EV_CH_EX_ENTRY ) )
+        {
+            _c.exceptions++;
+        }
+
+        if ( TRACERecordChanged( r, EV_CH_ADDRESS ) )
+        {
+            _c.addresses++;
+        }
+
+        if ( TRACERecordChanged( r, EV_CH_ENATOMS ) )
+        {
+            _c.atoms += r->eatoms + r->natoms;
+        }
+
+        r++;
+    }
+}
+// ====================================================================================================
+static double _now( void )
+
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+// ====================================================================================================
+static size_t _synthesise( enum TRACEprotocol p, uint8_t *b, size_t len )
+
+/* Build a stream that's mostly atoms, with regular address packets, for the protocol */
+
+{
+    static const uint8_t etm4Atoms[] = { 0xf7, 0xf6, 0xda, 0xfb, 0xdd, 0xd6, 0xc3, 0xe5, 0xdb, 0xf9 };
+    static const uint8_t etm35Atoms[] = { 0x84, 0x8c, 0xc4, 0x82, 0x86, 0x8a, 0x41, 0x94, 0x88, 0x21 };
+    size_t i = 0;
+    uint32_t n = 0;
+
+    switch ( p )
+    {
+        case TRACE_PROT_ETM4:
+            memset( b, 0, 11 );
+            i = 11;
+            b[i++] = 0x80;              /* A-Sync */
+            b[i++] = 0x01;              /* Trace info, no sections */
+            b[i++] = 0x00;
+
+            while ( i + 8 < len )
+            {
+                if ( !( n++ % 64 ) )
+                {
+                    /* Long address, 32 bit, IS1 */
+                    b[i++] = 0x9b;
+                    b[i++] = 0x00;
+                    b[i++] = 0x10 + ( n & 0x3f );
+                    b[i++] = 0x00;
+                    b[i++] = 0x08;
+                }
+
+                b[i++] = etm4Atoms[n % sizeof( etm4Atoms )];
+            }
+
+            break;
+
+        case TRACE_PROT_ETM35:
+            memset( b, 0, 5 );
+            i = 5;
+            b[i++] = 0x80;              /* A-Sync */
+
+            while ( i + 8 < len )
+            {
+                if ( !( n++ % 64 ) )
+                {
+                    /* I-Sync to a thumb address */
+                    b[i++] = 0x08;
+                    b[i++] = 0x00;
+                    b[i++] = 0x01;
+                    b[i++] = 0x10 + ( n & 0x3f );
+                    b[i++] = 0x00;
+                    b[i++] = 0x08;
+                }
+
+                if ( !( n % 16 ) )
+                {
+                    /* Branch address with two continuation bytes */
+                    b[i++] = 0xc3;
+                    b[i++] = 0x91;
+                    b[i++] = 0x02;
+                }
+
+                b[i++] = etm35Atoms[n % sizeof( etm35Atoms )];
+            }
+
+            break;
+
+        case TRACE_PROT_MTB:
+            while ( i + 8 <= len )
+            {
+                uint32_t from = 0x08001000 + ( ( n * 52 ) & 0xffff );
+                uint32_t to   = 0x08002000 + ( ( n++ * 76 ) & 0xffff );
+                memcpy( &b[i], &from, 4 );
+                memcpy( &b[i + 4], &to, 4 );
+                i += 8;
+            }
+
+            break;
+
+        default:
+            break;
+    }
+
+    return i;
+}
+// ====================================================================================================
+static double _pass( enum TRACEprotocol p, enum verbLevel level, bool records, uint8_t *b, size_t len )
+
+/* Decode the buffer once, returning the time it took */
+
+{
+    struct TRACEDecoder i;
+    double t = _now();
+
+    memset( &_c, 0, sizeof( _c ) );
+    TRACEDecoderInit( &i, p, true, _report );
+    TRACEDecoderSetReportLevel( &i, level );
+    TRACEDecoderForceSync( &i, p == TRACE_PROT_MTB );
+
+    if ( records )
+    {
+        TRACEDecoderPumpRecords( &i, b, len, _cbRecords, NULL );
+    }
+    else
+    {
+        TRACEDecoderPump( &i, b, len, _cb, &i );
+    }
+
+    TRACEDecoderDestroy( &i );
+    return _now() - t;
+}
+// ====================================================================================================
+
+int main( int argc, char **argv )
+
+{
+    enum TRACEprotocol p = TRACE_PROT_ETM4;
+    uint8_t *b;
+    size_t len;
+
+    if ( argc > 1 )
+    {
+        p = !strcmp( argv[1], "ETM35" ) ? TRACE_PROT_ETM35 : !strcmp( argv[1], "MTB" ) ? TRACE_PROT_MTB : TRACE_PROT_ETM4;
+    }
+
+    if ( argc > 2 )
+    {
+        FILE *f = fopen( argv[2], "rb" );
+
+        if ( !f )
+        {
+            fprintf( stderr, "Cannot open %s\n", argv[2] );
+            return -1;
+        }
+
+        fseek( f, 0, SEEK_END );
+        len = ftell( f );
+        fseek( f, 0, SEEK_SET );
+        b = malloc( len );
+
+        if ( fread( b, 1, len, f ) != len )
+        {
+            fprintf( stderr, "Cannot read %s\n", argv[2] );
+            return -1;
+        }
+
+        fclose( f );
+    }
+    else
+    {
+        b = malloc( SYNTHETIC_LEN );
+        len = _synthesise( p, b, SYNTHETIC_LEN );
+    }
+
+    fprintf( stderr, "Decoding %zu bytes of %s%s\n", len, TRACEDecodeGetProtocolName( p ), ( argc > 2 ) ? "" : " (synthetic)" );
+#ifdef NO_TRACE_DEBUG
+    fprintf( stderr, "Debug reporting compiled out\n" );
+#endif
+
+    /* Passes of each configuration are interleaved, and the best of each kept, so they all see the same machine */
+    struct
+    {
+        const char *name;
+        enum verbLevel level;
+        bool records;
+        double best;
+        struct Consumed c;
+    } run[] =
+    {
+        { "Debug reports delivered", V_DEBUG, false },
+        { "Debug reports not wanted", V_WARN, false },
+        { "Record batches", V_WARN, true },
+    };
+    const int nruns = sizeof( run ) / sizeof( run[0] );
+    double start = _now();
+
+    while ( _now() - start < RUN_SECONDS )
+    {
+        for ( int r = 0; r < nruns; r++ )
+        {
+            double t = _pass( p, run[r].level, run[r].records, b, len );
+
+            if ( ( !run[r].best ) || ( t < run[r].best ) )
+            {
+                run[r].best = t;
+            }
+
+            run[r].c = _c;
+        }
+    }
+
+    for ( int r = 0; r < nruns; r++ )
+    {
+        fprintf( stderr, "%-25s: %8.1f MB/s (x%.2f) %10" PRIu64 " reports, %10" PRIu64 " atoms, %8" PRIu64 " addresses, %6" PRIu64 " exceptions\n",
+                 run[r].name, len / run[r].best / ( 1024 * 1024 ), run[0].best / run[r].best,
+                 run[r].c.reports, run[r].c.atoms, run[r].c.addresses, run[r].c.exceptions );
+    }
+
+    free( b );
+    return 0;
+}
+
+// ====================================================================================================